@@ -884,6 +884,7 @@ void MifareNested(uint32_t arg0, uint32_t arg1, uint32_t arg2, uint8_t *datain)
     uint32_t cuid = 0, nt1, nt2, nttest, ks1;
     uint8_t par[1] = {0x00};
     uint32_t target_nt[2] = {0x00}, target_ks[2] = {0x00};
+    uint8_t target_par_err[2] = {0x00};
 
     uint8_t par_array[4] = {0x00};
     uint16_t ncount = 0;
@@ -1044,6 +1045,7 @@ void MifareNested(uint32_t arg0, uint32_t arg1, uint32_t arg2, uint8_t *datain)
                     }
                     target_nt[i] = nttest;
                     target_ks[i] = ks1;
+                    target_par_err[i] = par_array[0] << 3 | par_array[1] << 2 | par_array[2] << 1 | par_array[3];
                     ncount++;
                     if (i == 1 && target_nt[1] == target_nt[0]) { // we need two different nonces
                         target_nt[i] = 0;
@@ -1061,12 +1063,15 @@ void MifareNested(uint32_t arg0, uint32_t arg1, uint32_t arg2, uint8_t *datain)
 
     crypto1_destroy(pcs);
 
-    uint8_t buf[4 + 4 * 4] = {0};
+    uint8_t buf[4 + 4 * 4 + 2] = {0};
     memcpy(buf, &cuid, 4);
     memcpy(buf + 4, &target_nt[0], 4);
     memcpy(buf + 8, &target_ks[0], 4);
     memcpy(buf + 12, &target_nt[1], 4);
     memcpy(buf + 16, &target_ks[1], 4);
+    // parity errors of the encrypted nonces, the last one gives one more keystream bit
+    buf[20] = target_par_err[0];
+    buf[21] = target_par_err[1];
 
     LED_B_ON();
     reply_mix(CMD_ACK, isOK, 0, targetBlockNo + (targetKeyType * 0x100), buf, sizeof(buf));
@@ -0,0 +1,10 @@
+#include "proxmark3_arm.h"
+/* Generated file, do not edit */
+const struct version_information __attribute__((section(".version_information"))) version_information = {
+    VERSION_INFORMATION_MAGIC,
+    1,
+    1,
+    0,
+    "RRG/Iceman/master/3645dc3-dirty",
+    "2026-10-17 23:23:37",
+};
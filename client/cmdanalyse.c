@@ -12,6 +12,7 @@
 #include <stdlib.h>       // size_t
 #include <string.h>
 #include <ctype.h>        // tolower
+#include <pthread.h>
 
 #include "commonutil.h"   // reflect...
 #include "comms.h"        // clearCommandBuffer
@@ -21,6 +22,8 @@
 #include "crc16.h"        // crc16 ccitt
 #include "tea.h"
 #include "legic_prng.h"
+#include "util.h"         // num_CPUs
+#include "util_posix.h"   // usclock
 
 static int CmdHelp(const char *Cmd);
 
@@ -78,6 +81,20 @@ static int usage_analyse_nuid(void) {
     PrintAndLogEx(NORMAL, "      analyse nuid 11223344556677");
     return 0;
 }
+static int usage_analyse_crc16(void) {
+    PrintAndLogEx(NORMAL, "Self test and benchmark of the table driven CRC16 implementations");
+    PrintAndLogEx(NORMAL, "");
+    PrintAndLogEx(NORMAL, "Usage:  analyse crc16 [h] [t] [b]");
+    PrintAndLogEx(NORMAL, "Options:");
+    PrintAndLogEx(NORMAL, "           h          This help");
+    PrintAndLogEx(NORMAL, "           t          check all CRC types against the bitwise CRC, from several threads at once");
+    PrintAndLogEx(NORMAL, "           b          throughput per CRC type, with the byte, slice-by-4 and slice-by-8 tables");
+    PrintAndLogEx(NORMAL, "");
+    PrintAndLogEx(NORMAL, "Examples:");
+    PrintAndLogEx(NORMAL, "      analyse crc16 t");
+    PrintAndLogEx(NORMAL, "      analyse crc16 b");
+    return 0;
+}
 static int usage_analyse_a(void) {
     PrintAndLogEx(NORMAL, "Iceman's personal garbage test command");
     PrintAndLogEx(NORMAL, "");
@@ -366,6 +383,190 @@ static int CmdAnalyseCRC(const char *Cmd) {
     free(data);
     return 0;
 }
+typedef struct {
+    CrcType_t type;
+    const char *name;
+    uint16_t init;
+    uint16_t poly;
+    bool ref;
+    uint16_t xorout;
+} crc16_model_t;
+
+static const crc16_model_t crc16_models[] = {
+    {CRC_14443_A, "ISO14443 A", 0xC6C6, CRC16_POLY_CCITT, true,  0x0000},
+    {CRC_14443_B, "ISO14443 B", 0xFFFF, CRC16_POLY_CCITT, true,  0xFFFF},
+    {CRC_15693,   "ISO15693",   0xFFFF, CRC16_POLY_CCITT, true,  0xFFFF},
+    {CRC_ICLASS,  "iCLASS",     0x4807, CRC16_POLY_CCITT, true,  0x0000},
+    {CRC_FELICA,  "FeliCa",     0x0000, CRC16_POLY_CCITT, false, 0x0000},
+    {CRC_CCITT,   "CCITT",      0xFFFF, CRC16_POLY_CCITT, false, 0x0000},
+    {CRC_KERMIT,  "KERMIT",     0x0000, CRC16_POLY_CCITT, true,  0x0000},
+    {CRC_XMODEM,  "XMODEM",     0x0000, CRC16_POLY_CCITT, false, 0x0000},
+    // init from uid crc 0x4B, the Legic crc8 of uid 51 f5 7a d6
+    {CRC_LEGIC,   "Legic",      0x4B4B, CRC16_POLY_LEGIC, true,  0x0000},
+};
+#define CRC16_MODELS (sizeof(crc16_models) / sizeof(crc16_models[0]))
+
+// crc16_sliced() has no initial value for Legic, it takes the uid crc through crc16_legic()
+static uint16_t crc16_model_sliced(const crc16_model_t *m, uint8_t const *d, size_t n, uint8_t slices) {
+    if (m->type == CRC_LEGIC)
+        return crc16_legic(d, n, m->init & 0xFF);
+    return crc16_sliced(m->type, d, n, slices);
+}
+
+#define CRC16_TEST_ROUNDS  20000
+#define CRC16_TEST_MAXLEN  300
+
+typedef struct {
+    uint32_t seed;
+    uint32_t errors;
+} crc16_test_job_t;
+
+static uint32_t crc16_test_rand(uint32_t *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+// the dispatchers and the per type functions, against the bitwise crc.
+// crc16_fast() runs on the table this thread picked and must not see other threads switching theirs.
+static void *crc16_test_thread(void *arg) {
+    crc16_test_job_t *job = arg;
+    uint8_t buf[CRC16_TEST_MAXLEN];
+
+    for (int r = 0; r < CRC16_TEST_ROUNDS; r++) {
+        const crc16_model_t *m = &crc16_models[crc16_test_rand(&job->seed) % CRC16_MODELS];
+        size_t n = 1 + crc16_test_rand(&job->seed) % (CRC16_TEST_MAXLEN - 2);
+        for (size_t i = 0; i < n; i++)
+            buf[i] = crc16_test_rand(&job->seed);
+
+        uint16_t expected = Crc16(buf, n, m->init, m->poly, m->ref, m->ref) ^ m->xorout;
+
+        init_table(m->type);
+        if (crc16_model_sliced(m, buf, n, 1) != expected ||
+                crc16_model_sliced(m, buf, n, 4) != expected ||
+                crc16_model_sliced(m, buf, n, 8) != expected ||
+                (crc16_fast(buf, n, m->init, m->ref, m->ref) ^ m->xorout) != expected) {
+            job->errors++;
+            continue;
+        }
+
+        // compute_crc() and check_crc() don't know the uid crc
+        if (m->type == CRC_LEGIC)
+            continue;
+
+        uint8_t b1 = 0, b2 = 0;
+        compute_crc(m->type, buf, n, &b1, &b2);
+        if ((b1 | (b2 << 8)) != expected) {
+            job->errors++;
+            continue;
+        }
+
+        // append the crc (msb first for the non reflected ones), the residue tells check_crc
+        if (m->type != CRC_KERMIT) {
+            buf[n] = m->ref ? b1 : b2;
+            buf[n + 1] = m->ref ? b2 : b1;
+            if (check_crc(m->type, buf, n + 2) == false)
+                job->errors++;
+        }
+    }
+    return NULL;
+}
+
+static int crc16_selftest(void) {
+    int threads = MAX(4, MIN(num_CPUs(), 16));
+    pthread_t thread[16];
+    crc16_test_job_t jobs[16];
+
+    PrintAndLogEx(INFO, "CRC16 self test, %d threads x %d rounds", threads, CRC16_TEST_ROUNDS);
+
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        jobs[started].seed = 0x1234567 * (i + 1);
+        jobs[started].errors = 0;
+        if (pthread_create(&thread[started], NULL, crc16_test_thread, &jobs[started]) == 0)
+            started++;
+    }
+
+    uint32_t errors = 0;
+    if (started == 0) {
+        // no thread at all, do the work here
+        jobs[0].seed = 0x1234567;
+        jobs[0].errors = 0;
+        crc16_test_thread(&jobs[0]);
+        errors += jobs[0].errors;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(thread[i], NULL);
+        errors += jobs[i].errors;
+    }
+
+    // the well known check values
+    const uint8_t check[] = "123456789";
+    const uint16_t check_value[] = {0xBF05, 0x906E, 0x906E, 0x5D04, 0x31C3, 0x29B1, 0x2189, 0x31C3, 0x3AD2};
+    for (size_t i = 0; i < CRC16_MODELS; i++) {
+        uint16_t crc = crc16_model_sliced(&crc16_models[i], check, 9, 8);
+        if (crc != check_value[i]) {
+            PrintAndLogEx(FAILED, "%-10s check value %04X, expected %04X", crc16_models[i].name, crc, check_value[i]);
+            errors++;
+        }
+    }
+
+    if (errors) {
+        PrintAndLogEx(FAILED, "CRC16 self test ( %s ), %u errors", _RED_("fail"), errors);
+        return PM3_ESOFT;
+    }
+    PrintAndLogEx(SUCCESS, "CRC16 self test ( %s )", _GREEN_("ok"));
+    return PM3_SUCCESS;
+}
+
+static int crc16_benchmark(void) {
+    const size_t len = 64 * 1024;
+    const int rounds = 64;
+    const uint8_t slices[] = {1, 4, 8};
+
+    uint8_t *buf = calloc(len, sizeof(uint8_t));
+    if (buf == NULL)
+        return PM3_EMALLOC;
+
+    uint32_t seed = 0xC0FFEE;
+    for (size_t i = 0; i < len; i++)
+        buf[i] = crc16_test_rand(&seed);
+
+    PrintAndLogEx(INFO, "CRC16 throughput, %d x %zu kB", rounds, len / 1024);
+    PrintAndLogEx(NORMAL, "type       |   byte MB/s | slice-4 MB/s | slice-8 MB/s");
+    PrintAndLogEx(NORMAL, "-----------+-------------+--------------+-------------");
+
+    for (size_t m = 0; m < CRC16_MODELS; m++) {
+        // crc16_legic() always runs on all slices, no columns to compare
+        if (crc16_models[m].type == CRC_LEGIC)
+            continue;
+        double mbs[3];
+        uint16_t crc[3];
+        for (int s = 0; s < 3; s++) {
+            uint64_t start = usclock();
+            for (int r = 0; r < rounds; r++)
+                crc[s] = crc16_sliced(crc16_models[m].type, buf, len, slices[s]);
+            uint64_t t = usclock() - start;
+            mbs[s] = (double)len * rounds / (t ? t : 1);
+        }
+        PrintAndLogEx(NORMAL, "%-10s | %11.1f | %12.1f | %12.1f %s",
+                      crc16_models[m].name, mbs[0], mbs[1], mbs[2],
+                      (crc[0] == crc[1] && crc[1] == crc[2]) ? "" : _RED_("mismatch"));
+    }
+
+    free(buf);
+    return PM3_SUCCESS;
+}
+
+static int CmdAnalyseCRC16(const char *Cmd) {
+    char cmdp = tolower(param_getchar(Cmd, 0));
+    if (cmdp == 'h') return usage_analyse_crc16();
+
+    if (cmdp == 'b')
+        return crc16_benchmark();
+
+    return crc16_selftest();
+}
+
 static int CmdAnalyseCHKSUM(const char *Cmd) {
 
     uint8_t data[50];
@@ -836,6 +1037,7 @@ static void generate4bNUID(uint8_t *uid, uint8_t *nuid) {
     nuid[1] = b1;
     crc = b1;
     crc |= b2 << 8;
+    init_table(CRC_14443_A);
     crc = crc16_fast(&uid[3], 4, reflect16(crc), true, true);
     nuid[2] = (crc >> 8) & 0xFF ;
     nuid[3] = crc & 0xFF;
@@ -882,6 +1084,7 @@ static command_t CommandTable[] = {
     {"help",    CmdHelp,            AlwaysAvailable, "This help"},
     {"lcr",     CmdAnalyseLCR,      AlwaysAvailable, "Generate final byte for XOR LRC"},
     {"crc",     CmdAnalyseCRC,      AlwaysAvailable, "Stub method for CRC evaluations"},
+    {"crc16",   CmdAnalyseCRC16,    AlwaysAvailable, "CRC16 self test and benchmark"},
     {"chksum",  CmdAnalyseCHKSUM,   AlwaysAvailable, "Checksum with adding, masking and one's complement"},
     {"dates",   CmdAnalyseDates,    AlwaysAvailable, "Look for datestamps in a given array of bytes"},
     {"tea",     CmdAnalyseTEASelfTest, AlwaysAvailable, "Crypto TEA test"},
@@ -60,8 +60,7 @@ int GetModels(char *Models[], int *count, uint8_t *width) {
     /* default values */
     static model_t model = MZERO;
 
-    poly_t apoly, crc, qpoly = PZERO, *apolys = NULL, *pptr = NULL, *qptr = NULL;
-    model_t pset = model;
+    poly_t qpoly = PZERO, *apolys = NULL, *pptr = NULL, *qptr = NULL;
 
     /* stdin must be binary */
 #ifdef _WIN32
@@ -124,60 +123,60 @@ int GetModels(char *Models[], int *count, uint8_t *width) {
         if (~uflags & C_NOPCK) {
             pass = 0;
             int Cnt = 0;
+            model_t *pmods = calloc(mcount() + 1, sizeof(model_t));
+            int *pmatch = calloc(mcount() + 1, sizeof(int));
+            if (pmods == NULL || pmatch == NULL) {
+                PrintAndLogEx(WARNING, "out of memory?");
+                free(pmods);
+                free(pmatch);
+                return 0;
+            }
             do {
                 int psets = mcount();
+                int nmods = 0;
 
+                // collect the presets to try, then check them all against the arguments in one go
                 while (psets) {
-                    mbynum(&pset, --psets);
+                    model_t *pset = &pmods[nmods];
+                    mbynum(pset, --psets);
 
                     /* skip if different width, or refin or refout don't match */
-                    if (plen(pset.spoly) != width[0] || (model.flags ^ pset.flags) & (P_REFIN | P_REFOUT))
+                    if (plen(pset->spoly) != width[0] || (model.flags ^ pset->flags) & (P_REFIN | P_REFOUT))
                         continue;
                     /* skip if the preset doesn't match specified parameters */
-                    if (rflags & R_HAVEP && pcmp(&model.spoly, &pset.spoly))
+                    if (rflags & R_HAVEP && pcmp(&model.spoly, &pset->spoly))
                         continue;
-                    if (rflags & R_HAVEI && psncmp(&model.init, &pset.init))
+                    if (rflags & R_HAVEI && psncmp(&model.init, &pset->init))
                         continue;
-                    if (rflags & R_HAVEX && psncmp(&model.xorout, &pset.xorout))
+                    if (rflags & R_HAVEX && psncmp(&model.xorout, &pset->xorout))
                         continue;
+                    nmods++;
+                }
 
-                    //for additional args (not used yet, maybe future?)
-                    apoly = pclone(pset.xorout);
+                //for additional args (not used yet, maybe future?)
+                mscan(pmods, nmods, (int)(pptr - apolys), apolys, pmatch);
 
-                    if (pset.flags & P_REFOUT)
-                        prev(&apoly);
+                for (int i = 0; i < nmods; i++) {
+                    if (pmatch[i] == 0)
+                        continue;
 
+                    /* the selected model solved all arguments */
+                    model_t *pset = &pmods[i];
+                    mcanon(pset);
 
-                    for (qptr = apolys; qptr < pptr; ++qptr) {
-                        crc = pcrc(*qptr, pset.spoly, pset.init, apoly, 0);
-                        if (ptst(crc)) {
-                            pfree(&crc);
-                            break;
-                        }
-                        pfree(&crc);
-                    }
-                    pfree(&apoly);
-
-                    if (qptr == pptr) {
-
-                        /* the selected model solved all arguments */
-                        mcanon(&pset);
-
-                        size_t size = (pset.name && *pset.name) ? strlen(pset.name) : 7;
-                        //PrintAndLogEx(NORMAL, "Size: %d, %s, count: %d",size,pset.name, Cnt);
-                        char *tmp = calloc(size + 1, sizeof(char));
-                        if (tmp == NULL) {
-                            PrintAndLogEx(WARNING, "out of memory?");
-                            return 0;
-                        }
-                        width[Cnt] = width[0];
-                        memcpy(tmp, pset.name, size);
-                        Models[Cnt++] = tmp;
-                        *count = Cnt;
-                        uflags |= C_RESULT;
+                    size_t size = (pset->name && *pset->name) ? strlen(pset->name) : 7;
+                    //PrintAndLogEx(NORMAL, "Size: %d, %s, count: %d",size,pset->name, Cnt);
+                    char *tmp = calloc(size + 1, sizeof(char));
+                    if (tmp == NULL) {
+                        PrintAndLogEx(WARNING, "out of memory?");
+                        return 0;
                     }
+                    width[Cnt] = width[0];
+                    memcpy(tmp, pset->name, size);
+                    Models[Cnt++] = tmp;
+                    *count = Cnt;
+                    uflags |= C_RESULT;
                 }
-                mfree(&pset);
 
                 /* toggle refIn/refOut and reflect arguments */
                 if (~rflags & R_HAVERI) {
@@ -187,6 +186,12 @@ int GetModels(char *Models[], int *count, uint8_t *width) {
                     }
                 }
             } while (~rflags & R_HAVERI && ++pass < 2);
+
+            for (int i = 0; i <= mcount(); i++) {
+                mfree(&pmods[i]);
+            }
+            free(pmods);
+            free(pmatch);
         }
         //got everything now free the memory...
 
@@ -10,6 +10,7 @@
 #include "cmddata.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>   // for CmdNorm INT_MIN && INT_MAX
 #include <math.h>     // pow
@@ -24,11 +25,7 @@
 #include "loclass/cipherutils.h" // for decimating samples in getsamples
 #include "cmdlfem4x.h" // askem410xdecode
 #include "fileutils.h" // searchFile
-
-uint8_t DemodBuffer[MAX_DEMOD_BUF_LEN];
-size_t DemodBufferLen = 0;
-size_t g_DemodStartIdx = 0;
-int g_DemodClock = 0;
+#include "util_posix.h"   // usclock
 
 static int CmdHelp(const char *Cmd);
 
@@ -197,11 +194,29 @@ static int usage_data_rawdemod_p2(void) {
 }
 static int usage_data_autocorr(void) {
     PrintAndLogEx(NORMAL, "Autocorrelate is used to detect repeating sequences. We use it as detection of length in bits a message inside the signal is");
-    PrintAndLogEx(NORMAL, "Usage: data autocorr w <window> [g]");
+    PrintAndLogEx(NORMAL, "Usage: data autocorr w <window> [g] [f] [b]");
     PrintAndLogEx(NORMAL, "Options:");
     PrintAndLogEx(NORMAL, "       h              This help");
     PrintAndLogEx(NORMAL, "       w <window>     window length for correlation - default = 4000");
     PrintAndLogEx(NORMAL, "       g              save back to GraphBuffer (overwrite)");
+    PrintAndLogEx(NORMAL, "       f              use the FFT correlation, much faster on long traces. It normally gives the");
+    PrintAndLogEx(NORMAL, "                      same results as the default direct one, but that isn't guaranteed");
+    PrintAndLogEx(NORMAL, "       b              benchmark, compare the direct and the FFT correlation on GraphBuffer");
+    return PM3_SUCCESS;
+}
+static int usage_data_xcorr(void) {
+    PrintAndLogEx(NORMAL, "Cross-correlate GraphBuffer against a reference waveform and list where it matches best");
+    PrintAndLogEx(NORMAL, "Usage: data xcorr f <filename> [n <count>] [g]");
+    PrintAndLogEx(NORMAL, "Options:");
+    PrintAndLogEx(NORMAL, "       h              This help");
+    PrintAndLogEx(NORMAL, "       f <filename>   reference waveform, same format as 'data load'");
+    PrintAndLogEx(NORMAL, "       n <count>      number of matches to list - default = 5");
+    PrintAndLogEx(NORMAL, "       g              save the normalised correlation to GraphBuffer (overwrite)");
+    PrintAndLogEx(NORMAL, "");
+    PrintAndLogEx(NORMAL, "Samples:");
+    PrintAndLogEx(NORMAL, "       data load traces/homeagain1600.pm3");
+    PrintAndLogEx(NORMAL, "       data xcorr f homeagain");
+    PrintAndLogEx(NORMAL, "       data xcorr f homeagain n 10 g");
     return PM3_SUCCESS;
 }
 static int usage_data_undecimate(void) {
@@ -331,6 +346,118 @@ static double compute_variance(const int *data, size_t n) {
     return variance;
 }
 
+// in place iterative radix-2 FFT, n must be a power of two. The inverse transform is not scaled by 1/n
+// returns false, with the buffers only partly transformed, when out of memory
+static bool fft_radix2(double *re, double *im, size_t n, bool inverse) {
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            double t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    double *tw_re = calloc(n / 2 + 1, sizeof(double));
+    double *tw_im = calloc(n / 2 + 1, sizeof(double));
+    if (tw_re == NULL || tw_im == NULL) {
+        free(tw_re);
+        free(tw_im);
+        return false;
+    }
+    for (size_t k = 0; k < n / 2; k++) {
+        tw_re[k] = cos(2 * M_PI * k / n);
+        tw_im[k] = (inverse ? 1 : -1) * sin(2 * M_PI * k / n);
+    }
+
+    for (size_t len = 2; len <= n; len <<= 1) {
+        size_t half = len / 2;
+        size_t step = n / len;
+        for (size_t i = 0; i < n; i += len) {
+            for (size_t k = 0; k < half; k++) {
+                double wr = tw_re[k * step];
+                double wi = tw_im[k * step];
+                size_t a = i + k, b = i + k + half;
+                double xr = re[b] * wr - im[b] * wi;
+                double xi = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - xr;
+                im[b] = im[a] - xi;
+                re[a] += xr;
+                im[a] += xi;
+            }
+        }
+    }
+    free(tw_re);
+    free(tw_im);
+    return true;
+}
+
+// out[k] = sum over j of x[j + k] * y[j], for 0 <= k < nout.  y == NULL correlates x with itself.
+// O(n log n) through the FFT, results carry the usual floating point rounding of a transform.
+static bool correlate_fft(const double *x, size_t xlen, const double *y, size_t ylen, double *out, size_t nout) {
+    if (y == NULL)
+        ylen = xlen;
+
+    size_t n = 1;
+    while (n < xlen + ylen)
+        n <<= 1;
+
+    double *xr = calloc(n, sizeof(double));
+    double *xi = calloc(n, sizeof(double));
+    double *yr = (y) ? calloc(n, sizeof(double)) : NULL;
+    double *yi = (y) ? calloc(n, sizeof(double)) : NULL;
+    if (xr == NULL || xi == NULL || (y && (yr == NULL || yi == NULL))) {
+        free(xr);
+        free(xi);
+        free(yr);
+        free(yi);
+        return false;
+    }
+
+    bool ok = false;
+    memcpy(xr, x, xlen * sizeof(double));
+    if (fft_radix2(xr, xi, n, false) == false)
+        goto out;
+
+    if (y) {
+        memcpy(yr, y, ylen * sizeof(double));
+        if (fft_radix2(yr, yi, n, false) == false)
+            goto out;
+        // X * conj(Y)
+        for (size_t i = 0; i < n; i++) {
+            double r = xr[i] * yr[i] + xi[i] * yi[i];
+            double m = xi[i] * yr[i] - xr[i] * yi[i];
+            xr[i] = r;
+            xi[i] = m;
+        }
+    } else {
+        // |X|^2
+        for (size_t i = 0; i < n; i++) {
+            xr[i] = xr[i] * xr[i] + xi[i] * xi[i];
+            xi[i] = 0;
+        }
+    }
+
+    if (fft_radix2(xr, xi, n, true) == false)
+        goto out;
+    for (size_t k = 0; k < nout && k < n; k++)
+        out[k] = xr[k] / n;
+    ok = true;
+
+out:
+    free(xr);
+    free(xi);
+    free(yr);
+    free(yi);
+    return ok;
+}
+
 // Function to compute autocorrelation for a series
 //  Author: Kenneth J. Christensen
 //  - Corrected divide by n to divide (n - lag) from Tobias Mueller
@@ -357,25 +484,21 @@ static double compute_autoc(const int *data, size_t n, int lag) {
 
 // option '1' to save DemodBuffer any other to restore
 void save_restoreDB(uint8_t saveOpt) {
-    static uint8_t SavedDB[MAX_DEMOD_BUF_LEN];
-    static size_t SavedDBlen;
-    static bool DB_Saved = false;
-    static size_t savedDemodStartIdx = 0;
-    static int savedDemodClock = 0;
+    graph_state_t *st = g_graph_state;
 
     if (saveOpt == GRAPH_SAVE) { //save
 
-        memcpy(SavedDB, DemodBuffer, sizeof(DemodBuffer));
-        SavedDBlen = DemodBufferLen;
-        DB_Saved = true;
-        savedDemodStartIdx = g_DemodStartIdx;
-        savedDemodClock = g_DemodClock;
-    } else if (DB_Saved) { //restore
+        memcpy(st->saved_demod, DemodBuffer, sizeof(DemodBuffer));
+        st->saved_demod_len = DemodBufferLen;
+        st->demod_saved = true;
+        st->saved_demod_start_idx = g_DemodStartIdx;
+        st->saved_demod_clock = g_DemodClock;
+    } else if (st->demod_saved) { //restore
 
-        memcpy(DemodBuffer, SavedDB, sizeof(DemodBuffer));
-        DemodBufferLen = SavedDBlen;
-        g_DemodClock = savedDemodClock;
-        g_DemodStartIdx = savedDemodStartIdx;
+        memcpy(DemodBuffer, st->saved_demod, sizeof(DemodBuffer));
+        DemodBufferLen = st->saved_demod_len;
+        g_DemodClock = st->saved_demod_clock;
+        g_DemodStartIdx = st->saved_demod_start_idx;
     }
 }
 
@@ -505,53 +628,70 @@ int CmdConvertBitStream(const char *Cmd) {
     return PM3_SUCCESS;
 }
 
-//by marshmellow
-//Cmd Args: Clock, invert, maxErr, maxLen as integers and amplify as char == 'a'
-//   (amp may not be needed anymore)
-//verbose will print results and demoding messages
-//emSearch will auto search for EM410x format in bitstream
-//askType switches decode: ask/raw = 0, ask/manchester = 1
-int ASKDemod_ext(const char *Cmd, bool verbose, bool emSearch, uint8_t askType, bool *stCheck) {
-    int invert = 0;
-    int clk = 0;
-    int maxErr = 100;
-    size_t maxLen = 0;
-    uint8_t askamp = 0;
-    char amp = tolower(param_getchar(Cmd, 0));
-    uint8_t bits[MAX_GRAPH_TRACE_LEN] = {0};
+// load the context samples into its bit buffer, clamped the way getFromGraphBuf() does,
+// and make the context signal properties the ones the lfdemod functions see on this thread
+static size_t loadDemodCtx(demod_ctx_t *ctx) {
+    *getSignalProperties() = ctx->signal;
+    for (size_t i = 0; i < ctx->num_samples; i++) {
+        int sample = ctx->samples[i];
+        if (sample > 127) sample = 127;
+        if (sample < -127) sample = -127;
+        ctx->bits[i] = (uint8_t)(sample + 128);
+    }
+    return ctx->num_samples;
+}
 
-    sscanf(Cmd, "%i %i %i %zu %c", &clk, &invert, &maxErr, &maxLen, &amp);
+void initDemodCtx(demod_ctx_t *ctx, const int *samples, size_t num_samples, uint8_t *bits) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->samples = samples;
+    ctx->num_samples = num_samples;
+    ctx->bits = bits;
+    ctx->max_err = 100;
+    ctx->signal = *getSignalProperties();
+}
 
-    if (!maxLen) maxLen = BIGBUF_SIZE;
+void computeDemodCtxSignal(demod_ctx_t *ctx) {
+    size_t size = loadDemodCtx(ctx);
+    computeSignalProperties(ctx->bits, size);
+    ctx->signal = *getSignalProperties();
+}
 
-    if (invert != 0 && invert != 1) {
-        PrintAndLogEx(WARNING, "Invalid argument: %s", Cmd);
-        return PM3_EINVARG;
-    }
+// GraphBuffer callers have always seen the samples trimmed in place by getFromGraphBuf()
+static void initDemodCtxFromGraph(demod_ctx_t *ctx, uint8_t *bits) {
+    getFromGraphBuf(bits);
+    initDemodCtx(ctx, GraphBuffer, GraphTraceLen, bits);
+}
 
-    if (clk == 1) {
-        invert = 1;
-        clk = 0;
-    }
+void setDemodBuffFromCtx(const demod_ctx_t *ctx) {
+    setDemodBuff(ctx->bits, ctx->num_bits, 0);
+    setClockGrid(ctx->clock, ctx->start_idx);
+    g_graph_state->demod_err_cnt = ctx->err_cnt;
+    g_graph_state->demod_num_bits = ctx->num_bits;
+}
 
-    size_t BitLen = getFromGraphBuf(bits);
+//askType switches decode: ask/raw = 0, ask/manchester = 1
+int ASKDemodCtx(demod_ctx_t *ctx, uint8_t askType) {
+    if (ctx->invert != 0 && ctx->invert != 1)
+        return PM3_EINVARG;
+
+    size_t BitLen = loadDemodCtx(ctx);
 
     PrintAndLogEx(DEBUG, "DEBUG: (ASKDemod_ext) #samples from graphbuff: %d", BitLen);
 
     if (BitLen < 255) return PM3_ESOFT;
 
-    if (maxLen < BitLen && maxLen != 0) BitLen = maxLen;
+    size_t maxLen = (ctx->max_len) ? ctx->max_len : BIGBUF_SIZE;
+    if (maxLen < BitLen) BitLen = maxLen;
 
     int foundclk = 0;
 
     //amplify signal before ST check
-    if (amp == 'a') {
-        askAmp(bits, BitLen);
+    if (ctx->amplify) {
+        askAmp(ctx->bits, BitLen);
     }
 
-    size_t ststart = 0, stend = 0;
-//    if (*stCheck)
-    bool st = DetectST(bits, &BitLen, &foundclk, &ststart, &stend);
+    int clk = ctx->clock;
+    ctx->st = DetectST(ctx->bits, &BitLen, &foundclk, &ctx->st_start, &ctx->st_end);
 
     if (clk == 0) {
         if (foundclk == 32 || foundclk == 64) {
@@ -559,40 +699,67 @@ int ASKDemod_ext(const char *Cmd, bool verbose, bool emSearch, uint8_t askType,
         }
     }
 
-    if (st) {
-        *stCheck = st;
-        CursorCPos = ststart;
-        CursorDPos = stend;
-        if (verbose)
-            PrintAndLogEx(DEBUG, "Found Sequence Terminator - First one is shown by orange / blue graph markers");
-    }
-
+    int invert = ctx->invert;
     int startIdx = 0;
-    int errCnt = askdemod_ext(bits, &BitLen, &clk, &invert, maxErr, askamp, askType, &startIdx);
+    int errCnt = askdemod_ext(ctx->bits, &BitLen, &clk, &invert, ctx->max_err, 0, askType, &startIdx);
+    ctx->err_cnt = errCnt;
 
     if (errCnt < 0 || BitLen < 16) { //if fatal error (or -1)
         PrintAndLogEx(DEBUG, "DEBUG: (ASKDemod_ext) No data found errors:%d, invert:%c, bitlen:%d, clock:%d", errCnt, (invert) ? 'Y' : 'N', BitLen, clk);
         return PM3_ESOFT;
     }
 
-    if (errCnt > maxErr) {
+    if (errCnt > ctx->max_err) {
         PrintAndLogEx(DEBUG, "DEBUG: (ASKDemod_ext) Too many errors found, errors:%d, bits:%d, clock:%d", errCnt, BitLen, clk);
         return PM3_ESOFT;
     }
 
-    if (verbose) PrintAndLogEx(DEBUG, "DEBUG: (ASKDemod_ext) Using clock:%d, invert:%d, bits found:%d, start index %d", clk, invert, BitLen, startIdx);
+    ctx->num_bits = BitLen;
+    ctx->clock = clk;
+    ctx->invert = invert;
+    ctx->start_idx = startIdx;
+    return PM3_SUCCESS;
+}
+
+//verbose will print results and demoding messages
+//emSearch will auto search for EM410x format in bitstream
+int ASKDemodGraph(int clk, int invert, int maxErr, size_t maxLen, bool amp, bool verbose, bool emSearch, uint8_t askType, bool *stCheck) {
+    uint8_t bits[MAX_GRAPH_TRACE_LEN] = {0};
+    demod_ctx_t ctx;
+    initDemodCtxFromGraph(&ctx, bits);
+    ctx.clock = clk;
+    ctx.invert = invert;
+    ctx.max_err = maxErr;
+    ctx.max_len = maxLen;
+    ctx.amplify = amp;
+
+    int res = ASKDemodCtx(&ctx, askType);
+
+    if (ctx.st) {
+        *stCheck = true;
+        if (isGraphStateShared()) {
+            CursorCPos = ctx.st_start;
+            CursorDPos = ctx.st_end;
+        }
+        if (verbose)
+            PrintAndLogEx(DEBUG, "Found Sequence Terminator - First one is shown by orange / blue graph markers");
+    }
+
+    if (res != PM3_SUCCESS)
+        return res;
+
+    if (verbose) PrintAndLogEx(DEBUG, "DEBUG: (ASKDemod_ext) Using clock:%d, invert:%d, bits found:%d, start index %d", ctx.clock, ctx.invert, ctx.num_bits, ctx.start_idx);
 
     //output
-    setDemodBuff(bits, BitLen, 0);
-    setClockGrid(clk, startIdx);
+    setDemodBuffFromCtx(&ctx);
 
     if (verbose) {
-        if (errCnt > 0)
-            PrintAndLogEx(DEBUG, "# Errors during Demoding (shown as 7 in bit stream): %d", errCnt);
+        if (ctx.err_cnt > 0)
+            PrintAndLogEx(DEBUG, "# Errors during Demoding (shown as 7 in bit stream): %d", ctx.err_cnt);
         if (askType)
-            PrintAndLogEx(DEBUG, "ASK/Manchester - Clock: %d - Decoded bitstream:", clk);
+            PrintAndLogEx(DEBUG, "ASK/Manchester - Clock: %d - Decoded bitstream:", ctx.clock);
         else
-            PrintAndLogEx(DEBUG, "ASK/Raw - Clock: %d - Decoded bitstream:", clk);
+            PrintAndLogEx(DEBUG, "ASK/Raw - Clock: %d - Decoded bitstream:", ctx.clock);
 
         printDemodBuff();
     }
@@ -603,6 +770,31 @@ int ASKDemod_ext(const char *Cmd, bool verbose, bool emSearch, uint8_t askType,
 
     return PM3_SUCCESS;
 }
+
+//by marshmellow
+//Cmd Args: Clock, invert, maxErr, maxLen as integers and amplify as char == 'a'
+//   (amp may not be needed anymore)
+int ASKDemod_ext(const char *Cmd, bool verbose, bool emSearch, uint8_t askType, bool *stCheck) {
+    int invert = 0;
+    int clk = 0;
+    int maxErr = 100;
+    size_t maxLen = 0;
+    char amp = tolower(param_getchar(Cmd, 0));
+
+    sscanf(Cmd, "%i %i %i %zu %c", &clk, &invert, &maxErr, &maxLen, &amp);
+
+    if (invert != 0 && invert != 1) {
+        PrintAndLogEx(WARNING, "Invalid argument: %s", Cmd);
+        return PM3_EINVARG;
+    }
+
+    if (clk == 1) {
+        invert = 1;
+        clk = 0;
+    }
+
+    return ASKDemodGraph(clk, invert, maxErr, maxLen, amp == 'a', verbose, emSearch, askType, stCheck);
+}
 int ASKDemod(const char *Cmd, bool verbose, bool emSearch, uint8_t askType) {
     bool st = false;
     return ASKDemod_ext(Cmd, verbose, emSearch, askType, &st);
@@ -729,46 +921,74 @@ static int CmdBiphaseDecodeRaw(const char *Cmd) {
 }
 
 //by marshmellow
-// - ASK Demod then Biphase decode GraphBuffer samples
-int ASKbiphaseDemod(const char *Cmd, bool verbose) {
-    //ask raw demod GraphBuffer first
-    int offset = 0, clk = 0, invert = 0, maxErr = 50;
-    sscanf(Cmd, "%i %i %i %i", &offset, &clk, &invert, &maxErr);
-
-    uint8_t BitStream[MAX_DEMOD_BUF_LEN];
-    size_t size = getFromGraphBuf(BitStream);
+// - ASK Demod then Biphase decode the context samples
+int ASKbiphaseDemodCtx(demod_ctx_t *ctx) {
+    size_t size = loadDemodCtx(ctx);
     if (size == 0) {
         PrintAndLogEx(DEBUG, "DEBUG: no data in graphbuf");
         return PM3_ESOFT;
     }
+    int clk = ctx->clock;
+    int invert = ctx->invert;
     int startIdx = 0;
     //invert here inverts the ask raw demoded bits which has no effect on the demod, but we need the pointer
-    int errCnt = askdemod_ext(BitStream, &size, &clk, &invert, maxErr, 0, 0, &startIdx);
-    if (errCnt < 0 || errCnt > maxErr) {
+    int errCnt = askdemod_ext(ctx->bits, &size, &clk, &invert, ctx->max_err, 0, 0, &startIdx);
+    if (errCnt < 0 || errCnt > ctx->max_err) {
         PrintAndLogEx(DEBUG, "DEBUG: no data or error found %d, clock: %d", errCnt, clk);
         return PM3_ESOFT;
     }
 
     //attempt to Biphase decode BitStream
-    errCnt = BiphaseRawDecode(BitStream, &size, &offset, invert);
+    int offset = ctx->offset;
+    errCnt = BiphaseRawDecode(ctx->bits, &size, &offset, invert);
+    ctx->err_cnt = errCnt;
     if (errCnt < 0) {
-        if (g_debugMode || verbose) PrintAndLogEx(DEBUG, "DEBUG: Error BiphaseRawDecode: %d", errCnt);
+        PrintAndLogEx(DEBUG, "DEBUG: Error BiphaseRawDecode: %d", errCnt);
         return PM3_ESOFT;
     }
-    if (errCnt > maxErr) {
-        if (g_debugMode || verbose) PrintAndLogEx(DEBUG, "DEBUG: Error BiphaseRawDecode too many errors: %d", errCnt);
+    if (errCnt > ctx->max_err) {
+        PrintAndLogEx(DEBUG, "DEBUG: Error BiphaseRawDecode too many errors: %d", errCnt);
         return PM3_ESOFT;
     }
 
+    ctx->num_bits = size;
+    ctx->clock = clk;
+    ctx->invert = invert;
+    ctx->offset = offset;
+    ctx->start_idx = startIdx + clk * offset / 2;
+    return PM3_SUCCESS;
+}
+
+// - ASK Demod then Biphase decode GraphBuffer samples
+int ASKbiphaseDemodGraph(int offset, int clk, int invert, int maxErr, bool verbose) {
+    uint8_t bits[MAX_GRAPH_TRACE_LEN] = {0};
+    demod_ctx_t ctx;
+    initDemodCtxFromGraph(&ctx, bits);
+    ctx.offset = offset;
+    ctx.clock = clk;
+    ctx.invert = invert;
+    ctx.max_err = maxErr;
+
+    int res = ASKbiphaseDemodCtx(&ctx);
+    if (res != PM3_SUCCESS)
+        return res;
+
     //success set DemodBuffer and return
-    setDemodBuff(BitStream, size, 0);
-    setClockGrid(clk, startIdx + clk * offset / 2);
+    setDemodBuffFromCtx(&ctx);
     if (g_debugMode || verbose) {
-        PrintAndLogEx(DEBUG, "Biphase Decoded using offset %d | clock %d | #errors %d | start index %d\ndata\n", offset, clk, errCnt, (startIdx + clk * offset / 2));
+        PrintAndLogEx(DEBUG, "Biphase Decoded using offset %d | clock %d | #errors %d | start index %d\ndata\n", ctx.offset, ctx.clock, ctx.err_cnt, ctx.start_idx);
         printDemodBuff();
     }
     return PM3_SUCCESS;
 }
+
+//by marshmellow
+//takes 4 arguments - offset, clock, invert, maxErr as integers
+int ASKbiphaseDemod(const char *Cmd, bool verbose) {
+    int offset = 0, clk = 0, invert = 0, maxErr = 50;
+    sscanf(Cmd, "%i %i %i %i", &offset, &clk, &invert, &maxErr);
+    return ASKbiphaseDemodGraph(offset, clk, invert, maxErr, verbose);
+}
 //by marshmellow - see ASKbiphaseDemod
 static int Cmdaskbiphdemod(const char *Cmd) {
     char cmdp = tolower(param_getchar(Cmd, 0));
@@ -785,24 +1005,13 @@ static int Cmdaskrawdemod(const char *Cmd) {
     return ASKDemod(Cmd, true, false, 0);
 }
 
-int AutoCorrelate(const int *in, int *out, size_t len, size_t window, bool SaveGrph, bool verbose) {
-    // sanity check
-    if (window > len) window = len;
-
-    if (verbose) PrintAndLogEx(INFO, "performing " _YELLOW_("%d")" correlations", GraphTraceLen - window);
-
-    //test
+// reference autocorrelation, one O(len) sum per lag.
+// note autocv is carried over from the previous lag, the FFT version reproduces that.
+static size_t autocorr_direct(const int *in, size_t len, size_t window, double mean, double variance, int *buf) {
     double autocv = 0.0;    // Autocovariance value
     size_t correlation = 0;
     int lastmax = 0;
 
-    // in, len, 4000
-    double mean = compute_mean(in, len);
-    // Computed variance
-    double variance = compute_variance(in, len);
-
-    static int CorrelBuffer[MAX_GRAPH_TRACE_LEN];
-
     for (size_t i = 0; i < len - window; ++i) {
 
         for (size_t j = 0; j < (len - i); j++) {
@@ -810,7 +1019,7 @@ int AutoCorrelate(const int *in, int *out, size_t len, size_t window, bool SaveG
         }
         autocv = (1.0 / (len - i)) * autocv;
 
-        CorrelBuffer[i] = autocv;
+        buf[i] = autocv;
 
         // Computed autocorrelation value to be returned
         // Autocorrelation is autocovariance divided by variance
@@ -822,6 +1031,89 @@ int AutoCorrelate(const int *in, int *out, size_t len, size_t window, bool SaveG
             lastmax = i;
         }
     }
+    return correlation;
+}
+
+// autocorr_direct() in O(len log len), the lag sums come from one FFT. Only used when asked for.
+// The only decisions taken on autocv are the truncation to int and ac_value > 1, so lags whose
+// FFT value is close to one of these edges are summed again the direct way. That's a heuristic,
+// not a guarantee: the results normally match the direct way, 'data autocorr b' checks a capture.
+static bool autocorr_fft(const int *in, size_t len, size_t window, double mean, double variance, int *buf, size_t *correlation) {
+    size_t lags = len - window;
+    *correlation = 0;
+    if (lags == 0)
+        return true;
+
+    double *d = calloc(len, sizeof(double));
+    double *sums = calloc(lags, sizeof(double));
+    if (d == NULL || sums == NULL) {
+        free(d);
+        free(sums);
+        return false;
+    }
+
+    double energy = 0;
+    for (size_t j = 0; j < len; j++) {
+        d[j] = in[j] - mean;
+        energy += d[j] * d[j];
+    }
+
+    if (correlate_fft(d, len, NULL, 0, sums, lags) == false) {
+        free(d);
+        free(sums);
+        return false;
+    }
+
+    double autocv = 0.0;
+    int lastmax = 0;
+    for (size_t i = 0; i < lags; ++i) {
+        double prev = autocv;
+        autocv = (1.0 / (len - i)) * (prev + sums[i]);
+
+        // transform rounding is a tiny fraction of the signal energy, stay well clear of it
+        double tol = 1e-9 * (energy / (len - i)) + 1e-12;
+        double edge = nearbyint(autocv);
+        bool near_int = (edge != 0) && (fabs(autocv - edge) <= tol);
+        bool near_one = (variance > 0) && (fabs(autocv - variance) <= tol);
+        if (near_int || near_one) {
+            autocv = prev;
+            for (size_t j = 0; j < (len - i); j++) {
+                autocv += (in[j] - mean) * (in[j + i] - mean);
+            }
+            autocv = (1.0 / (len - i)) * autocv;
+        }
+
+        buf[i] = autocv;
+
+        double ac_value = autocv / variance;
+        if (ac_value > 1) {
+            *correlation = i - lastmax;
+            lastmax = i;
+        }
+    }
+
+    free(d);
+    free(sums);
+    return true;
+}
+
+// fft selects autocorr_fft(), falls back to the direct way when that fails
+static int AutoCorrelate_ext(const int *in, int *out, size_t len, size_t window, bool SaveGrph, bool verbose, bool fft) {
+    // sanity check
+    if (window > len) window = len;
+
+    if (verbose) PrintAndLogEx(INFO, "performing " _YELLOW_("%d")" correlations", GraphTraceLen - window);
+
+    // in, len, 4000
+    double mean = compute_mean(in, len);
+    // Computed variance
+    double variance = compute_variance(in, len);
+
+    static int CorrelBuffer[MAX_GRAPH_TRACE_LEN];
+
+    size_t correlation = 0;
+    if (fft == false || autocorr_fft(in, len, window, mean, variance, CorrelBuffer, &correlation) == false)
+        correlation = autocorr_direct(in, len, window, mean, variance, CorrelBuffer);
 
     //
     int hi = 0, idx = 0;
@@ -871,11 +1163,72 @@ int AutoCorrelate(const int *in, int *out, size_t len, size_t window, bool SaveG
     return retval;
 }
 
+int AutoCorrelate(const int *in, int *out, size_t len, size_t window, bool SaveGrph, bool verbose) {
+    return AutoCorrelate_ext(in, out, len, window, SaveGrph, verbose, false);
+}
+
+// runs both correlation engines on the same samples and checks they agree
+static int AutoCorrelateBenchmark(const int *in, size_t len, size_t window) {
+    if (window > len) window = len;
+    size_t lags = len - window;
+
+    int *direct = calloc(len + 1, sizeof(int));
+    int *fft = calloc(len + 1, sizeof(int));
+    if (direct == NULL || fft == NULL) {
+        PrintAndLogEx(WARNING, "failed to allocate memory");
+        free(direct);
+        free(fft);
+        return PM3_EMALLOC;
+    }
+
+    double mean = compute_mean(in, len);
+    double variance = compute_variance(in, len);
+
+    uint64_t t1 = usclock();
+    size_t corr_direct = autocorr_direct(in, len, window, mean, variance, direct);
+    t1 = usclock() - t1;
+
+    size_t corr_fft = 0;
+    uint64_t t2 = usclock();
+    bool ok = autocorr_fft(in, len, window, mean, variance, fft, &corr_fft);
+    t2 = usclock() - t2;
+
+    if (ok == false) {
+        PrintAndLogEx(WARNING, "FFT correlation failed");
+        free(direct);
+        free(fft);
+        return PM3_EMALLOC;
+    }
+
+    size_t mismatch = 0;
+    for (size_t i = 0; i < lags; i++) {
+        if (direct[i] != fft[i])
+            mismatch++;
+    }
+
+    PrintAndLogEx(INFO, "samples %zu, window %zu, %zu correlations", len, window, lags);
+    PrintAndLogEx(INFO, "direct  %8" PRIu64 " us   correlation %zu", t1, corr_direct);
+    PrintAndLogEx(INFO, "fft     %8" PRIu64 " us   correlation %zu", t2, corr_fft);
+    if (t2)
+        PrintAndLogEx(INFO, "speedup %.1fx", (double)t1 / t2);
+
+    if (mismatch == 0 && corr_direct == corr_fft)
+        PrintAndLogEx(SUCCESS, "results " _GREEN_("identical"));
+    else
+        PrintAndLogEx(FAILED, "results " _RED_("differ") " in %zu lags", mismatch);
+
+    free(direct);
+    free(fft);
+    return (mismatch == 0 && corr_direct == corr_fft) ? PM3_SUCCESS : PM3_ESOFT;
+}
+
 static int CmdAutoCorr(const char *Cmd) {
 
     uint32_t window = 4000;
     uint8_t cmdp = 0;
     bool updateGrph = false;
+    bool benchmark = false;
+    bool fft = false;
     bool errors = false;
 
     while (param_getchar(Cmd, cmdp) != 0x00 && !errors) {
@@ -886,6 +1239,14 @@ static int CmdAutoCorr(const char *Cmd) {
                 updateGrph = true;
                 cmdp++;
                 break;
+            case 'b':
+                benchmark = true;
+                cmdp++;
+                break;
+            case 'f':
+                fft = true;
+                cmdp++;
+                break;
             case 'w':
                 window = param_get32ex(Cmd, cmdp + 1, 4000, 10);
                 if (window >= GraphTraceLen) {
@@ -903,11 +1264,216 @@ static int CmdAutoCorr(const char *Cmd) {
     //Validations
     if (errors || cmdp == 0) return usage_data_autocorr();
 
-    AutoCorrelate(GraphBuffer, GraphBuffer, GraphTraceLen, window, updateGrph, true);
+    if (benchmark)
+        return AutoCorrelateBenchmark(GraphBuffer, GraphTraceLen, window);
+
+    AutoCorrelate_ext(GraphBuffer, GraphBuffer, GraphTraceLen, window, updateGrph, true, fft);
 
     return PM3_SUCCESS;
 }
 
+// reads a sample file, one value per line, as written by 'data save'
+int loadSampleFile(const char *Cmd, int *buf, size_t maxlen, size_t *len) {
+    char filename[FILE_PATH_SIZE] = {0x00};
+    int fnlen = strlen(Cmd);
+    if (fnlen > FILE_PATH_SIZE - 1) fnlen = FILE_PATH_SIZE - 1;
+    memcpy(filename, Cmd, fnlen);
+
+    char *path;
+    if (searchFile(&path, TRACES_SUBDIR, filename, ".pm3", true) != PM3_SUCCESS) {
+        if (searchFile(&path, TRACES_SUBDIR, filename, "", false) != PM3_SUCCESS) {
+            return PM3_EFILE;
+        }
+    }
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        PrintAndLogEx(WARNING, "couldn't open '%s'", path);
+        free(path);
+        return PM3_EFILE;
+    }
+    free(path);
+
+    *len = 0;
+    char line[80];
+    while (fgets(line, sizeof(line), f)) {
+        buf[*len] = atoi(line);
+        (*len)++;
+
+        if (*len >= maxlen)
+            break;
+    }
+
+    fclose(f);
+    return PM3_SUCCESS;
+}
+
+// normalised cross-correlation of GraphBuffer against a reference waveform.
+// score[k] = sum((x[k+j] - mean_k) * (r[j] - mean_r)) / sqrt(energy_k * energy_r), in [-1 .. 1]
+static int CmdXcorr(const char *Cmd) {
+
+    char filename[FILE_PATH_SIZE] = {0};
+    uint32_t count = 5;
+    uint8_t cmdp = 0;
+    bool updateGrph = false;
+    bool errors = false;
+
+    while (param_getchar(Cmd, cmdp) != 0x00 && !errors) {
+        switch (tolower(param_getchar(Cmd, cmdp))) {
+            case 'h':
+                return usage_data_xcorr();
+            case 'f':
+                if (param_getstr(Cmd, cmdp + 1, filename, FILE_PATH_SIZE) >= FILE_PATH_SIZE) {
+                    PrintAndLogEx(FAILED, "Filename too long");
+                    errors = true;
+                }
+                cmdp += 2;
+                break;
+            case 'n':
+                count = param_get32ex(Cmd, cmdp + 1, 5, 10);
+                cmdp += 2;
+                break;
+            case 'g':
+                updateGrph = true;
+                cmdp++;
+                break;
+            default:
+                PrintAndLogEx(WARNING, "Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+                errors = true;
+                break;
+        }
+    }
+    //Validations
+    if (errors || strlen(filename) == 0 || count == 0) return usage_data_xcorr();
+
+    int *ref = calloc(MAX_GRAPH_TRACE_LEN, sizeof(int));
+    if (ref == NULL) {
+        PrintAndLogEx(WARNING, "failed to allocate memory");
+        return PM3_EMALLOC;
+    }
+
+    size_t rlen = 0;
+    int res = loadSampleFile(filename, ref, MAX_GRAPH_TRACE_LEN, &rlen);
+    if (res != PM3_SUCCESS) {
+        free(ref);
+        return res;
+    }
+
+    size_t len = GraphTraceLen;
+    if (rlen < 2 || rlen > len) {
+        PrintAndLogEx(WARNING, "reference must hold between 2 and %zu samples, got %zu", len, rlen);
+        free(ref);
+        return PM3_EINVARG;
+    }
+
+    size_t nscores = len - rlen + 1;
+    double *x = calloc(len, sizeof(double));
+    double *r = calloc(rlen, sizeof(double));
+    double *score = calloc(nscores, sizeof(double));
+    double *s1 = calloc(len + 1, sizeof(double));
+    double *s2 = calloc(len + 1, sizeof(double));
+    if (x == NULL || r == NULL || score == NULL || s1 == NULL || s2 == NULL) {
+        PrintAndLogEx(WARNING, "failed to allocate memory");
+        res = PM3_EMALLOC;
+        goto out;
+    }
+
+    double rmean = compute_mean(ref, rlen);
+    double renergy = 0;
+    for (size_t j = 0; j < rlen; j++) {
+        r[j] = ref[j] - rmean;
+        renergy += r[j] * r[j];
+    }
+    if (renergy == 0) {
+        PrintAndLogEx(WARNING, "reference waveform is flat");
+        res = PM3_EINVARG;
+        goto out;
+    }
+
+    // prefix sums give the local energy of every window in O(1)
+    for (size_t i = 0; i < len; i++) {
+        x[i] = GraphBuffer[i];
+        s1[i + 1] = s1[i] + x[i];
+        s2[i + 1] = s2[i] + x[i] * x[i];
+    }
+
+    // the reference has zero mean, so the window mean drops out of the numerator
+    if (correlate_fft(x, len, r, rlen, score, nscores) == false) {
+        PrintAndLogEx(WARNING, "failed to allocate memory");
+        res = PM3_EMALLOC;
+        goto out;
+    }
+
+    for (size_t k = 0; k < nscores; k++) {
+        double sum = s1[k + rlen] - s1[k];
+        double energy = (s2[k + rlen] - s2[k]) - (sum * sum) / rlen;
+        score[k] = (energy > 1e-9) ? score[k] / sqrt(energy * renergy) : 0;
+    }
+
+    PrintAndLogEx(INFO, "correlated %zu samples against a %zu samples reference", len, rlen);
+    PrintAndLogEx(NORMAL, "");
+    PrintAndLogEx(NORMAL, "  # |  offset | score");
+    PrintAndLogEx(NORMAL, "----+---------+-------");
+
+    // best matches first, a match hides its neighbours closer than one reference length
+    size_t best = 0;
+    for (uint32_t n = 0; n < count; n++) {
+        bool found = false;
+        size_t idx = 0;
+        for (size_t k = 0; k < nscores; k++) {
+            if (isnan(score[k]))
+                continue;
+            if (found == false || score[k] > score[idx]) {
+                idx = k;
+                found = true;
+            }
+        }
+        if (found == false)
+            break;
+
+        if (n == 0)
+            best = idx;
+
+        PrintAndLogEx(NORMAL, "%3u | %7zu | %5.3f", n + 1, idx, score[idx]);
+
+        size_t lo = (idx >= rlen) ? idx - rlen + 1 : 0;
+        size_t hi = MIN(idx + rlen, nscores);
+        for (size_t k = lo; k < hi; k++)
+            score[k] = NAN;
+    }
+
+    if (updateGrph) {
+        // recompute, the listing above has masked the peaks
+        if (correlate_fft(x, len, r, rlen, score, nscores) == false) {
+            PrintAndLogEx(WARNING, "failed to allocate memory");
+            res = PM3_EMALLOC;
+            goto out;
+        }
+        for (size_t k = 0; k < nscores; k++) {
+            double sum = s1[k + rlen] - s1[k];
+            double energy = (s2[k + rlen] - s2[k]) - (sum * sum) / rlen;
+            GraphBuffer[k] = (energy > 1e-9) ? (int)(127 * score[k] / sqrt(energy * renergy)) : 0;
+        }
+        GraphTraceLen = nscores;
+        setClockGrid(0, 0);
+        DemodBufferLen = 0;
+    }
+
+    CursorCPos = best;
+    CursorDPos = best + rlen;
+    RepaintGraphWindow();
+    res = PM3_SUCCESS;
+
+out:
+    free(ref);
+    free(x);
+    free(r);
+    free(score);
+    free(s1);
+    free(s2);
+    return res;
+}
+
 static int CmdBitsamples(const char *Cmd) {
     (void)Cmd; // Cmd is not used so far
     int cnt = 0;
@@ -1057,7 +1623,7 @@ static int CmdDetectClockRate(const char *Cmd) {
 }
 
 static char *GetFSKType(uint8_t fchigh, uint8_t fclow, uint8_t invert) {
-    static char fType[8];
+    static __thread char fType[8];
     memset(fType, 0x00, 8);
     char *fskType = fType;
 
@@ -1081,15 +1647,77 @@ static char *GetFSKType(uint8_t fchigh, uint8_t fclow, uint8_t invert) {
     return fskType;
 }
 
+//by marshmellow
+//fsk raw demod, no manchester decoding no start bit finding just get binary from wave
+int FSKDemodCtx(demod_ctx_t *ctx) {
+    if (ctx->signal.isnoise)
+        return PM3_ESOFT;
+
+    size_t BitLen = loadDemodCtx(ctx);
+    if (BitLen == 0) return PM3_ESOFT;
+
+    //get field clock lengths
+    if (!ctx->fchigh || !ctx->fclow) {
+        uint16_t fcs = countFC(ctx->bits, BitLen, true);
+        if (!fcs) {
+            ctx->fchigh = 10;
+            ctx->fclow = 8;
+        } else {
+            ctx->fchigh = (fcs >> 8) & 0x00FF;
+            ctx->fclow = fcs & 0x00FF;
+        }
+    }
+    //get bit clock length
+    if (!ctx->clock) {
+        int firstClockEdge = 0; //todo - align grid on graph with this...
+        ctx->clock = detectFSKClk(ctx->bits, BitLen, ctx->fchigh, ctx->fclow, &firstClockEdge);
+        if (!ctx->clock) ctx->clock = 50;
+    }
+    int startIdx = 0;
+    int size = fskdemod(ctx->bits, BitLen, ctx->clock, ctx->invert, ctx->fchigh, ctx->fclow, &startIdx);
+    if (size <= 0) {
+        PrintAndLogEx(DEBUG, "no FSK data found");
+        return PM3_ESOFT;
+    }
+    ctx->num_bits = size;
+    ctx->start_idx = startIdx;
+    return PM3_SUCCESS;
+}
+
+//defaults: clock = 50, invert=1, fchigh=10, fclow=8 (RF/10 RF/8 (fsk2a))
+int FSKDemodGraph(uint8_t rfLen, uint8_t invert, uint8_t fchigh, uint8_t fclow, bool verbose) {
+    uint8_t bits[MAX_GRAPH_TRACE_LEN] = {0};
+    demod_ctx_t ctx;
+    initDemodCtxFromGraph(&ctx, bits);
+    ctx.clock = rfLen;
+    ctx.invert = invert;
+    ctx.fchigh = fchigh;
+    ctx.fclow = fclow;
+
+    int res = FSKDemodCtx(&ctx);
+    if (res != PM3_SUCCESS) {
+        // no FSK data found leaves the DemodBuffer alone, callers have always treated that as success
+        return (ctx.signal.isnoise || ctx.num_samples == 0) ? res : PM3_SUCCESS;
+    }
+
+    setDemodBuffFromCtx(&ctx);
+
+    // Now output the bitstream to the scrollback by line of 16 bits
+    if (verbose || g_debugMode) {
+        PrintAndLogEx(DEBUG, "DEBUG: (FSKrawDemod) Using Clock:%u, invert:%u, fchigh:%u, fclow:%u", ctx.clock, ctx.invert, ctx.fchigh, ctx.fclow);
+        PrintAndLogEx(NORMAL, "%s decoded bitstream:", GetFSKType(ctx.fchigh, ctx.fclow, ctx.invert));
+        printDemodBuff();
+    }
+    return PM3_SUCCESS;
+}
+
 //by marshmellow
 //fsk raw demod and print binary
 //takes 4 arguments - Clock, invert, fchigh, fclow
 //defaults: clock = 50, invert=1, fchigh=10, fclow=8 (RF/10 RF/8 (fsk2a))
 int FSKrawDemod(const char *Cmd, bool verbose) {
-    //raw fsk demod  no manchester decoding no start bit finding just get binary from wave
     uint8_t rfLen, invert, fchigh, fclow;
 
-    //set defaults
     //set options from parameters entered with the command
     rfLen = param_get8(Cmd, 0);
     invert = param_get8(Cmd, 1);
@@ -1103,47 +1731,7 @@ int FSKrawDemod(const char *Cmd, bool verbose) {
         }
     }
 
-    if (getSignalProperties()->isnoise)
-        return PM3_ESOFT;
-
-    uint8_t bits[MAX_GRAPH_TRACE_LEN] = {0};
-    size_t BitLen = getFromGraphBuf(bits);
-    if (BitLen == 0) return PM3_ESOFT;
-
-    //get field clock lengths
-    if (!fchigh || !fclow) {
-        uint16_t fcs = countFC(bits, BitLen, true);
-        if (!fcs) {
-            fchigh = 10;
-            fclow = 8;
-        } else {
-            fchigh = (fcs >> 8) & 0x00FF;
-            fclow = fcs & 0x00FF;
-        }
-    }
-    //get bit clock length
-    if (!rfLen) {
-        int firstClockEdge = 0; //todo - align grid on graph with this...
-        rfLen = detectFSKClk(bits, BitLen, fchigh, fclow, &firstClockEdge);
-        if (!rfLen) rfLen = 50;
-    }
-    int startIdx = 0;
-    int size = fskdemod(bits, BitLen, rfLen, invert, fchigh, fclow, &startIdx);
-    if (size > 0) {
-        setDemodBuff(bits, size, 0);
-        setClockGrid(rfLen, startIdx);
-
-        // Now output the bitstream to the scrollback by line of 16 bits
-        if (verbose || g_debugMode) {
-            PrintAndLogEx(DEBUG, "DEBUG: (FSKrawDemod) Using Clock:%u, invert:%u, fchigh:%u, fclow:%u", rfLen, invert, fchigh, fclow);
-            PrintAndLogEx(NORMAL, "%s decoded bitstream:", GetFSKType(fchigh, fclow, invert));
-            printDemodBuff();
-        }
-        return PM3_SUCCESS;
-    } else {
-        PrintAndLogEx(DEBUG, "no FSK data found");
-    }
-    return PM3_SUCCESS;
+    return FSKDemodGraph(rfLen, invert, fchigh, fclow, verbose);
 }
 
 //by marshmellow
@@ -1158,55 +1746,84 @@ static int CmdFSKrawdemod(const char *Cmd) {
 }
 
 //by marshmellow
-//attempt to psk1 demod graph buffer
-int PSKDemod(const char *Cmd, bool verbose) {
-    int invert = 0, clk = 0, maxErr = 100;
-
-    sscanf(Cmd, "%i %i %i", &clk, &invert, &maxErr);
-
-    if (clk == 1) {
-        invert = 1;
-        clk = 0;
-    }
-    if (invert != 0 && invert != 1) {
-        if (g_debugMode || verbose) PrintAndLogEx(WARNING, "Invalid argument: %s", Cmd);
+//attempt to psk1 demod the context samples
+int PSKDemodCtx(demod_ctx_t *ctx) {
+    if (ctx->invert != 0 && ctx->invert != 1)
         return PM3_EINVARG;
-    }
 
-    if (getSignalProperties()->isnoise)
+    if (ctx->signal.isnoise)
         return PM3_ESOFT;
 
-    uint8_t bits[MAX_GRAPH_TRACE_LEN] = {0};
-    size_t bitlen = getFromGraphBuf(bits);
+    size_t bitlen = loadDemodCtx(ctx);
     if (bitlen == 0)
         return PM3_ESOFT;
 
+    int clk = ctx->clock;
+    int invert = ctx->invert;
     int startIdx = 0;
-    int errCnt = pskRawDemod_ext(bits, &bitlen, &clk, &invert, &startIdx);
-    if (errCnt > maxErr) {
-        if (g_debugMode || verbose) PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) Too many errors found, clk: %d, invert: %d, numbits: %d, errCnt: %d", clk, invert, bitlen, errCnt);
+    int errCnt = pskRawDemod_ext(ctx->bits, &bitlen, &clk, &invert, &startIdx);
+    ctx->err_cnt = errCnt;
+    if (errCnt > ctx->max_err) {
+        PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) Too many errors found, clk: %d, invert: %d, numbits: %d, errCnt: %d", clk, invert, bitlen, errCnt);
         return PM3_ESOFT;
     }
     if (errCnt < 0 || bitlen < 16) { //throw away static - allow 1 and -1 (in case of threshold command first)
-        if (g_debugMode || verbose) PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) no data found, clk: %d, invert: %d, numbits: %d, errCnt: %d", clk, invert, bitlen, errCnt);
+        PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) no data found, clk: %d, invert: %d, numbits: %d, errCnt: %d", clk, invert, bitlen, errCnt);
         return PM3_ESOFT;
     }
+    ctx->num_bits = bitlen;
+    ctx->clock = clk;
+    ctx->invert = invert;
+    ctx->start_idx = startIdx;
+    return PM3_SUCCESS;
+}
+
+int PSKDemodGraph(int clk, int invert, int maxErr, bool verbose) {
+    uint8_t bits[MAX_GRAPH_TRACE_LEN] = {0};
+    demod_ctx_t ctx;
+    initDemodCtxFromGraph(&ctx, bits);
+    ctx.clock = clk;
+    ctx.invert = invert;
+    ctx.max_err = maxErr;
+
+    int res = PSKDemodCtx(&ctx);
+    if (res != PM3_SUCCESS)
+        return res;
+
     if (verbose || g_debugMode) {
-        PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) Using Clock:%d, invert:%d, Bits Found:%d", clk, invert, bitlen);
-        if (errCnt > 0) {
-            PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) errors during Demoding (shown as 7 in bit stream): %d", errCnt);
+        PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) Using Clock:%d, invert:%d, Bits Found:%d", ctx.clock, ctx.invert, ctx.num_bits);
+        if (ctx.err_cnt > 0) {
+            PrintAndLogEx(DEBUG, "DEBUG: (PSKdemod) errors during Demoding (shown as 7 in bit stream): %d", ctx.err_cnt);
         }
     }
     //prime demod buffer for output
-    setDemodBuff(bits, bitlen, 0);
-    setClockGrid(clk, startIdx);
+    setDemodBuffFromCtx(&ctx);
     return PM3_SUCCESS;
 }
 
+//by marshmellow
+//takes 3 arguments - clock, invert, maxErr as integers
+int PSKDemod(const char *Cmd, bool verbose) {
+    int invert = 0, clk = 0, maxErr = 100;
+
+    sscanf(Cmd, "%i %i %i", &clk, &invert, &maxErr);
+
+    if (clk == 1) {
+        invert = 1;
+        clk = 0;
+    }
+    if (invert != 0 && invert != 1) {
+        if (g_debugMode || verbose) PrintAndLogEx(WARNING, "Invalid argument: %s", Cmd);
+        return PM3_EINVARG;
+    }
+
+    return PSKDemodGraph(clk, invert, maxErr, verbose);
+}
+
 static int CmdIdteckDemod(const char *Cmd) {
     (void)Cmd; // Cmd is not used so far
 
-    if (PSKDemod("", false) != PM3_SUCCESS) {
+    if (PSKDemodGraph(0, 0, 100, false) != PM3_SUCCESS) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - Idteck PSKDemod failed");
         return PM3_ESOFT;
     }
@@ -1228,7 +1845,7 @@ static int CmdIdteckDemod(const char *Cmd) {
             PrintAndLogEx(DEBUG, "DEBUG: Error - Idteck: idx: %d", idx);
 
         // if didn't find preamble try again inverting
-        if (PSKDemod("1", false) != PM3_SUCCESS) {
+        if (PSKDemodGraph(0, 1, 100, false) != PM3_SUCCESS) {
             PrintAndLogEx(DEBUG, "DEBUG: Error - Idteck PSKDemod failed");
             return PM3_ESOFT;
         }
@@ -1270,34 +1887,23 @@ int demodIdteck(void) {
 
 
 // by marshmellow
-// takes 3 arguments - clock, invert, maxErr as integers
 // attempts to demodulate nrz only
-// prints binary found and saves in demodbuffer for further commands
-int NRZrawDemod(const char *Cmd, bool verbose) {
-
-    int errCnt = 0, clkStartIdx = 0;
-    int invert = 0, clk = 0, maxErr = 100;
-    sscanf(Cmd, "%i %i %i", &clk, &invert, &maxErr);
-    if (clk == 1) {
-        invert = 1;
-        clk = 0;
-    }
-
-    if (invert != 0 && invert != 1) {
-        PrintAndLogEx(WARNING, "(NRZrawDemod) Invalid argument: %s", Cmd);
+int NRZDemodCtx(demod_ctx_t *ctx) {
+    if (ctx->invert != 0 && ctx->invert != 1)
         return PM3_EINVARG;
-    }
 
-    if (getSignalProperties()->isnoise)
+    if (ctx->signal.isnoise)
         return PM3_ESOFT;
 
-    uint8_t bits[MAX_GRAPH_TRACE_LEN] = {0};
-    size_t BitLen = getFromGraphBuf(bits);
-
+    size_t BitLen = loadDemodCtx(ctx);
     if (BitLen == 0) return PM3_ESOFT;
 
-    errCnt = nrzRawDemod(bits, &BitLen, &clk, &invert, &clkStartIdx);
-    if (errCnt > maxErr) {
+    int clk = ctx->clock;
+    int invert = ctx->invert;
+    int clkStartIdx = 0;
+    int errCnt = nrzRawDemod(ctx->bits, &BitLen, &clk, &invert, &clkStartIdx);
+    ctx->err_cnt = errCnt;
+    if (errCnt > ctx->max_err) {
         PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) Too many errors found, clk: %d, invert: %d, numbits: %d, errCnt: %d", clk, invert, BitLen, errCnt);
         return PM3_ESOFT;
     }
@@ -1305,13 +1911,30 @@ int NRZrawDemod(const char *Cmd, bool verbose) {
         PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) no data found, clk: %d, invert: %d, numbits: %d, errCnt: %d", clk, invert, BitLen, errCnt);
         return PM3_ESOFT;
     }
-    if (verbose || g_debugMode) PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) Tried NRZ Demod using Clock: %d - invert: %d - Bits Found: %d", clk, invert, BitLen);
-    //prime demod buffer for output
-    setDemodBuff(bits, BitLen, 0);
-    setClockGrid(clk, clkStartIdx);
+    ctx->num_bits = BitLen;
+    ctx->clock = clk;
+    ctx->invert = invert;
+    ctx->start_idx = clkStartIdx;
+    return PM3_SUCCESS;
+}
 
+int NRZDemodGraph(int clk, int invert, int maxErr, bool verbose) {
+    uint8_t bits[MAX_GRAPH_TRACE_LEN] = {0};
+    demod_ctx_t ctx;
+    initDemodCtxFromGraph(&ctx, bits);
+    ctx.clock = clk;
+    ctx.invert = invert;
+    ctx.max_err = maxErr;
+
+    int res = NRZDemodCtx(&ctx);
+    if (res != PM3_SUCCESS)
+        return res;
+
+    if (verbose || g_debugMode) PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) Tried NRZ Demod using Clock: %d - invert: %d - Bits Found: %d", ctx.clock, ctx.invert, ctx.num_bits);
+    //prime demod buffer for output
+    setDemodBuffFromCtx(&ctx);
 
-    if (errCnt > 0 && (verbose || g_debugMode)) PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) Errors during Demoding (shown as 7 in bit stream): %d", errCnt);
+    if (ctx.err_cnt > 0 && (verbose || g_debugMode)) PrintAndLogEx(DEBUG, "DEBUG: (NRZrawDemod) Errors during Demoding (shown as 7 in bit stream): %d", ctx.err_cnt);
     if (verbose || g_debugMode) {
         PrintAndLogEx(NORMAL, "NRZ demoded bitstream:");
         // Now output the bitstream to the scrollback by line of 16 bits
@@ -1320,6 +1943,26 @@ int NRZrawDemod(const char *Cmd, bool verbose) {
     return PM3_SUCCESS;
 }
 
+// by marshmellow
+// takes 3 arguments - clock, invert, maxErr as integers
+// attempts to demodulate nrz only
+// prints binary found and saves in demodbuffer for further commands
+int NRZrawDemod(const char *Cmd, bool verbose) {
+    int invert = 0, clk = 0, maxErr = 100;
+    sscanf(Cmd, "%i %i %i", &clk, &invert, &maxErr);
+    if (clk == 1) {
+        invert = 1;
+        clk = 0;
+    }
+
+    if (invert != 0 && invert != 1) {
+        PrintAndLogEx(WARNING, "(NRZrawDemod) Invalid argument: %s", Cmd);
+        return PM3_EINVARG;
+    }
+
+    return NRZDemodGraph(clk, invert, maxErr, verbose);
+}
+
 static int CmdNRZrawDemod(const char *Cmd) {
     char cmdp = tolower(param_getchar(Cmd, 0));
     if (strlen(Cmd) > 16 || cmdp == 'h') return usage_data_rawdemod_nr();
@@ -1394,6 +2037,9 @@ void setClockGrid(uint32_t clk, int offset) {
     else
         PrintAndLogEx(DEBUG, "DEBUG: (setClockGrid) demodoffset %d, clk %d", offset, clk);
 
+    // private graph states (lf search workers) don't own the plot grid
+    if (isGraphStateShared() == false) return;
+
     if (offset > clk) offset %= clk;
     if (offset < 0) offset += clk;
 
@@ -1672,39 +2318,12 @@ int CmdTuneSamples(const char *Cmd) {
 }
 
 static int CmdLoad(const char *Cmd) {
-    char filename[FILE_PATH_SIZE] = {0x00};
-    int len = 0;
-
-    len = strlen(Cmd);
-    if (len > FILE_PATH_SIZE) len = FILE_PATH_SIZE;
-    memcpy(filename, Cmd, len);
-
-    char *path;
-    if (searchFile(&path, TRACES_SUBDIR, filename, ".pm3", true) != PM3_SUCCESS) {
-        if (searchFile(&path, TRACES_SUBDIR, filename, "", false) != PM3_SUCCESS) {
-            return PM3_EFILE;
-        }
-    }
+    size_t len = 0;
+    int res = loadSampleFile(Cmd, GraphBuffer, MAX_GRAPH_TRACE_LEN, &len);
+    if (res != PM3_SUCCESS)
+        return res;
 
-    FILE *f = fopen(path, "r");
-    if (!f) {
-        PrintAndLogEx(WARNING, "couldn't open '%s'", path);
-        free(path);
-        return PM3_EFILE;
-    }
-    free(path);
-
-    GraphTraceLen = 0;
-    char line[80];
-    while (fgets(line, sizeof(line), f)) {
-        GraphBuffer[GraphTraceLen] = atoi(line);
-        GraphTraceLen++;
-
-        if (GraphTraceLen >= MAX_GRAPH_TRACE_LEN)
-            break;
-    }
-
-    fclose(f);
+    GraphTraceLen = len;
 
     PrintAndLogEx(SUCCESS, "loaded %d samples", GraphTraceLen);
 
@@ -2168,7 +2787,7 @@ static int CmdDataIIR(const char *Cmd) {
 static command_t CommandTable[] = {
     {"help",            CmdHelp,                 AlwaysAvailable, "This help"},
     {"askedgedetect",   CmdAskEdgeDetect,        AlwaysAvailable, "[threshold] Adjust Graph for manual ASK demod using the length of sample differences to detect the edge of a wave (use 20-45, def:25)"},
-    {"autocorr",        CmdAutoCorr,             AlwaysAvailable, "[window length] [g] -- Autocorrelation over window - g to save back to GraphBuffer (overwrite)"},
+    {"autocorr",        CmdAutoCorr,             AlwaysAvailable, "[window length] [g] [f] -- Autocorrelation over window - g to save back to GraphBuffer (overwrite), f for the FFT engine"},
     {"biphaserawdecode", CmdBiphaseDecodeRaw,    AlwaysAvailable, "[offset] [invert<0|1>] [maxErr] -- Biphase decode bin stream in DemodBuffer (offset = 0|1 bits to shift the decode start)"},
     {"bin2hex",         Cmdbin2hex,              AlwaysAvailable, "<digits> -- Converts binary to hexadecimal"},
     {"bitsamples",      CmdBitsamples,           IfPm3Present,    "Get raw samples as bitstring"},
@@ -2201,6 +2820,7 @@ static command_t CommandTable[] = {
     {"dirthreshold",    CmdDirectionalThreshold, AlwaysAvailable, "<thres up> <thres down> -- Max rising higher up-thres/ Min falling lower down-thres, keep rest as prev."},
     {"tune",            CmdTuneSamples,          IfPm3Present,    "Get hw tune samples for graph window"},
     {"undec",           CmdUndec,                AlwaysAvailable, "Un-decimate samples by 2"},
+    {"xcorr",           CmdXcorr,                AlwaysAvailable, "f <filename> [n <count>] [g] -- Cross-correlate against a reference waveform"},
     {"zerocrossings",   CmdZerocrossings,        AlwaysAvailable, "Count time between zero-crossings"},
     {"iir",             CmdDataIIR,              IfPm3Present,    "apply IIR buttersworth filter on plotdata"},
     {NULL, NULL, NULL, NULL}
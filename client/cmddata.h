@@ -12,11 +12,56 @@
 #define CMDDATA_H__
 
 #include "common.h"
+#include "lfdemod.h"   // signal_t
+#include "graph.h"     // DemodBuffer
 
 //#include <stdlib.h>  //size_t
 
 int CmdData(const char *Cmd);
 
+// Demodulation context, lets a caller demodulate any sample buffer without going through
+// GraphBuffer / DemodBuffer and without encoding its parameters in a command string.
+typedef struct {
+    // input
+    const int *samples;     // graph style samples, -128..127 (out of range values are clamped)
+    size_t num_samples;
+    signal_t signal;        // signal properties of the samples, see computeDemodCtxSignal()
+    // output buffer, at least num_samples bytes
+    uint8_t *bits;
+    size_t num_bits;
+    // parameters, 0 = autodetect. clock, invert, fchigh, fclow and offset return what was used
+    int clock;
+    int invert;
+    int max_err;
+    size_t max_len;
+    bool amplify;
+    uint8_t fchigh;
+    uint8_t fclow;
+    int offset;
+    // results
+    int start_idx;
+    int err_cnt;
+    bool st;                // ASK sequence terminator found between st_start and st_end
+    size_t st_start;
+    size_t st_end;
+} demod_ctx_t;
+
+void initDemodCtx(demod_ctx_t *ctx, const int *samples, size_t num_samples, uint8_t *bits);
+void computeDemodCtxSignal(demod_ctx_t *ctx);
+void setDemodBuffFromCtx(const demod_ctx_t *ctx);
+int ASKDemodCtx(demod_ctx_t *ctx, uint8_t askType);
+int ASKbiphaseDemodCtx(demod_ctx_t *ctx);
+int FSKDemodCtx(demod_ctx_t *ctx);
+int PSKDemodCtx(demod_ctx_t *ctx);
+int NRZDemodCtx(demod_ctx_t *ctx);
+
+// same demodulators on GraphBuffer, result goes to DemodBuffer
+int ASKDemodGraph(int clk, int invert, int maxErr, size_t maxLen, bool amp, bool verbose, bool emSearch, uint8_t askType, bool *stCheck);
+int ASKbiphaseDemodGraph(int offset, int clk, int invert, int maxErr, bool verbose);
+int FSKDemodGraph(uint8_t rfLen, uint8_t invert, uint8_t fchigh, uint8_t fclow, bool verbose);
+int PSKDemodGraph(int clk, int invert, int maxErr, bool verbose);
+int NRZDemodGraph(int clk, int invert, int maxErr, bool verbose);
+
 // Still quite work to do here to provide proper functions for internal usage...
 /*
 int Cmdaskrawdemod(const char *Cmd);
@@ -54,12 +99,13 @@ int CmdLtrim(const char *Cmd);
 int CmdNorm(const char *Cmd);                                                                   // used by cmd lf data (!)
 int CmdPlot(const char *Cmd);                                                                   // used by cmd lf cotag
 int CmdTuneSamples(const char *Cmd);                                                            // used by cmd lf hw
-int ASKbiphaseDemod(const char *Cmd, bool verbose);                                             // used by cmd lf em4x, lf fdx, lf guard, lf jablotron, lf nedap, lf t55xx
-int ASKDemod(const char *Cmd, bool verbose, bool emSearch, uint8_t askType);                    // used by cmd lf em4x, lf t55xx, lf viking
-int ASKDemod_ext(const char *Cmd, bool verbose, bool emSearch, uint8_t askType, bool *stCheck); // used by cmd lf, lf em4x, lf noralsy, le presco, lf securekey, lf t55xx, lf visa2k
-int FSKrawDemod(const char *Cmd, bool verbose);                                                 // used by cmd lf, lf em4x, lf t55xx
-int PSKDemod(const char *Cmd, bool verbose);                                                    // used by cmd lf em4x, lf indala, lf keri, lf nexwatch, lf t55xx
-int NRZrawDemod(const char *Cmd, bool verbose);                                                 // used by cmd lf pac, lf t55xx
+// string argument versions, they parse a user command and call the *Graph() functions above
+int ASKbiphaseDemod(const char *Cmd, bool verbose);
+int ASKDemod(const char *Cmd, bool verbose, bool emSearch, uint8_t askType);                    // used by cmd lf em4x, lf viking
+int ASKDemod_ext(const char *Cmd, bool verbose, bool emSearch, uint8_t askType, bool *stCheck); // used by cmd lf em4x
+int FSKrawDemod(const char *Cmd, bool verbose);
+int PSKDemod(const char *Cmd, bool verbose);                                                    // used by cmd lf indala
+int NRZrawDemod(const char *Cmd, bool verbose);                                                 // used by cmd lf pac
 
 
 void printDemodBuff(void);
@@ -68,18 +114,14 @@ bool getDemodBuff(uint8_t *buff, size_t *size);
 void save_restoreDB(uint8_t saveOpt);// option '1' to save DemodBuffer any other to restore
 int AutoCorrelate(const int *in, int *out, size_t len, size_t window, bool SaveGrph, bool verbose);
 int getSamples(uint32_t n, bool silent);
+int loadSampleFile(const char *Cmd, int *buf, size_t maxlen, size_t *len);
 void setClockGrid(uint32_t clk, int offset);
 int directionalThreshold(const int *in, int *out, size_t len, int8_t up, int8_t down);
 int AskEdgeDetect(const int *in, int *out, int len, int threshold);
 int demodIdteck(void);
 
-#define MAX_DEMOD_BUF_LEN (1024*128)
 #define BIGBUF_SIZE 40000
-extern uint8_t DemodBuffer[MAX_DEMOD_BUF_LEN];
-extern size_t DemodBufferLen;
 
-extern int g_DemodClock;
-extern size_t g_DemodStartIdx;
 extern uint8_t g_debugMode;
 
 #endif
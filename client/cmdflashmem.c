@@ -29,6 +29,9 @@
 
 #define FASTFLASH (FLASHMEM_SPIBAUDRATE > FLASH_MINFAST)
 
+// mem load writes sent ahead of their ACKs
+#define FLASH_MEM_WRITES_IN_FLIGHT 4
+
 static int CmdHelp(const char *Cmd);
 
 static int usage_flashmem_spibaud(void) {
@@ -232,40 +235,47 @@ static int CmdFlashMemLoad(const char *Cmd) {
     }
 
     //Send to device
-    uint32_t bytes_sent = 0;
-    uint32_t bytes_remaining = datalen;
-
-    // fast push mode
-    conn.block_after_ACK = true;
+    // keep a few writes in flight, each ACK is matched to its write by the reply ticket.
+    // The FPC usart has no room to queue commands on the device side, stay stop-and-wait there.
+    reply_ticket_t tickets[FLASH_MEM_WRITES_IN_FLIGHT];
+    uint32_t window = conn.send_via_fpc_usart ? 1 : FLASH_MEM_WRITES_IN_FLIGHT;
+    uint32_t packets = (datalen + FLASH_MEM_BLOCK_SIZE - 1) / FLASH_MEM_BLOCK_SIZE;
+    uint32_t sent = 0, acked = 0;
 
-    while (bytes_remaining > 0) {
-        uint32_t bytes_in_packet = MIN(FLASH_MEM_BLOCK_SIZE, bytes_remaining);
-
-        clearCommandBuffer();
+    clearCommandBuffer();
+    res = SubscribeReply(CMD_ACK);
 
-        SendCommandOLD(CMD_FLASHMEM_WRITE, start_index + bytes_sent, bytes_in_packet, 0, data + bytes_sent, bytes_in_packet);
+    while (res == PM3_SUCCESS && acked < packets) {
 
-        bytes_remaining -= bytes_in_packet;
-        bytes_sent += bytes_in_packet;
+        while (sent < packets && sent - acked < window) {
+            uint32_t offset = sent * FLASH_MEM_BLOCK_SIZE;
+            uint32_t bytes_in_packet = MIN(FLASH_MEM_BLOCK_SIZE, datalen - offset);
+            tickets[sent % FLASH_MEM_WRITES_IN_FLIGHT] = ExpectReply(CMD_ACK);
+            SendCommandOLD(CMD_FLASHMEM_WRITE, start_index + offset, bytes_in_packet, 0, data + offset, bytes_in_packet);
+            sent++;
+        }
 
         PacketResponseNG resp;
-        if (!WaitForResponseTimeout(CMD_ACK, &resp, 2000)) {
+        if (!WaitForReply(tickets[acked % FLASH_MEM_WRITES_IN_FLIGHT], &resp, 2000)) {
             PrintAndLogEx(WARNING, "timeout while waiting for reply.");
-            conn.block_after_ACK = false;
-            free(data);
-            return PM3_ETIMEOUT;
+            res = PM3_ETIMEOUT;
+            break;
         }
 
         uint8_t isok  = resp.oldarg[0] & 0xFF;
         if (!isok) {
-            conn.block_after_ACK = false;
-            PrintAndLogEx(FAILED, "Flash write fail [offset %u]", bytes_sent);
-            return PM3_EFLASH;
+            PrintAndLogEx(FAILED, "Flash write fail [offset %u]", acked * FLASH_MEM_BLOCK_SIZE);
+            res = PM3_EFLASH;
+            break;
         }
+        acked++;
     }
 
-    conn.block_after_ACK = false;
+    UnsubscribeReply(CMD_ACK);
     free(data);
+    if (res != PM3_SUCCESS)
+        return res;
+
     PrintAndLogEx(SUCCESS, "Wrote "_GREEN_("%u")"bytes to offset "_GREEN_("%u"), datalen, start_index);
     return PM3_SUCCESS;
 }
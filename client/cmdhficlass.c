@@ -14,6 +14,9 @@
 #include "cmdhficlass.h"
 
 #include <ctype.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <pthread.h>
 
 #include "cmdparser.h"    // command_t
 #include "commonutil.h"  // ARRAYLEN
@@ -28,6 +31,18 @@
 #include "loclass/elite_crack.h"
 #include "fileutils.h"
 #include "protocols.h"
+#include "optimized_cipher.h"
+#include "util.h"         // num_CPUs
+#include "ui.h"           // searchHomeFilePath
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <utime.h>
+#endif
 
 
 #define NUM_CSNS 9
@@ -233,6 +248,7 @@ static int usage_hf_iclass_loclass(void) {
     PrintAndLogEx(NORMAL, "Options:");
     PrintAndLogEx(NORMAL, "      h             Show this help");
     PrintAndLogEx(NORMAL, "      t             Perform self-test");
+    PrintAndLogEx(NORMAL, "      b             Benchmark the bruteforce engine");
     PrintAndLogEx(NORMAL, "      f <filename>  Bruteforce iclass dumpfile");
     PrintAndLogEx(NORMAL, "                    An iclass dumpfile is assumed to consist of an arbitrary number of");
     PrintAndLogEx(NORMAL, "                    malicious CSNs, and their protocol responses");
@@ -1837,6 +1853,8 @@ static int CmdHFiClass_loclass(const char *Cmd) {
         errors += testElite();
         if (errors) PrintAndLogEx(ERR, "There were errors!!!");
         return PM3_ESOFT;
+    } else if (opt == 'b') {
+        return benchmarkElite() ? PM3_ESOFT : PM3_SUCCESS;
     }
     return PM3_SUCCESS;
 }
@@ -2591,41 +2609,325 @@ static int CmdHFiClassLookUp(const char *Cmd) {
     return PM3_SUCCESS;
 }
 
-// precalc diversified keys and their MAC
-void GenerateMacFrom(uint8_t *CSN, uint8_t *CCNR, bool use_raw, bool use_elite, uint8_t *keys, int keycnt, iclass_premac_t *list) {
-    uint8_t key[8] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-    uint8_t div_key[8] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+//----------------------------------------------------------------------------
+// Precalc for hf iclass chk / lookup. For elite keys, the part of the key
+// diversification that doesn't depend on the tag is the hash2 keytable (16 DES
+// operations per key). It is cached in the user directory, one file per dictionary,
+// and mapped read-only on the next run. Only the most recently used files are kept.
+// Standard keys only need one DES key setup per key and raw keys nothing, they aren't cached.
+//----------------------------------------------------------------------------
+#define ICLASS_PRECALC_MAGIC        "PM3ICPC2"
+#define ICLASS_PRECALC_PREFIX       "iclass_elite_"     // + dictionary hash in hex + ".cache"
+#define ICLASS_PRECALC_SUFFIX       ".cache"
+#define ICLASS_PRECALC_MAX_FILES    4
+#define ICLASS_PRECALC_BLOCK        256     // keys handed to a thread at a time
+#define ICLASS_PRECALC_MAX_THREADS  64
+
+// hash2 output of one key. hash1 of the CSN selects 8 of its bytes, so all of it is needed
+typedef struct {
+    uint8_t keytable[128];
+} iclass_elite_precalc_t;
 
-    for (int i = 0; i < keycnt; i++) {
+_Static_assert(sizeof(iclass_elite_precalc_t) == 128, "iclass cache entries are hash2 keytables of 128 bytes");
 
-        memcpy(key, keys + 8 * i, 8);
+typedef struct {
+    char magic[8];
+    uint64_t dict_hash;
+    uint32_t keycount;
+    uint32_t elite;
+    uint32_t entry_size;
+    uint32_t reserved;
+} iclass_precalc_header_t;
 
-        if (use_raw)
-            memcpy(div_key, key, 8);
-        else
-            HFiClassCalcDivKey(CSN, key, div_key, use_elite);
+typedef struct {
+    uint8_t *CSN;
+    uint8_t *CCNR;
+    bool use_raw;
+    bool use_elite;
+    bool fill_precalc;      // compute the precalc entries instead of the MACs
+    uint8_t *keys;
+    int keycnt;
+    iclass_elite_precalc_t *precalc;   // keycnt entries, elite only
+    uint8_t key_index[8];   // hash1 of the CSN, elite only
+    uint8_t *macs;          // MAC of key i goes to macs + i * mac_stride
+    size_t mac_stride;
+    int next;               // first key of the next unclaimed block
+} iclass_precalc_job_t;
+
+static void *iclass_precalc_thread(void *arg) {
+    iclass_precalc_job_t *job = (iclass_precalc_job_t *)arg;
+    uint8_t div_key[8];
+
+    while (true) {
+        int i = __atomic_fetch_add(&job->next, ICLASS_PRECALC_BLOCK, __ATOMIC_RELAXED);
+        if (i >= job->keycnt)
+            break;
+
+        int end = MIN(i + ICLASS_PRECALC_BLOCK, job->keycnt);
+        for (; i < end; i++) {
+            uint8_t *key = job->keys + 8 * i;
+
+            if (job->fill_precalc) {
+                hash2(key, job->precalc[i].keytable);
+                continue;
+            }
+
+            // generate diversifed key
+            if (job->use_raw) {
+                memcpy(div_key, key, 8);
+            } else if (job->use_elite) {
+                uint8_t key_sel[8], key_sel_p[8];
+                for (uint8_t j = 0; j < 8 ; j++)
+                    key_sel[j] = job->precalc[i].keytable[job->key_index[j]];
+                //Permute from iclass format to standard format
+                permutekey_rev(key_sel, key_sel_p);
+                diversifyKey(job->CSN, key_sel_p, div_key);
+            } else {
+                diversifyKey(job->CSN, key, div_key);
+            }
 
-        doMAC(CCNR, div_key, list[i].mac);
+            // generate MAC
+            opt_doReaderMAC(job->CCNR, div_key, job->macs + i * job->mac_stride);
+        }
     }
+    return NULL;
 }
 
-void GenerateMacKeyFrom(uint8_t *CSN, uint8_t *CCNR, bool use_raw, bool use_elite, uint8_t *keys, int keycnt, iclass_prekey_t *list) {
+static void iclass_precalc_run(iclass_precalc_job_t *job) {
+    job->next = 0;
+    int thread_count = MIN(num_CPUs(), ICLASS_PRECALC_MAX_THREADS);
+    thread_count = MAX(1, MIN(thread_count, (job->keycnt + ICLASS_PRECALC_BLOCK - 1) / ICLASS_PRECALC_BLOCK));
 
-    uint8_t div_key[8] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    pthread_t threads[ICLASS_PRECALC_MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&threads[started], NULL, iclass_precalc_thread, job) == 0)
+            started++;
+    }
+    // no thread at all, do the work here
+    if (started == 0)
+        iclass_precalc_thread(job);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+}
 
-    for (int i = 0; i < keycnt; i++) {
+#if !defined(_WIN32)
+static uint64_t iclass_dict_hash(uint8_t *keys, int keycnt) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < (size_t)keycnt * 8; i++) {
+        hash ^= keys[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
 
-        memcpy(list[i].key, keys + 8 * i, 8);
+static iclass_elite_precalc_t *map_iclass_precalc(const char *cache_path, iclass_precalc_header_t *expected, size_t *map_size) {
+    int fd = open(cache_path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
 
-        // generate diversifed key
-        if (use_raw)
-            memcpy(div_key, list[i].key, 8);
-        else
-            HFiClassCalcDivKey(CSN, list[i].key, div_key, use_elite);
+    iclass_precalc_header_t header;
+    struct stat st;
+    if (read(fd, &header, sizeof(header)) != sizeof(header)
+            || memcmp(&header, expected, sizeof(header)) != 0
+            || fstat(fd, &st) != 0
+            || (uint64_t)st.st_size != sizeof(header) + (uint64_t)header.keycount * header.entry_size) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    *map_size = st.st_size;
+    return (iclass_elite_precalc_t *)((uint8_t *)map + sizeof(header));
+}
+
+// cache files are named ICLASS_PRECALC_PREFIX <16 hex digits> ICLASS_PRECALC_SUFFIX, nothing else is touched
+static bool is_iclass_precalc_name(const char *name) {
+    size_t plen = strlen(ICLASS_PRECALC_PREFIX);
+    if (strlen(name) != plen + 16 + strlen(ICLASS_PRECALC_SUFFIX)
+            || strncmp(name, ICLASS_PRECALC_PREFIX, plen) != 0
+            || strcmp(name + plen + 16, ICLASS_PRECALC_SUFFIX) != 0)
+        return false;
+
+    for (size_t i = plen; i < plen + 16; i++) {
+        if (isxdigit((unsigned char)name[i]) == 0)
+            return false;
+    }
+    return true;
+}
+
+// removes the least recently used cache files until ICLASS_PRECALC_MAX_FILES are left
+static void evict_iclass_precalc(const char *cache_path) {
+    const char *sep = strrchr(cache_path, PATHSEP[0]);
+    if (sep == NULL)
+        return;
+
+    char dir_path[sep - cache_path + 1];
+    memcpy(dir_path, cache_path, sep - cache_path);
+    dir_path[sep - cache_path] = '\0';
+
+    for (;;) {
+        DIR *dir = opendir(dir_path);
+        if (dir == NULL)
+            return;
+
+        int count = 0;
+        time_t oldest_time = 0;
+        char oldest[FILE_PATH_SIZE] = {0};
+        struct dirent *de;
+        while ((de = readdir(dir)) != NULL) {
+            if (is_iclass_precalc_name(de->d_name) == false)
+                continue;
+
+            char path[FILE_PATH_SIZE];
+            struct stat st;
+            snprintf(path, sizeof(path), "%s%s%s", dir_path, PATHSEP, de->d_name);
+            if (stat(path, &st) != 0)
+                continue;
+
+            if (count == 0 || st.st_mtime < oldest_time) {
+                oldest_time = st.st_mtime;
+                memcpy(oldest, path, sizeof(oldest));
+            }
+            count++;
+        }
+        closedir(dir);
+
+        if (count <= ICLASS_PRECALC_MAX_FILES || remove(oldest) != 0)
+            return;
+        PrintAndLogEx(DEBUG, "Removed iclass precalc cache %s", oldest);
+    }
+}
+
+static void write_iclass_precalc(const char *cache_path, iclass_precalc_header_t *header, iclass_elite_precalc_t *precalc) {
+    size_t data_size = (size_t)header->keycount * header->entry_size;
+
+    // write to a temporary file first, other processes may be mapping the current cache
+    char tmp_path[strlen(cache_path) + 16];
+    sprintf(tmp_path, "%s.%d", cache_path, (int)getpid());
+    FILE *f = fopen(tmp_path, "wb");
+    if (f == NULL)
+        return;
+
+    bool ok = (fwrite(header, 1, sizeof(*header), f) == sizeof(*header));
+    ok = ok && (fwrite(precalc, 1, data_size, f) == data_size);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp_path, cache_path) != 0) {
+        PrintAndLogEx(WARNING, "Could not write iclass precalc cache %s", cache_path);
+        remove(tmp_path);
+        return;
+    }
+    evict_iclass_precalc(cache_path);
+}
+#endif
+
+// returns the elite precalc of all keys, from the cache if possible. *map_size is 0 if they were computed
+static iclass_elite_precalc_t *get_iclass_precalc(iclass_precalc_job_t *job, size_t *map_size) {
+    *map_size = 0;
+
+#if !defined(_WIN32)
+    iclass_precalc_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ICLASS_PRECALC_MAGIC, sizeof(header.magic));
+    header.dict_hash = iclass_dict_hash(job->keys, job->keycnt);
+    header.keycount = job->keycnt;
+    header.elite = 1;
+    header.entry_size = sizeof(iclass_elite_precalc_t);
+
+    char cache_name[64];
+    snprintf(cache_name, sizeof(cache_name), ICLASS_PRECALC_PREFIX "%016" PRIx64 ICLASS_PRECALC_SUFFIX, header.dict_hash);
+    char *cache_path = NULL;
+    if (searchHomeFilePath(&cache_path, cache_name, true) != PM3_SUCCESS)
+        cache_path = NULL;
+
+    if (cache_path != NULL) {
+        iclass_elite_precalc_t *precalc = map_iclass_precalc(cache_path, &header, map_size);
+        if (precalc != NULL) {
+            PrintAndLogEx(DEBUG, "Using iclass precalc cache %s", cache_path);
+            // the modification time orders the files for evict_iclass_precalc()
+            utime(cache_path, NULL);
+            free(cache_path);
+            return precalc;
+        }
+    }
+#endif
 
-        // generate MAC
-        doMAC(CCNR, div_key, list[i].mac);
+    iclass_elite_precalc_t *precalc = calloc(job->keycnt, sizeof(iclass_elite_precalc_t));
+    if (precalc != NULL) {
+        job->precalc = precalc;
+        job->fill_precalc = true;
+        iclass_precalc_run(job);
+        job->fill_precalc = false;
     }
+
+#if !defined(_WIN32)
+    if (precalc != NULL && cache_path != NULL)
+        write_iclass_precalc(cache_path, &header, precalc);
+    free(cache_path);
+#endif
+    return precalc;
+}
+
+static void free_iclass_precalc(iclass_elite_precalc_t *precalc, size_t map_size) {
+#if !defined(_WIN32)
+    if (map_size) {
+        munmap((uint8_t *)precalc - sizeof(iclass_precalc_header_t), map_size);
+        return;
+    }
+#endif
+    free(precalc);
+}
+
+static void iclass_generate_macs(uint8_t *CSN, uint8_t *CCNR, bool use_raw, bool use_elite, uint8_t *keys, int keycnt, uint8_t *macs, size_t mac_stride) {
+    iclass_precalc_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.CSN = CSN;
+    job.CCNR = CCNR;
+    job.use_raw = use_raw;
+    job.use_elite = use_elite && !use_raw;
+    job.keys = keys;
+    job.keycnt = keycnt;
+    job.macs = macs;
+    job.mac_stride = mac_stride;
+    hash1(CSN, job.key_index);
+
+    size_t map_size = 0;
+    iclass_elite_precalc_t *precalc = NULL;
+    if (job.use_elite) {
+        precalc = get_iclass_precalc(&job, &map_size);
+        if (precalc == NULL) {
+            // out of memory, diversify key by key
+            for (int i = 0; i < keycnt; i++) {
+                uint8_t div_key[8];
+                HFiClassCalcDivKey(CSN, keys + 8 * i, div_key, use_elite);
+                doMAC(CCNR, div_key, macs + i * mac_stride);
+            }
+            return;
+        }
+        job.precalc = precalc;
+    }
+
+    iclass_precalc_run(&job);
+
+    if (precalc != NULL)
+        free_iclass_precalc(precalc, map_size);
+}
+
+// precalc diversified keys and their MAC
+void GenerateMacFrom(uint8_t *CSN, uint8_t *CCNR, bool use_raw, bool use_elite, uint8_t *keys, int keycnt, iclass_premac_t *list) {
+    iclass_generate_macs(CSN, CCNR, use_raw, use_elite, keys, keycnt, (uint8_t *)list + offsetof(iclass_premac_t, mac), sizeof(iclass_premac_t));
+}
+
+void GenerateMacKeyFrom(uint8_t *CSN, uint8_t *CCNR, bool use_raw, bool use_elite, uint8_t *keys, int keycnt, iclass_prekey_t *list) {
+
+    for (int i = 0; i < keycnt; i++)
+        memcpy(list[i].key, keys + 8 * i, 8);
+
+    iclass_generate_macs(CSN, CCNR, use_raw, use_elite, keys, keycnt, (uint8_t *)list + offsetof(iclass_prekey_t, mac), sizeof(iclass_prekey_t));
 }
 
 // print diversified keys
@@ -14,12 +14,16 @@
 #include <inttypes.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #include "commonutil.h"  // ARRAYLEN
 #include "mifare/mifarehost.h"
 #include "mifare/mifaredefault.h"
 #include "parity.h"         // oddparity
 #include "ui.h"
+#include "util.h"           // num_CPUs
+#include "util_posix.h"
 #include "crc16.h"
 #include "crapto1/crapto1.h"
 #include "protocols.h"
@@ -1190,31 +1194,21 @@ bool DecodeMifareData(uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, bool isRes
 
             //hardnested
             if (!traceCrypto1) {
-                PrintAndLogEx(NORMAL, "hardnested not implemented. uid:%x nt:%x ar_enc:%x at_enc:%x\n", AuthData.uid, AuthData.nt, AuthData.ar_enc, AuthData.at_enc);
-                MifareAuthState = masError;
-
-                /* TOO SLOW( needs to have more strong filter. with this filter - aprox 4 mln tests
-                uint32_t t = msclock();
-                uint32_t t1 = t;
-                int n = 0;
-                for (uint32_t i = 0; i < 0xFFFFFFFF; i++) {
-                    if (NTParityChk(&AuthData, i)){
-
-                        uint32_t ks2 = AuthData.ar_enc ^ prng_successor(i, 64);
-                        uint32_t ks3 = AuthData.at_enc ^ prng_successor(i, 96);
-                        struct Crypto1State *pcs = lfsr_recovery64(ks2, ks3);
-
-                        n++;
-
-                        if (!(n % 100000)) {
-                            PrintAndLogEx(NORMAL, "delta=%d n=%d ks2=%x ks3=%x \n", msclock() - t1 , n, ks2, ks3);
-                            t1 = msclock();
-                        }
-
-                    }
+                uint32_t nt = 0;
+                traceCrypto1 = HardnestedRecoverState(&AuthData, cmd, cmdsize, parity, &nt);
+                if (traceCrypto1) {
+                    AuthData.nt = nt;
+                    AuthData.ks2 = AuthData.ar_enc ^ prng_successor(nt, 64);
+                    AuthData.ks3 = AuthData.at_enc ^ prng_successor(nt, 96);
+                    mfLastKey = GetCrypto1ProbableKey(&AuthData);
+                    PrintAndLogEx(NORMAL, "            |            |  *  | hardnested probable key:%012"PRIx64"  ks2:%08x ks3:%08x |     |",
+                                  mfLastKey,
+                                  AuthData.ks2,
+                                  AuthData.ks3);
+                } else {
+                    PrintAndLogEx(NORMAL, "hardnested: key not found. uid:%x nt_enc:%x ar_enc:%x at_enc:%x\n", AuthData.uid, AuthData.nt_enc, AuthData.ar_enc, AuthData.at_enc);
+                    MifareAuthState = masError;
                 }
-                PrintAndLogEx(NORMAL, "delta=%d n=%d\n", msclock() - t, n);
-                */
             }
         }
         MifareAuthState = masData;
@@ -1229,14 +1223,8 @@ bool DecodeMifareData(uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, bool isRes
     return *mfDataLen > 0;
 }
 
-bool NTParityChk(TAuthData *ad, uint32_t ntx) {
-    if (
-        (oddparity8(ntx >> 8 & 0xff) ^ (ntx & 0x01) ^ ((ad->nt_enc_par >> 5) & 0x01) ^ (ad->nt_enc & 0x01)) ||
-        (oddparity8(ntx >> 16 & 0xff) ^ (ntx >> 8 & 0x01) ^ ((ad->nt_enc_par >> 6) & 0x01) ^ (ad->nt_enc >> 8 & 0x01)) ||
-        (oddparity8(ntx >> 24 & 0xff) ^ (ntx >> 16 & 0x01) ^ ((ad->nt_enc_par >> 7) & 0x01) ^ (ad->nt_enc >> 16 & 0x01))
-    )
-        return false;
-
+// parity bits of ar and at. They only depend on the nt bits which are still in the PRNG window 64 shifts later
+static bool ArAtParityChk(TAuthData *ad, uint32_t ntx) {
     uint32_t ar = prng_successor(ntx, 64);
     if (
         (oddparity8(ar >> 8 & 0xff) ^ (ar & 0x01) ^ ((ad->ar_enc_par >> 5) & 0x01) ^ (ad->ar_enc & 0x01)) ||
@@ -1257,6 +1245,175 @@ bool NTParityChk(TAuthData *ad, uint32_t ntx) {
     return true;
 }
 
+bool NTParityChk(TAuthData *ad, uint32_t ntx) {
+    if (
+        (oddparity8(ntx >> 8 & 0xff) ^ (ntx & 0x01) ^ ((ad->nt_enc_par >> 5) & 0x01) ^ (ad->nt_enc & 0x01)) ||
+        (oddparity8(ntx >> 16 & 0xff) ^ (ntx >> 8 & 0x01) ^ ((ad->nt_enc_par >> 6) & 0x01) ^ (ad->nt_enc >> 8 & 0x01)) ||
+        (oddparity8(ntx >> 24 & 0xff) ^ (ntx >> 16 & 0x01) ^ ((ad->nt_enc_par >> 7) & 0x01) ^ (ad->nt_enc >> 16 & 0x01))
+    )
+        return false;
+
+    return ArAtParityChk(ad, ntx);
+}
+
+// hardnested: nt is random, so it can't be found by walking the PRNG from the previous nonce.
+// ar and at are determined by the 16 nt bits left in the PRNG window after 32 shifts, which gives at most
+// 2^16 (ks2, ks3) pairs, about 2^9 of them with matching parity bits. Each one is recovered with lfsr_recovery64()
+// and rolled back over nr and nt. nt then falls out of the rollback and has to fit ar, the nt parity bits
+// and the first command's parity and CRC.
+typedef struct {
+    TAuthData *ad;
+    uint8_t *cmd;
+    uint8_t cmdsize;
+    uint8_t *parity;
+    uint32_t *candidates;
+    uint32_t num_candidates;
+    uint32_t next;
+    uint32_t checked;
+    uint32_t running;
+    bool found;
+    uint32_t nt;
+    struct Crypto1State state;
+    pthread_mutex_t lock;
+} hardnested_search_t;
+
+#define HARDNESTED_MAX_THREADS 64
+
+static bool HardnestedCheckCandidate(hardnested_search_t *hs, uint32_t ntx, uint32_t *nt, struct Crypto1State *state) {
+    TAuthData *ad = hs->ad;
+    uint32_t ar = prng_successor(ntx, 64);
+    uint32_t at = prng_successor(ntx, 96);
+    struct Crypto1State *states = lfsr_recovery64(ad->ar_enc ^ ar, ad->at_enc ^ at);
+    if (states == NULL)
+        return false;
+
+    bool found = false;
+    for (struct Crypto1State *sl = states; !found && (sl->odd | sl->even); sl++) {
+        struct Crypto1State s = *sl;
+        lfsr_rollback_word(&s, 0, 0);
+        lfsr_rollback_word(&s, 0, 0);
+        lfsr_rollback_word(&s, ad->nr_enc, 1);
+        uint32_t nt1 = lfsr_rollback_word(&s, ad->uid ^ ad->nt_enc, 1) ^ ad->nt_enc;
+        if (prng_successor(nt1, 64) != ar || !NTParityChk(ad, nt1))
+            continue;
+
+        uint8_t buf[32] = {0};
+        memcpy(buf, hs->cmd, hs->cmdsize);
+        s = *sl;
+        mf_crypto1_decrypt(&s, buf, hs->cmdsize, 0);
+        if (CheckCrypto1Parity(hs->cmd, hs->cmdsize, buf, hs->parity) && check_crc(CRC_14443_A, buf, hs->cmdsize)) {
+            *nt = nt1;
+            *state = *sl;
+            found = true;
+        }
+    }
+    crypto1_destroy(states);
+    return found;
+}
+
+static void *HardnestedThread(void *arg) {
+    hardnested_search_t *hs = (hardnested_search_t *)arg;
+    while (!__atomic_load_n(&hs->found, __ATOMIC_ACQUIRE)) {
+        uint32_t i = __atomic_fetch_add(&hs->next, 1, __ATOMIC_RELAXED);
+        if (i >= hs->num_candidates)
+            break;
+
+        uint32_t nt;
+        struct Crypto1State state;
+        if (HardnestedCheckCandidate(hs, hs->candidates[i], &nt, &state)) {
+            pthread_mutex_lock(&hs->lock);
+            if (!hs->found) {
+                hs->nt = nt;
+                hs->state = state;
+                __atomic_store_n(&hs->found, true, __ATOMIC_RELEASE);
+            }
+            pthread_mutex_unlock(&hs->lock);
+        }
+        __atomic_fetch_add(&hs->checked, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_sub(&hs->running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+struct Crypto1State *HardnestedRecoverState(TAuthData *ad, uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, uint32_t *nt) {
+    hardnested_search_t hs = {
+        .ad = ad,
+        .cmd = cmd,
+        .cmdsize = cmdsize,
+        .parity = parity,
+    };
+
+    // nt bits which still influence ar and at
+    uint32_t mask = 0;
+    for (int i = 0; i < 32; i++) {
+        if (prng_successor(1u << i, 64) | prng_successor(1u << i, 96))
+            mask |= 1u << i;
+    }
+
+    hs.candidates = calloc(1u << __builtin_popcount(mask), sizeof(uint32_t));
+    if (hs.candidates == NULL) {
+        PrintAndLogEx(WARNING, "hardnested: out of memory");
+        return NULL;
+    }
+    uint32_t ntx = 0;
+    do {
+        if (ArAtParityChk(ad, ntx))
+            hs.candidates[hs.num_candidates++] = ntx;
+        ntx = (ntx - mask) & mask;
+    } while (ntx != 0);
+
+    int num_threads = MIN(num_CPUs(), HARDNESTED_MAX_THREADS);
+    if (num_threads < 1)
+        num_threads = 1;
+    PrintAndLogEx(INFO, "hardnested: checking %u keystream candidates using %d threads", hs.num_candidates, num_threads);
+
+    pthread_mutex_init(&hs.lock, NULL);
+    pthread_t threads[HARDNESTED_MAX_THREADS];
+    hs.running = num_threads;
+    int started = 0;
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[started], NULL, HardnestedThread, &hs) == 0)
+            started++;
+    }
+    // threads which didn't start can't count themselves out
+    __atomic_fetch_sub(&hs.running, num_threads - started, __ATOMIC_RELEASE);
+    if (started == 0) {
+        // no thread at all, do the work here
+        hs.running = 1;
+        HardnestedThread(&hs);
+    }
+
+    uint64_t start = msclock();
+    uint64_t last_print = start;
+    while (__atomic_load_n(&hs.running, __ATOMIC_ACQUIRE) > 0) {
+        msleep(100);
+        if (msclock() - last_print < 1000)
+            continue;
+        last_print = msclock();
+        uint32_t checked = __atomic_load_n(&hs.checked, __ATOMIC_RELAXED);
+        uint64_t elapsed = last_print - start;
+        uint64_t remaining = checked ? elapsed * (hs.num_candidates - checked) / checked / 1000 : 0;
+        PrintAndLogEx(INPLACE, "hardnested: %u / %u checked, %" PRIu64 " s remaining", checked, hs.num_candidates, remaining);
+    }
+    PrintAndLogEx(NORMAL, "");
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&hs.lock);
+    free(hs.candidates);
+
+    if (!hs.found)
+        return NULL;
+
+    struct Crypto1State *pcs = crypto1_create(0);
+    if (pcs == NULL)
+        return NULL;
+    *pcs = hs.state;
+    *nt = hs.nt;
+    return pcs;
+}
+
 bool NestedCheckKey(uint64_t key, TAuthData *ad, uint8_t *cmd, uint8_t cmdsize, uint8_t *parity) {
     uint8_t buf[32] = {0};
     struct Crypto1State *pcs;
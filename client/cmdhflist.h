@@ -11,6 +11,7 @@
 #define CMDHFLIST_H
 
 #include "common.h"
+#include "crapto1/crapto1.h"
 
 typedef struct {
     uint32_t uid;       // UID
@@ -50,6 +51,7 @@ void annotateMifare(char *exp, size_t size, uint8_t *cmd, uint8_t cmdsize, uint8
 
 bool DecodeMifareData(uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, bool isResponse, uint8_t *mfData, size_t *mfDataLen);
 bool NTParityChk(TAuthData *ad, uint32_t ntx);
+struct Crypto1State *HardnestedRecoverState(TAuthData *ad, uint8_t *cmd, uint8_t cmdsize, uint8_t *parity, uint32_t *nt);
 bool NestedCheckKey(uint64_t key, TAuthData *ad, uint8_t *cmd, uint8_t cmdsize, uint8_t *parity);
 bool CheckCrypto1Parity(uint8_t *cmd_enc, uint8_t cmdsize, uint8_t *cmd, uint8_t *parity_enc);
 uint64_t GetCrypto1ProbableKey(TAuthData *ad);
@@ -120,11 +120,13 @@ static int usage_hf14_nested(void) {
     PrintAndLogEx(NORMAL, " all sectors:  hf mf nested  <card memory> <block number> <key A/B> <key (12 hex symbols)> [t,d]");
     PrintAndLogEx(NORMAL, " one sector:   hf mf nested  o <block number> <key A/B> <key (12 hex symbols)>");
     PrintAndLogEx(NORMAL, "               <target block number> <target key A/B> [t]");
+    PrintAndLogEx(NORMAL, " benchmark:    hf mf nested  b");
     PrintAndLogEx(NORMAL, "Options:");
     PrintAndLogEx(NORMAL, "      h    this help");
     PrintAndLogEx(NORMAL, "      card memory - 0 - MINI(320 bytes), 1 - 1K, 2 - 2K, 4 - 4K, <other> - 1K");
     PrintAndLogEx(NORMAL, "      t    transfer keys into emulator memory");
     PrintAndLogEx(NORMAL, "      d    write keys to binary file `hf-mf-<UID>-key.bin`");
+    PrintAndLogEx(NORMAL, "      b    benchmark the key recovery on synthetic nonces (no card needed)");
     PrintAndLogEx(NORMAL, "");
     PrintAndLogEx(NORMAL, "Examples:");
     PrintAndLogEx(NORMAL, "      hf mf nested 1 0 A FFFFFFFFFFFF     -- nested attack against 1k,block 0, Key A using key FFFFFFFFFFFF");
@@ -138,21 +140,26 @@ static int usage_hf14_hardnested(void) {
     PrintAndLogEx(NORMAL, "      hf mf hardnested <block number> <key A|B> <key (12 hex symbols)>");
     PrintAndLogEx(NORMAL, "                       <target block number> <target key A|B> [known target key (12 hex symbols)] [w] [s]");
     PrintAndLogEx(NORMAL, "  or  hf mf hardnested r [known target key]");
+    PrintAndLogEx(NORMAL, "  or  hf mf hardnested b [nonces file]");
     PrintAndLogEx(NORMAL, "");
     PrintAndLogEx(NORMAL, "Options:");
     PrintAndLogEx(NORMAL, "      h         this help");
     PrintAndLogEx(NORMAL, "      w         acquire nonces and UID, and write them to binary file with default name hf-mf-<UID>-nonces.bin");
     PrintAndLogEx(NORMAL, "      s         slower acquisition (required by some non standard cards)");
     PrintAndLogEx(NORMAL, "      r         read hf-mf-<UID>-nonces.bin if tag present, otherwise read nonces.bin, then start attack");
+    PrintAndLogEx(NORMAL, "                if the brute force phase of a previous run was interrupted, resume it from <nonces file>.session");
     PrintAndLogEx(NORMAL, "      u <UID>   read/write hf-mf-<UID>-nonces.bin instead of default name");
     PrintAndLogEx(NORMAL, "      f <name>  read/write <name> instead of default name");
     PrintAndLogEx(NORMAL, "      t         tests?");
+    PrintAndLogEx(NORMAL, "      b         benchmark the brute force core of every SIMD instruction set supported by this CPU");
+    PrintAndLogEx(NORMAL, "      b <name>  benchmark reading and checking the nonces stored in <name> (no card needed)");
     PrintAndLogEx(NORMAL, "      i <X>     set type of SIMD instructions. Without this flag programs autodetect it.");
     PrintAndLogEx(NORMAL, "        i 5   = AVX512");
     PrintAndLogEx(NORMAL, "        i 2   = AVX2");
     PrintAndLogEx(NORMAL, "        i a   = AVX");
     PrintAndLogEx(NORMAL, "        i s   = SSE2");
     PrintAndLogEx(NORMAL, "        i m   = MMX");
+    PrintAndLogEx(NORMAL, "        i e   = NEON (ARM)");
     PrintAndLogEx(NORMAL, "        i n   = none (use CPU regular instruction set)");
     PrintAndLogEx(NORMAL, "");
     PrintAndLogEx(NORMAL, "Examples:");
@@ -161,6 +168,8 @@ static int usage_hf14_hardnested(void) {
     PrintAndLogEx(NORMAL, "      hf mf hardnested 0 A FFFFFFFFFFFF 4 A f nonces.bin w s");
     PrintAndLogEx(NORMAL, "      hf mf hardnested r");
     PrintAndLogEx(NORMAL, "      hf mf hardnested r a0a1a2a3a4a5");
+    PrintAndLogEx(NORMAL, "      hf mf hardnested b");
+    PrintAndLogEx(NORMAL, "      hf mf hardnested b nonces.bin");
     PrintAndLogEx(NORMAL, "");
     PrintAndLogEx(NORMAL, "Add the known target key to check if it is present in the remaining key space:");
     PrintAndLogEx(NORMAL, "      hf mf hardnested 0 A A0A1A2A3A4A5 4 A FFFFFFFFFFFF");
@@ -193,6 +202,7 @@ static int usage_hf14_autopwn(void) {
     PrintAndLogEx(NORMAL, "        i a   = AVX");
     PrintAndLogEx(NORMAL, "        i s   = SSE2");
     PrintAndLogEx(NORMAL, "        i m   = MMX");
+    PrintAndLogEx(NORMAL, "        i e   = NEON (ARM)");
     PrintAndLogEx(NORMAL, "        i n   = none (use CPU regular instruction set)");
     PrintAndLogEx(NORMAL, "");
     PrintAndLogEx(NORMAL, "Examples:");
@@ -1178,10 +1188,19 @@ static int CmdHF14AMfNested(const char *Cmd) {
     bool transferToEml = false;
     bool createDumpFile = false;
 
-    if (strlen(Cmd) < 3) return usage_hf14_nested();
-
     char cmdp, ctmp;
     cmdp = tolower(param_getchar(Cmd, 0));
+    if (cmdp == 'h') return usage_hf14_nested();
+    if (cmdp == 'b') return mfnested_benchmark();
+
+    // only help and the benchmark work without a device
+    if (!IfPm3Iso14443a()) {
+        PrintAndLogEx(WARNING, "This command is " _YELLOW_("not available") " in this mode");
+        return PM3_ENOTIMPL;
+    }
+
+    if (strlen(Cmd) < 3) return usage_hf14_nested();
+
     uint8_t blockNo = param_get8(Cmd, 1);
     ctmp = tolower(param_getchar(Cmd, 2));
 
@@ -1448,6 +1467,16 @@ jumptoend:
     return PM3_SUCCESS;
 }
 
+// NEON is only built for ARM, elsewhere the NOSIMD core would run without a word
+static void SetSIMDInstrNEON(void) {
+    if (SIMDInstrSupported(SIMD_NEON)) {
+        SetSIMDInstr(SIMD_NEON);
+        return;
+    }
+    PrintAndLogEx(WARNING, "NEON is " _YELLOW_("not available") " on this build or CPU, using no SIMD");
+    SetSIMDInstr(SIMD_NONE);
+}
+
 static int CmdHF14AMfNestedHard(const char *Cmd) {
     uint8_t blockNo = 0;
     uint8_t keyType = 0;
@@ -1482,6 +1511,13 @@ static int CmdHF14AMfNestedHard(const char *Cmd) {
             }
             cmdp++;
             break;
+        case 'b':
+            if (param_getchar(Cmd, cmdp + 1) != 0x00) {
+                param_getstr(Cmd, cmdp + 1, filename, FILE_PATH_SIZE);
+                return hardnested_benchmark_nonces(filename);
+            }
+            hardnested_benchmark_simd();
+            return 0;
         case 't':
             tests = param_get32ex(Cmd, cmdp + 1, 100, 10);
             if (!param_gethex(Cmd, cmdp + 2, trgkey, 12)) {
@@ -1574,6 +1610,9 @@ static int CmdHF14AMfNestedHard(const char *Cmd) {
                     case 'm':
                         SetSIMDInstr(SIMD_MMX);
                         break;
+                    case 'e':
+                        SetSIMDInstrNEON();
+                        break;
                     case 'n':
                         SetSIMDInstr(SIMD_NONE);
                         break;
@@ -1747,6 +1786,9 @@ static int CmdHF14AMfAutoPWN(const char *Cmd) {
                     case 'm':
                         SetSIMDInstr(SIMD_MMX);
                         break;
+                    case 'e':
+                        SetSIMDInstrNEON();
+                        break;
                     case 'n':
                         SetSIMDInstr(SIMD_NONE);
                         break;
@@ -4398,7 +4440,7 @@ static command_t CommandTable[] = {
     {"help",        CmdHelp,                AlwaysAvailable, "This help"},
     {"list",        CmdHF14AMfList,         AlwaysAvailable,  "List MIFARE history"},
     {"darkside",    CmdHF14AMfDarkside,     IfPm3Iso14443a,  "Darkside attack"},
-    {"nested",      CmdHF14AMfNested,       IfPm3Iso14443a,  "Nested attack"},
+    {"nested",      CmdHF14AMfNested,       AlwaysAvailable, "Nested attack"},
     {"hardnested",  CmdHF14AMfNestedHard,   AlwaysAvailable, "Nested attack for hardened MIFARE Classic cards"},
     {"autopwn",     CmdHF14AMfAutoPWN,      IfPm3Iso14443a,  "Automatic key recovery tool for MIFARE Classic"},
 //    {"keybrute",    CmdHF14AMfKeyBrute,     IfPm3Iso14443a,  "J_Run's 2nd phase of multiple sector nested authentication key recovery"},
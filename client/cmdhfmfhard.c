@@ -38,6 +38,13 @@
 #include "zlib.h"
 #include "fileutils.h"
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #define NUM_CHECK_BITFLIPS_THREADS      (num_CPUs())
 #define NUM_REDUCTION_WORKING_THREADS   (num_CPUs())
 
@@ -45,6 +52,9 @@
 
 #define STATE_FILES_DIRECTORY           "hardnested_tables/"
 #define STATE_FILE_TEMPLATE             "bitflip_%d_%03" PRIx16 "_states.bin.z"
+#define BITFLIP_CACHE_FILE              "hardnested_tables.cache" // uncompressed bitflip tables, in the user directory
+#define BITFLIP_CACHE_MAGIC             "PM3HNBT1"
+#define BITFLIP_CACHE_DATA_OFFSET       0x10000 // keeps the tables page aligned, even with 64kB pages
 
 #define DEBUG_KEY_ELIMINATION
 // #define DEBUG_REDUCTION
@@ -74,26 +84,33 @@ static float brute_force_per_second;
 
 
 static void get_SIMD_instruction_set(char *instruction_set) {
-    switch (GetSIMDInstrAuto()) {
-        case SIMD_AVX512:
-            strcpy(instruction_set, "AVX512F");
-            break;
-        case SIMD_AVX2:
-            strcpy(instruction_set, "AVX2");
-            break;
-        case SIMD_AVX:
-            strcpy(instruction_set, "AVX");
-            break;
-        case SIMD_SSE2:
-            strcpy(instruction_set, "SSE2");
-            break;
-        case SIMD_MMX:
-            strcpy(instruction_set, "MMX");
-            break;
-        default:
-            strcpy(instruction_set, "no");
-            break;
+    strcpy(instruction_set, SIMDInstrName(GetSIMDInstrAuto()));
+}
+
+
+void hardnested_benchmark_simd(void) {
+    static const SIMDExecInstr instr_sets[] = {SIMD_AVX512, SIMD_AVX2, SIMD_AVX, SIMD_SSE2, SIMD_MMX, SIMD_NEON, SIMD_NONE};
+    SIMDExecInstr saved = GetSIMDInstrSetting();
+
+    SetSIMDInstr(SIMD_AUTO);
+    SIMDExecInstr auto_instr = GetSIMDInstrAuto();
+
+    PrintAndLogEx(INFO, "Benchmarking the brute force core using %d threads", num_CPUs());
+    PrintAndLogEx(NORMAL, " SIMD     | keys/s                  | autodetected");
+    PrintAndLogEx(NORMAL, "--------------------------------------------------");
+    for (size_t i = 0; i < ARRAYLEN(instr_sets); i++) {
+        if (!SIMDInstrSupported(instr_sets[i]))
+            continue;
+        SetSIMDInstr(instr_sets[i]);
+        float keys_per_second = brute_force_benchmark();
+        PrintAndLogEx(NORMAL, " %-8s | %6.1f million (2^%4.1f) | %s",
+                      SIMDInstrName(instr_sets[i]),
+                      keys_per_second / 1000000,
+                      log(keys_per_second) / log(2.0),
+                      instr_sets[i] == auto_instr ? "(autodetected)" : "");
     }
+
+    SetSIMDInstr(saved);
 }
 
 
@@ -232,39 +249,42 @@ static void init_inflate(z_streamp compressed_stream, uint8_t *input_buffer, uin
 }
 
 
-static void init_bitflip_bitarrays(void) {
+static char *get_bitflip_state_file_path(odd_even_t odd_even, uint16_t bitflip) {
+    char state_files_path[strlen(STATE_FILES_DIRECTORY) + strlen(STATE_FILE_TEMPLATE) + 1];
+    char state_file_name[strlen(STATE_FILE_TEMPLATE) + 1];
+    sprintf(state_file_name, STATE_FILE_TEMPLATE, odd_even, bitflip);
+    strcpy(state_files_path, STATE_FILES_DIRECTORY);
+    strcat(state_files_path, state_file_name);
+    char *path;
+    if (searchFile(&path, RESOURCES_SUBDIR, state_files_path, "", true) != PM3_SUCCESS) {
+        return NULL;
+    }
+    return path;
+}
+
+
+static void inflate_bitflip_bitarrays(char *state_file_paths[2][0x400]) {
 #if defined (DEBUG_REDUCTION)
     uint8_t line = 0;
 #endif
 
-
     z_stream compressed_stream;
 
-    char state_files_path[strlen(get_my_executable_directory()) + strlen(STATE_FILES_DIRECTORY) + strlen(STATE_FILE_TEMPLATE) + 1];
-    char state_file_name[strlen(STATE_FILE_TEMPLATE) + 1];
-
     for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
-        num_effective_bitflips[odd_even] = 0;
         for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
-            bitflip_bitarrays[odd_even][bitflip] = NULL;
-            count_bitflip_bitarrays[odd_even][bitflip] = 1 << 24;
-            sprintf(state_file_name, STATE_FILE_TEMPLATE, odd_even, bitflip);
-            strcpy(state_files_path, STATE_FILES_DIRECTORY);
-            strcat(state_files_path, state_file_name);
-            char *path;
-            if (searchFile(&path, RESOURCES_SUBDIR, state_files_path, "", true) != PM3_SUCCESS) {
+            char *path = state_file_paths[odd_even][bitflip];
+            if (path == NULL) {
                 continue;
             }
 
             FILE *statesfile = fopen(path, "rb");
-            free(path);
             if (statesfile == NULL) {
                 continue;
             } else {
                 fseek(statesfile, 0, SEEK_END);
                 int fsize = ftell(statesfile);
                 if (fsize == -1) {
-                    PrintAndLogEx(ERR, "File read error with %s. Aborting...\n", state_file_name);
+                    PrintAndLogEx(ERR, "File read error with %s. Aborting...\n", path);
                     fclose(statesfile);
                     exit(5);
                 }
@@ -273,7 +293,7 @@ static void init_bitflip_bitarrays(void) {
                 uint8_t input_buffer[filesize];
                 size_t bytesread = fread(input_buffer, 1, filesize, statesfile);
                 if (bytesread != filesize) {
-                    PrintAndLogEx(ERR, "File read error with %s. Aborting...\n", state_file_name);
+                    PrintAndLogEx(ERR, "File read error with %s. Aborting...\n", path);
                     fclose(statesfile);
                     //inflateEnd(&compressed_stream);
                     exit(5);
@@ -307,6 +327,183 @@ static void init_bitflip_bitarrays(void) {
                 inflateEnd(&compressed_stream);
             }
         }
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Cache of the uncompressed bitflip tables. The file is mapped read-only and
+// shared, so that concurrent hardnested processes use the same pages.
+//
+// layout: header, index (one entry per effective table), then at
+// BITFLIP_CACHE_DATA_OFFSET the tables, one after the other.
+//----------------------------------------------------------------------------
+#if !defined(_WIN32)
+
+typedef struct {
+    char magic[8];
+    uint64_t fingerprint;   // of the compressed state files the cache was built from
+    uint32_t num_tables;
+    uint32_t table_size;
+} bitflip_cache_header_t;
+
+typedef struct {
+    uint16_t odd_even;
+    uint16_t bitflip;
+    uint32_t count;
+} bitflip_cache_entry_t;
+
+static void *bitflip_cache_map = NULL;
+static size_t bitflip_cache_map_size = 0;
+
+static uint64_t fnv1a_64(uint64_t hash, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
+// changes whenever a state file is added, removed, or replaced
+static uint64_t get_bitflip_tables_fingerprint(char *state_file_paths[2][0x400]) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint32_t threshold = IGNORE_BITFLIP_THRESHOLD * 1000000;
+    uint32_t table_size = sizeof(uint32_t) * (1 << 19);
+    hash = fnv1a_64(hash, &threshold, sizeof(threshold));
+    hash = fnv1a_64(hash, &table_size, sizeof(table_size));
+    for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+        for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
+            struct stat st;
+            if (state_file_paths[odd_even][bitflip] == NULL || stat(state_file_paths[odd_even][bitflip], &st) != 0) {
+                continue;
+            }
+            uint64_t file_id[4] = {odd_even, bitflip, (uint64_t)st.st_size, (uint64_t)st.st_mtime};
+            hash = fnv1a_64(hash, file_id, sizeof(file_id));
+        }
+    }
+    return hash;
+}
+
+
+static bool map_bitflip_cache(const char *cache_path, uint64_t fingerprint) {
+    int fd = open(cache_path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    bitflip_cache_header_t header;
+    struct stat st;
+    if (read(fd, &header, sizeof(header)) != sizeof(header)
+            || memcmp(header.magic, BITFLIP_CACHE_MAGIC, sizeof(header.magic)) != 0
+            || header.fingerprint != fingerprint
+            || header.table_size != sizeof(uint32_t) * (1 << 19)
+            || header.num_tables > 2 * 0x400
+            || fstat(fd, &st) != 0
+            || (uint64_t)st.st_size != BITFLIP_CACHE_DATA_OFFSET + (uint64_t)header.num_tables * header.table_size) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    bitflip_cache_entry_t *index = (bitflip_cache_entry_t *)((uint8_t *)map + sizeof(header));
+    for (uint32_t i = 0; i < header.num_tables; i++) {
+        odd_even_t odd_even = index[i].odd_even & 0x01;
+        uint16_t bitflip = index[i].bitflip & 0x3ff;
+        effective_bitflip[odd_even][num_effective_bitflips[odd_even]++] = bitflip;
+        bitflip_bitarrays[odd_even][bitflip] = (uint32_t *)((uint8_t *)map + BITFLIP_CACHE_DATA_OFFSET + (size_t)i * header.table_size);
+        count_bitflip_bitarrays[odd_even][bitflip] = index[i].count;
+    }
+
+    bitflip_cache_map = map;
+    bitflip_cache_map_size = st.st_size;
+    return true;
+}
+
+
+static void write_bitflip_cache(const char *cache_path, uint64_t fingerprint) {
+    bitflip_cache_header_t header;
+    memcpy(header.magic, BITFLIP_CACHE_MAGIC, sizeof(header.magic));
+    header.fingerprint = fingerprint;
+    header.num_tables = num_effective_bitflips[EVEN_STATE] + num_effective_bitflips[ODD_STATE];
+    header.table_size = sizeof(uint32_t) * (1 << 19);
+
+    uint8_t header_block[BITFLIP_CACHE_DATA_OFFSET] = {0};
+    memcpy(header_block, &header, sizeof(header));
+    bitflip_cache_entry_t *index = (bitflip_cache_entry_t *)(header_block + sizeof(header));
+    uint32_t n = 0;
+    for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+        for (uint16_t i = 0; i < num_effective_bitflips[odd_even]; i++) {
+            uint16_t bitflip = effective_bitflip[odd_even][i];
+            index[n].odd_even = odd_even;
+            index[n].bitflip = bitflip;
+            index[n].count = count_bitflip_bitarrays[odd_even][bitflip];
+            n++;
+        }
+    }
+
+    // write to a temporary file first, other processes may be mapping the current cache
+    char tmp_path[strlen(cache_path) + 16];
+    sprintf(tmp_path, "%s.%d", cache_path, (int)getpid());
+    FILE *cachefile = fopen(tmp_path, "wb");
+    if (cachefile == NULL) {
+        return;
+    }
+    bool ok = (fwrite(header_block, 1, sizeof(header_block), cachefile) == sizeof(header_block));
+    for (odd_even_t odd_even = EVEN_STATE; ok && odd_even <= ODD_STATE; odd_even++) {
+        for (uint16_t i = 0; ok && i < num_effective_bitflips[odd_even]; i++) {
+            ok = (fwrite(bitflip_bitarrays[odd_even][effective_bitflip[odd_even][i]], 1, header.table_size, cachefile) == header.table_size);
+        }
+    }
+    ok = (fclose(cachefile) == 0) && ok;
+    if (!ok || rename(tmp_path, cache_path) != 0) {
+        PrintAndLogEx(WARNING, "Could not write bitflip tables cache %s", cache_path);
+        remove(tmp_path);
+    }
+}
+
+#endif
+
+
+static void init_bitflip_bitarrays(void) {
+    char *state_file_paths[2][0x400];
+
+    for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+        num_effective_bitflips[odd_even] = 0;
+        for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
+            bitflip_bitarrays[odd_even][bitflip] = NULL;
+            count_bitflip_bitarrays[odd_even][bitflip] = 1 << 24;
+            state_file_paths[odd_even][bitflip] = get_bitflip_state_file_path(odd_even, bitflip);
+        }
+    }
+
+#if !defined(_WIN32)
+    char *cache_path = NULL;
+    uint64_t fingerprint = get_bitflip_tables_fingerprint(state_file_paths);
+    if (searchHomeFilePath(&cache_path, BITFLIP_CACHE_FILE, true) != PM3_SUCCESS) {
+        cache_path = NULL;
+    }
+    if (cache_path == NULL || !map_bitflip_cache(cache_path, fingerprint)) {
+        inflate_bitflip_bitarrays(state_file_paths);
+        if (cache_path != NULL) {
+            write_bitflip_cache(cache_path, fingerprint);
+        }
+    }
+    free(cache_path);
+#else
+    inflate_bitflip_bitarrays(state_file_paths);
+#endif
+
+    for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+        for (uint16_t bitflip = 0x001; bitflip < 0x400; bitflip++) {
+            free(state_file_paths[odd_even][bitflip]);
+        }
         effective_bitflip[odd_even][num_effective_bitflips[odd_even]] = 0x400; // EndOfList marker
     }
 
@@ -351,6 +548,13 @@ static void init_bitflip_bitarrays(void) {
 
 
 static void free_bitflip_bitarrays(void) {
+#if !defined(_WIN32)
+    if (bitflip_cache_map != NULL) {
+        munmap(bitflip_cache_map, bitflip_cache_map_size);
+        bitflip_cache_map = NULL;
+        return;
+    }
+#endif
     for (int16_t bitflip = 0x3ff; bitflip > 0x000; bitflip--) {
         free_bitarray(bitflip_bitarrays[ODD_STATE][bitflip]);
     }
@@ -514,43 +718,25 @@ static statelist_t *candidates = NULL;
 
 static int add_nonce(uint32_t nonce_enc, uint8_t par_enc) {
     uint8_t first_byte = nonce_enc >> 24;
-    noncelistentry_t *p1 = nonces[first_byte].first;
-    noncelistentry_t *p2 = NULL;
+    uint8_t second_byte = nonce_enc >> 16;
+    noncelist_t *list = &nonces[first_byte];
 
-    if (p1 == NULL) { // first nonce with this 1st byte
+    if (list->num == 0) { // first nonce with this 1st byte
         first_byte_num++;
         first_byte_Sum += evenparity32((nonce_enc & 0xff000000) | (par_enc & 0x08));
     }
 
-    while (p1 != NULL && (p1->nonce_enc & 0x00ff0000) < (nonce_enc & 0x00ff0000)) {
-        p2 = p1;
-        p1 = p1->next;
-    }
-
-    if (p1 == NULL) {                                                          // need to add at the end of the list
-        if (p2 == NULL) {           // list is empty yet. Add first entry.
-            p2 = nonces[first_byte].first = malloc(sizeof(noncelistentry_t));
-        } else {                    // add new entry at end of existing list.
-            p2 = p2->next = malloc(sizeof(noncelistentry_t));
-        }
-    } else if ((p1->nonce_enc & 0x00ff0000) != (nonce_enc & 0x00ff0000)) {     // found distinct 2nd byte. Need to insert.
-        if (p2 == NULL) {           // need to insert at start of list
-            p2 = nonces[first_byte].first = malloc(sizeof(noncelistentry_t));
-        } else {
-            p2 = p2->next = malloc(sizeof(noncelistentry_t));
-        }
-    } else {                                                                   // we have seen this 2nd byte before. Nothing to add or insert.
+    if (has_2nd_byte(list, second_byte)) {    // we have seen this 2nd byte before. Nothing to add.
         return (0);
     }
 
-    // add or insert new data
-    p2->next = p1;
-    p2->nonce_enc = nonce_enc;
-    p2->par_enc = par_enc;
+    list->second_bytes[second_byte >> 5] |= 1U << (second_byte & 0x1f);
+    list->entry[second_byte].nonce_enc = nonce_enc;
+    list->entry[second_byte].par_enc = par_enc;
 
-    nonces[first_byte].num++;
-    nonces[first_byte].Sum += evenparity32((nonce_enc & 0x00ff0000) | (par_enc & 0x04));
-    nonces[first_byte].sum_a8_guess_dirty = true;   // indicates that we need to recalculate the Sum(a8) probability for this first byte
+    list->num++;
+    list->Sum += evenparity32((nonce_enc & 0x00ff0000) | (par_enc & 0x04));
+    list->sum_a8_guess_dirty = true;   // indicates that we need to recalculate the Sum(a8) probability for this first byte
     return (1); // new nonce added
 }
 
@@ -559,7 +745,7 @@ static void init_nonce_memory(void) {
     for (uint16_t i = 0; i < 256; i++) {
         nonces[i].num = 0;
         nonces[i].Sum = 0;
-        nonces[i].first = NULL;
+        memset(nonces[i].second_bytes, 0, sizeof(nonces[i].second_bytes));
         for (uint16_t j = 0; j < NUM_SUMS; j++) {
             nonces[i].sum_a8_guess[j].sum_a8_idx = j;
             nonces[i].sum_a8_guess[j].prob = 0.0;
@@ -590,20 +776,7 @@ static void init_nonce_memory(void) {
 }
 
 
-static void free_nonce_list(noncelistentry_t *p) {
-    if (p == NULL) {
-        return;
-    } else {
-        free_nonce_list(p->next);
-        free(p);
-    }
-}
-
-
 static void free_nonces_memory(void) {
-    for (uint16_t i = 0; i < 256; i++) {
-        free_nonce_list(nonces[i].first);
-    }
     for (int i = 255; i >= 0; i--) {
         free_bitarray(nonces[i].states_bitarray[ODD_STATE]);
         free_bitarray(nonces[i].states_bitarray[EVEN_STATE]);
@@ -1040,7 +1213,7 @@ static void estimate_sum_a8(void) {
 }
 
 
-static int read_nonce_file(char *filename) {
+static int read_nonce_file(char *filename, bool verbose) {
     FILE *fnonces = NULL;
     char progress_text[80] = "";
     uint8_t read_buf[9];
@@ -1050,8 +1223,10 @@ static int read_nonce_file(char *filename) {
         PrintAndLogEx(WARNING, "Could not open file %s", filename);
         return 1;
     }
-    snprintf(progress_text, 80, "Reading nonces from file %s...", filename);
-    hardnested_print_progress(0, progress_text, (float)(1LL << 47), 0);
+    if (verbose) {
+        snprintf(progress_text, 80, "Reading nonces from file %s...", filename);
+        hardnested_print_progress(0, progress_text, (float)(1LL << 47), 0);
+    }
     size_t bytes_read = fread(read_buf, 1, 6, fnonces);
     if (bytes_read != 6) {
         PrintAndLogEx(ERR, "File reading error.");
@@ -1074,11 +1249,13 @@ static int read_nonce_file(char *filename) {
     }
     fclose(fnonces);
 
-    char progress_string[80];
-    sprintf(progress_string, "Read %u nonces from file. cuid = %08x", num_acquired_nonces, cuid);
-    hardnested_print_progress(num_acquired_nonces, progress_string, (float)(1LL << 47), 0);
-    sprintf(progress_string, "Target Block=%d, Keytype=%c", trgBlockNo, trgKeyType == 0 ? 'A' : 'B');
-    hardnested_print_progress(num_acquired_nonces, progress_string, (float)(1LL << 47), 0);
+    if (verbose) {
+        char progress_string[80];
+        sprintf(progress_string, "Read %u nonces from file. cuid = %08x", num_acquired_nonces, cuid);
+        hardnested_print_progress(num_acquired_nonces, progress_string, (float)(1LL << 47), 0);
+        sprintf(progress_string, "Target Block=%d, Keytype=%c", trgBlockNo, trgKeyType == 0 ? 'A' : 'B');
+        hardnested_print_progress(num_acquired_nonces, progress_string, (float)(1LL << 47), 0);
+    }
 
     for (uint16_t i = 0; i < NUM_SUMS; i++) {
         if (first_byte_Sum == sums[i]) {
@@ -1091,18 +1268,6 @@ static int read_nonce_file(char *filename) {
 }
 
 
-static noncelistentry_t *SearchFor2ndByte(uint8_t b1, uint8_t b2) {
-    noncelistentry_t *p = nonces[b1].first;
-    while (p != NULL) {
-        if ((p->nonce_enc >> 16 & 0xff) == b2) {
-            return p;
-        }
-        p = p->next;
-    }
-    return NULL;
-}
-
-
 static bool timeout(void) {
     return (msclock() > last_sample_clock + sample_period);
 }
@@ -1131,9 +1296,10 @@ __attribute__((force_align_arg_pointer))
             }
             for (uint16_t i = first_byte; i <= last_byte; i++) {
                 if (nonces[i].BitFlips[bitflip] == 0 && nonces[i].BitFlips[bitflip ^ 0x100] == 0
-                        && nonces[i].first != NULL && nonces[i ^ (bitflip & 0xff)].first != NULL) {
-                    uint8_t parity1 = (nonces[i].first->par_enc) >> 3;                  // parity of first byte
-                    uint8_t parity2 = (nonces[i ^ (bitflip & 0xff)].first->par_enc) >> 3; // parity of nonce with bits flipped
+                        && nonces[i].num != 0 && nonces[i ^ (bitflip & 0xff)].num != 0) {
+                    noncelist_t *list2 = &nonces[i ^ (bitflip & 0xff)];
+                    uint8_t parity1 = nonces[i].entry[next_2nd_byte(&nonces[i], 0)].par_enc >> 3; // parity of first byte
+                    uint8_t parity2 = list2->entry[next_2nd_byte(list2, 0)].par_enc >> 3;         // parity of nonce with bits flipped
                     if ((parity1 == parity2 && !(bitflip & 0x100))          // bitflip
                             || (parity1 != parity2 && (bitflip & 0x100))) {     // not bitflip
                         nonces[i].BitFlips[bitflip] = 1;
@@ -1168,12 +1334,10 @@ __attribute__((force_align_arg_pointer))
             for (uint16_t i = first_byte; i <= last_byte; i++) {
                 // Check for Bit Flip Property of 2nd bytes
                 if (nonces[i].BitFlips[bitflip] == 0) {
-                    for (uint16_t j = 0; j < 256; j++) { // for each 2nd Byte
-                        noncelistentry_t *byte1 = SearchFor2ndByte(i, j);
-                        noncelistentry_t *byte2 = SearchFor2ndByte(i, j ^ (bitflip & 0xff));
-                        if (byte1 != NULL && byte2 != NULL) {
-                            uint8_t parity1 = byte1->par_enc >> 2 & 0x01; // parity of 2nd byte
-                            uint8_t parity2 = byte2->par_enc >> 2 & 0x01; // parity of 2nd byte with bits flipped
+                    for_each_nonce(&nonces[i], j) { // for each 2nd Byte
+                        if (has_2nd_byte(&nonces[i], j ^ (bitflip & 0xff))) {
+                            uint8_t parity1 = nonces[i].entry[j].par_enc >> 2 & 0x01;                       // parity of 2nd byte
+                            uint8_t parity2 = nonces[i].entry[j ^ (bitflip & 0xff)].par_enc >> 2 & 0x01;    // parity of 2nd byte with bits flipped
                             if ((parity1 == parity2 && !(bitflip & 0x100)) // bitflip
                                     || (parity1 != parity2 && (bitflip & 0x100))) { // not bitflip
                                 nonces[i].BitFlips[bitflip] = 1;
@@ -1249,6 +1413,63 @@ static void update_nonce_data(bool time_budget) {
 }
 
 
+#define NONCE_BENCHMARK_ROUNDS 20
+
+// replay a nonces file through the nonce store and the bitflip property checks, without a card
+int hardnested_benchmark_nonces(char *filename) {
+    uint64_t read_time = 0;
+    uint64_t check_time = 0;
+    uint32_t num_stored_nonces = 0;
+    int res = 0;
+
+    init_bitflip_bitarrays();
+    init_part_sum_bitarrays();
+    init_sum_bitarrays();
+    init_allbitflips_array();
+
+    PrintAndLogEx(INFO, "Replaying %s %d times", filename, NONCE_BENCHMARK_ROUNDS);
+    for (int round = 0; round < NONCE_BENCHMARK_ROUNDS; round++) {
+        init_nonce_memory();
+        uint64_t start = msclock();
+        if (read_nonce_file(filename, false) != 0) {
+            free_nonces_memory();
+            res = 1;
+            break;
+        }
+        read_time += msclock() - start;
+
+        // the bitflip property checks are dominated by the 2^24 bitarray operations, one pass is enough
+        if (round == 0) {
+            start = msclock();
+            hardnested_stage = CHECK_1ST_BYTES | CHECK_2ND_BYTES;
+            check_for_BitFlipProperties(false);
+            check_time = msclock() - start;
+        }
+
+        num_stored_nonces = 0;
+        for (uint16_t i = 0; i < 256; i++) {
+            num_stored_nonces += nonces[i].num;
+        }
+        free_nonces_memory();
+    }
+
+    if (res == 0) {
+        PrintAndLogEx(SUCCESS, "nonces read          : %u (%u distinct)", num_acquired_nonces, num_stored_nonces);
+        PrintAndLogEx(SUCCESS, "read nonce file      : %8.1f ms (%.1f million nonces/s)",
+                      (float)read_time / NONCE_BENCHMARK_ROUNDS,
+                      read_time == 0 ? 0.0 : (float)num_acquired_nonces * NONCE_BENCHMARK_ROUNDS / read_time / 1000.0);
+        PrintAndLogEx(SUCCESS, "bitflip properties   : %8.1f ms", (float)check_time);
+    }
+
+    free_bitflip_bitarrays();
+    free_bitarray(all_bitflips_bitarray[ODD_STATE]);
+    free_bitarray(all_bitflips_bitarray[EVEN_STATE]);
+    free_sum_bitarrays();
+    free_part_sum_bitarrays();
+    return res;
+}
+
+
 static void apply_sum_a0(void) {
     uint32_t old_count = num_all_bitflips_bitarray[EVEN_STATE];
     num_all_bitflips_bitarray[EVEN_STATE] = count_bitarray_AND(all_bitflips_bitarray[EVEN_STATE], sum_a0_bitarrays[EVEN_STATE][first_byte_Sum]);
@@ -1359,15 +1580,132 @@ static void simulate_acquire_nonces() {
 }
 
 
+//----------------------------------------------------------------------------
+// Nonce acquisition pipeline. A producer thread keeps ACQ_REQUESTS_IN_FLIGHT
+// acquisition requests queued on the device, so the radio never waits for the
+// analysis, and pushes the received batches into a single producer / single
+// consumer ring. acquire_nonces() consumes all queued batches, runs the
+// analysis once, and tells the producer to stop when the key space is small
+// enough. The mutex and condition variable are only used to sleep on an
+// empty or full ring.
+//----------------------------------------------------------------------------
+#define ACQ_REQUESTS_IN_FLIGHT  2
+#define ACQ_QUEUE_SIZE          64      // batches
+
+typedef struct {
+    uint16_t num_nonces;
+    uint64_t received;                  // msclock() when the batch arrived
+    uint8_t data[PM3_CMD_DATA_SIZE];
+} nonce_batch_t;
+
+static struct {
+    nonce_batch_t batch[ACQ_QUEUE_SIZE];
+    uint32_t head;                      // next batch to write, producer only
+    uint32_t tail;                      // next batch to read, consumer only
+    bool stop;                          // set by the consumer
+    bool done;                          // set by the producer when it doesn't deliver any more
+    int result;                         // 0, or the error which stopped the producer
+    uint8_t blockNo;
+    uint8_t keyType;
+    uint8_t trgBlockNo;
+    uint8_t trgKeyType;
+    uint8_t key[6];
+    bool slow;
+    bool running;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t sig;
+} acq = {.lock = PTHREAD_MUTEX_INITIALIZER, .sig = PTHREAD_COND_INITIALIZER};
+
+static void acq_signal(void) {
+    pthread_mutex_lock(&acq.lock);
+    pthread_cond_broadcast(&acq.sig);
+    pthread_mutex_unlock(&acq.lock);
+}
+
+static void send_acquire_nonces(uint32_t flags) {
+    flags |= acq.slow ? 0x0002 : 0;
+    SendCommandMIX(CMD_HF_MIFARE_ACQ_ENCRYPTED_NONCES, acq.blockNo + acq.keyType * 0x100, acq.trgBlockNo + acq.trgKeyType * 0x100, flags, acq.key, 6);
+}
+
+static void *acquire_nonces_thread(void *arg) {
+    reply_ticket_t tickets[ACQ_REQUESTS_IN_FLIGHT];
+    uint32_t sent = 0, received = 0;
+    int result = 0;
+
+    SubscribeReply(CMD_ACK);
+
+    while (true) {
+        bool stop = __atomic_load_n(&acq.stop, __ATOMIC_ACQUIRE);
+
+        // keep the device busy, as long as the ring has room for the answers
+        uint32_t queued = acq.head - __atomic_load_n(&acq.tail, __ATOMIC_ACQUIRE);
+        while (!stop && sent - received < ACQ_REQUESTS_IN_FLIGHT && queued + sent - received < ACQ_QUEUE_SIZE) {
+            tickets[sent % ACQ_REQUESTS_IN_FLIGHT] = ExpectReply(CMD_ACK);
+            send_acquire_nonces(0);
+            sent++;
+        }
+
+        if (sent == received) {
+            if (stop)
+                break;
+            // ring full, wait for the consumer
+            pthread_mutex_lock(&acq.lock);
+            while (!__atomic_load_n(&acq.stop, __ATOMIC_ACQUIRE) && acq.head - __atomic_load_n(&acq.tail, __ATOMIC_ACQUIRE) >= ACQ_QUEUE_SIZE)
+                pthread_cond_wait(&acq.sig, &acq.lock);
+            pthread_mutex_unlock(&acq.lock);
+            continue;
+        }
+
+        PacketResponseNG resp;
+        if (!WaitForReply(tickets[received % ACQ_REQUESTS_IN_FLIGHT], &resp, 3000)) {
+            result = 1;
+            break;
+        }
+        received++;
+        if (resp.oldarg[0]) {
+            result = resp.oldarg[0];  // error during nested_hard
+            break;
+        }
+
+        if (!stop) {
+            nonce_batch_t *batch = &acq.batch[acq.head % ACQ_QUEUE_SIZE];
+            batch->num_nonces = resp.oldarg[2];
+            batch->received = msclock();
+            memcpy(batch->data, resp.data.asBytes, sizeof(batch->data));
+            __atomic_store_n(&acq.head, acq.head + 1, __ATOMIC_RELEASE);
+            acq_signal();
+        }
+    }
+
+    UnsubscribeReply(CMD_ACK);
+
+    // switch off field. As before, the answer to this isn't waited for
+    send_acquire_nonces(0x0004);
+
+    acq.result = result;
+    __atomic_store_n(&acq.done, true, __ATOMIC_RELEASE);
+    acq_signal();
+    return NULL;
+}
+
+// waits for the producer, which may still be draining the requests in flight after acquire_nonces() returned
+static int finish_acquire_nonces(void) {
+    if (!acq.running)
+        return 0;
+    __atomic_store_n(&acq.stop, true, __ATOMIC_RELEASE);
+    acq_signal();
+    pthread_join(acq.thread, NULL);
+    acq.running = false;
+    return acq.result;
+}
+
 static int acquire_nonces(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, bool nonce_file_write, bool slow, char *filename) {
     last_sample_clock = msclock();
     sample_period = 2000; // initial rough estimate. Will be refined.
-    bool initialize = true;
-    bool field_off = false;
     hardnested_stage = CHECK_1ST_BYTES;
     bool acquisition_completed = false;
     uint8_t write_buf[9];
-    //uint32_t total_num_nonces = 0;
     float brute_force_depth;
     bool reported_suma8 = false;
     char progress_text[80];
@@ -1376,49 +1714,79 @@ static int acquire_nonces(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_
 
     num_acquired_nonces = 0;
 
-    clearCommandBuffer();
-
-    do {
-        uint32_t flags = 0;
-        flags |= initialize ? 0x0001 : 0;
-        flags |= slow ? 0x0002 : 0;
-        flags |= field_off ? 0x0004 : 0;
+    acq.blockNo = blockNo;
+    acq.keyType = keyType;
+    acq.trgBlockNo = trgBlockNo;
+    acq.trgKeyType = trgKeyType;
+    memcpy(acq.key, key, sizeof(acq.key));
+    acq.slow = slow;
 
+    // the first batch selects the card and tells us its cuid
+    clearCommandBuffer();
+    send_acquire_nonces(0x0001);
+    if (!WaitForResponseTimeout(CMD_ACK, &resp, 3000)) {
+        uint8_t nullkey[6] = {0};
+        //strange second call (iceman)
         clearCommandBuffer();
-        SendCommandMIX(CMD_HF_MIFARE_ACQ_ENCRYPTED_NONCES, blockNo + keyType * 0x100, trgBlockNo + trgKeyType * 0x100, flags, key, 6);
+        SendCommandMIX(CMD_HF_MIFARE_ACQ_ENCRYPTED_NONCES, blockNo + keyType * 0x100, trgBlockNo + trgKeyType * 0x100, 4, nullkey, sizeof(nullkey));
+        return 1;
+    }
+    if (resp.oldarg[0]) return resp.oldarg[0];  // error during nested_hard
 
-        if (field_off) break;
+    cuid = resp.oldarg[1];
+    if (nonce_file_write) {
+        if ((fnonces = fopen(filename, "wb")) == NULL) {
+            PrintAndLogEx(WARNING, "Could not create file %s", filename);
+            return 3;
+        }
+        snprintf(progress_text, 80, "Writing acquired nonces to binary file %s", filename);
+        hardnested_print_progress(0, progress_text, (float)(1LL << 47), 0);
+        num_to_bytes(cuid, 4, write_buf);
+        fwrite(write_buf, 1, 4, fnonces);
+        fwrite(&trgBlockNo, 1, 1, fnonces);
+        fwrite(&trgKeyType, 1, 1, fnonces);
+        fflush(fnonces);
+    }
+
+    // the nonces of the first batch are analysed like all others
+    acq.batch[0].num_nonces = resp.oldarg[2];
+    acq.batch[0].received = msclock();
+    memcpy(acq.batch[0].data, resp.data.asBytes, sizeof(acq.batch[0].data));
+    acq.head = 1;
+    acq.tail = 0;
+    acq.stop = false;
+    acq.done = false;
+    acq.result = 0;
+    clearCommandBuffer();
+    if (pthread_create(&acq.thread, NULL, acquire_nonces_thread, NULL) != 0) {
+        if (nonce_file_write) {
+            fclose(fnonces);
+        }
+        return 1;
+    }
+    acq.running = true;
 
-        if (initialize) {
-            if (!WaitForResponseTimeout(CMD_ACK, &resp, 3000)) {
-                uint8_t nullkey[6] = {0};
-                //strange second call (iceman)
-                clearCommandBuffer();
-                SendCommandMIX(CMD_HF_MIFARE_ACQ_ENCRYPTED_NONCES, blockNo + keyType * 0x100, trgBlockNo + trgKeyType * 0x100, 4, nullkey, sizeof(nullkey));
-                return 1;
-            }
-            if (resp.oldarg[0]) return resp.oldarg[0];  // error during nested_hard
+    while (!acquisition_completed) {
 
-            cuid = resp.oldarg[1];
-            if (nonce_file_write && fnonces == NULL) {
-                if ((fnonces = fopen(filename, "wb")) == NULL) {
-                    PrintAndLogEx(WARNING, "Could not create file %s", filename);
-                    return 3;
-                }
-                snprintf(progress_text, 80, "Writing acquired nonces to binary file %s", filename);
-                hardnested_print_progress(0, progress_text, (float)(1LL << 47), 0);
-                num_to_bytes(cuid, 4, write_buf);
-                fwrite(write_buf, 1, 4, fnonces);
-                fwrite(&trgBlockNo, 1, 1, fnonces);
-                fwrite(&trgKeyType, 1, 1, fnonces);
-                fflush(fnonces);
+        pthread_mutex_lock(&acq.lock);
+        while (__atomic_load_n(&acq.head, __ATOMIC_ACQUIRE) == acq.tail && !__atomic_load_n(&acq.done, __ATOMIC_ACQUIRE))
+            pthread_cond_wait(&acq.sig, &acq.lock);
+        pthread_mutex_unlock(&acq.lock);
+
+        uint32_t head = __atomic_load_n(&acq.head, __ATOMIC_ACQUIRE);
+        if (head == acq.tail) {
+            // the producer gave up
+            if (nonce_file_write) {
+                fclose(fnonces);
             }
+            return finish_acquire_nonces();
         }
 
-        if (!initialize) {
-            uint16_t num_sampled_nonces = resp.oldarg[2];
-            uint8_t *bufp = resp.data.asBytes;
-            for (uint16_t i = 0; i < num_sampled_nonces; i += 2) {
+        // take everything which arrived meanwhile, then analyse once
+        for (; acq.tail != head; __atomic_store_n(&acq.tail, acq.tail + 1, __ATOMIC_RELEASE)) {
+            nonce_batch_t *batch = &acq.batch[acq.tail % ACQ_QUEUE_SIZE];
+            uint8_t *bufp = batch->data;
+            for (uint16_t i = 0; i < batch->num_nonces; i += 2) {
                 uint32_t nt_enc1 = bytes_to_num(bufp, 4);
                 uint32_t nt_enc2 = bytes_to_num(bufp + 4, 4);
                 uint8_t par_enc = bytes_to_num(bufp + 8, 1);
@@ -1430,77 +1798,56 @@ static int acquire_nonces(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_
 
                 if (nonce_file_write) {
                     fwrite(bufp, 1, 9, fnonces);
-                    fflush(fnonces);
                 }
                 bufp += 9;
             }
-            //total_num_nonces += num_sampled_nonces;
-
-            if (first_byte_num == 256) {
-                if (hardnested_stage == CHECK_1ST_BYTES) {
-                    for (uint16_t i = 0; i < NUM_SUMS; i++) {
-                        if (first_byte_Sum == sums[i]) {
-                            first_byte_Sum = i;
-                            break;
-                        }
-                    }
-                    hardnested_stage |= CHECK_2ND_BYTES;
-                    apply_sum_a0();
-                }
-                update_nonce_data(true);
-                acquisition_completed = shrink_key_space(&brute_force_depth);
-                if (!reported_suma8) {
-                    char progress_string[80];
-                    sprintf(progress_string, "Apply Sum property. Sum(a0) = %d", sums[first_byte_Sum]);
-                    hardnested_print_progress(num_acquired_nonces, progress_string, brute_force_depth, 0);
-                    reported_suma8 = true;
-                } else {
-                    hardnested_print_progress(num_acquired_nonces, "Apply bit flip properties", brute_force_depth, 0);
-                }
-            } else {
-                update_nonce_data(true);
-                acquisition_completed = shrink_key_space(&brute_force_depth);
-                hardnested_print_progress(num_acquired_nonces, "Apply bit flip properties", brute_force_depth, 0);
+
+            if (batch->received - last_sample_clock < sample_period) {
+                sample_period = batch->received - last_sample_clock;
             }
+            last_sample_clock = batch->received;
         }
-
-        if (acquisition_completed) {
-            field_off = true; // switch off field with next SendCommandOLD and then finish
+        acq_signal();
+        if (nonce_file_write) {
+            fflush(fnonces);
         }
 
-        if (!initialize) {
-            if (!WaitForResponseTimeout(CMD_ACK, &resp, 3000)) {
-                if (nonce_file_write) {
-                    fclose(fnonces);
+        if (first_byte_num == 256) {
+            if (hardnested_stage == CHECK_1ST_BYTES) {
+                for (uint16_t i = 0; i < NUM_SUMS; i++) {
+                    if (first_byte_Sum == sums[i]) {
+                        first_byte_Sum = i;
+                        break;
+                    }
                 }
-                return 1;
+                hardnested_stage |= CHECK_2ND_BYTES;
+                apply_sum_a0();
             }
-            if (resp.oldarg[0]) {
-                if (nonce_file_write) {
-                    fclose(fnonces);
-                }
-                return resp.oldarg[0];  // error during nested_hard
+            update_nonce_data(true);
+            acquisition_completed = shrink_key_space(&brute_force_depth);
+            if (!reported_suma8) {
+                char progress_string[80];
+                sprintf(progress_string, "Apply Sum property. Sum(a0) = %d", sums[first_byte_Sum]);
+                hardnested_print_progress(num_acquired_nonces, progress_string, brute_force_depth, 0);
+                reported_suma8 = true;
+            } else {
+                hardnested_print_progress(num_acquired_nonces, "Apply bit flip properties", brute_force_depth, 0);
             }
+        } else {
+            update_nonce_data(true);
+            acquisition_completed = shrink_key_space(&brute_force_depth);
+            hardnested_print_progress(num_acquired_nonces, "Apply bit flip properties", brute_force_depth, 0);
         }
+    }
 
-        initialize = false;
-
-        if (msclock() - last_sample_clock < sample_period) {
-            sample_period = msclock() - last_sample_clock;
-        }
-        last_sample_clock = msclock();
-
-    } while (!acquisition_completed || field_off);
+    // the producer drains the requests still in flight and switches off the field in the background
+    __atomic_store_n(&acq.stop, true, __ATOMIC_RELEASE);
+    acq_signal();
 
     if (nonce_file_write) {
         fclose(fnonces);
     }
 
-    // PrintAndLogEx(NORMAL, "Sampled a total of %d nonces in %d seconds (%0.0f nonces/minute)",
-    // total_num_nonces,
-    // time(NULL)-time1,
-    // (float)total_num_nonces*60.0/(time(NULL)-time1));
-
     return 0;
 }
 
@@ -2049,20 +2396,185 @@ static void free_candidates_memory(statelist_t *sl) {
     free(sl);
 }
 
+static void xor_cuid(uint32_t *nonce_enc, uint8_t *par_enc) {
+    // XOR the cryptoUID and its parity. Applying it twice restores the original values.
+    *nonce_enc ^= cuid;
+    *par_enc ^= oddparity8(cuid >>  0 & 0xff) << 0;
+    *par_enc ^= oddparity8(cuid >>  8 & 0xff) << 1;
+    *par_enc ^= oddparity8(cuid >> 16 & 0xff) << 2;
+    *par_enc ^= oddparity8(cuid >> 24 & 0xff) << 3;
+}
+
 static void pre_XOR_nonces(void) {
     // prepare acquired nonces for faster brute forcing.
+    for (uint16_t i = 0; i < 256; i++) {
+        for_each_nonce(&nonces[i], j) {
+            xor_cuid(&nonces[i].entry[j].nonce_enc, &nonces[i].entry[j].par_enc);
+        }
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// session file. Holds everything needed to resume an interrupted brute force phase:
+//
+//   magic            8 bytes  SESSION_FILE_MAGIC
+//   nonces file id   session_id_t fields: uint64_t hash, uint32_t cuid, uint32_t nonces, uint8_t block, uint8_t key type
+//   cuid             uint32_t
+//   acquired nonces  uint32_t  (including duplicates)
+//   stored nonces    uint32_t  n
+//   nonces           n * (uint32_t nonce_enc, uint8_t par_enc), not XORed with cuid
+//   best_first_bytes 256 bytes
+//   Sum(a8) guess    uint8_t   index into sum_a8_guess[], or SESSION_NO_SUM_A8_GUESS
+//   expected bf      float     expected_num_brute_force of best_first_bytes[0]
+//   buckets          uint32_t  m
+//   candidates       m * (uint32_t len_odd, uint32_t len_even, len_odd * uint32_t, len_even * uint32_t)
+//   bucket done      m * uint8_t, updated in place while brute forcing
+//
+// All values are stored in host byte order.
+
+#define SESSION_FILE_MAGIC              "PM3HNSS2"
+#define SESSION_NO_SUM_A8_GUESS         0xff      // candidates were generated ignoring the Sum(a8) property
+
+// identifies the nonces file a session belongs to. A session is only resumed against the very same file.
+typedef struct {
+    uint64_t nonces_hash;       // FNV-1a of the whole nonces file
+    uint32_t cuid;
+    uint32_t num_nonces;        // nonces in the file, including duplicates
+    uint8_t trg_block;
+    uint8_t trg_key_type;
+} session_id_t;
+
+static FILE *session_file = NULL;
+static long session_bucket_done_offset = 0;
+static pthread_mutex_t session_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void session_bucket_completed(uint32_t bucket_idx) {
+    pthread_mutex_lock(&session_mutex);
+    if (session_file != NULL) {
+        uint8_t done = 1;
+        fseek(session_file, session_bucket_done_offset + bucket_idx, SEEK_SET);
+        fwrite(&done, 1, sizeof(done), session_file);
+        fflush(session_file);
+    }
+    pthread_mutex_unlock(&session_mutex);
+}
+
+static bool get_session_id(const char *nonces_filename, session_id_t *id) {
+    FILE *f = fopen(nonces_filename, "rb");
+    if (f == NULL)
+        return false;
+
+    uint8_t buf[8192];
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint64_t file_size = 0;
+    size_t bytes_read;
+    while ((bytes_read = fread(buf, 1, sizeof(buf), f)) > 0) {
+        if (file_size == 0 && bytes_read >= 6) {
+            id->cuid = bytes_to_num(buf, 4);
+            id->trg_block = buf[4];
+            id->trg_key_type = buf[5];
+        }
+        hash = fnv1a_64(hash, buf, bytes_read);
+        file_size += bytes_read;
+    }
+    bool ok = !ferror(f) && file_size >= 6;
+    fclose(f);
+
+    id->nonces_hash = hash;
+    id->num_nonces = ok ? (file_size - 6) / 9 * 2 : 0;     // same count as read_nonce_file()
+    return ok;
+}
+
+static void close_session(void) {
+    pthread_mutex_lock(&session_mutex);
+    if (session_file != NULL) {
+        fclose(session_file);
+        session_file = NULL;
+    }
+    pthread_mutex_unlock(&session_mutex);
+}
+
+static void write_session(const char *session_filename, const session_id_t *id, uint8_t sum_a8_guess, bool nonces_xored) {
+    if (session_filename == NULL || session_filename[0] == '\0')
+        return;
 
-    // XOR the cryptoUID and its parity
+    close_session();
+
+    FILE *f = fopen(session_filename, "w+b");
+    if (f == NULL) {
+        PrintAndLogEx(WARNING, "Could not create session file %s", session_filename);
+        return;
+    }
+
+    uint32_t num_stored_nonces = 0;
+    for (uint16_t i = 0; i < 256; i++) {
+        num_stored_nonces += nonces[i].num;
+    }
+
+    uint32_t num_buckets = 0;
+    for (statelist_t *sl = candidates; sl != NULL; sl = sl->next) {
+        num_buckets++;
+    }
+
+    bool ok = true;
+    ok &= fwrite(SESSION_FILE_MAGIC, 1, 8, f) == 8;
+    ok &= fwrite(&id->nonces_hash, sizeof(id->nonces_hash), 1, f) == 1;
+    ok &= fwrite(&id->cuid, sizeof(id->cuid), 1, f) == 1;
+    ok &= fwrite(&id->num_nonces, sizeof(id->num_nonces), 1, f) == 1;
+    ok &= fwrite(&id->trg_block, sizeof(id->trg_block), 1, f) == 1;
+    ok &= fwrite(&id->trg_key_type, sizeof(id->trg_key_type), 1, f) == 1;
+    ok &= fwrite(&cuid, sizeof(cuid), 1, f) == 1;
+    ok &= fwrite(&num_acquired_nonces, sizeof(num_acquired_nonces), 1, f) == 1;
+    ok &= fwrite(&num_stored_nonces, sizeof(num_stored_nonces), 1, f) == 1;
     for (uint16_t i = 0; i < 256; i++) {
-        noncelistentry_t *test_nonce = nonces[i].first;
-        while (test_nonce != NULL) {
-            test_nonce->nonce_enc ^= cuid;
-            test_nonce->par_enc ^= oddparity8(cuid >>  0 & 0xff) << 0;
-            test_nonce->par_enc ^= oddparity8(cuid >>  8 & 0xff) << 1;
-            test_nonce->par_enc ^= oddparity8(cuid >> 16 & 0xff) << 2;
-            test_nonce->par_enc ^= oddparity8(cuid >> 24 & 0xff) << 3;
-            test_nonce = test_nonce->next;
+        for_each_nonce(&nonces[i], j) {
+            uint32_t nonce_enc = nonces[i].entry[j].nonce_enc;
+            uint8_t par_enc = nonces[i].entry[j].par_enc;
+            if (nonces_xored) {
+                xor_cuid(&nonce_enc, &par_enc);
+            }
+            ok &= fwrite(&nonce_enc, sizeof(nonce_enc), 1, f) == 1;
+            ok &= fwrite(&par_enc, sizeof(par_enc), 1, f) == 1;
+        }
+    }
+    ok &= fwrite(best_first_bytes, 1, 256, f) == 256;
+    ok &= fwrite(&sum_a8_guess, sizeof(sum_a8_guess), 1, f) == 1;
+    ok &= fwrite(&nonces[best_first_bytes[0]].expected_num_brute_force, sizeof(float), 1, f) == 1;
+    ok &= fwrite(&num_buckets, sizeof(num_buckets), 1, f) == 1;
+    for (statelist_t *sl = candidates; sl != NULL; sl = sl->next) {
+        uint32_t len[2];
+        for (odd_even_t odd_even = EVEN_STATE; odd_even <= ODD_STATE; odd_even++) {
+            len[odd_even] = (sl->states[odd_even] == NULL) ? 0 : sl->len[odd_even];
         }
+        ok &= fwrite(&len[ODD_STATE], sizeof(uint32_t), 1, f) == 1;
+        ok &= fwrite(&len[EVEN_STATE], sizeof(uint32_t), 1, f) == 1;
+        ok &= fwrite(sl->states[ODD_STATE], sizeof(uint32_t), len[ODD_STATE], f) == len[ODD_STATE];
+        ok &= fwrite(sl->states[EVEN_STATE], sizeof(uint32_t), len[EVEN_STATE], f) == len[EVEN_STATE];
+    }
+    session_bucket_done_offset = ftell(f);
+    for (uint32_t i = 0; i < num_buckets; i++) {
+        uint8_t done = 0;
+        ok &= fwrite(&done, sizeof(done), 1, f) == 1;
+    }
+    ok &= fflush(f) == 0;
+
+    if (!ok) {
+        PrintAndLogEx(WARNING, "Could not write session file %s", session_filename);
+        fclose(f);
+        remove(session_filename);
+        return;
+    }
+
+    pthread_mutex_lock(&session_mutex);
+    session_file = f;
+    pthread_mutex_unlock(&session_mutex);
+}
+
+static void remove_session(const char *session_filename) {
+    close_session();
+    if (session_filename != NULL && session_filename[0] != '\0') {
+        remove(session_filename);
     }
 }
 
@@ -2070,7 +2582,150 @@ static bool brute_force(uint64_t *found_key) {
     if (known_target_key != -1) {
         TestIfKeyExists(known_target_key);
     }
-    return brute_force_bs(NULL, candidates, cuid, num_acquired_nonces, maximum_states, nonces, best_first_bytes, found_key);
+    return brute_force_bs(NULL, candidates, cuid, num_acquired_nonces, maximum_states, nonces, best_first_bytes, found_key, session_file != NULL ? session_bucket_completed : NULL);
+}
+
+// Resume the brute force phase of an interrupted run from its session file.
+// Returns false if there is no usable session, e.g. one of another nonces file than *id.
+// Otherwise brute forces the buckets which haven't been completed yet. If the key isn't
+// found and the candidates belonged to a Sum(a8) guess, *next_guess is the next guess to try.
+static bool resume_session(const char *session_filename, const session_id_t *id, uint64_t *foundkey, bool *key_found, uint8_t *next_guess) {
+    char progress_text[80];
+
+    if (session_filename == NULL || session_filename[0] == '\0')
+        return false;
+
+    FILE *f = fopen(session_filename, "r+b");
+    if (f == NULL)
+        return false;
+
+    char magic[8];
+    session_id_t session_id;
+    bool ok = true;
+
+    ok &= fread(magic, 1, 8, f) == 8 && memcmp(magic, SESSION_FILE_MAGIC, 8) == 0;
+    ok &= fread(&session_id.nonces_hash, sizeof(session_id.nonces_hash), 1, f) == 1;
+    ok &= fread(&session_id.cuid, sizeof(session_id.cuid), 1, f) == 1;
+    ok &= fread(&session_id.num_nonces, sizeof(session_id.num_nonces), 1, f) == 1;
+    ok &= fread(&session_id.trg_block, sizeof(session_id.trg_block), 1, f) == 1;
+    ok &= fread(&session_id.trg_key_type, sizeof(session_id.trg_key_type), 1, f) == 1;
+    ok &= fread(&cuid, sizeof(cuid), 1, f) == 1;
+    if (!ok
+            || session_id.nonces_hash != id->nonces_hash
+            || session_id.cuid != id->cuid
+            || session_id.num_nonces != id->num_nonces
+            || session_id.trg_block != id->trg_block
+            || session_id.trg_key_type != id->trg_key_type
+            || cuid != id->cuid) {
+        PrintAndLogEx(WARNING, "Session file %s doesn't match the nonces file. Discarding it.", session_filename);
+        fclose(f);
+        remove(session_filename);
+        return false;
+    }
+
+    init_nonce_memory();
+
+    uint32_t num_stored_nonces = 0;
+    uint8_t sum_a8_guess = 0;
+    float expected_num_brute_force = 0.0;
+    uint32_t num_buckets = 0;
+
+    ok &= fread(&num_acquired_nonces, sizeof(num_acquired_nonces), 1, f) == 1;
+    ok &= fread(&num_stored_nonces, sizeof(num_stored_nonces), 1, f) == 1;
+    for (uint32_t i = 0; ok && i < num_stored_nonces; i++) {
+        uint32_t nonce_enc;
+        uint8_t par_enc;
+        ok &= fread(&nonce_enc, sizeof(nonce_enc), 1, f) == 1;
+        ok &= fread(&par_enc, sizeof(par_enc), 1, f) == 1;
+        if (ok) {
+            add_nonce(nonce_enc, par_enc);
+        }
+    }
+    ok &= fread(best_first_bytes, 1, 256, f) == 256;
+    ok &= fread(&sum_a8_guess, sizeof(sum_a8_guess), 1, f) == 1;
+    ok &= fread(&expected_num_brute_force, sizeof(expected_num_brute_force), 1, f) == 1;
+    ok &= fread(&num_buckets, sizeof(num_buckets), 1, f) == 1;
+
+    candidates = NULL;
+    statelist_t **next_p = &candidates;
+    for (uint32_t i = 0; ok && i < num_buckets; i++) {
+        statelist_t *sl = calloc(1, sizeof(statelist_t));
+        if (sl == NULL) {
+            PrintAndLogEx(ERR, "Out of memory error in resume_session(). Aborting...\n");
+            exit(4);
+        }
+        *next_p = sl;
+        next_p = (statelist_t **)&sl->next;
+        ok &= fread(&sl->len[ODD_STATE], sizeof(uint32_t), 1, f) == 1;
+        ok &= fread(&sl->len[EVEN_STATE], sizeof(uint32_t), 1, f) == 1;
+        const odd_even_t order[2] = {ODD_STATE, EVEN_STATE};   // same order as in write_session()
+        for (uint8_t n = 0; ok && n < 2; n++) {
+            odd_even_t odd_even = order[n];
+            if (sl->len[odd_even] == 0)
+                continue;
+            sl->states[odd_even] = malloc(sl->len[odd_even] * sizeof(uint32_t));
+            if (sl->states[odd_even] == NULL) {
+                PrintAndLogEx(ERR, "Out of memory error in resume_session(). Aborting...\n");
+                exit(4);
+            }
+            ok &= fread(sl->states[odd_even], sizeof(uint32_t), sl->len[odd_even], f) == sl->len[odd_even];
+        }
+    }
+    session_bucket_done_offset = ftell(f);
+
+    // skip the buckets which have been completed already
+    uint32_t num_buckets_done = 0;
+    maximum_states = 0;
+    for (statelist_t *sl = candidates; ok && sl != NULL; sl = sl->next) {
+        uint8_t done;
+        ok &= fread(&done, sizeof(done), 1, f) == 1;
+        if (ok && done) {
+            free(sl->states[ODD_STATE]);
+            free(sl->states[EVEN_STATE]);
+            sl->states[ODD_STATE] = sl->states[EVEN_STATE] = NULL;
+            sl->len[ODD_STATE] = sl->len[EVEN_STATE] = 0;
+            num_buckets_done++;
+        }
+        maximum_states += (uint64_t)sl->len[ODD_STATE] * sl->len[EVEN_STATE];
+    }
+
+    if (!ok) {
+        PrintAndLogEx(WARNING, "Session file %s is corrupt. Ignoring it.", session_filename);
+        fclose(f);
+        for (statelist_t *sl = candidates; sl != NULL; sl = sl->next) {
+            free(sl->states[ODD_STATE]);
+            free(sl->states[EVEN_STATE]);
+        }
+        free_candidates_memory(candidates);
+        candidates = NULL;
+        free_nonces_memory();
+        num_acquired_nonces = 0;
+        return false;
+    }
+
+    snprintf(progress_text, sizeof(progress_text), "Resuming session. %u of %u buckets already done", num_buckets_done, num_buckets);
+    hardnested_print_progress(num_acquired_nonces, progress_text, expected_num_brute_force, 0);
+
+    pthread_mutex_lock(&session_mutex);
+    session_file = f;
+    pthread_mutex_unlock(&session_mutex);
+
+    nonces[best_first_bytes[0]].expected_num_brute_force = expected_num_brute_force;
+    pre_XOR_nonces();
+    prepare_bf_test_nonces(nonces, best_first_bytes[0]);
+    *key_found = brute_force(foundkey);
+
+    close_session();
+    for (statelist_t *sl = candidates; sl != NULL; sl = sl->next) {
+        free(sl->states[ODD_STATE]);
+        free(sl->states[EVEN_STATE]);
+    }
+    free_candidates_memory(candidates);
+    candidates = NULL;
+    free_nonces_memory();
+
+    *next_guess = (sum_a8_guess == SESSION_NO_SUM_A8_GUESS) ? NUM_SUMS : sum_a8_guess + 1;
+    return true;
 }
 
 static uint16_t SumProperty(struct Crypto1State *s) {
@@ -2271,6 +2926,34 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
         print_progress_header();
         sprintf(progress_text, "Brute force benchmark: %1.0f million (2^%1.1f) keys/s", brute_force_per_second / 1000000, log(brute_force_per_second) / log(2.0));
         hardnested_print_progress(0, progress_text, (float)(1LL << 47), 0);
+
+        // keep a session file next to the nonces file, to be able to resume an interrupted brute force phase
+        char session_filename[FILE_PATH_SIZE + 8] = {0};
+        if (filename != NULL && filename[0] != '\0' && (nonce_file_read || nonce_file_write)) {
+            snprintf(session_filename, sizeof(session_filename), "%s.session", filename);
+        }
+        if (nonce_file_write) {
+            remove_session(session_filename);   // new nonces. An old session is of no use.
+        }
+
+        bool key_found = false;
+        uint8_t first_guess = 0;
+        session_id_t session_id = {0};
+        if (nonce_file_read && session_filename[0] != '\0' && !get_session_id(filename, &session_id)) {
+            session_filename[0] = '\0';
+        }
+        if (nonce_file_read && session_filename[0] != '\0') {
+            known_target_key = -1;
+            bool resumed = resume_session(session_filename, &session_id, foundkey, &key_found, &first_guess);
+            if (resumed && (key_found || first_guess >= NUM_SUMS)) {
+                if (!key_found) {
+                    hardnested_print_progress(num_acquired_nonces, "Brute force phase completed. Key not found", 0.0, 0);
+                }
+                remove_session(session_filename);
+                return 0;
+            }
+        }
+
         init_bitflip_bitarrays();
         init_part_sum_bitarrays();
         init_sum_bitarrays();
@@ -2279,7 +2962,7 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
         update_reduction_rate(0.0, true);
 
         if (nonce_file_read) {  // use pre-acquired data from file nonces.bin
-            if (read_nonce_file(filename) != 0) {
+            if (read_nonce_file(filename, true) != 0) {
                 free_bitflip_bitarrays();
                 free_nonces_memory();
                 free_bitarray(all_bitflips_bitarray[ODD_STATE]);
@@ -2303,6 +2986,10 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
                 free_part_sum_bitarrays();
                 return is_OK;
             }
+            // the nonces file is complete now
+            if (session_filename[0] != '\0' && !get_session_id(filename, &session_id)) {
+                session_filename[0] = '\0';
+            }
         }
 
         if (trgkey != NULL) {
@@ -2315,7 +3002,6 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
         Tests();
 
         free_bitflip_bitarrays();
-        bool key_found = false;
         num_keys_tested = 0;
         uint32_t num_odd = nonces[best_first_byte_smallest_bitarray].num_states_bitarray[ODD_STATE];
         uint32_t num_even = nonces[best_first_byte_smallest_bitarray].num_states_bitarray[EVEN_STATE];
@@ -2337,7 +3023,9 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
             pre_XOR_nonces();
             prepare_bf_test_nonces(nonces, best_first_bytes[0]);
 
+            write_session(session_filename, &session_id, SESSION_NO_SUM_A8_GUESS, true);
             key_found = brute_force(foundkey);
+            close_session();
             free(candidates->states[ODD_STATE]);
             free(candidates->states[EVEN_STATE]);
             free_candidates_memory(candidates);
@@ -2347,7 +3035,16 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
             pre_XOR_nonces();
             prepare_bf_test_nonces(nonces, best_first_bytes[0]);
 
-            for (uint8_t j = 0; j < NUM_SUMS && !key_found; j++) {
+            // skip the Sum(a8) guesses which have been tried already in a resumed session
+            for (uint8_t j = 0; j < first_guess; j++) {
+                nonces[best_first_bytes[0]].sum_a8_guess[j].prob = 0;
+                nonces[best_first_bytes[0]].sum_a8_guess[j].num_states = 0;
+            }
+            if (first_guess > 0) {
+                update_expected_brute_force(best_first_bytes[0]);
+            }
+
+            for (uint8_t j = first_guess; j < NUM_SUMS && !key_found; j++) {
                 float expected_brute_force = nonces[best_first_bytes[0]].expected_num_brute_force;
                 sprintf(progress_text, "(%d. guess: Sum(a8) = %" PRIu16 ")", j + 1, sums[nonces[best_first_bytes[0]].sum_a8_guess[j].sum_a8_idx]);
                 hardnested_print_progress(num_acquired_nonces, progress_text, expected_brute_force, 0);
@@ -2358,7 +3055,9 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
                 }
 
                 generate_candidates(first_byte_Sum, nonces[best_first_bytes[0]].sum_a8_guess[j].sum_a8_idx);
+                write_session(session_filename, &session_id, j, true);
                 key_found = brute_force(foundkey);
+                close_session();
                 free_statelist_cache();
                 free_candidates_memory(candidates);
                 candidates = NULL;
@@ -2372,6 +3071,10 @@ int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBloc
             }
         }
 
+        // the attack is finished, no need to resume it later
+        remove_session(session_filename);
+        finish_acquire_nonces();
+
         free_nonces_memory();
         free_bitarray(all_bitflips_bitarray[ODD_STATE]);
         free_bitarray(all_bitflips_bitarray[EVEN_STATE]);
@@ -24,7 +24,6 @@ typedef struct guess_sum_a8 {
 typedef struct noncelistentry {
     uint32_t nonce_enc;
     uint8_t par_enc;
-    void *next;
 } noncelistentry_t;
 
 typedef struct noncelist {
@@ -37,10 +36,33 @@ typedef struct noncelist {
     uint32_t *states_bitarray[2];
     uint32_t num_states_bitarray[2];
     bool all_bitflips_dirty[2];
-    noncelistentry_t *first;
+    uint32_t second_bytes[8];           // bitmap of the 2nd bytes seen with this 1st byte
+    noncelistentry_t entry[256];        // indexed by 2nd byte, valid where the bitmap bit is set
 } noncelist_t;
 
+static inline bool has_2nd_byte(const noncelist_t *list, uint8_t second_byte) {
+    return (list->second_bytes[second_byte >> 5] >> (second_byte & 0x1f)) & 1;
+}
+
+// the smallest 2nd byte >= from which has been seen with this 1st byte, or 256 if there is none
+static inline uint16_t next_2nd_byte(const noncelist_t *list, uint16_t from) {
+    for (uint16_t word = from >> 5; word < 8; word++) {
+        uint32_t bits = list->second_bytes[word];
+        if (word == from >> 5)
+            bits &= 0xffffffff << (from & 0x1f);
+        if (bits != 0)
+            return (word << 5) | __builtin_ctz(bits);
+    }
+    return 256;
+}
+
+// iterate over the stored nonces of one 1st byte, in ascending order of the 2nd byte
+#define for_each_nonce(list, second_byte) \
+    for (uint16_t second_byte = next_2nd_byte(list, 0); second_byte < 256; second_byte = next_2nd_byte(list, second_byte + 1))
+
 int mfnestedhard(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *trgkey, bool nonce_file_read, bool nonce_file_write, bool slow, int tests, uint64_t *foundkey, char *filename);
+void hardnested_benchmark_simd(void);
+int hardnested_benchmark_nonces(char *filename);
 void hardnested_print_progress(uint32_t nonces, const char *activity, float brute_force, uint64_t min_diff_print_time);
 
 #endif
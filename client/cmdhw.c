@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <inttypes.h>
 
 #include "cmdparser.h"    // command_t
 #include "comms.h"
@@ -504,6 +505,15 @@ static int CmdStatus(const char *Cmd) {
     SendCommandNG(CMD_STATUS, NULL, 0);
     if (!WaitForResponseTimeout(CMD_ACK, &resp, 2000))
         PrintAndLogEx(WARNING, "Status command failed. Communication speed test timed out");
+
+    rx_queue_stats_t stats;
+    GetResponseQueueStats(&stats);
+    if (stats.packets > 0) {
+        PrintAndLogEx(NORMAL, _BLUE_("Client response queue"));
+        PrintAndLogEx(NORMAL, "  Replies handled.........%u", stats.packets);
+        PrintAndLogEx(NORMAL, "  Average time in queue...%" PRIu64 " us", stats.total_us / stats.packets);
+        PrintAndLogEx(NORMAL, "  Max time in queue.......%" PRIu64 " us", stats.max_us);
+    }
     return PM3_SUCCESS;
 }
 
@@ -14,10 +14,14 @@
 #include <string.h>
 #include <limits.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <inttypes.h>
 
 #include "cmdparser.h"    // command_t
 #include "comms.h"
 #include "commonutil.h"  // ARRAYLEN
+#include "util.h"         // num_CPUs
+#include "util_posix.h"   // usclock
 
 #include "lfdemod.h"        // device/client demods of LF signals
 #include "ui.h"             // for show graph controls
@@ -177,17 +181,21 @@ static int usage_lf_simpsk(void) {
     return PM3_SUCCESS;
 }
 static int usage_lf_find(void) {
-    PrintAndLogEx(NORMAL, "Usage:  lf search [h] <0|1> [u]");
+    PrintAndLogEx(NORMAL, "Usage:  lf search [h] <0|1> [u] [t]");
     PrintAndLogEx(NORMAL, "");
     PrintAndLogEx(NORMAL, "Options:");
     PrintAndLogEx(NORMAL, "       h             This help");
     PrintAndLogEx(NORMAL, "       <0|1>         Use data from Graphbuffer, if not set, try reading data from tag.");
     PrintAndLogEx(NORMAL, "       u             Search for Unknown tags, if not set, reads only known tags.");
+    PrintAndLogEx(NORMAL, "       t             Show time spent in each demodulator.");
+    PrintAndLogEx(NORMAL, "");
+    PrintAndLogEx(NORMAL, "All known tag demodulators run concurrently, every match is listed, best first.");
     PrintAndLogEx(NORMAL, "Examples:");
     PrintAndLogEx(NORMAL, "      lf search     = try reading data from tag & search for known tags");
     PrintAndLogEx(NORMAL, "      lf search 1   = use data from GraphBuffer & search for known tags");
     PrintAndLogEx(NORMAL, "      lf search u   = try reading data from tag & search for known and unknown tags");
     PrintAndLogEx(NORMAL, "      lf search 1 u = use data from GraphBuffer & search for known and unknown tags");
+    PrintAndLogEx(NORMAL, "      lf search 1 t = use data from GraphBuffer & show demodulator timings");
     return PM3_SUCCESS;
 }
 
@@ -1011,18 +1019,206 @@ out:
     return retval;
 }
 
+static int demodEM4x50(void) {
+    return EM4x50Read("", false);
+}
+
+// known tag demodulators `lf search` tries, in the order they win ties
+static const struct {
+    const char *name;
+    int (*demod)(void);
+} lf_search_demods[] = {
+    {"EM4x50 ID",             demodEM4x50},
+    {"HID Prox ID",           demodHID},
+    {"AWID ID",               demodAWID},
+    {"Paradox ID",            demodParadox},
+    {"EM410x ID",             demodEM410x},
+    {"FDX-B ID",              demodFDX},
+    {"Guardall G-Prox II ID", demodGuard},
+    {"Idteck ID",             demodIdteck},
+    {"Indala ID",             demodIndala},
+    {"IO Prox ID",            demodIOProx},
+    {"Jablotron ID",          demodJablotron},
+    {"NEDAP ID",              demodNedap},
+    {"NexWatch ID",           demodNexWatch},
+    {"Noralsy ID",            demodNoralsy},
+    {"KERI ID",               demodKeri},
+    {"PAC/Stanley ID",        demodPac},
+    {"Presco ID",             demodPresco},
+    {"Pyramid ID",            demodPyramid},
+    {"Securakey ID",          demodSecurakey},
+    {"Viking ID",             demodViking},
+    {"Visa2000 ID",           demodVisa2k},
+    {"Texas Instrument ID",   demodTI},
+    //{"Fermax ID",             demodFermax},
+    //{"Flex ID",               demodFlex},
+};
+
+#define LF_SEARCH_NUM_DEMODS   ARRAYLEN(lf_search_demods)
+#define LF_SEARCH_MAX_THREADS  32
+// demodulators keep several sample sized buffers on the stack
+#define LF_SEARCH_STACK_SIZE   (8 * 1024 * 1024)
+
+typedef struct {
+    int res;
+    int confidence;
+    uint64_t time_us;
+    print_capture_t output;
+} lf_search_result_t;
+
+typedef struct {
+    signal_t signal;
+    uint32_t next;
+    lf_search_result_t results[LF_SEARCH_NUM_DEMODS];
+} lf_search_t;
+
+// percentage of the bits the demodulator got right, demods without an error count are taken as clean.
+// Every warning the decoder printed (crc / parity mismatch...) costs another 20%
+static int lfSearchConfidence(const graph_state_t *state, const print_capture_t *output) {
+    int confidence = 100;
+    if (state->demod_num_bits) {
+        size_t errors = MIN((size_t)state->demod_err_cnt, state->demod_num_bits);
+        confidence -= (int)(errors * 100 / state->demod_num_bits);
+    }
+    confidence -= MIN(output->warnings, 5) * 20;
+    return MAX(confidence, 0);
+}
+
+// each demodulator runs on a fresh copy of the capture, only its output and score are kept.
+// A thread reuses one private state for all its demods, the shared one isn't touched
+static void *lfSearchThread(void *arg) {
+    lf_search_t *ls = (lf_search_t *)arg;
+    graph_state_t *state = newGraphState();
+    for (;;) {
+        uint32_t i = __atomic_fetch_add(&ls->next, 1, __ATOMIC_RELAXED);
+        if (i >= LF_SEARCH_NUM_DEMODS)
+            break;
+
+        lf_search_result_t *r = &ls->results[i];
+        r->res = PM3_EMALLOC;
+        if (state == NULL)
+            continue;
+
+        loadGraphState(state);
+        useGraphState(state);
+        *getSignalProperties() = ls->signal;
+        PrintAndLogCapture(&r->output);
+
+        uint64_t start = usclock();
+        r->res = lf_search_demods[i].demod();
+        r->time_us = usclock() - start;
+        r->confidence = lfSearchConfidence(state, &r->output);
+
+        PrintAndLogCapture(NULL);
+        useGraphState(NULL);
+    }
+    free(state);
+    return NULL;
+}
+
+typedef struct {
+    int idx;
+    int confidence;
+} lf_search_rank_t;
+
+static int lfSearchCmp(const void *a, const void *b) {
+    const lf_search_rank_t *ra = (const lf_search_rank_t *)a;
+    const lf_search_rank_t *rb = (const lf_search_rank_t *)b;
+    if (ra->confidence != rb->confidence)
+        return rb->confidence - ra->confidence;
+    return ra->idx - rb->idx;
+}
+
+// runs all known tag demodulators on the shared capture, returns number of matches, best in ranking[0]
+static int lfSearchKnown(lf_search_t *ls, lf_search_rank_t *ranking, uint64_t *wall_us) {
+    ls->signal = *getSignalProperties();
+    ls->next = 0;
+
+    int num_threads = MIN(num_CPUs(), LF_SEARCH_MAX_THREADS);
+    num_threads = MIN(num_threads, (int)LF_SEARCH_NUM_DEMODS);
+    if (num_threads < 1)
+        num_threads = 1;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, LF_SEARCH_STACK_SIZE);
+
+    uint64_t start = usclock();
+    pthread_t threads[LF_SEARCH_MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[started], &attr, lfSearchThread, ls) == 0)
+            started++;
+    }
+    // no thread at all, do the work here
+    if (started == 0)
+        lfSearchThread(ls);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_attr_destroy(&attr);
+    *wall_us = usclock() - start;
+
+    int found = 0;
+    for (int i = 0; i < (int)LF_SEARCH_NUM_DEMODS; i++) {
+        if (ls->results[i].res == PM3_SUCCESS) {
+            ranking[found].idx = i;
+            ranking[found].confidence = ls->results[i].confidence;
+            found++;
+        }
+    }
+    qsort(ranking, found, sizeof(lf_search_rank_t), lfSearchCmp);
+    return found;
+}
+
+static void lfSearchPrintTimings(const lf_search_t *ls, uint64_t wall_us) {
+    uint64_t total = 0;
+    PrintAndLogEx(INFO, "");
+    PrintAndLogEx(INFO, "demodulator              | result | time (ms)");
+    PrintAndLogEx(INFO, "-------------------------+--------+----------");
+    for (size_t i = 0; i < LF_SEARCH_NUM_DEMODS; i++) {
+        const lf_search_result_t *r = &ls->results[i];
+        PrintAndLogEx(INFO, "%-24s | %-6s | %5" PRIu64 ".%01" PRIu64
+                      , lf_search_demods[i].name
+                      , (r->res == PM3_SUCCESS) ? "match" : "-"
+                      , r->time_us / 1000
+                      , (r->time_us / 100) % 10
+                     );
+        total += r->time_us;
+    }
+    PrintAndLogEx(INFO, "-------------------------+--------+----------");
+    PrintAndLogEx(INFO, "sum of demodulators: %" PRIu64 " ms, elapsed: %" PRIu64 " ms", total / 1000, wall_us / 1000);
+}
+
 //by marshmellow
 int CmdLFfind(const char *Cmd) {
     int ans = 0;
     size_t minLength = 2000;
-    char cmdp = tolower(param_getchar(Cmd, 0));
-    char testRaw = param_getchar(Cmd, 1);
-
-    if (strlen(Cmd) > 3 || cmdp == 'h') return usage_lf_find();
-
-    if (cmdp == 'u') testRaw = 'u';
+    bool isOnline = session.pm3_present;
+    bool testRaw = false;
+    bool timings = false;
+    uint8_t cmdp = 0;
 
-    bool isOnline = (session.pm3_present && (cmdp != '1'));
+    while (param_getchar(Cmd, cmdp) != 0x00) {
+        switch (tolower(param_getchar(Cmd, cmdp))) {
+            case '1':
+                isOnline = false;
+                break;
+            case '0':
+                break;
+            case 'u':
+                testRaw = true;
+                break;
+            case 't':
+                timings = true;
+                break;
+            case 'h':
+            default:
+                return usage_lf_find();
+        }
+        cmdp++;
+    }
 
     if (isOnline)
         lf_read(true, 30000);
@@ -1054,37 +1250,69 @@ int CmdLFfind(const char *Cmd) {
         }
     }
 
-    if (EM4x50Read("", false) == PM3_SUCCESS)  { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("EM4x50 ID") "found!"); return PM3_SUCCESS;}
-
-    if (demodHID() == PM3_SUCCESS)             { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("HID Prox ID") "found!"); goto out;}
-    if (demodAWID() == PM3_SUCCESS)            { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("AWID ID") "found!"); goto out;}
-    if (demodParadox() == PM3_SUCCESS)         { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Paradox ID") "found!"); goto out;}
-
-    if (demodEM410x() == PM3_SUCCESS)          { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("EM410x ID") "found!"); goto out;}
-    if (demodFDX() == PM3_SUCCESS)             { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("FDX-B ID") "found!"); goto out;}
-    if (demodGuard() == PM3_SUCCESS)           { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Guardall G-Prox II ID") "found!"); goto out; }
-    if (demodIdteck() == PM3_SUCCESS)          { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Idteck ID") "found!"); goto out;}
-    if (demodIndala() == PM3_SUCCESS)          { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Indala ID") "found!");  goto out;}
-    if (demodIOProx() == PM3_SUCCESS)          { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("IO Prox ID") "found!"); goto out;}
-    if (demodJablotron() == PM3_SUCCESS)       { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Jablotron ID") "found!"); goto out;}
-    if (demodNedap() == PM3_SUCCESS)           { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("NEDAP ID") "found!"); goto out;}
-    if (demodNexWatch() == PM3_SUCCESS)        { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("NexWatch ID") "found!"); goto out;}
-    if (demodNoralsy() == PM3_SUCCESS)         { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Noralsy ID") "found!"); goto out;}
-    if (demodKeri() == PM3_SUCCESS)            { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("KERI ID") "found!"); goto out;}
-    if (demodPac() == PM3_SUCCESS)             { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("PAC/Stanley ID") "found!"); goto out;}
-
-    if (demodPresco() == PM3_SUCCESS)          { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Presco ID") "found!"); goto out;}
-    if (demodPyramid() == PM3_SUCCESS)         { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Pyramid ID") "found!"); goto out;}
-    if (demodSecurakey() == PM3_SUCCESS)       { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Securakey ID") "found!"); goto out;}
-    if (demodViking() == PM3_SUCCESS)          { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Viking ID") "found!"); goto out;}
-    if (demodVisa2k() == PM3_SUCCESS)          { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Visa2000 ID") "found!"); goto out;}
-    if (demodTI() == PM3_SUCCESS)              { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Texas Instrument ID") "found!"); goto out;}
-    //if (demodFermax() == PM3_SUCCESS)          { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Fermax ID") "found!"); goto out;}
-    //if (demodFlex() == PM3_SUCCESS)            { PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("Flex ID") "found!"); goto out;}
+    lf_search_t *ls = calloc(1, sizeof(lf_search_t));
+    if (ls == NULL) {
+        PrintAndLogEx(WARNING, "Failed to allocate memory");
+        return PM3_EMALLOC;
+    }
+
+    lf_search_rank_t ranking[LF_SEARCH_NUM_DEMODS];
+    uint64_t wall_us = 0;
+    int found = lfSearchKnown(ls, ranking, &wall_us);
+
+    // with debug on, show what the demods that didn't match had to say as well
+    if (g_debugMode) {
+        for (size_t i = 0; i < LF_SEARCH_NUM_DEMODS; i++) {
+            if (ls->results[i].res != PM3_SUCCESS && ls->results[i].output.len) {
+                PrintAndLogEx(DEBUG, "--- %s", lf_search_demods[i].name);
+                PrintAndLogCaptured(&ls->results[i].output);
+            }
+        }
+    }
+
+    for (int i = 0; i < found; i++) {
+        lf_search_result_t *r = &ls->results[ranking[i].idx];
+        if (i > 0)
+            PrintAndLogEx(NORMAL, "");
+        PrintAndLogCaptured(&r->output);
+        PrintAndLogEx(SUCCESS, "\nValid " _GREEN_("%s") "found!  (match %d of %d, confidence %d%%)"
+                      , lf_search_demods[ranking[i].idx].name
+                      , i + 1
+                      , found
+                      , r->confidence
+                     );
+    }
+
+    // run the best match once more on the shared samples, so they end up exactly as if it
+    // had been the only demod run. Its output was printed above already
+    bool em4x50 = false;
+    if (found) {
+        print_capture_t again = {0};
+        PrintAndLogCapture(&again);
+        lf_search_demods[ranking[0].idx].demod();
+        PrintAndLogCapture(NULL);
+        free(again.buf);
+        em4x50 = (lf_search_demods[ranking[0].idx].demod == demodEM4x50);
+    }
+
+    for (size_t i = 0; i < LF_SEARCH_NUM_DEMODS; i++) {
+        free(ls->results[i].output.buf);
+    }
+
+    if (timings)
+        lfSearchPrintTimings(ls, wall_us);
+
+    free(ls);
+
+    if (em4x50)
+        return PM3_SUCCESS;
+
+    if (found)
+        goto out;
 
     PrintAndLogEx(FAILED, _RED_("No known 125/134 kHz tags found!"));
 
-    if (testRaw == 'u') {
+    if (testRaw) {
         //test unknown tag formats (raw mode)
         PrintAndLogEx(INFO, "\nChecking for unknown tags:\n");
         ans = AutoCorrelate(GraphBuffer, GraphBuffer, GraphTraceLen, 8000, false, false);
@@ -1098,14 +1326,14 @@ int CmdLFfind(const char *Cmd) {
 
         //fsk
         if (GetFskClock("", false)) {
-            if (FSKrawDemod("", true) == PM3_SUCCESS) {
+            if (FSKDemodGraph(0, 0, 0, 0, true) == PM3_SUCCESS) {
                 PrintAndLogEx(NORMAL, "\nUnknown FSK Modulated Tag found!");
                 goto out;
             }
         }
 
         bool st = true;
-        if (ASKDemod_ext("0 0 0", true, false, 1, &st) == PM3_SUCCESS) {
+        if (ASKDemodGraph(0, 0, 0, 0, false, true, false, 1, &st) == PM3_SUCCESS) {
             PrintAndLogEx(NORMAL, "\nUnknown ASK Modulated and Manchester encoded Tag found!");
             PrintAndLogEx(NORMAL, "if it does not look right it could instead be ASK/Biphase - try " _YELLOW_("'data rawdemod ab'"));
             goto out;
@@ -1064,7 +1064,7 @@ static bool detectFSK() {
         return false;
     }
     // demod
-    int ans = FSKrawDemod("0 0", false);
+    int ans = FSKDemodGraph(0, 0, 0, 0, false);
     if (ans != PM3_SUCCESS) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - EM: FSK Demod failed");
         return false;
@@ -1080,12 +1080,12 @@ static bool detectPSK() {
     }
     //demod
     //try psk1 -- 0 0 6 (six errors?!?)
-    ans = PSKDemod("0 0 6", false);
+    ans = PSKDemodGraph(0, 0, 6, false);
     if (ans != PM3_SUCCESS) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - EM: PSK1 Demod failed");
 
         //try psk1 inverted
-        ans = PSKDemod("0 1 6", false);
+        ans = PSKDemodGraph(0, 1, 6, false);
         if (ans != PM3_SUCCESS) {
             PrintAndLogEx(DEBUG, "DEBUG: Error - EM: PSK1 inverted Demod failed");
             return false;
@@ -1098,7 +1098,7 @@ static bool detectPSK() {
 // try manchester - NOTE: ST only applies to T55x7 tags.
 static bool detectASK_MAN() {
     bool stcheck = false;
-    if (ASKDemod_ext("0 0 0", false, false, 1, &stcheck) != PM3_SUCCESS) {
+    if (ASKDemodGraph(0, 0, 0, 0, false, false, false, 1, &stcheck) != PM3_SUCCESS) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - EM: ASK/Manchester Demod failed");
         return false;
     }
@@ -1106,11 +1106,11 @@ static bool detectASK_MAN() {
 }
 
 static bool detectASK_BI() {
-    int ans = ASKbiphaseDemod("0 0 1", false);
+    int ans = ASKbiphaseDemodGraph(0, 0, 1, 50, false);
     if (ans != PM3_SUCCESS) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - EM: ASK/biphase normal demod failed");
 
-        ans = ASKbiphaseDemod("0 1 1", false);
+        ans = ASKbiphaseDemodGraph(0, 1, 1, 50, false);
         if (ans != PM3_SUCCESS) {
             PrintAndLogEx(DEBUG, "DEBUG: Error - EM: ASK/biphase inverted demod failed");
             return false;
@@ -67,7 +67,7 @@ static int CmdGuardDemod(const char *Cmd) {
 
     //Differential Biphase
     //get binary from ask wave
-    if (ASKbiphaseDemod("0 64 0 0", false) != PM3_SUCCESS) {
+    if (ASKbiphaseDemodGraph(0, 64, 0, 0, false) != PM3_SUCCESS) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - gProxII ASKbiphaseDemod failed");
         return PM3_ESOFT;
     }
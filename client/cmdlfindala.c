@@ -78,7 +78,7 @@ static int CmdIndalaDemod(const char *Cmd) {
     if (strlen(Cmd) > 0)
         ans = PSKDemod(Cmd, true);
     else
-        ans = PSKDemod("32", true);
+        ans = PSKDemodGraph(32, 0, 100, true);
 
     if (ans != PM3_SUCCESS) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - Indala can't demod signal: %d", ans);
@@ -55,7 +55,7 @@ static int usage_lf_keri_sim(void) {
 static int CmdKeriDemod(const char *Cmd) {
     (void)Cmd; // Cmd is not used so far
 
-    if (PSKDemod("", false) != PM3_SUCCESS) {
+    if (PSKDemodGraph(0, 0, 100, false) != PM3_SUCCESS) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - KERI: PSK1 Demod failed");
         return PM3_ESOFT;
     }
@@ -108,7 +108,7 @@ static int CmdLFNedapDemod(const char *Cmd) {
     uint16_t checksum, customerCode; // 12 bits
     uint32_t badgeId; // max 99999
 
-    if (ASKbiphaseDemod("0 64 1 0", false) != PM3_SUCCESS) {
+    if (ASKbiphaseDemodGraph(0, 64, 1, 0, false) != PM3_SUCCESS) {
         if (g_debugMode) PrintAndLogEx(DEBUG, "DEBUG: Error - NEDAP: ASK/Biphase Demod failed");
         return PM3_ESOFT;
     }
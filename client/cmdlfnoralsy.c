@@ -65,7 +65,7 @@ static int CmdNoralsyDemod(const char *Cmd) {
 
     //ASK / Manchester
     bool st = true;
-    if (ASKDemod_ext("32 0 0", false, false, 1, &st) != PM3_SUCCESS) {
+    if (ASKDemodGraph(32, 0, 0, 0, false, false, false, 1, &st) != PM3_SUCCESS) {
         if (g_debugMode) PrintAndLogEx(DEBUG, "DEBUG: Error - Noralsy: ASK/Manchester Demod failed");
         return PM3_ESOFT;
     }
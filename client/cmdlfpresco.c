@@ -58,7 +58,7 @@ static int usage_lf_presco_sim(void) {
 static int CmdPrescoDemod(const char *Cmd) {
     (void)Cmd; // Cmd is not used so far
     bool st = true;
-    if (ASKDemod_ext("32 0 0 0 0 a", false, false, 1, &st) != PM3_SUCCESS) {
+    if (ASKDemodGraph(32, 0, 0, 0, false, false, false, 1, &st) != PM3_SUCCESS) {
         PrintAndLogEx(DEBUG, "DEBUG: Error Presco ASKDemod failed");
         return PM3_ESOFT;
     }
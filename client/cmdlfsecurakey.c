@@ -27,7 +27,7 @@ static int CmdSecurakeyDemod(const char *Cmd) {
 
     //ASK / Manchester
     bool st = false;
-    if (ASKDemod_ext("40 0 0", false, false, 1, &st) != PM3_SUCCESS) {
+    if (ASKDemodGraph(40, 0, 0, 0, false, false, false, 1, &st) != PM3_SUCCESS) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - Securakey: ASK/Manchester Demod failed");
         return PM3_ESOFT;
     }
@@ -16,6 +16,8 @@
 
 #include <ctype.h>
 #include <time.h> // MingW
+#include <dirent.h>
+#include <pthread.h>
 
 #include "cmdparser.h"    // command_t
 #include "comms.h"
@@ -27,6 +29,7 @@
 #include "cmdhf14a.h"   // for getTagInfo
 #include "fileutils.h"  // loadDictionary
 #include "util_posix.h"
+#include "util.h"         // num_CPUs
 
 
 // Some defines for readability
@@ -202,6 +205,21 @@ static int usage_t55xx_detect() {
     PrintAndLogEx(NORMAL, "");
     return PM3_SUCCESS;
 }
+static int usage_t55xx_batchdetect() {
+    PrintAndLogEx(NORMAL, "Detect the modulation of saved configuration block captures, without a device.");
+    PrintAndLogEx(NORMAL, "Every capture is tried against all modulations, possible matches are ranked");
+    PrintAndLogEx(NORMAL, "known configuration blocks first, then by demodulation errors.");
+    PrintAndLogEx(NORMAL, "");
+    PrintAndLogEx(NORMAL, "Usage:  lf t55xx batchdetect f <file|directory> [f <file|directory> ...]");
+    PrintAndLogEx(NORMAL, "Options:");
+    PrintAndLogEx(NORMAL, "     f <file>     - capture saved with 'data save', or a directory holding .pm3 captures");
+    PrintAndLogEx(NORMAL, "");
+    PrintAndLogEx(NORMAL, "Examples:");
+    PrintAndLogEx(NORMAL, "      lf t55xx batchdetect f t55xx_block0.pm3");
+    PrintAndLogEx(NORMAL, "      lf t55xx batchdetect f audit/site1 f audit/site2");
+    PrintAndLogEx(NORMAL, "");
+    return PM3_SUCCESS;
+}
 static int usage_t55xx_detectP1() {
     PrintAndLogEx(NORMAL, "Command: Detect Page 1 of a t55xx chip");
     PrintAndLogEx(NORMAL, "Usage:  lf t55xx p1detect [1] [r <mode>] [p <password>]");
@@ -747,8 +765,6 @@ static int CmdT55xxReadBlock(const char *Cmd) {
 
 bool DecodeT55xxBlock(void) {
 
-    char buf[30] = {0x00};
-    char *cmdStr = buf;
     int ans = 0;
     bool ST = config.ST;
     uint8_t bitRate[8] = {8, 16, 32, 40, 50, 64, 100, 128};
@@ -756,29 +772,24 @@ bool DecodeT55xxBlock(void) {
 
     switch (config.modulation) {
         case DEMOD_FSK:
-            snprintf(cmdStr, sizeof(buf), "%d %d", bitRate[config.bitrate], config.inverted);
-            ans = FSKrawDemod(cmdStr, false);
+            ans = FSKDemodGraph(bitRate[config.bitrate], config.inverted, 0, 0, false);
             break;
         case DEMOD_FSK1:
         case DEMOD_FSK1a:
-            snprintf(cmdStr, sizeof(buf), "%d %d 8 5", bitRate[config.bitrate], config.inverted);
-            ans = FSKrawDemod(cmdStr, false);
+            ans = FSKDemodGraph(bitRate[config.bitrate], config.inverted, 8, 5, false);
             break;
         case DEMOD_FSK2:
         case DEMOD_FSK2a:
-            snprintf(cmdStr, sizeof(buf), "%d %d 10 8", bitRate[config.bitrate], config.inverted);
-            ans = FSKrawDemod(cmdStr, false);
+            ans = FSKDemodGraph(bitRate[config.bitrate], config.inverted, 10, 8, false);
             break;
         case DEMOD_ASK:
-            snprintf(cmdStr, sizeof(buf), "%d %d 1", bitRate[config.bitrate], config.inverted);
-            ans = ASKDemod_ext(cmdStr, false, false, 1, &ST);
+            ans = ASKDemodGraph(bitRate[config.bitrate], config.inverted, 1, 0, false, false, false, 1, &ST);
             break;
         case DEMOD_PSK1:
             // skip first 160 samples to allow antenna to settle in (psk gets inverted occasionally otherwise)
             save_restoreGB(GRAPH_SAVE);
             CmdLtrim("150");
-            snprintf(cmdStr, sizeof(buf), "%d %d 6", bitRate[config.bitrate], config.inverted);
-            ans = PSKDemod(cmdStr, false);
+            ans = PSKDemodGraph(bitRate[config.bitrate], config.inverted, 6, false);
             //undo trim samples
             save_restoreGB(GRAPH_RESTORE);
             break;
@@ -787,20 +798,17 @@ bool DecodeT55xxBlock(void) {
             // skip first 160 samples to allow antenna to settle in (psk gets inverted occasionally otherwise)
             save_restoreGB(GRAPH_SAVE);
             CmdLtrim("150");
-            snprintf(cmdStr, sizeof(buf), "%d 0 6", bitRate[config.bitrate]);
-            ans = PSKDemod(cmdStr, false);
+            ans = PSKDemodGraph(bitRate[config.bitrate], 0, 6, false);
             psk1TOpsk2(DemodBuffer, DemodBufferLen);
             //undo trim samples
             save_restoreGB(GRAPH_RESTORE);
             break;
         case DEMOD_NRZ:
-            snprintf(cmdStr, sizeof(buf), "%d %d 1", bitRate[config.bitrate], config.inverted);
-            ans = NRZrawDemod(cmdStr, false);
+            ans = NRZDemodGraph(bitRate[config.bitrate], config.inverted, 1, false);
             break;
         case DEMOD_BI:
         case DEMOD_BIa:
-            snprintf(cmdStr, sizeof(buf), "0 %d %d 1", bitRate[config.bitrate], config.inverted);
-            ans = ASKbiphaseDemod(cmdStr, false);
+            ans = ASKbiphaseDemodGraph(0, bitRate[config.bitrate], config.inverted, 1, false);
             break;
         default:
             return false;
@@ -812,7 +820,8 @@ static bool DecodeT5555TraceBlock(void) {
     DemodBufferLen = 0x00;
 
     // According to datasheet. Always: RF/64, not inverted, Manchester
-    return (ASKDemod("64 0 1", false, false, 1) == PM3_SUCCESS);
+    bool st = false;
+    return (ASKDemodGraph(64, 0, 1, 0, false, false, false, 1, &st) == PM3_SUCCESS);
 }
 
 // sanity check. Don't use proxmark if it is offline and you didn't specify useGraphbuf
@@ -918,171 +927,320 @@ static int CmdT55xxDetect(const char *Cmd) {
     return PM3_SUCCESS;
 }
 
-// detect configuration?
-bool tryDetectModulation(uint8_t downlink_mode, bool print_config) {
+// Modulation detection.
+// A capture of the configuration block is first probed for its clocks, then every
+// modulation / inversion hypothesis is demodulated and checked against the block layout.
+// The hypotheses don't depend on each other, each one runs on its own copy of the capture,
+// spread over all cores. 'lf t55xx detect' feeds one capture, 'lf t55xx batchdetect' many.
+
+typedef enum {
+    T55XX_FAMILY_FSK,
+    T55XX_FAMILY_ASK,
+    T55XX_FAMILY_NRZ,
+    T55XX_FAMILY_PSK,
+} t55xx_family_t;
+
+// in the order the old serial detection tried them, this is also the order hits are reported in
+static const struct {
+    t55xx_family_t family;
+    uint8_t mode;
+    bool inverted;
+} t55xx_hypotheses[] = {
+    {T55XX_FAMILY_FSK, DEMOD_FSK,  false},
+    {T55XX_FAMILY_FSK, DEMOD_FSK,  true},
+    {T55XX_FAMILY_ASK, DEMOD_ASK,  false},
+    {T55XX_FAMILY_ASK, DEMOD_ASK,  true},
+    {T55XX_FAMILY_ASK, DEMOD_BI,   false},
+    {T55XX_FAMILY_ASK, DEMOD_BIa,  true},
+    {T55XX_FAMILY_NRZ, DEMOD_NRZ,  false},
+    {T55XX_FAMILY_NRZ, DEMOD_NRZ,  true},
+    {T55XX_FAMILY_PSK, DEMOD_PSK1, false},
+    {T55XX_FAMILY_PSK, DEMOD_PSK1, true},
+    {T55XX_FAMILY_PSK, DEMOD_PSK2, false},
+    {T55XX_FAMILY_PSK, DEMOD_PSK3, false},
+};
 
-    t55xx_conf_block_t tests[15];
-    int bitRate = 0, clk = 0, firstClockEdge = 0;
-    uint8_t hits = 0, fc1 = 0, fc2 = 0, ans = 0;
+#define T55XX_NUM_HYPOTHESES      ARRAYLEN(t55xx_hypotheses)
+#define T55XX_DETECT_MAX_THREADS  32
+// demodulators keep several sample sized buffers on the stack
+#define T55XX_DETECT_STACK_SIZE   (8 * 1024 * 1024)
+// captures loaded at once by batchdetect
+#define T55XX_BATCH_CHUNK         64
+
+typedef struct {
+    bool hit;
+    t55xx_conf_block_t conf;
+    // demod errors / bits, used to rank hits
+    int err_cnt;
+    size_t num_bits;
+} t55xx_detect_result_t;
+
+typedef struct {
+    const char *name;
+    int *samples;
+    size_t len;
+    bool loaded;
+    signal_t signal;
+    // clocks found by the probe
+    bool fsk;
+    uint8_t fc1;
+    uint8_t fc2;
+    int fsk_clk;
+    int ask_clk;
+    int nrz_clk;
+    int psk_clk;
+    uint8_t downlink_mode;
+    t55xx_detect_result_t results[T55XX_NUM_HYPOTHESES];
+} t55xx_capture_t;
+
+typedef struct {
+    t55xx_capture_t *captures;
+    uint32_t num_captures;
+    uint32_t next;
+} t55xx_detect_job_t;
+
+// same clock probes, and same decision between FSK and the others, as the serial detection had
+static void t55xxProbeClocks(t55xx_capture_t *cap) {
+    int firstClockEdge = 0;
+    cap->fsk_clk = 0;
+    uint8_t ans = fskClocks(&cap->fc1, &cap->fc2, (uint8_t *)&cap->fsk_clk, &firstClockEdge);
+    cap->fsk = ans && ((cap->fc1 == 10 && cap->fc2 == 8) || (cap->fc1 == 8 && cap->fc2 == 5));
+    if (cap->fsk)
+        return;
 
-    ans = fskClocks(&fc1, &fc2, (uint8_t *)&clk, &firstClockEdge);
+    cap->ask_clk = GetAskClock("", false);
+    cap->nrz_clk = GetNrzClock("", false);
+    cap->psk_clk = GetPskClock("", false);
+}
 
-    if (ans && ((fc1 == 10 && fc2 == 8) || (fc1 == 8 && fc2 == 5))) {
-        if ((FSKrawDemod("0 0", false) == PM3_SUCCESS) && test(DEMOD_FSK, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-            tests[hits].modulation = DEMOD_FSK;
-            if (fc1 == 8 && fc2 == 5)
-                tests[hits].modulation = DEMOD_FSK1a;
-            else if (fc1 == 10 && fc2 == 8)
-                tests[hits].modulation = DEMOD_FSK2;
-            tests[hits].bitrate = bitRate;
-            tests[hits].inverted = false;
-            tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-            tests[hits].ST = false;
-            tests[hits].downlink_mode = downlink_mode;
-            ++hits;
-        }
-        if ((FSKrawDemod("0 1", false) == PM3_SUCCESS) && test(DEMOD_FSK, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-            tests[hits].modulation = DEMOD_FSK;
-            if (fc1 == 8 && fc2 == 5)
-                tests[hits].modulation = DEMOD_FSK1;
-            else if (fc1 == 10 && fc2 == 8)
-                tests[hits].modulation = DEMOD_FSK2a;
-            tests[hits].bitrate = bitRate;
-            tests[hits].inverted = true;
-            tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-            tests[hits].ST = false;
-            tests[hits].downlink_mode = downlink_mode;
-            ++hits;
-        }
-    } else {
-        clk = GetAskClock("", false);
-        if (clk > 0) {
-            tests[hits].ST = true;
-            // "0 0 1 " == clock auto, invert false, maxError 1.
-            // false = no verbose
-            // false = no emSearch
-            // 1 = Ask/Man
-            // st = true
-            if ((ASKDemod_ext("0 0 1", false, false, 1, &tests[hits].ST) == PM3_SUCCESS) && test(DEMOD_ASK, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_ASK;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = false;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
-            tests[hits].ST = true;
-            // "0 0 1 " == clock auto, invert true, maxError 1.
-            // false = no verbose
-            // false = no emSearch
-            // 1 = Ask/Man
-            // st = true
-            if ((ASKDemod_ext("0 1 1", false, false, 1, &tests[hits].ST) == PM3_SUCCESS) && test(DEMOD_ASK, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_ASK;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = true;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
-            if ((ASKbiphaseDemod("0 0 0 2", false) == PM3_SUCCESS) && test(DEMOD_BI, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_BI;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = false;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-                tests[hits].ST = false;
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
-            if ((ASKbiphaseDemod("0 0 1 2", false) == PM3_SUCCESS) && test(DEMOD_BIa, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_BIa;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = true;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-                tests[hits].ST = false;
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
-        }
-        clk = GetNrzClock("", false);
-        if (clk > 8) { //clock of rf/8 is likely a false positive, so don't use it.
-            if ((NRZrawDemod("0 0 1", false) == PM3_SUCCESS) && test(DEMOD_NRZ, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_NRZ;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = false;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-                tests[hits].ST = false;
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
+// copy a capture into the calling threads private graph state
+static void t55xxLoadCapture(const t55xx_capture_t *cap) {
+    memcpy(GraphBuffer, cap->samples, cap->len * sizeof(int));
+    GraphTraceLen = cap->len;
+    DemodBufferLen = 0;
+    *getSignalProperties() = cap->signal;
+}
+
+// runs hypothesis h on the capture in GraphBuffer
+static bool t55xxTryHypothesis(const t55xx_capture_t *cap, size_t h, t55xx_detect_result_t *r) {
+    t55xx_conf_block_t *c = &r->conf;
+    bool inverted = t55xx_hypotheses[h].inverted;
+    uint8_t mode = t55xx_hypotheses[h].mode;
+    int bitRate = 0, clk = 0;
+    bool ok = false;
 
-            if ((NRZrawDemod("0 1 1", false) == PM3_SUCCESS) && test(DEMOD_NRZ, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_NRZ;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = true;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-                tests[hits].ST = false;
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
+    memset(c, 0, sizeof(t55xx_conf_block_t));
+
+    switch (t55xx_hypotheses[h].family) {
+        case T55XX_FAMILY_FSK:
+            if (cap->fsk == false)
+                return false;
+
+            clk = cap->fsk_clk;
+            ok = (FSKDemodGraph(0, inverted, 0, 0, false) == PM3_SUCCESS);
+            if (cap->fc1 == 8 && cap->fc2 == 5)
+                c->modulation = (inverted) ? DEMOD_FSK1 : DEMOD_FSK1a;
+            else
+                c->modulation = (inverted) ? DEMOD_FSK2a : DEMOD_FSK2;
+            break;
+        case T55XX_FAMILY_ASK:
+            if (cap->fsk || cap->ask_clk <= 0)
+                return false;
+
+            clk = cap->ask_clk;
+            c->modulation = mode;
+            if (mode == DEMOD_ASK) {
+                // clock auto, maxError 1, no verbose, no emSearch, ask/man, check sequence terminator
+                c->ST = true;
+                ok = (ASKDemodGraph(0, inverted, 1, 0, false, false, false, 1, &c->ST) == PM3_SUCCESS);
+            } else {
+                ok = (ASKbiphaseDemodGraph(0, 0, inverted, 2, false) == PM3_SUCCESS);
             }
-        }
+            break;
+        case T55XX_FAMILY_NRZ:
+            //clock of rf/8 is likely a false positive, so don't use it.
+            if (cap->fsk || cap->nrz_clk <= 8)
+                return false;
 
-        clk = GetPskClock("", false);
-        if (clk > 0) {
-            // allow undo
-            save_restoreGB(GRAPH_SAVE);
+            clk = cap->nrz_clk;
+            c->modulation = mode;
+            ok = (NRZDemodGraph(0, inverted, 1, false) == PM3_SUCCESS);
+            break;
+        case T55XX_FAMILY_PSK:
+            if (cap->fsk || cap->psk_clk <= 0)
+                return false;
+
+            clk = cap->psk_clk;
+            c->modulation = mode;
             // skip first 160 samples to allow antenna to settle in (psk gets inverted occasionally otherwise)
             CmdLtrim("160");
-            if ((PSKDemod("0 0 6", false) == PM3_SUCCESS) && test(DEMOD_PSK1, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_PSK1;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = false;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-                tests[hits].ST = false;
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
-            if ((PSKDemod("0 1 6", false) == PM3_SUCCESS) && test(DEMOD_PSK1, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                tests[hits].modulation = DEMOD_PSK1;
-                tests[hits].bitrate = bitRate;
-                tests[hits].inverted = true;
-                tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-                tests[hits].ST = false;
-                tests[hits].downlink_mode = downlink_mode;
-                ++hits;
-            }
-            //ICEMAN: are these PSKDemod calls needed?
-            // PSK2 - needs a call to psk1TOpsk2.
-            if (PSKDemod("0 0 6", false) == PM3_SUCCESS) {
-                psk1TOpsk2(DemodBuffer, DemodBufferLen);
-                if (test(DEMOD_PSK2, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                    tests[hits].modulation = DEMOD_PSK2;
-                    tests[hits].bitrate = bitRate;
-                    tests[hits].inverted = false;
-                    tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-                    tests[hits].ST = false;
-                    tests[hits].downlink_mode = downlink_mode;
-                    ++hits;
-                }
-            } // inverse waves does not affect this demod
-            // PSK3 - needs a call to psk1TOpsk2.
-            if (PSKDemod("0 0 6", false) == PM3_SUCCESS) {
+            ok = (PSKDemodGraph(0, inverted, 6, false) == PM3_SUCCESS);
+            // PSK2 / PSK3 - needs a call to psk1TOpsk2. inverse waves does not affect this demod
+            if (ok && mode != DEMOD_PSK1)
                 psk1TOpsk2(DemodBuffer, DemodBufferLen);
-                if (test(DEMOD_PSK3, &tests[hits].offset, &bitRate, clk, &tests[hits].Q5)) {
-                    tests[hits].modulation = DEMOD_PSK3;
-                    tests[hits].bitrate = bitRate;
-                    tests[hits].inverted = false;
-                    tests[hits].block0 = PackBits(tests[hits].offset, 32, DemodBuffer);
-                    tests[hits].ST = false;
-                    tests[hits].downlink_mode = downlink_mode;
-                    ++hits;
-                }
-            } // inverse waves does not affect this demod
-            //undo trim samples
-            save_restoreGB(GRAPH_RESTORE);
+            break;
+    }
+
+    if (ok == false || test(mode, &c->offset, &bitRate, clk, &c->Q5) == false)
+        return false;
+
+    c->bitrate = bitRate;
+    c->inverted = inverted;
+    c->block0 = PackBits(c->offset, 32, DemodBuffer);
+    c->downlink_mode = cap->downlink_mode;
+    r->err_cnt = g_graph_state->demod_err_cnt;
+    r->num_bits = g_graph_state->demod_num_bits;
+    return true;
+}
+
+// load, normalise (like 'data load') and probe one capture file per work item
+static void *t55xxProbeThread(void *arg) {
+    t55xx_detect_job_t *job = (t55xx_detect_job_t *)arg;
+    graph_state_t *state = newGraphState();
+    if (state == NULL)
+        return NULL;
+    useGraphState(state);
+
+    for (;;) {
+        uint32_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->num_captures)
+            break;
+
+        t55xx_capture_t *cap = &job->captures[i];
+        size_t len = 0;
+        if (loadSampleFile(cap->name, GraphBuffer, MAX_GRAPH_TRACE_LEN, &len) != PM3_SUCCESS || len == 0)
+            continue;
+        GraphTraceLen = len;
+
+        uint8_t bits[GraphTraceLen];
+        size_t size = getFromGraphBuf(bits);
+        removeSignalOffset(bits, size);
+        setGraphBuf(bits, size);
+        computeSignalProperties(bits, size);
+
+        cap->samples = calloc(GraphTraceLen, sizeof(int));
+        if (cap->samples == NULL)
+            continue;
+        memcpy(cap->samples, GraphBuffer, GraphTraceLen * sizeof(int));
+        cap->len = GraphTraceLen;
+        cap->signal = *getSignalProperties();
+
+        t55xxProbeClocks(cap);
+        cap->loaded = true;
+    }
+
+    useGraphState(NULL);
+    free(state);
+    return NULL;
+}
+
+// one work item per capture and hypothesis
+static void *t55xxDetectThread(void *arg) {
+    t55xx_detect_job_t *job = (t55xx_detect_job_t *)arg;
+    graph_state_t *state = newGraphState();
+    if (state == NULL)
+        return NULL;
+    useGraphState(state);
+
+    uint32_t items = job->num_captures * T55XX_NUM_HYPOTHESES;
+    for (;;) {
+        uint32_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= items)
+            break;
+
+        t55xx_capture_t *cap = &job->captures[i / T55XX_NUM_HYPOTHESES];
+        size_t h = i % T55XX_NUM_HYPOTHESES;
+        if (cap->loaded == false)
+            continue;
+
+        t55xxLoadCapture(cap);
+        cap->results[h].hit = t55xxTryHypothesis(cap, h, &cap->results[h]);
+    }
+
+    useGraphState(NULL);
+    free(state);
+    return NULL;
+}
+
+// demodulate hypothesis h of the capture once more and leave its bits in the shared DemodBuffer,
+// where the serial detection left the detected block
+static void t55xxPublishHit(const t55xx_capture_t *cap, size_t h) {
+    graph_state_t *state = newGraphState();
+    if (state == NULL)
+        return;
+
+    t55xx_detect_result_t r;
+    useGraphState(state);
+    t55xxLoadCapture(cap);
+    bool hit = t55xxTryHypothesis(cap, h, &r);
+    useGraphState(NULL);
+
+    if (hit)
+        publishDemodBuffer(state);
+    free(state);
+}
+
+static void t55xxRunJob(t55xx_detect_job_t *job, void *(*worker)(void *), uint32_t items) {
+    job->next = 0;
+
+    int num_threads = MIN(num_CPUs(), T55XX_DETECT_MAX_THREADS);
+    num_threads = MIN(num_threads, (int)items);
+    if (num_threads < 1)
+        num_threads = 1;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, T55XX_DETECT_STACK_SIZE);
+
+    pthread_t threads[T55XX_DETECT_MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[started], &attr, worker, job) == 0)
+            started++;
+    }
+    // no thread at all, do the work here
+    if (started == 0)
+        worker(job);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// detect configuration?
+bool tryDetectModulation(uint8_t downlink_mode, bool print_config) {
+
+    t55xx_capture_t *cap = calloc(1, sizeof(t55xx_capture_t));
+    if (cap == NULL) {
+        PrintAndLogEx(WARNING, "failed to allocate memory");
+        return false;
+    }
+
+    // the probe trims GraphBuffer in place, as it always did
+    t55xxProbeClocks(cap);
+    cap->samples = GraphBuffer;
+    cap->len = GraphTraceLen;
+    cap->signal = *getSignalProperties();
+    cap->downlink_mode = downlink_mode;
+    cap->loaded = true;
+
+    t55xx_detect_job_t job = { .captures = cap, .num_captures = 1 };
+    t55xxRunJob(&job, t55xxDetectThread, T55XX_NUM_HYPOTHESES);
+
+    t55xx_conf_block_t tests[T55XX_NUM_HYPOTHESES];
+    size_t tests_h[T55XX_NUM_HYPOTHESES];
+    uint8_t hits = 0;
+    for (size_t h = 0; h < T55XX_NUM_HYPOTHESES; h++) {
+        if (cap->results[h].hit) {
+            tests_h[hits] = h;
+            tests[hits++] = cap->results[h].conf;
         }
     }
+
     if (hits == 1) {
+        t55xxPublishHit(cap, tests_h[0]);
+        free(cap);
         config.modulation = tests[0].modulation;
         config.bitrate = tests[0].bitrate;
         config.inverted = tests[0].inverted;
@@ -1099,12 +1257,14 @@ bool tryDetectModulation(uint8_t downlink_mode, bool print_config) {
     }
 
     bool retval = false;
+    int selected = -1;
     if (hits > 1) {
         PrintAndLogEx(SUCCESS, "Found [%d] possible matches for modulation.", hits);
         for (int i = 0; i < hits; ++i) {
             retval = testKnownConfigBlock(tests[i].block0);
             if (retval) {
                 PrintAndLogEx(NORMAL, "--[%d]--------------- << selected this", i + 1);
+                selected = i;
                 config.modulation = tests[i].modulation;
                 config.bitrate = tests[i].bitrate;
                 config.inverted = tests[i].inverted;
@@ -1121,9 +1281,201 @@ bool tryDetectModulation(uint8_t downlink_mode, bool print_config) {
 			    printConfiguration(tests[i]);
         }
     }
+    if (selected >= 0)
+        t55xxPublishHit(cap, tests_h[selected]);
+    free(cap);
     return retval;
 }
 
+typedef struct {
+    size_t idx;
+    bool known;
+    uint32_t err_rate;
+} t55xx_rank_t;
+
+// known configuration blocks first, then fewest demod errors, then hypothesis order
+static int t55xxRankCmp(const void *a, const void *b) {
+    const t55xx_rank_t *ra = (const t55xx_rank_t *)a;
+    const t55xx_rank_t *rb = (const t55xx_rank_t *)b;
+    if (ra->known != rb->known)
+        return (ra->known) ? -1 : 1;
+    if (ra->err_rate != rb->err_rate)
+        return (ra->err_rate < rb->err_rate) ? -1 : 1;
+    return (ra->idx < rb->idx) ? -1 : (ra->idx > rb->idx);
+}
+
+// ranked hits of one capture, returns number of hits
+static size_t t55xxPrintCapture(const t55xx_capture_t *cap) {
+    if (cap->loaded == false) {
+        PrintAndLogEx(WARNING, "%s : " _RED_("could not load"), cap->name);
+        return 0;
+    }
+
+    t55xx_rank_t rank[T55XX_NUM_HYPOTHESES];
+    size_t hits = 0;
+    for (size_t h = 0; h < T55XX_NUM_HYPOTHESES; h++) {
+        const t55xx_detect_result_t *r = &cap->results[h];
+        if (r->hit == false)
+            continue;
+        rank[hits].idx = h;
+        rank[hits].known = testKnownConfigBlock(r->conf.block0);
+        rank[hits].err_rate = (r->num_bits) ? (uint32_t)((uint64_t)MIN((size_t)r->err_cnt, r->num_bits) * 10000 / r->num_bits) : 0;
+        hits++;
+    }
+
+    if (hits == 0) {
+        PrintAndLogEx(INFO, "%s : no configuration block found", cap->name);
+        return 0;
+    }
+    qsort(rank, hits, sizeof(t55xx_rank_t), t55xxRankCmp);
+
+    PrintAndLogEx(SUCCESS, "%s : %zu possible match%s", cap->name, hits, (hits > 1) ? "es" : "");
+    for (size_t i = 0; i < hits; i++) {
+        const t55xx_conf_block_t *c = &cap->results[rank[i].idx].conf;
+        PrintAndLogEx(NORMAL, "  %2zu | %-10s | %-10s | %-3s | %3u | %-5s | %-3s | %08X | %-5s | %3u.%02u%%"
+                      , i + 1
+                      , GetSelectedModulationStr(c->modulation)
+                      , GetBitRateStr(c->bitrate, (c->block0 & T55x7_X_MODE && (c->block0 >> 28 == 6 || c->block0 >> 28 == 9)))
+                      , (c->inverted) ? "yes" : "no"
+                      , c->offset
+                      , (c->Q5) ? "T5555" : "T55x7"
+                      , (c->ST) ? "yes" : "no"
+                      , c->block0
+                      , (rank[i].known) ? "known" : ""
+                      , rank[i].err_rate / 100
+                      , rank[i].err_rate % 100
+                     );
+    }
+    return hits;
+}
+
+static int t55xxNameCmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// adds a file, or all .pm3 files of a directory, to the list
+static int t55xxAddCaptures(const char *path, char ***names, size_t *count) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        char **tmp = realloc(*names, (*count + 1) * sizeof(char *));
+        char *name = calloc(strlen(path) + 1, sizeof(char));
+        if (tmp == NULL || name == NULL) {
+            free(name);
+            if (tmp)
+                *names = tmp;
+            return PM3_EMALLOC;
+        }
+        strcpy(name, path);
+        *names = tmp;
+        (*names)[(*count)++] = name;
+        return PM3_SUCCESS;
+    }
+
+    size_t first = *count;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (str_endswith(ent->d_name, ".pm3") == false)
+            continue;
+
+        char **tmp = realloc(*names, (*count + 1) * sizeof(char *));
+        char *name = calloc(strlen(path) + strlen(ent->d_name) + 2, sizeof(char));
+        if (tmp == NULL || name == NULL) {
+            free(name);
+            if (tmp)
+                *names = tmp;
+            closedir(dir);
+            return PM3_EMALLOC;
+        }
+        sprintf(name, "%s/%s", path, ent->d_name);
+        *names = tmp;
+        (*names)[(*count)++] = name;
+    }
+    closedir(dir);
+
+    qsort(*names + first, *count - first, sizeof(char *), t55xxNameCmp);
+    return PM3_SUCCESS;
+}
+
+static int CmdT55xxBatchDetect(const char *Cmd) {
+    char **names = NULL;
+    size_t count = 0;
+    uint8_t cmdp = 0;
+    bool errors = false;
+    int res = PM3_SUCCESS;
+
+    while (param_getchar(Cmd, cmdp) != 0x00 && !errors) {
+        switch (tolower(param_getchar(Cmd, cmdp))) {
+            case 'h':
+                errors = true;
+                break;
+            case 'f': {
+                char path[FILE_PATH_SIZE] = {0};
+                if (param_getstr(Cmd, cmdp + 1, path, sizeof(path)) == 0) {
+                    PrintAndLogEx(WARNING, "missing file or directory name");
+                    errors = true;
+                    break;
+                }
+                if (t55xxAddCaptures(path, &names, &count) != PM3_SUCCESS) {
+                    PrintAndLogEx(WARNING, "failed to allocate memory");
+                    errors = true;
+                }
+                cmdp += 2;
+                break;
+            }
+            default:
+                PrintAndLogEx(WARNING, "Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+                errors = true;
+                break;
+        }
+    }
+
+    if (errors || count == 0) {
+        res = (errors) ? PM3_EINVARG : PM3_SUCCESS;
+        usage_t55xx_batchdetect();
+        goto out;
+    }
+
+    t55xx_capture_t *caps = calloc(MIN(count, T55XX_BATCH_CHUNK), sizeof(t55xx_capture_t));
+    if (caps == NULL) {
+        PrintAndLogEx(WARNING, "failed to allocate memory");
+        res = PM3_EMALLOC;
+        goto out;
+    }
+
+    PrintAndLogEx(INFO, "detecting %zu capture%s", count, (count > 1) ? "s" : "");
+    PrintAndLogEx(NORMAL, "   # | modulation | bit rate   | inv | ofs | chip  | ST  | block0   | known | errors");
+
+    size_t detected = 0;
+    uint64_t t1 = msclock();
+    for (size_t start = 0; start < count; start += T55XX_BATCH_CHUNK) {
+        uint32_t n = MIN(count - start, T55XX_BATCH_CHUNK);
+        memset(caps, 0, n * sizeof(t55xx_capture_t));
+        for (uint32_t i = 0; i < n; i++)
+            caps[i].name = names[start + i];
+
+        t55xx_detect_job_t job = { .captures = caps, .num_captures = n };
+        t55xxRunJob(&job, t55xxProbeThread, n);
+        t55xxRunJob(&job, t55xxDetectThread, n * T55XX_NUM_HYPOTHESES);
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (t55xxPrintCapture(&caps[i]))
+                detected++;
+            free(caps[i].samples);
+        }
+    }
+    t1 = msclock() - t1;
+    free(caps);
+
+    PrintAndLogEx(NORMAL, "");
+    PrintAndLogEx(SUCCESS, "configuration detected in " _YELLOW_("%zu") " of %zu captures, %" PRIu64 " ms", detected, count, t1);
+
+out:
+    for (size_t i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+    return res;
+}
+
 bool testKnownConfigBlock(uint32_t block0) {
     switch (block0) {
         case T55X7_DEFAULT_CONFIG_BLOCK:
@@ -2822,12 +3174,12 @@ bool tryDetectP1(bool getData) {
     // try fsk clock detect. if successful it cannot be any other type of modulation...  (in theory...)
     ans = fskClocks(&fc1, &fc2, (uint8_t *)&clk, &firstClockEdge);
     if (ans && ((fc1 == 10 && fc2 == 8) || (fc1 == 8 && fc2 == 5))) {
-        if ((FSKrawDemod("0 0", false) == PM3_SUCCESS) &&
+        if ((FSKDemodGraph(0, 0, 0, 0, false) == PM3_SUCCESS) &&
                 preambleSearchEx(DemodBuffer, preamble, sizeof(preamble), &DemodBufferLen, &startIdx, false) &&
                 (DemodBufferLen == 32 || DemodBufferLen == 64)) {
             return true;
         }
-        if ((FSKrawDemod("0 1", false) == PM3_SUCCESS) &&
+        if ((FSKDemodGraph(0, 1, 0, 0, false) == PM3_SUCCESS) &&
                 preambleSearchEx(DemodBuffer, preamble, sizeof(preamble), &DemodBufferLen, &startIdx, false) &&
                 (DemodBufferLen == 32 || DemodBufferLen == 64)) {
             return true;
@@ -2838,26 +3190,26 @@ bool tryDetectP1(bool getData) {
     // try ask clock detect.  it could be another type even if successful.
     clk = GetAskClock("", false);
     if (clk > 0) {
-        if ((ASKDemod_ext("0 0 1", false, false, 1, &st) == PM3_SUCCESS) &&
+        if ((ASKDemodGraph(0, 0, 1, 0, false, false, false, 1, &st) == PM3_SUCCESS) &&
                 preambleSearchEx(DemodBuffer, preamble, sizeof(preamble), &DemodBufferLen, &startIdx, false) &&
                 (DemodBufferLen == 32 || DemodBufferLen == 64)) {
             return true;
         }
 
         st = true;
-        if ((ASKDemod_ext("0 1 1", false, false, 1, &st) == PM3_SUCCESS) &&
+        if ((ASKDemodGraph(0, 1, 1, 0, false, false, false, 1, &st) == PM3_SUCCESS) &&
                 preambleSearchEx(DemodBuffer, preamble, sizeof(preamble), &DemodBufferLen, &startIdx, false) &&
                 (DemodBufferLen == 32 || DemodBufferLen == 64)) {
             return true;
         }
 
-        if ((ASKbiphaseDemod("0 0 0 2", false) == PM3_SUCCESS) &&
+        if ((ASKbiphaseDemodGraph(0, 0, 0, 2, false) == PM3_SUCCESS) &&
                 preambleSearchEx(DemodBuffer, preamble, sizeof(preamble), &DemodBufferLen, &startIdx, false) &&
                 (DemodBufferLen == 32 || DemodBufferLen == 64)) {
             return true;
         }
 
-        if ((ASKbiphaseDemod("0 0 1 2", false) == PM3_SUCCESS) &&
+        if ((ASKbiphaseDemodGraph(0, 0, 1, 2, false) == PM3_SUCCESS) &&
                 preambleSearchEx(DemodBuffer, preamble, sizeof(preamble), &DemodBufferLen, &startIdx, false) &&
                 (DemodBufferLen == 32 || DemodBufferLen == 64)) {
             return true;
@@ -2867,12 +3219,12 @@ bool tryDetectP1(bool getData) {
     // try NRZ clock detect.  it could be another type even if successful.
     clk = GetNrzClock("", false); //has the most false positives :(
     if (clk > 0) {
-        if ((NRZrawDemod("0 0 1", false) == PM3_SUCCESS) &&
+        if ((NRZDemodGraph(0, 0, 1, false) == PM3_SUCCESS) &&
                 preambleSearchEx(DemodBuffer, preamble, sizeof(preamble), &DemodBufferLen, &startIdx, false) &&
                 (DemodBufferLen == 32 || DemodBufferLen == 64)) {
             return true;
         }
-        if ((NRZrawDemod("0 1 1", false) == PM3_SUCCESS)  &&
+        if ((NRZDemodGraph(0, 1, 1, false) == PM3_SUCCESS)  &&
                 preambleSearchEx(DemodBuffer, preamble, sizeof(preamble), &DemodBufferLen, &startIdx, false) &&
                 (DemodBufferLen == 32 || DemodBufferLen == 64)) {
             return true;
@@ -2887,20 +3239,20 @@ bool tryDetectP1(bool getData) {
         // save_restoreGB(GRAPH_SAVE);
         // skip first 160 samples to allow antenna to settle in (psk gets inverted occasionally otherwise)
         //CmdLtrim("160");
-        if ((PSKDemod("0 0 6", false) == PM3_SUCCESS) &&
+        if ((PSKDemodGraph(0, 0, 6, false) == PM3_SUCCESS) &&
                 preambleSearchEx(DemodBuffer, preamble, sizeof(preamble), &DemodBufferLen, &startIdx, false) &&
                 (DemodBufferLen == 32 || DemodBufferLen == 64)) {
             //save_restoreGB(GRAPH_RESTORE);
             return true;
         }
-        if ((PSKDemod("0 1 6", false) == PM3_SUCCESS) &&
+        if ((PSKDemodGraph(0, 1, 6, false) == PM3_SUCCESS) &&
                 preambleSearchEx(DemodBuffer, preamble, sizeof(preamble), &DemodBufferLen, &startIdx, false) &&
                 (DemodBufferLen == 32 || DemodBufferLen == 64)) {
             //save_restoreGB(GRAPH_RESTORE);
             return true;
         }
         // PSK2 - needs a call to psk1TOpsk2.
-        if (PSKDemod("0 0 6", false) == PM3_SUCCESS) {
+        if (PSKDemodGraph(0, 0, 6, false) == PM3_SUCCESS) {
             psk1TOpsk2(DemodBuffer, DemodBufferLen);
             if (preambleSearchEx(DemodBuffer, preamble, sizeof(preamble), &DemodBufferLen, &startIdx, false) &&
                     (DemodBufferLen == 32 || DemodBufferLen == 64)) {
@@ -3166,6 +3518,7 @@ static int CmdT55xxProtect(const char *Cmd) {
 
 static command_t CommandTable[] = {
     {"help",         CmdHelp,                 AlwaysAvailable, "This help"},
+    {"batchdetect",  CmdT55xxBatchDetect,     AlwaysAvailable, "f <file|dir> Detect the modulation of saved captures, in bulk"},
     {"bruteforce",   CmdT55xxBruteForce,      IfPm3Lf,         "<start password> <end password> Simple bruteforce attack to find password"},
     {"config",       CmdT55xxSetConfig,       AlwaysAvailable, "Set/Get T55XX configuration (modulation, inverted, offset, rate)"},
     {"chk",          CmdT55xxChkPwds,         IfPm3Lf,         "Check passwords from dictionary/flash"},
@@ -90,7 +90,7 @@ static int CmdVisa2kDemod(const char *Cmd) {
 
     //ASK / Manchester
     bool st = true;
-    if (ASKDemod_ext("64 0 0", false, false, 1, &st) != PM3_SUCCESS) {
+    if (ASKDemodGraph(64, 0, 0, 0, false, false, false, 1, &st) != PM3_SUCCESS) {
         PrintAndLogEx(DEBUG, "DEBUG: Error - Visa2k: ASK/Manchester Demod failed");
         save_restoreGB(GRAPH_RESTORE);
         return PM3_ESOFT;
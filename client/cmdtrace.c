@@ -7,9 +7,17 @@
 //-----------------------------------------------------------------------------
 // Trace commands
 //-----------------------------------------------------------------------------
+// ensure fileno and posix_madvise are available even with -std=c99; must be included before
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200112L
+#endif
 #include "cmdtrace.h"
 
 #include <ctype.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 #include "cmdparser.h"    // command_t
 #include "protocols.h"
@@ -17,20 +25,53 @@
 #include "cmdhflist.h"          // annotations
 #include "comms.h"              // for sending cmds to device. GetFromBigBuf
 #include "fileutils.h"          // for saveFile
+#include "util_posix.h"         // msclock
 
 static int CmdHelp(const char *Cmd);
 
 // trace pointer
 static uint8_t *trace;
-long traceLen = 0;
+static size_t traceLen = 0;
+
+// Trace files, version 2: a header, the records exactly as the device logs them,
+// then optionally an index with the offset of every index_stride'th record so a
+// listing can start anywhere without walking the records before it.
+// Files without the header are version 1, a plain copy of the device trace buffer.
+#define TRACE_FILE_MAGIC        "PM3TRACE"
+#define TRACE_FILE_VERSION      2
+#define TRACE_FILE_HAS_INDEX    0x0001
+#define TRACE_INDEX_STRIDE      256
+
+typedef struct {
+    uint8_t magic[8];
+    uint16_t version;
+    uint16_t flags;
+    uint32_t index_stride;      // records per index entry
+    uint64_t data_len;          // bytes of records after the header
+    uint64_t record_count;
+    uint64_t index_count;       // uint64_t record offsets after the records
+} PACKED trace_file_header_t;
+
+// timestamp, duration, data_len (msb set for responses)
+#define TRACE_RECORD_HDR_LEN    (sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint16_t))
+
+// a loaded trace file is mapped as a whole, trace then points at its records
+static uint8_t *trace_map = NULL;
+static size_t trace_map_len = 0;
+static bool trace_mapped = false;
+static const uint8_t *trace_index = NULL;
+static uint64_t trace_index_count = 0;
+static uint32_t trace_index_stride = 0;
 
 static int usage_trace_list() {
     PrintAndLogEx(NORMAL, "List protocol data in trace buffer.");
-    PrintAndLogEx(NORMAL, "Usage:  trace list <protocol> [f][c| <0|1>");
+    PrintAndLogEx(NORMAL, "Usage:  trace list <protocol> [f][c][s <n>][n <n>]| <0|1>");
     PrintAndLogEx(NORMAL, "    f      - show frame delay times as well");
     PrintAndLogEx(NORMAL, "    c      - mark CRC bytes");
     PrintAndLogEx(NORMAL, "    x      - show hexdump to convert to pcap(ng) or to import into Wireshark using encapsulation type \"ISO 14443\"");
     PrintAndLogEx(NORMAL, "             syntax to use: `text2pcap -t \"%%S.\" -l 264 -n <input-text-file> <output-pcapng-file>`");
+    PrintAndLogEx(NORMAL, "    s <n>  - skip the first <n> records");
+    PrintAndLogEx(NORMAL, "    n <n>  - list at most <n> records");
     PrintAndLogEx(NORMAL, "    <0|1>  - use data from Tracebuffer, if not set, try reading data from tag.");
     PrintAndLogEx(NORMAL, "Supported <protocol> values:");
     PrintAndLogEx(NORMAL, "    raw      - just show raw data without annotations");
@@ -50,10 +91,12 @@ static int usage_trace_list() {
     PrintAndLogEx(NORMAL, "Examples:");
     PrintAndLogEx(NORMAL, "        trace list 14a f");
     PrintAndLogEx(NORMAL, "        trace list iclass");
+    PrintAndLogEx(NORMAL, "        trace list 14a 1 s 100000 n 50");
     return 0;
 }
 static int usage_trace_load() {
     PrintAndLogEx(NORMAL, "Load protocol data from file to trace buffer.");
+    PrintAndLogEx(NORMAL, "The file is mapped into memory, not read, so traces of any size can be listed.");
     PrintAndLogEx(NORMAL, "Usage:  trace load <filename>");
     PrintAndLogEx(NORMAL, "Examples:");
     PrintAndLogEx(NORMAL, "        trace load mytracefile.bin");
@@ -61,22 +104,92 @@ static int usage_trace_load() {
 }
 static int usage_trace_save() {
     PrintAndLogEx(NORMAL, "Save protocol data from trace buffer to file.");
-    PrintAndLogEx(NORMAL, "Usage:  trace save <filename>");
+    PrintAndLogEx(NORMAL, "The file has a header and an index of the records, older clients can't load it.");
+    PrintAndLogEx(NORMAL, "Usage:  trace save <filename> [o]");
+    PrintAndLogEx(NORMAL, "    o      - old format (v1), just the trace buffer, no header or index");
     PrintAndLogEx(NORMAL, "Examples:");
     PrintAndLogEx(NORMAL, "        trace save mytracefile.bin");
+    PrintAndLogEx(NORMAL, "        trace save mytracefile.bin o");
     return 0;
 }
 
-static bool is_last_record(uint16_t tracepos, uint8_t *trace, uint16_t traceLen) {
+static int usage_trace_export() {
+    PrintAndLogEx(NORMAL, "Export protocol data from trace buffer to a pcapng file, one packet per trace record.");
+    PrintAndLogEx(NORMAL, "Timestamps are converted to ns, the direction is kept in the packet flags.");
+    PrintAndLogEx(NORMAL, "Usage:  trace export <protocol> <filename> [r][a] <0|1>");
+    PrintAndLogEx(NORMAL, "    r      - raw packets for all protocols, see below");
+    PrintAndLogEx(NORMAL, "    a      - append to the file as a new section, e.g. after each sniff");
+    PrintAndLogEx(NORMAL, "    <0|1>  - use data from Tracebuffer, if not set, try reading data from tag.");
+    PrintAndLogEx(NORMAL, "<protocol> as for trace list, except felica.");
+    PrintAndLogEx(NORMAL, "14a, mf, des, topaz and thinfilm are written as link type 264 (ISO 14443), which Wireshark decodes.");
+    PrintAndLogEx(NORMAL, "Other protocols use link type 147 + 1 + protocol number (147 for raw). Their packets hold the");
+    PrintAndLogEx(NORMAL, "trace record without the timestamp: duration (u16), data length (u16, msb set for tag");
+    PrintAndLogEx(NORMAL, "responses), data and parity bytes, little endian.");
+    PrintAndLogEx(NORMAL, "Examples:");
+    PrintAndLogEx(NORMAL, "        trace export 14a mysniff.pcapng");
+    PrintAndLogEx(NORMAL, "        trace export 15 mysniff.pcapng a");
+    return 0;
+}
+
+static size_t next_record(size_t tracepos, uint8_t *trace, size_t traceLen) {
+    if (tracepos + TRACE_RECORD_HDR_LEN > traceLen) return traceLen;
+    uint16_t data_len = *((uint16_t *)(trace + tracepos + sizeof(uint32_t) + sizeof(uint16_t))) & 0x7FFF;
+    uint16_t parity_len = (data_len - 1) / 8 + 1;
+    tracepos += TRACE_RECORD_HDR_LEN + data_len + parity_len;
+    return (tracepos > traceLen) ? traceLen : tracepos;
+}
+
+// offset of record number <record>, or traceLen if there are fewer records
+static size_t seek_record(uint64_t record) {
+    size_t tracepos = 0;
+    uint64_t n = 0;
+    if (trace_index_stride && trace_index_count && record >= trace_index_stride) {
+        uint64_t slot = record / trace_index_stride;
+        if (slot >= trace_index_count)
+            slot = trace_index_count - 1;
+        uint64_t offset;
+        memcpy(&offset, trace_index + slot * sizeof(uint64_t), sizeof(offset));
+        if (offset < traceLen) {
+            tracepos = offset;
+            n = slot * trace_index_stride;
+        }
+    }
+    for (; n < record && tracepos < traceLen; n++)
+        tracepos = next_record(tracepos, trace, traceLen);
+    return tracepos;
+}
+
+static void trace_free(void) {
+    if (trace_map) {
+#ifndef _WIN32
+        if (trace_mapped)
+            munmap(trace_map, trace_map_len);
+        else
+#endif
+            free(trace_map);
+    } else {
+        free(trace);
+    }
+    trace = NULL;
+    traceLen = 0;
+    trace_map = NULL;
+    trace_map_len = 0;
+    trace_mapped = false;
+    trace_index = NULL;
+    trace_index_count = 0;
+    trace_index_stride = 0;
+}
+
+static bool is_last_record(size_t tracepos, uint8_t *trace, size_t traceLen) {
     return (tracepos + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint16_t) >= traceLen);
 }
 
-static bool next_record_is_response(uint16_t tracepos, uint8_t *trace) {
+static bool next_record_is_response(size_t tracepos, uint8_t *trace) {
     uint16_t next_records_datalen = *((uint16_t *)(trace + tracepos + sizeof(uint32_t) + sizeof(uint16_t)));
     return ((next_records_datalen & 0x8000) == 0x8000);
 }
 
-static bool merge_topaz_reader_frames(uint32_t timestamp, uint32_t *duration, uint16_t *tracepos, uint16_t traceLen,
+static bool merge_topaz_reader_frames(uint32_t timestamp, uint32_t *duration, size_t *tracepos, size_t traceLen,
                                       uint8_t *trace, uint8_t *frame, uint8_t *topaz_reader_command, uint16_t *data_len) {
 
 #define MAX_TOPAZ_READER_CMD_LEN 16
@@ -114,7 +227,7 @@ static bool merge_topaz_reader_frames(uint32_t timestamp, uint32_t *duration, ui
     return true;
 }
 
-static uint16_t printHexLine(uint16_t tracepos, uint16_t traceLen, uint8_t *trace, uint8_t protocol) {
+static size_t printHexLine(size_t tracepos, size_t traceLen, uint8_t *trace, uint8_t protocol) {
     // sanity check
     if (tracepos + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint16_t) > traceLen) return traceLen;
 
@@ -197,7 +310,7 @@ static uint16_t printHexLine(uint16_t tracepos, uint16_t traceLen, uint8_t *trac
     return tracepos;
 }
 
-static uint16_t printTraceLine(uint16_t tracepos, uint16_t traceLen, uint8_t *trace, uint8_t protocol, bool showWaitCycles, bool markCRCBytes) {
+static size_t printTraceLine(size_t tracepos, size_t traceLen, uint8_t *trace, uint8_t protocol, bool showWaitCycles, bool markCRCBytes) {
     // sanity check
     if (tracepos + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint16_t) > traceLen) return traceLen;
 
@@ -422,12 +535,14 @@ static uint16_t printTraceLine(uint16_t tracepos, uint16_t traceLen, uint8_t *tr
     return tracepos;
 }
 
-static void printFelica(uint16_t traceLen, uint8_t *trace) {
+// FeliCa records have their own layout, the index doesn't apply. Skips <skip> records, lists at most <limit>
+static void printFelica(size_t traceLen, uint8_t *trace, uint64_t skip, uint64_t limit) {
 
     PrintAndLogEx(NORMAL, "ISO18092 / FeliCa - Timings are not as accurate");
     PrintAndLogEx(NORMAL, "    Gap | Src | Data                            | CRC      | Annotation        |");
     PrintAndLogEx(NORMAL, "--------|-----|---------------------------------|----------|-------------------|");
-    uint16_t tracepos = 0;
+    size_t tracepos = 0;
+    uint64_t record = 0;
 
     while (tracepos < traceLen) {
 
@@ -447,6 +562,12 @@ static void printFelica(uint16_t traceLen, uint8_t *trace) {
 
         if (tracepos + len + 1 >= traceLen) break;
 
+        if (record++ < skip) {
+            tracepos += len + 1;
+            continue;
+        }
+        if (record - skip > limit) break;
+
         uint8_t cmd = trace[tracepos];
         uint8_t isResponse = cmd & 1;
 
@@ -622,6 +743,241 @@ static int SanityOfflineCheck( bool useTraceBuffer ){
 }
 */
 
+// pcapng export.  Records are written as they are walked, nothing is formatted,
+// so export() can be fed a trace buffer piece by piece.
+#define PCAPNG_SHB                  0x0A0D0D0A
+#define PCAPNG_IDB                  0x00000001
+#define PCAPNG_EPB                  0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC     0x1A2B3C4D
+#define PCAPNG_OPT_ENDOFOPT         0
+#define PCAPNG_OPT_SHB_USERAPPL     4
+#define PCAPNG_OPT_IF_NAME          2
+#define PCAPNG_OPT_IF_DESCRIPTION   3
+#define PCAPNG_OPT_IF_TSRESOL       9
+#define PCAPNG_OPT_EPB_FLAGS        2
+#define PCAPNG_EPB_INBOUND          0x00000001
+#define PCAPNG_EPB_OUTBOUND         0x00000002
+
+#define LINKTYPE_ISO_14443          264
+#define LINKTYPE_USER0              147
+
+typedef struct {
+    FILE *f;
+    bool iso14443;          // LINKTYPE_ISO_14443 pseudo header, else raw records
+    uint32_t tick_ps;       // duration of a trace timestamp tick
+    uint32_t last_ts;
+    uint64_t ts_wraps;      // the 32 bit trace timestamps wrap during long sniffs
+    uint64_t records;
+    bool error;
+} pcapng_t;
+
+// pads an option or block part to 32 bits
+#define PCAPNG_PAD(n)   (((n) + 3) & ~3)
+
+static size_t pcapng_opt(uint8_t *p, uint16_t code, const void *value, uint16_t len) {
+    memcpy(p, &code, 2);
+    memcpy(p + 2, &len, 2);
+    memset(p + 4, 0, PCAPNG_PAD(len));
+    memcpy(p + 4, value, len);
+    return 4 + PCAPNG_PAD(len);
+}
+
+static bool pcapng_block(FILE *f, uint32_t type, uint8_t *block, size_t len) {
+    // type and length at both ends were left free by the caller
+    uint32_t total = len + 12;
+    memcpy(block, &type, 4);
+    memcpy(block + 4, &total, 4);
+    memcpy(block + 8 + len, &total, 4);
+    return fwrite(block, 1, total, f) == total;
+}
+
+static bool pcapng_start(pcapng_t *pc, uint8_t protocol, bool raw) {
+    uint8_t block[256];
+    size_t len = 0;
+
+    // section header
+    uint32_t magic = PCAPNG_BYTE_ORDER_MAGIC;
+    uint16_t major = 1, minor = 0;
+    int64_t section_len = -1;
+    memcpy(block + 8, &magic, 4);
+    memcpy(block + 12, &major, 2);
+    memcpy(block + 14, &minor, 2);
+    memcpy(block + 16, &section_len, 8);
+    len = 16;
+    len += pcapng_opt(block + 8 + len, PCAPNG_OPT_SHB_USERAPPL, "proxmark3", 9);
+    len += pcapng_opt(block + 8 + len, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    if (!pcapng_block(pc->f, PCAPNG_SHB, block, len)) {
+        pc->error = true;
+        return false;
+    }
+
+    const char *name;
+    switch (protocol) {
+        case ISO_14443A:   name = "ISO14443A"; break;
+        case PROTO_MIFARE: name = "ISO14443A / MIFARE"; break;
+        case MFDES:        name = "ISO14443A / DESFire"; break;
+        case TOPAZ:        name = "Topaz"; break;
+        case THINFILM:     name = "Thinfilm"; break;
+        case ISO_14443B:   name = "ISO14443B"; break;
+        case ISO_7816_4:   name = "ISO7816-4"; break;
+        case ISO_15693:    name = "ISO15693"; break;
+        case ICLASS:       name = "iClass"; break;
+        case LEGIC:        name = "LEGIC"; break;
+        case PROTO_HITAG:  name = "Hitag2 / HitagS"; break;
+        default:           name = "raw"; break;
+    }
+    pc->iso14443 = !raw && (protocol == ISO_14443A || protocol == PROTO_MIFARE || protocol == MFDES
+                            || protocol == TOPAZ || protocol == THINFILM);
+    uint16_t linktype = pc->iso14443 ? LINKTYPE_ISO_14443 : LINKTYPE_USER0 + (uint8_t)(protocol + 1);
+
+    // timestamps are in carrier periods (1/13.56MHz) unless stated otherwise in trace list
+    const char *unit = "1/13.56MHz carrier periods";
+    pc->tick_ps = 73746;
+    if (protocol == LEGIC) {
+        unit = "LEGIC ticks (1us == 1.5ticks)";
+        pc->tick_ps = 666667;
+    } else if (protocol == PROTO_HITAG) {
+        unit = "Hitag ETU (8us)";
+        pc->tick_ps = 8000000;
+    }
+
+    // interface description
+    char desc[100];
+    snprintf(desc, sizeof(desc), "%s trace, timestamps converted from %s", name, unit);
+    uint16_t reserved = 0;
+    uint32_t snaplen = 0;
+    uint8_t tsresol = 9;
+    memcpy(block + 8, &linktype, 2);
+    memcpy(block + 10, &reserved, 2);
+    memcpy(block + 12, &snaplen, 4);
+    len = 8;
+    len += pcapng_opt(block + 8 + len, PCAPNG_OPT_IF_NAME, "proxmark3", 9);
+    len += pcapng_opt(block + 8 + len, PCAPNG_OPT_IF_DESCRIPTION, desc, strlen(desc));
+    len += pcapng_opt(block + 8 + len, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+    len += pcapng_opt(block + 8 + len, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    if (!pcapng_block(pc->f, PCAPNG_IDB, block, len)) {
+        pc->error = true;
+        return false;
+    }
+
+    pc->last_ts = 0;
+    pc->ts_wraps = 0;
+    pc->records = 0;
+    pc->error = false;
+    return true;
+}
+
+// writes the complete records in trace[0..traceLen), returns the offset after the last one written
+static size_t pcapng_export(pcapng_t *pc, uint8_t *trace, size_t traceLen) {
+    // header, pseudo header or duration and length, data and parity (up to 0x7fff + 0x1000 bytes), options
+    static uint8_t block[8 + 20 + 4 + 0x7FFF + 0x1000 + 3 + 12 + 4 + 4];
+    size_t tracepos = 0;
+
+    while (tracepos + TRACE_RECORD_HDR_LEN <= traceLen) {
+        uint8_t *rec = trace + tracepos;
+        uint32_t timestamp;
+        uint16_t data_len;
+        memcpy(&timestamp, rec, 4);
+        memcpy(&data_len, rec + 6, 2);
+        bool isResponse = data_len & 0x8000;
+        data_len &= 0x7FFF;
+        uint16_t parity_len = (data_len - 1) / 8 + 1;
+        size_t next = tracepos + TRACE_RECORD_HDR_LEN + data_len + parity_len;
+        if (next > traceLen)
+            break;
+
+        if (pc->records && timestamp < pc->last_ts && pc->last_ts - timestamp > 0x80000000)
+            pc->ts_wraps++;
+        pc->last_ts = timestamp;
+        uint64_t ts = (((pc->ts_wraps << 32) | timestamp) * pc->tick_ps) / 1000;
+
+        uint8_t *p = block + 8 + 20;
+        uint32_t caplen;
+        if (pc->iso14443) {
+            // version, event (Rdr: 0xfe, Tag: 0xff), length (big endian), data
+            p[0] = 0x00;
+            p[1] = isResponse ? 0xff : 0xfe;
+            p[2] = data_len >> 8;
+            p[3] = data_len & 0xff;
+            memcpy(p + 4, rec + TRACE_RECORD_HDR_LEN, data_len);
+            caplen = 4 + data_len;
+        } else {
+            // the record without its timestamp
+            caplen = next - tracepos - sizeof(uint32_t);
+            memcpy(p, rec + sizeof(uint32_t), caplen);
+        }
+        memset(p + caplen, 0, PCAPNG_PAD(caplen) - caplen);
+
+        uint32_t hdr[5] = { 0, ts >> 32, ts & 0xFFFFFFFF, caplen, caplen };
+        memcpy(block + 8, hdr, sizeof(hdr));
+        size_t len = 20 + PCAPNG_PAD(caplen);
+        uint32_t flags = isResponse ? PCAPNG_EPB_INBOUND : PCAPNG_EPB_OUTBOUND;
+        len += pcapng_opt(block + 8 + len, PCAPNG_OPT_EPB_FLAGS, &flags, 4);
+        len += pcapng_opt(block + 8 + len, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+        if (!pcapng_block(pc->f, PCAPNG_EPB, block, len)) {
+            pc->error = true;
+            break;
+        }
+
+        pc->records++;
+        tracepos = next;
+    }
+    return tracepos;
+}
+
+static bool get_protocol(const char *type, uint8_t *protocol) {
+    if (strcmp(type,      "iclass") == 0)   *protocol = ICLASS;
+    else if (strcmp(type, "14a") == 0)      *protocol = ISO_14443A;
+    else if (strcmp(type, "14b") == 0)      *protocol = ISO_14443B;
+    else if (strcmp(type, "topaz") == 0)    *protocol = TOPAZ;
+    else if (strcmp(type, "7816") == 0)     *protocol = ISO_7816_4;
+    else if (strcmp(type, "des") == 0)      *protocol = MFDES;
+    else if (strcmp(type, "legic") == 0)    *protocol = LEGIC;
+    else if (strcmp(type, "15") == 0)       *protocol = ISO_15693;
+    else if (strcmp(type, "felica") == 0)   *protocol = FELICA;
+    else if (strcmp(type, "mf") == 0)       *protocol = PROTO_MIFARE;
+    else if (strcmp(type, "hitag") == 0)    *protocol = PROTO_HITAG;
+    else if (strcmp(type, "thinfilm") == 0) *protocol = THINFILM;
+    else if (strcmp(type, "raw") == 0)      *protocol = -1; //No crc, no annotations
+    else return false;
+    return true;
+}
+
+// fetch the trace buffer from the device, replacing a loaded trace
+static int download_trace(void) {
+    trace_free();
+    trace = calloc(PM3_CMD_DATA_SIZE, sizeof(uint8_t));
+    if (trace == NULL) {
+        PrintAndLogEx(FAILED, "Cannot allocate memory for trace");
+        return 2;
+    }
+
+    // Query for the size of the trace,  downloading PM3_CMD_DATA_SIZE
+    PacketResponseNG response;
+    if (!GetFromDevice(BIG_BUF, trace, PM3_CMD_DATA_SIZE, 0, NULL, 0, &response, 4000, true)) {
+        PrintAndLogEx(WARNING, "timeout while waiting for reply.");
+        trace_free();
+        return 1;
+    }
+
+    traceLen = response.oldarg[2];
+    if (traceLen > PM3_CMD_DATA_SIZE) {
+        uint8_t *p = realloc(trace, traceLen);
+        if (p == NULL) {
+            PrintAndLogEx(FAILED, "Cannot allocate memory for trace");
+            trace_free();
+            return 2;
+        }
+        trace = p;
+        if (!GetFromDevice(BIG_BUF, trace, traceLen, 0, NULL, 0, NULL, 2500, false)) {
+            PrintAndLogEx(WARNING, "command execution time out");
+            trace_free();
+            return 3;
+        }
+    }
+    return 0;
+}
+
 static int CmdTraceLoad(const char *Cmd) {
 
     FILE *f = NULL;
@@ -636,36 +992,76 @@ static int CmdTraceLoad(const char *Cmd) {
         return 0;
     }
 
-    // get filesize in order to malloc memory
-    fseek(f, 0, SEEK_END);
-    long fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    if (fsize < 0) {
+    // get filesize in order to map the file
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || st.st_size < 0) {
         PrintAndLogEx(FAILED, "error, when getting filesize");
         fclose(f);
         return 3;
     }
-    if (fsize < 4) {
+    if (st.st_size < 4) {
         PrintAndLogEx(FAILED, "error, file is too small");
         fclose(f);
         return 4;
     }
-
-    if (trace)
-        free(trace);
-
-    trace = calloc(fsize, sizeof(uint8_t));
-    if (!trace) {
-        PrintAndLogEx(FAILED, "Cannot allocate memory for trace");
+    if ((uint64_t)st.st_size > SIZE_MAX) {
+        PrintAndLogEx(FAILED, "error, file is too large");
         fclose(f);
         return 2;
     }
 
-    size_t bytes_read = fread(trace, 1, fsize, f);
-    traceLen = bytes_read;
+    trace_free();
+    trace_map_len = st.st_size;
+
+#ifndef _WIN32
+    // private and writable, some annotations modify frames in place while listing
+    trace_map = mmap(NULL, trace_map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+    if (trace_map == MAP_FAILED) {
+        trace_map = NULL;
+    } else {
+        trace_mapped = true;
+        posix_madvise(trace_map, trace_map_len, POSIX_MADV_SEQUENTIAL);
+    }
+#endif
+    if (trace_map == NULL) {
+        trace_map = malloc(trace_map_len);
+        if (trace_map == NULL) {
+            PrintAndLogEx(FAILED, "Cannot allocate memory for trace");
+            trace_map_len = 0;
+            fclose(f);
+            return 2;
+        }
+        trace_map_len = fread(trace_map, 1, trace_map_len, f);
+    }
     fclose(f);
-    PrintAndLogEx(SUCCESS, "Recorded Activity (TraceLen = %d bytes) loaded from file %s", traceLen, filename);
+
+    trace = trace_map;
+    traceLen = trace_map_len;
+
+    int version = 1;
+    if (trace_map_len >= sizeof(trace_file_header_t) && memcmp(trace_map, TRACE_FILE_MAGIC, 8) == 0) {
+        trace_file_header_t hdr;
+        memcpy(&hdr, trace_map, sizeof(hdr));
+        uint64_t avail = trace_map_len - sizeof(hdr);
+        if (hdr.version != TRACE_FILE_VERSION
+                || hdr.data_len > avail
+                || ((hdr.flags & TRACE_FILE_HAS_INDEX)
+                    && (hdr.index_stride == 0 || hdr.index_count > (avail - hdr.data_len) / sizeof(uint64_t)))) {
+            PrintAndLogEx(FAILED, "error, unsupported or damaged trace file");
+            trace_free();
+            return 5;
+        }
+        version = hdr.version;
+        trace = trace_map + sizeof(hdr);
+        traceLen = hdr.data_len;
+        if (hdr.flags & TRACE_FILE_HAS_INDEX) {
+            trace_index = trace + traceLen;
+            trace_index_count = hdr.index_count;
+            trace_index_stride = hdr.index_stride;
+        }
+    }
+
+    PrintAndLogEx(SUCCESS, "Recorded Activity (TraceLen = %zu bytes) loaded from file %s (v%d)", traceLen, filename, version);
     return 0;
 }
 
@@ -681,12 +1077,135 @@ static int CmdTraceSave(const char *Cmd) {
     if (strlen(Cmd) < 1 || cmdp == 'h') return usage_trace_save();
 
     param_getstr(Cmd, 0, filename, sizeof(filename));
-    saveFile(filename, ".bin", trace, traceLen);
+
+    if (param_getchar(Cmd, 1) != 0x00) {
+        if (tolower(param_getchar(Cmd, 1)) != 'o') return usage_trace_save();
+        saveFile(filename, ".bin", trace, traceLen);
+        return 0;
+    }
+
+    // index every TRACE_INDEX_STRIDE'th record while counting them
+    uint64_t *index = NULL;
+    size_t index_count = 0, index_size = 0;
+    uint64_t record_count = 0;
+    for (size_t tracepos = 0; tracepos < traceLen; record_count++) {
+        if (record_count % TRACE_INDEX_STRIDE == 0) {
+            if (index_count == index_size) {
+                index_size = index_size ? index_size * 2 : 64;
+                uint64_t *p = realloc(index, index_size * sizeof(uint64_t));
+                if (p == NULL) {
+                    PrintAndLogEx(FAILED, "Cannot allocate memory for trace index");
+                    free(index);
+                    return 2;
+                }
+                index = p;
+            }
+            index[index_count++] = tracepos;
+        }
+        tracepos = next_record(tracepos, trace, traceLen);
+    }
+
+    trace_file_header_t hdr = {
+        .version = TRACE_FILE_VERSION,
+        .flags = TRACE_FILE_HAS_INDEX,
+        .index_stride = TRACE_INDEX_STRIDE,
+        .data_len = traceLen,
+        .record_count = record_count,
+        .index_count = index_count,
+    };
+    memcpy(hdr.magic, TRACE_FILE_MAGIC, sizeof(hdr.magic));
+
+    const void *parts[] = { &hdr, trace, index };
+    size_t lens[] = { sizeof(hdr), traceLen, index_count * sizeof(uint64_t) };
+    saveFileParts(filename, ".bin", parts, lens, 3);
+    free(index);
+    return 0;
+}
+
+static int CmdTraceExport(const char *Cmd) {
+
+    char type[10] = {0};
+    char filename[FILE_PATH_SIZE] = {0};
+    uint8_t protocol = 0;
+    bool raw = false;
+    bool append = false;
+    bool isOnline = true;
+    bool errors = false;
+
+    char cmdp = tolower(param_getchar(Cmd, 0));
+    if (strlen(Cmd) < 1 || cmdp == 'h') return usage_trace_export();
+
+    param_getstr(Cmd, 0, type, sizeof(type));
+    str_lower(type);
+    if (!get_protocol(type, &protocol) || protocol == FELICA) {
+        PrintAndLogEx(WARNING, "Unknown protocol '%s'", type);
+        errors = true;
+    }
+    if (param_getstr(Cmd, 1, filename, sizeof(filename)) == 0)
+        errors = true;
+
+    for (cmdp = 2; param_getchar(Cmd, cmdp) != 0x00 && !errors; cmdp++) {
+        switch (tolower(param_getchar(Cmd, cmdp))) {
+            case 'r':
+                raw = true;
+                break;
+            case 'a':
+                append = true;
+                break;
+            case '0':
+                isOnline = true;
+                break;
+            case '1':
+                isOnline = false;
+                break;
+            default:
+                PrintAndLogEx(WARNING, "Unknown parameter '%c'", param_getchar(Cmd, cmdp));
+                errors = true;
+                break;
+        }
+    }
+    if (errors) return usage_trace_export();
+
+    if (isOnline) {
+        int res = download_trace();
+        if (res)
+            return res;
+    }
+
+    if (traceLen == 0) {
+        PrintAndLogEx(WARNING, "trace is empty, nothing to export");
+        return 0;
+    }
+
+    pcapng_t pc = {0};
+    pc.f = fopen(filename, append ? "ab" : "wb");
+    if (pc.f == NULL) {
+        PrintAndLogEx(WARNING, "file not found or locked. '" _YELLOW_("%s")"'", filename);
+        return PM3_EFILE;
+    }
+    setvbuf(pc.f, NULL, _IOFBF, 1 << 20);
+
+    uint64_t t1 = msclock();
+    size_t done = 0;
+    if (pcapng_start(&pc, protocol, raw))
+        done = pcapng_export(&pc, trace, traceLen);
+    bool ok = (fclose(pc.f) == 0) && !pc.error;
+    t1 = msclock() - t1;
+
+    if (!ok) {
+        PrintAndLogEx(WARNING, "could not write pcapng file " _YELLOW_("%s"), filename);
+        return PM3_EFILE;
+    }
+    if (done < traceLen)
+        PrintAndLogEx(WARNING, "last %zu bytes of the trace are not a complete record, skipped", traceLen - done);
+    PrintAndLogEx(SUCCESS, "%s %" PRIu64 " records to pcapng file " _YELLOW_("%s") " in %" PRIu64 " ms",
+                  append ? "appended" : "exported", pc.records, filename, t1);
     return 0;
 }
 
 static command_t CommandTable[] = {
     {"help",    CmdHelp,          AlwaysAvailable, "This help"},
+    {"export",  CmdTraceExport,   AlwaysAvailable, "Export trace buffer to pcapng file"},
     {"list",    CmdTraceList,     AlwaysAvailable, "List protocol data in trace buffer"},
     {"load",    CmdTraceLoad,     AlwaysAvailable, "Load trace from file"},
     {"save",    CmdTraceSave,     AlwaysAvailable, "Save trace buffer to file"},
@@ -714,6 +1233,7 @@ int CmdTraceList(const char *Cmd) {
     bool isOnline = true;
     bool errors = false;
     uint8_t protocol = 0;
+    uint64_t skip = 0, limit = UINT64_MAX;
     char type[10] = {0};
 
     //int tlen = param_getstr(Cmd,0,type);
@@ -741,6 +1261,14 @@ int CmdTraceList(const char *Cmd) {
                     showHex = true;
                     cmdp++;
                     break;
+                case 's':
+                    skip = param_get64ex(Cmd, cmdp + 1, 0, 10);
+                    cmdp += 2;
+                    break;
+                case 'n':
+                    limit = param_get64ex(Cmd, cmdp + 1, 0, 10);
+                    cmdp += 2;
+                    break;
                 case '0':
                     isOnline = true;
                     cmdp++;
@@ -760,20 +1288,8 @@ int CmdTraceList(const char *Cmd) {
             str_lower(type);
 
             // validate type of output
-            if (strcmp(type,      "iclass") == 0)   protocol = ICLASS;
-            else if (strcmp(type, "14a") == 0)      protocol = ISO_14443A;
-            else if (strcmp(type, "14b") == 0)      protocol = ISO_14443B;
-            else if (strcmp(type, "topaz") == 0)    protocol = TOPAZ;
-            else if (strcmp(type, "7816") == 0)     protocol = ISO_7816_4;
-            else if (strcmp(type, "des") == 0)      protocol = MFDES;
-            else if (strcmp(type, "legic") == 0)    protocol = LEGIC;
-            else if (strcmp(type, "15") == 0)       protocol = ISO_15693;
-            else if (strcmp(type, "felica") == 0)   protocol = FELICA;
-            else if (strcmp(type, "mf") == 0)       protocol = PROTO_MIFARE;
-            else if (strcmp(type, "hitag") == 0)    protocol = PROTO_HITAG;
-            else if (strcmp(type, "thinfilm") == 0) protocol = THINFILM;
-            else if (strcmp(type, "raw") == 0)      protocol = -1; //No crc, no annotations
-            else errors = true;
+            if (!get_protocol(type, &protocol))
+                errors = true;
 
             cmdp++;
         }
@@ -784,43 +1300,21 @@ int CmdTraceList(const char *Cmd) {
     //Validations
     if (errors) return usage_trace_list();
 
-    uint16_t tracepos = 0;
-
-    // reserv some space.
-    if (!trace)
-        trace = calloc(PM3_CMD_DATA_SIZE, sizeof(uint8_t));
-
     if (isOnline) {
-        // Query for the size of the trace,  downloading PM3_CMD_DATA_SIZE
-        PacketResponseNG response;
-        if (!GetFromDevice(BIG_BUF, trace, PM3_CMD_DATA_SIZE, 0, NULL, 0, &response, 4000, true)) {
-            PrintAndLogEx(WARNING, "timeout while waiting for reply.");
-            return 1;
-        }
-
-        traceLen = response.oldarg[2];
-        if (traceLen > PM3_CMD_DATA_SIZE) {
-            uint8_t *p = realloc(trace, traceLen);
-            if (p == NULL) {
-                PrintAndLogEx(FAILED, "Cannot allocate memory for trace");
-                free(trace);
-                return 2;
-            }
-            trace = p;
-            if (!GetFromDevice(BIG_BUF, trace, traceLen, 0, NULL, 0, NULL, 2500, false)) {
-                PrintAndLogEx(WARNING, "command execution time out");
-                free(trace);
-                return 3;
-            }
-        }
+        int res = download_trace();
+        if (res)
+            return res;
     }
 
-    PrintAndLogEx(SUCCESS, "Recorded Activity (TraceLen = %d bytes)", traceLen);
+    size_t tracepos = seek_record(skip);
+    uint64_t listed = 0;
+
+    PrintAndLogEx(SUCCESS, "Recorded Activity (TraceLen = %zu bytes)", traceLen);
     PrintAndLogEx(INFO, "");
     if (protocol == FELICA) {
-        printFelica(traceLen, trace);
+        printFelica(traceLen, trace, skip, limit);
     } else if (showHex) {
-        while (tracepos < traceLen) {
+        while (tracepos < traceLen && listed++ < limit) {
             tracepos = printHexLine(tracepos, traceLen, trace, protocol);
         }
     } else {
@@ -850,7 +1344,7 @@ int CmdTraceList(const char *Cmd) {
         PrintAndLogEx(NORMAL, "------------+------------+-----+-------------------------------------------------------------------------+-----+--------------------");
 
         ClearAuthData();
-        while (tracepos < traceLen) {
+        while (tracepos < traceLen && listed++ < limit) {
             tracepos = printTraceLine(tracepos, traceLen, trace, protocol, showWaitCycles, markCRCBytes);
 
             if (kbd_enter_pressed())
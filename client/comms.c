@@ -14,6 +14,8 @@
 #include <inttypes.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <sys/time.h>
 
 #include "uart.h"
 #include "ui.h"
@@ -51,8 +53,34 @@ static int cmd_head = 0;
 // Points to the position of the last unread command
 static int cmd_tail = 0;
 
+// time (usclock) each reply was stored in rxBuffer
+static uint64_t rxBufferTime[CMD_BUFFER_SIZE];
+static rx_queue_stats_t rxQueueStats = {0, 0, 0};
+
+// sequence number of each reply to a subscribed command, 0 for all other replies
+static uint32_t rxBufferSeq[CMD_BUFFER_SIZE];
+// number of replies stored so far, lets a waiter sleep until something new arrives
+static uint32_t rxBufferStored = 0;
+
+// Replies to subscribed commands are numbered in arrival order. The device answers its commands
+// in order, so the n-th reply belongs to the n-th ticket handed out by ExpectReply and stays
+// queued until the holder of that ticket picks it up.
+#define MAX_REPLY_SUBSCRIPTIONS 8
+typedef struct {
+    uint16_t cmd;
+    uint32_t sent;
+    uint32_t received;
+} reply_subscription_t;
+static reply_subscription_t replySubscriptions[MAX_REPLY_SUBSCRIPTIONS];
+static int numReplySubscriptions = 0;
+
 // to lock rxBuffer operations from different threads
 static pthread_mutex_t rxBufferMutex = PTHREAD_MUTEX_INITIALIZER;
+// signals waiters when a reply is stored
+static pthread_cond_t rxBufferSig = PTHREAD_COND_INITIALIZER;
+
+// longest a waiter blocks before it rechecks its timeout, which is extended by incoming packets
+#define RX_WAIT_MAX_MS 1000
 
 // Global start time for WaitForResponseTimeout & dl_it, so we can reset timeout when we get packets
 // as sending lot of these packets can slow down things wuite a lot on slow links (e.g. hw status or lf read at 9600)
@@ -199,6 +227,7 @@ void SendCommandMIX(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, v
  *  responses from previous commands are stored in the buffer, a call to this method should clear them.
  *  A better method could have been to have explicit command-ACKS, so we can know which ACK goes to which
  *  operation. Right now we'll just have to live with this.
+ *  Tickets whose reply is cleared fail in WaitForReply right away, the numbering of later ones is unaffected.
  */
 void clearCommandBuffer() {
     //This is a very simple operation
@@ -206,6 +235,72 @@ void clearCommandBuffer() {
     cmd_tail = cmd_head;
     pthread_mutex_unlock(&rxBufferMutex);
 }
+
+// call with rxBufferMutex held
+static reply_subscription_t *findSubscription(uint16_t cmd) {
+    for (int i = 0; i < numReplySubscriptions; i++) {
+        if (replySubscriptions[i].cmd == cmd)
+            return &replySubscriptions[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief SubscribeReply starts numbering the replies to cmd, so several commands answered by cmd
+ *  can be in flight at the same time. Use ExpectReply before sending each of them and
+ *  WaitForReply to collect the answers, then UnsubscribeReply when done.
+ * @param cmd reply command, e.g. CMD_ACK
+ * @return PM3_SUCCESS, or PM3_EOVFLOW if too many commands are subscribed
+ */
+int SubscribeReply(uint16_t cmd) {
+    int res = PM3_SUCCESS;
+    pthread_mutex_lock(&rxBufferMutex);
+    reply_subscription_t *sub = findSubscription(cmd);
+    if (sub == NULL) {
+        if (numReplySubscriptions == MAX_REPLY_SUBSCRIPTIONS) {
+            res = PM3_EOVFLOW;
+        } else {
+            sub = &replySubscriptions[numReplySubscriptions++];
+            sub->cmd = cmd;
+        }
+    }
+    if (sub != NULL) {
+        sub->sent = 0;
+        sub->received = 0;
+    }
+    pthread_mutex_unlock(&rxBufferMutex);
+    return res;
+}
+
+void UnsubscribeReply(uint16_t cmd) {
+    pthread_mutex_lock(&rxBufferMutex);
+    reply_subscription_t *sub = findSubscription(cmd);
+    if (sub != NULL) {
+        *sub = replySubscriptions[--numReplySubscriptions];
+        // late replies nobody waits for any more are handled like any other stale reply
+        for (int i = cmd_tail; i != cmd_head; i = (i + 1) % CMD_BUFFER_SIZE) {
+            if (rxBuffer[i].cmd == cmd)
+                rxBufferSeq[i] = 0;
+        }
+    }
+    pthread_mutex_unlock(&rxBufferMutex);
+}
+
+/**
+ * @brief ExpectReply hands out the ticket for the reply to the command about to be sent
+ * @param cmd subscribed reply command
+ * @return ticket for WaitForReply, its seq is 0 if cmd isn't subscribed
+ */
+reply_ticket_t ExpectReply(uint16_t cmd) {
+    reply_ticket_t ticket = {cmd, 0};
+    pthread_mutex_lock(&rxBufferMutex);
+    reply_subscription_t *sub = findSubscription(cmd);
+    if (sub != NULL)
+        ticket.seq = ++sub->sent;
+    pthread_mutex_unlock(&rxBufferMutex);
+    return ticket;
+}
+
 /**
  * @brief storeCommand stores a USB command in a circular buffer
  * @param UC
@@ -214,39 +309,128 @@ static void storeReply(PacketResponseNG *packet) {
     pthread_mutex_lock(&rxBufferMutex);
     if ((cmd_head + 1) % CMD_BUFFER_SIZE == cmd_tail) {
         //If these two are equal, we're about to overwrite in the
-        // circular buffer.
-        PrintAndLogEx(FAILED, "WARNING: Command buffer about to overwrite command! This needs to be fixed!");
+        // circular buffer. Drop the oldest reply rather than the whole buffer.
+        PrintAndLogEx(FAILED, "WARNING: Command buffer full, dropping oldest reply! This needs to be fixed!");
         fflush(stdout);
+        cmd_tail = (cmd_tail + 1) % CMD_BUFFER_SIZE;
     }
     //Store the command at the 'head' location
     PacketResponseNG *destination = &rxBuffer[cmd_head];
     memcpy(destination, packet, sizeof(PacketResponseNG));
+    rxBufferTime[cmd_head] = usclock();
+    reply_subscription_t *sub = findSubscription(packet->cmd);
+    // a reply nobody holds a ticket for (sent without ExpectReply) must not shift the numbering of later ones
+    rxBufferSeq[cmd_head] = (sub != NULL && sub->received < sub->sent) ? ++sub->received : 0;
 
     //increment head and wrap
     cmd_head = (cmd_head + 1) % CMD_BUFFER_SIZE;
+    rxBufferStored++;
+    pthread_cond_broadcast(&rxBufferSig);
     pthread_mutex_unlock(&rxBufferMutex);
 }
+// call with rxBufferMutex held, removes entry idx and keeps the order of the older ones
+static void removeReply(int idx) {
+    while (idx != cmd_tail) {
+        int prev = (idx + CMD_BUFFER_SIZE - 1) % CMD_BUFFER_SIZE;
+        memcpy(&rxBuffer[idx], &rxBuffer[prev], sizeof(PacketResponseNG));
+        rxBufferTime[idx] = rxBufferTime[prev];
+        rxBufferSeq[idx] = rxBufferSeq[prev];
+        idx = prev;
+    }
+    cmd_tail = (cmd_tail + 1) % CMD_BUFFER_SIZE;
+}
+
 /**
  * @brief getCommand gets a command from an internal circular buffer.
+ *  Replies to subscribed commands are only handed to the waiter holding their ticket,
+ *  everything else in arrival order.
+ * @param cmd command the caller waits for, or CMD_UNKNOWN
+ * @param seq ticket sequence number the caller waits for, or 0
  * @param response location to write command
- * @return 1 if response was returned, 0 if nothing has been received
+ * @param stored if not NULL, receives the store count to pass to waitReply
+ * @return 1 if response was returned, 0 if nothing has been received,
+ *  -1 if the reply for the ticket arrived but was discarded
  */
-static int getReply(PacketResponseNG *packet) {
+static int getReply(uint16_t cmd, uint32_t seq, PacketResponseNG *packet, uint32_t *stored) {
     pthread_mutex_lock(&rxBufferMutex);
-    //If head == tail, there's nothing to read, or if we just got initialized
-    if (cmd_head == cmd_tail)  {
+    if (stored != NULL)
+        *stored = rxBufferStored;
+
+    for (int i = cmd_tail; i != cmd_head; i = (i + 1) % CMD_BUFFER_SIZE) {
+        if (rxBufferSeq[i] != 0) {
+            if (rxBuffer[i].cmd != cmd || rxBufferSeq[i] != seq)
+                continue;
+        } else if (seq != 0 && rxBuffer[i].cmd == cmd) {
+            // not the reply to this ticket
+            continue;
+        }
+
+        //Pick out the next unread command
+        memcpy(packet, &rxBuffer[i], sizeof(PacketResponseNG));
+
+        uint64_t queued_us = usclock() - rxBufferTime[i];
+        rxQueueStats.packets++;
+        rxQueueStats.total_us += queued_us;
+        if (queued_us > rxQueueStats.max_us)
+            rxQueueStats.max_us = queued_us;
+
+        removeReply(i);
         pthread_mutex_unlock(&rxBufferMutex);
-        return 0;
+        return 1;
     }
 
-    //Pick out the next unread command
-    memcpy(packet, &rxBuffer[cmd_tail], sizeof(PacketResponseNG));
+    // the reply to this ticket has been numbered already but isn't queued any more,
+    // it was dropped by clearCommandBuffer() or an overflow. No use waiting for it.
+    int res = 0;
+    if (seq != 0) {
+        reply_subscription_t *sub = findSubscription(cmd);
+        if (sub != NULL && seq <= sub->received)
+            res = -1;
+    }
+    pthread_mutex_unlock(&rxBufferMutex);
+    return res;
+}
 
-    //Increment tail - this is a circular buffer, so modulo buffer size
-    cmd_tail = (cmd_tail + 1) % CMD_BUFFER_SIZE;
+/**
+ * @brief waitReply blocks until a new reply is stored or ms_wait milliseconds have elapsed
+ * @param ms_wait maximum time to wait
+ * @param stored store count seen by the last getReply
+ */
+static void waitReply(uint32_t ms_wait, uint32_t stored) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t nsec = (uint64_t)now.tv_usec * 1000 + (uint64_t)(ms_wait % 1000) * 1000000;
+    struct timespec deadline;
+    deadline.tv_sec = now.tv_sec + ms_wait / 1000 + nsec / 1000000000;
+    deadline.tv_nsec = nsec % 1000000000;
 
+    pthread_mutex_lock(&rxBufferMutex);
+    while (rxBufferStored == stored) {
+        if (pthread_cond_timedwait(&rxBufferSig, &rxBufferMutex, &deadline) == ETIMEDOUT)
+            break;
+    }
+    pthread_mutex_unlock(&rxBufferMutex);
+}
+
+// how long until a wait loop started at start_clk must look at its timeout or warning again
+static uint32_t nextWakeup(uint64_t start_clk, size_t ms_timeout, bool show_warning) {
+    uint64_t elapsed = msclock() - start_clk;
+    uint64_t wait = RX_WAIT_MAX_MS;
+    if (ms_timeout != (size_t) -1) {
+        if (elapsed > ms_timeout)
+            return 0;
+        if (ms_timeout + 1 - elapsed < wait)
+            wait = ms_timeout + 1 - elapsed;
+    }
+    if (show_warning && elapsed <= 3000 && 3001 - elapsed < wait)
+        wait = 3001 - elapsed;
+    return wait;
+}
+
+void GetResponseQueueStats(rx_queue_stats_t *stats) {
+    pthread_mutex_lock(&rxBufferMutex);
+    memcpy(stats, &rxQueueStats, sizeof(rx_queue_stats_t));
     pthread_mutex_unlock(&rxBufferMutex);
-    return 1;
 }
 
 //-----------------------------------------------------------------------------
@@ -695,7 +879,7 @@ static size_t communication_delay(void) {
  * @param show_warning display message after 3 seconds
  * @return true if command was returned, otherwise false
  */
-bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms_timeout, bool show_warning) {
+static bool waitForResponse(uint32_t cmd, uint32_t seq, PacketResponseNG *response, size_t ms_timeout, bool show_warning) {
 
     PacketResponseNG resp;
 
@@ -709,9 +893,11 @@ bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms
     __atomic_store_n(&timeout_start_time,  msclock(), __ATOMIC_SEQ_CST);
 
     // Wait until the command is received
+    uint32_t stored;
     while (true) {
 
-        while (getReply(response)) {
+        int res;
+        while ((res = getReply(cmd, seq, response, &stored)) > 0) {
             if (cmd == CMD_UNKNOWN || response->cmd == cmd) {
                 return true;
             }
@@ -722,6 +908,8 @@ bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms
                     ms_timeout += wtx;
             }
         }
+        if (res < 0)
+            break;
 
         uint64_t tmp_clk = __atomic_load_n(&timeout_start_time, __ATOMIC_SEQ_CST);
         if ((ms_timeout != (size_t) -1) && (msclock() - tmp_clk > ms_timeout))
@@ -733,10 +921,28 @@ bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms
             PrintAndLogEx(INFO, "You can cancel this operation by pressing the pm3 button");
             show_warning = false;
         }
+
+        waitReply(nextWakeup(tmp_clk, ms_timeout, show_warning), stored);
     }
     return false;
 }
 
+bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms_timeout, bool show_warning) {
+    return waitForResponse(cmd, 0, response, ms_timeout, show_warning);
+}
+
+/**
+ * @brief Waits for the reply belonging to a ticket from ExpectReply.
+ *  Replies to the same command for later tickets stay queued for their own WaitForReply.
+ * @param ticket ticket handed out before sending the command
+ * @param response struct to copy received command into.
+ * @param ms_timeout timeout in milliseconds
+ * @return true if command was returned, otherwise false
+ */
+bool WaitForReply(reply_ticket_t ticket, PacketResponseNG *response, size_t ms_timeout) {
+    return waitForResponse(ticket.cmd, ticket.seq, response, ms_timeout, true);
+}
+
 bool WaitForResponseTimeout(uint32_t cmd, PacketResponseNG *response, size_t ms_timeout) {
     return WaitForResponseTimeoutW(cmd, response, ms_timeout, true);
 }
@@ -807,9 +1013,11 @@ static bool dl_it(uint8_t *dest, uint32_t bytes, uint32_t start_index, PacketRes
     if (ms_timeout != (size_t) -1)
         ms_timeout += communication_delay();
 
+    uint32_t stored;
     while (true) {
 
-        if (getReply(response)) {
+        bool got = getReply(CMD_UNKNOWN, 0, response, &stored);
+        if (got) {
 
             // sample_buf is a array pointer, located in data.c
             // arg0 = offset in transfer. Startindex of this chunk
@@ -855,6 +1063,9 @@ static bool dl_it(uint8_t *dest, uint32_t bytes, uint32_t start_index, PacketRes
             PrintAndLogEx(NORMAL, "You can cancel this operation by pressing the pm3 button");
             show_warning = false;
         }
+
+        if (got == false)
+            waitReply(nextWakeup(tmp_clk, ms_timeout, show_warning), stored);
     }
     return false;
 }
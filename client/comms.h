@@ -59,12 +59,29 @@ typedef struct {
 
 extern communication_arg_t conn;
 
+// time replies spent in the receive queue before a command handler took them
+typedef struct {
+    uint32_t packets;
+    uint64_t total_us;
+    uint64_t max_us;
+} rx_queue_stats_t;
+
+// reply to one of several in-flight commands answered by the same reply command
+typedef struct {
+    uint16_t cmd;
+    uint32_t seq;
+} reply_ticket_t;
+
 void *uart_receiver(void *targ);
 void SendCommandBL(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, void *data, size_t len);
 void SendCommandOLD(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, void *data, size_t len);
 void SendCommandNG(uint16_t cmd, uint8_t *data, size_t len);
 void SendCommandMIX(uint64_t cmd, uint64_t arg0, uint64_t arg1, uint64_t arg2, void *data, size_t len);
 void clearCommandBuffer(void);
+void GetResponseQueueStats(rx_queue_stats_t *stats);
+int SubscribeReply(uint16_t cmd);
+void UnsubscribeReply(uint16_t cmd);
+reply_ticket_t ExpectReply(uint16_t cmd);
 
 #define FLASHMODE_SPEED 460800
 bool IsCommunicationThreadDead(void);
@@ -75,6 +92,7 @@ void CloseProxmark(void);
 bool WaitForResponseTimeoutW(uint32_t cmd, PacketResponseNG *response, size_t ms_timeout, bool show_warning);
 bool WaitForResponseTimeout(uint32_t cmd, PacketResponseNG *response, size_t ms_timeout);
 bool WaitForResponse(uint32_t cmd, PacketResponseNG *response);
+bool WaitForReply(reply_ticket_t ticket, PacketResponseNG *response, size_t ms_timeout);
 
 //bool GetFromDevice(DeviceMemType_t memtype, uint8_t *dest, uint32_t bytes, uint32_t start_index, PacketResponseNG *response, size_t ms_timeout, bool show_warning);
 bool GetFromDevice(DeviceMemType_t memtype, uint8_t *dest, uint32_t bytes, uint32_t start_index, uint8_t *data, uint32_t datalen, PacketResponseNG *response, size_t ms_timeout, bool show_warning);
@@ -26,6 +26,8 @@
 #include "dol.h"
 #include "ui.h"
 #include "emv_tags.h"
+#include "emv_pk.h"
+#include "fileutils.h"
 
 static int CmdHelp(const char *Cmd);
 
@@ -1952,6 +1954,75 @@ out:
     return ret;
 }
 
+static int CmdEMVCAPK(const char *Cmd) {
+    CLIParserInit("emv capk",
+                  "List the CA public keys used for SDA/DDA/CDA, or compile them into a binary store.\n"
+                  "A capk.bin in the resources directory, at least as recent as capk.txt, is loaded instead of capk.txt.\n",
+                  "Usage:\n"
+                  "\temv capk -> list the CA public keys\n"
+                  "\temv capk -c -> compile the keys into capk.bin, next to capk.txt\n"
+                  "\temv capk -c -f mykeys.bin -> compile the keys into mykeys.bin\n"
+                 );
+
+    void *argtable[] = {
+        arg_param_begin,
+        arg_lit0("cC",  "compile",  "write the keys into a binary CAPK store"),
+        arg_str0("fF",  "file",     "<filename>", "binary CAPK store to write"),
+        arg_param_end
+    };
+    CLIExecWithReturn(Cmd, argtable, true);
+
+    bool compile = arg_get_lit(1);
+    uint8_t filename[FILE_PATH_SIZE] = {0};
+    int fnlen = 0;
+    CLIGetStrWithReturn(2, filename, &fnlen);
+    CLIParserFree();
+
+    const struct emv_pk_store *store = emv_pk_get_ca_store();
+    size_t count = emv_pk_store_count(store);
+    if (count == 0) {
+        PrintAndLogEx(ERR, "No CA public keys found.");
+        return PM3_EFILE;
+    }
+
+    if (compile == false) {
+        PrintAndLogEx(NORMAL, "RID            | idx | bits | expire | hash");
+        PrintAndLogEx(NORMAL, "---------------+-----+------+--------+-----");
+        for (size_t i = 0; i < count; i++) {
+            bool verified = false;
+            const struct emv_pk *pk = emv_pk_store_get(store, i, &verified);
+            PrintAndLogEx(NORMAL, "%02x:%02x:%02x:%02x:%02x |  %02x | %4zu | %06x | %s",
+                          pk->rid[0], pk->rid[1], pk->rid[2], pk->rid[3], pk->rid[4],
+                          pk->index,
+                          pk->mlen * 8,
+                          pk->expire,
+                          verified ? _GREEN_("OK") : _RED_("Fail")
+                         );
+        }
+        PrintAndLogEx(SUCCESS, "%zu CA public keys", count);
+        return PM3_SUCCESS;
+    }
+
+    char *path = NULL;
+    if (fnlen == 0) {
+        if (searchFile(&path, RESOURCES_SUBDIR, "capk", ".txt", false) != PM3_SUCCESS)
+            return PM3_EFILE;
+        // capk.txt -> capk.bin
+        strcpy(path + strlen(path) - 3, "bin");
+    } else {
+        path = calloc(fnlen + 1, sizeof(char));
+        if (path == NULL)
+            return PM3_EMALLOC;
+        memcpy(path, filename, fnlen);
+    }
+
+    int res = emv_pk_store_save(store, path);
+    if (res == PM3_SUCCESS)
+        PrintAndLogEx(SUCCESS, "Saved %zu CA public keys to " _YELLOW_("%s"), count, path);
+    free(path);
+    return res;
+}
+
 static command_t CommandTable[] =  {
     {"help",        CmdHelp,                        AlwaysAvailable, "This help"},
     {"exec",        CmdEMVExec,                     IfPm3Iso14443,   "Executes EMV contactless transaction."},
@@ -1965,6 +2036,7 @@ static command_t CommandTable[] =  {
     {"intauth",     CmdEMVInternalAuthenticate,     IfPm3Iso14443,   "Internal authentication."},
     {"scan",        CmdEMVScan,                     IfPm3Iso14443,   "Scan EMV card and save it contents to json file for emulator."},
     {"test",        CmdEMVTest,                     AlwaysAvailable, "Crypto logic test."},
+    {"capk",        CmdEMVCAPK,                     AlwaysAvailable, "List or compile the CA public key store."},
     /*
     {"getrng",      CmdEMVGetrng,                   IfPm3Iso14443,   "get random number from terminal"},
     {"eload",       CmdEmvELoad,                    IfPm3Iso14443,   "load EMV tag into device"},
@@ -25,6 +25,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 #include "ui.h"
 #include "crypto.h"
@@ -392,41 +397,6 @@ void emv_pk_free(struct emv_pk *pk) {
     free(pk);
 }
 
-static struct emv_pk *emv_pk_get_ca_pk_from_file(const char *fname,
-                                                 const unsigned char *rid,
-                                                 unsigned char idx) {
-    if (!fname)
-        return NULL;
-
-    FILE *f = fopen(fname, "r");
-    if (!f) {
-        PrintAndLogEx(ERR, "Error: can't open file %s.", fname);
-        return NULL;
-    }
-
-    while (!feof(f)) {
-        char buf[2048];
-        if (fgets(buf, sizeof(buf), f) == NULL)
-            break;
-
-        struct emv_pk *pk = emv_pk_parse_pk(buf);
-        if (!pk)
-            continue;
-        if (memcmp(pk->rid, rid, 5) || pk->index != idx) {
-            emv_pk_free(pk);
-            continue;
-        }
-
-        fclose(f);
-
-        return pk;
-    }
-
-    fclose(f);
-
-    return NULL;
-}
-
 char *emv_pk_get_ca_pk_file(const char *dirname, const unsigned char *rid, unsigned char idx) {
     if (!dirname)
         dirname = ".";//openemv_config_get_str("capk.dir", NULL);
@@ -466,32 +436,354 @@ char *emv_pk_get_ca_pk_rid_file(const char *dirname, const unsigned char *rid) {
     return filename;
 }
 
-struct emv_pk *emv_pk_get_ca_pk(const unsigned char *rid, unsigned char idx) {
-    struct emv_pk *pk = NULL;
+struct emv_pk *emv_pk_dup(const struct emv_pk *pk) {
+    struct emv_pk *copy = emv_pk_new(pk->mlen, pk->elen);
+    if (!copy)
+        return NULL;
+
+    unsigned char *modulus = copy->modulus;
+    *copy = *pk;
+    copy->modulus = modulus;
+    memcpy(copy->modulus, pk->modulus, pk->mlen);
+    return copy;
+}
 
-    /*  if (!pk) {
-            char *fname = emv_pk_get_ca_pk_file(NULL, rid, idx);
-            if (fname) {
-                pk = emv_pk_get_ca_pk_from_file(fname, rid, idx);
-                free(fname);
+/*
+ * CA public key store.
+ * All keys of a capk file, kept in memory with an open addressing hash index on (RID, index).
+ * The key hashes are checked once, when the store is loaded.
+ *
+ * Besides the text format a precompiled binary store can be used, it is mapped into memory
+ * and the moduli are used in place. Layout, integers little endian:
+ *   header  : "PM3CAPK\0", uint32 version, uint32 key count
+ *   key     : rid[5] index serial[3] pan[10] hash_algo pk_algo hash[20] exp[3] elen,
+ *             uint16 mlen, uint32 expire, uint32 modulus offset (from start of file)   (56 bytes)
+ *   moduli
+ */
+#define CAPK_BIN_MAGIC      "PM3CAPK"
+#define CAPK_BIN_VERSION    1
+#define CAPK_BIN_HDR_LEN    16
+#define CAPK_BIN_KEY_LEN    56
+
+struct emv_pk_store {
+    struct emv_pk *keys;
+    bool *verified;
+    size_t count;
+    // slot -> key number + 1, 0 = empty
+    uint32_t *table;
+    size_t table_size;
+    // binary store, moduli point into it
+    unsigned char *map;
+    size_t map_len;
+    bool mapped;
+};
+
+static uint32_t emv_pk_store_hash(const unsigned char *rid, unsigned char idx) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 5; i++)
+        h = (h ^ rid[i]) * 16777619u;
+    return (h ^ idx) * 16777619u;
+}
+
+static bool emv_pk_store_index(struct emv_pk_store *store) {
+    store->table_size = 16;
+    while (store->table_size < store->count * 2)
+        store->table_size <<= 1;
+
+    store->table = calloc(store->table_size, sizeof(uint32_t));
+    store->verified = calloc(store->count + 1, sizeof(bool));
+    if (!store->table || !store->verified)
+        return false;
+
+    for (size_t i = 0; i < store->count; i++) {
+        const struct emv_pk *pk = &store->keys[i];
+        store->verified[i] = emv_pk_verify(pk);
+
+        size_t slot = emv_pk_store_hash(pk->rid, pk->index) & (store->table_size - 1);
+        for (;;) {
+            uint32_t k = store->table[slot];
+            if (k == 0) {
+                store->table[slot] = i + 1;
+                break;
             }
+            // the first key of a (RID, index) pair wins, like the line by line search did
+            if (!memcmp(store->keys[k - 1].rid, pk->rid, 5) && store->keys[k - 1].index == pk->index)
+                break;
+            slot = (slot + 1) & (store->table_size - 1);
         }
+    }
+    return true;
+}
 
-        if (!pk) {
-            char *fname = emv_pk_get_ca_pk_rid_file(NULL, rid);
-            if (fname) {
-                pk = emv_pk_get_ca_pk_from_file(fname, rid, idx);
-                free(fname);
-            }
+void emv_pk_store_free(struct emv_pk_store *store) {
+    if (!store)
+        return;
+
+    if (!store->map) {
+        for (size_t i = 0; i < store->count; i++)
+            free(store->keys[i].modulus);
+    }
+
+#ifndef _WIN32
+    if (store->mapped)
+        munmap(store->map, store->map_len);
+    else
+#endif
+        free(store->map);
+
+    free(store->keys);
+    free(store->verified);
+    free(store->table);
+    free(store);
+}
+
+static bool emv_pk_store_add(struct emv_pk_store *store, size_t *size, const struct emv_pk *pk) {
+    if (store->count == *size) {
+        size_t nsize = (*size) ? *size * 2 : 32;
+        struct emv_pk *keys = realloc(store->keys, nsize * sizeof(struct emv_pk));
+        if (!keys)
+            return false;
+        store->keys = keys;
+        *size = nsize;
+    }
+    store->keys[store->count++] = *pk;
+    return true;
+}
+
+static struct emv_pk_store *emv_pk_store_load_txt(FILE *f) {
+    struct emv_pk_store *store = calloc(1, sizeof(struct emv_pk_store));
+    if (!store)
+        return NULL;
+
+    size_t size = 0;
+    char buf[2048];
+    while (fgets(buf, sizeof(buf), f)) {
+        struct emv_pk *pk = emv_pk_parse_pk(buf);
+        if (!pk)
+            continue;
+
+        if (!emv_pk_store_add(store, &size, pk)) {
+            emv_pk_free(pk);
+            emv_pk_store_free(store);
+            return NULL;
+        }
+        // the store owns the modulus now
+        free(pk);
+    }
+    return store;
+}
+
+static uint32_t capk_get_le(const unsigned char *p, int len) {
+    uint32_t v = 0;
+    for (int i = len - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static void capk_put_le(unsigned char *p, uint32_t v, int len) {
+    for (int i = 0; i < len; i++, v >>= 8)
+        p[i] = v & 0xff;
+}
+
+static struct emv_pk_store *emv_pk_store_load_bin(FILE *f) {
+    if (fseek(f, 0, SEEK_END))
+        return NULL;
+    long fsize = ftell(f);
+    if (fsize < CAPK_BIN_HDR_LEN)
+        return NULL;
+    rewind(f);
+
+    struct emv_pk_store *store = calloc(1, sizeof(struct emv_pk_store));
+    if (!store)
+        return NULL;
+    store->map_len = fsize;
+
+#ifndef _WIN32
+    store->map = mmap(NULL, store->map_len, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (store->map == MAP_FAILED) {
+        store->map = NULL;
+    } else {
+        store->mapped = true;
+    }
+#endif
+    if (!store->map) {
+        store->map = malloc(store->map_len);
+        if (!store->map || fread(store->map, 1, store->map_len, f) != store->map_len) {
+            emv_pk_store_free(store);
+            return NULL;
         }
-    */
-    char *path;
-    if (searchFile(&path, RESOURCES_SUBDIR, "capk", ".txt", false) != PM3_SUCCESS) {
+    }
+
+    const unsigned char *m = store->map;
+    size_t count = capk_get_le(m + 12, 4);
+    if (memcmp(m, CAPK_BIN_MAGIC, 8)
+            || capk_get_le(m + 8, 4) != CAPK_BIN_VERSION
+            || count > (store->map_len - CAPK_BIN_HDR_LEN) / CAPK_BIN_KEY_LEN) {
+        PrintAndLogEx(ERR, "Error: not a valid binary CAPK store.");
+        emv_pk_store_free(store);
+        return NULL;
+    }
+
+    store->keys = calloc(count + 1, sizeof(struct emv_pk));
+    if (!store->keys) {
+        emv_pk_store_free(store);
         return NULL;
     }
-    pk = emv_pk_get_ca_pk_from_file(path, rid, idx);
-    free(path);
 
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char *r = m + CAPK_BIN_HDR_LEN + i * CAPK_BIN_KEY_LEN;
+        struct emv_pk *pk = &store->keys[i];
+        memcpy(pk->rid, r, 5);
+        pk->index = r[5];
+        memcpy(pk->serial, r + 6, 3);
+        memcpy(pk->pan, r + 9, 10);
+        pk->hash_algo = r[19];
+        pk->pk_algo = r[20];
+        memcpy(pk->hash, r + 21, 20);
+        memcpy(pk->exp, r + 41, 3);
+        pk->elen = r[44];
+        pk->mlen = capk_get_le(r + 45, 2);
+        pk->expire = capk_get_le(r + 47, 4);
+        size_t offset = capk_get_le(r + 51, 4);
+
+        if (pk->elen > 3 || offset > store->map_len || pk->mlen > store->map_len - offset) {
+            PrintAndLogEx(ERR, "Error: binary CAPK store is corrupted.");
+            emv_pk_store_free(store);
+            return NULL;
+        }
+        pk->modulus = store->map + offset;
+        store->count++;
+    }
+    return store;
+}
+
+// text capk file, or a binary store made by emv_pk_store_save()
+struct emv_pk_store *emv_pk_store_load(const char *fname) {
+    FILE *f = fopen(fname, "rb");
+    if (!f) {
+        PrintAndLogEx(ERR, "Error: can't open file %s.", fname);
+        return NULL;
+    }
+
+    char magic[8] = {0};
+    bool binary = (fread(magic, 1, sizeof(magic), f) == sizeof(magic)) && !memcmp(magic, CAPK_BIN_MAGIC, sizeof(magic));
+    rewind(f);
+
+    struct emv_pk_store *store = (binary) ? emv_pk_store_load_bin(f) : emv_pk_store_load_txt(f);
+    fclose(f);
+
+    if (store && !emv_pk_store_index(store)) {
+        emv_pk_store_free(store);
+        return NULL;
+    }
+    return store;
+}
+
+int emv_pk_store_save(const struct emv_pk_store *store, const char *fname) {
+    FILE *f = fopen(fname, "wb");
+    if (!f) {
+        PrintAndLogEx(ERR, "Error: can't create file %s.", fname);
+        return PM3_EFILE;
+    }
+
+    unsigned char hdr[CAPK_BIN_HDR_LEN] = {0};
+    memcpy(hdr, CAPK_BIN_MAGIC, 8);
+    capk_put_le(hdr + 8, CAPK_BIN_VERSION, 4);
+    capk_put_le(hdr + 12, store->count, 4);
+    fwrite(hdr, 1, sizeof(hdr), f);
+
+    size_t offset = CAPK_BIN_HDR_LEN + store->count * CAPK_BIN_KEY_LEN;
+    for (size_t i = 0; i < store->count; i++) {
+        const struct emv_pk *pk = &store->keys[i];
+        unsigned char r[CAPK_BIN_KEY_LEN] = {0};
+        memcpy(r, pk->rid, 5);
+        r[5] = pk->index;
+        memcpy(r + 6, pk->serial, 3);
+        memcpy(r + 9, pk->pan, 10);
+        r[19] = pk->hash_algo;
+        r[20] = pk->pk_algo;
+        memcpy(r + 21, pk->hash, 20);
+        memcpy(r + 41, pk->exp, 3);
+        r[44] = pk->elen;
+        capk_put_le(r + 45, pk->mlen, 2);
+        capk_put_le(r + 47, pk->expire, 4);
+        capk_put_le(r + 51, offset, 4);
+        fwrite(r, 1, sizeof(r), f);
+        offset += pk->mlen;
+    }
+
+    for (size_t i = 0; i < store->count; i++)
+        fwrite(store->keys[i].modulus, 1, store->keys[i].mlen, f);
+
+    int res = ferror(f) ? PM3_EFILE : PM3_SUCCESS;
+    fclose(f);
+    return res;
+}
+
+const struct emv_pk *emv_pk_store_find(const struct emv_pk_store *store, const unsigned char *rid, unsigned char idx, bool *verified) {
+    if (!store || !store->count)
+        return NULL;
+
+    size_t slot = emv_pk_store_hash(rid, idx) & (store->table_size - 1);
+    for (uint32_t k; (k = store->table[slot]) != 0; slot = (slot + 1) & (store->table_size - 1)) {
+        const struct emv_pk *pk = &store->keys[k - 1];
+        if (!memcmp(pk->rid, rid, 5) && pk->index == idx) {
+            if (verified)
+                *verified = store->verified[k - 1];
+            return pk;
+        }
+    }
+    return NULL;
+}
+
+size_t emv_pk_store_count(const struct emv_pk_store *store) {
+    return (store) ? store->count : 0;
+}
+
+const struct emv_pk *emv_pk_store_get(const struct emv_pk_store *store, size_t n, bool *verified) {
+    if (!store || n >= store->count)
+        return NULL;
+    if (verified)
+        *verified = store->verified[n];
+    return &store->keys[n];
+}
+
+static struct emv_pk_store *ca_store = NULL;
+static pthread_once_t ca_store_once = PTHREAD_ONCE_INIT;
+
+static time_t emv_pk_mtime(const char *path) {
+    struct stat st;
+    return (stat(path, &st) == 0) ? st.st_mtime : 0;
+}
+
+// capk.bin when there is one at least as recent as capk.txt, capk.txt otherwise
+static void emv_pk_load_ca_store(void) {
+    char *txt = NULL, *bin = NULL;
+    if (searchFile(&txt, RESOURCES_SUBDIR, "capk", ".txt", true) != PM3_SUCCESS)
+        txt = NULL;
+    if (searchFile(&bin, RESOURCES_SUBDIR, "capk", ".bin", true) != PM3_SUCCESS)
+        bin = NULL;
+
+    if (bin && (!txt || emv_pk_mtime(bin) >= emv_pk_mtime(txt)))
+        ca_store = emv_pk_store_load(bin);
+
+    if (!ca_store && txt)
+        ca_store = emv_pk_store_load(txt);
+
+    free(txt);
+    free(bin);
+}
+
+// the process wide CA key store, loaded on first use
+const struct emv_pk_store *emv_pk_get_ca_store(void) {
+    pthread_once(&ca_store_once, emv_pk_load_ca_store);
+    return ca_store;
+}
+
+struct emv_pk *emv_pk_get_ca_pk(const unsigned char *rid, unsigned char idx) {
+    bool verified = false;
+    const struct emv_pk *pk = emv_pk_store_find(emv_pk_get_ca_store(), rid, idx, &verified);
     if (!pk)
         return NULL;
 
@@ -504,12 +796,11 @@ struct emv_pk *emv_pk_get_ca_pk(const unsigned char *rid, unsigned char idx) {
            pk->index,
            pk->mlen * 8);
 
-    if (emv_pk_verify(pk)) {
+    if (verified) {
         printf("OK\n");
-        return pk;
+        return emv_pk_dup(pk);
     }
 
     printf("Failed!\n");
-    emv_pk_free(pk);
     return NULL;
 }
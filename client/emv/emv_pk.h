@@ -44,4 +44,14 @@ bool emv_pk_verify(const struct emv_pk *pk);
 char *emv_pk_get_ca_pk_file(const char *dirname, const unsigned char *rid, unsigned char idx);
 char *emv_pk_get_ca_pk_rid_file(const char *dirname, const unsigned char *rid);
 struct emv_pk *emv_pk_get_ca_pk(const unsigned char *rid, unsigned char idx);
+struct emv_pk *emv_pk_dup(const struct emv_pk *pk);
+
+struct emv_pk_store;
+struct emv_pk_store *emv_pk_store_load(const char *fname);
+int emv_pk_store_save(const struct emv_pk_store *store, const char *fname);
+void emv_pk_store_free(struct emv_pk_store *store);
+const struct emv_pk *emv_pk_store_find(const struct emv_pk_store *store, const unsigned char *rid, unsigned char idx, bool *verified);
+size_t emv_pk_store_count(const struct emv_pk_store *store);
+const struct emv_pk *emv_pk_store_get(const struct emv_pk_store *store, size_t n, bool *verified);
+const struct emv_pk_store *emv_pk_get_ca_store(void);
 #endif
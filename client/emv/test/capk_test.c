@@ -0,0 +1,138 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) 2019 Proxmark3 contributors
+//
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// CA public key store tests
+//-----------------------------------------------------------------------------
+
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200809L                 // need for mkstemp()
+#endif
+
+#include "capk_test.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "../emv_pk.h"
+#include "fileutils.h"
+#include "ui.h"
+#include "pm3_cmd.h"
+
+static bool capk_test_same(const struct emv_pk *a, const struct emv_pk *b) {
+    return memcmp(a->rid, b->rid, sizeof(a->rid)) == 0 &&
+           a->index == b->index &&
+           memcmp(a->serial, b->serial, sizeof(a->serial)) == 0 &&
+           memcmp(a->pan, b->pan, sizeof(a->pan)) == 0 &&
+           a->hash_algo == b->hash_algo &&
+           a->pk_algo == b->pk_algo &&
+           memcmp(a->hash, b->hash, sizeof(a->hash)) == 0 &&
+           a->elen == b->elen &&
+           memcmp(a->exp, b->exp, a->elen) == 0 &&
+           a->mlen == b->mlen &&
+           memcmp(a->modulus, b->modulus, a->mlen) == 0 &&
+           a->expire == b->expire;
+}
+
+// every key of the text store must come back unchanged from the binary store
+static int capk_test_roundtrip(struct emv_pk_store *txt, const char *binpath, bool verbose) {
+    if (emv_pk_store_save(txt, binpath) != PM3_SUCCESS)
+        return 1;
+
+    struct emv_pk_store *bin = emv_pk_store_load(binpath);
+    if (bin == NULL)
+        return 1;
+
+    int ret = 0;
+    size_t count = emv_pk_store_count(txt);
+    if (emv_pk_store_count(bin) != count) {
+        fprintf(stderr, "CAPK store: key count mismatch %zu != %zu\n", emv_pk_store_count(bin), count);
+        ret = 1;
+    }
+
+    for (size_t i = 0; ret == 0 && i < count; i++) {
+        bool v1 = false, v2 = false;
+        const struct emv_pk *a = emv_pk_store_get(txt, i, &v1);
+        const struct emv_pk *b = emv_pk_store_get(bin, i, &v2);
+        if (b == NULL || v1 != v2 || capk_test_same(a, b) == false) {
+            fprintf(stderr, "CAPK store: key %zu differs\n", i);
+            ret = 1;
+            break;
+        }
+
+        // indexed lookup has to agree with the load order, first key wins
+        const struct emv_pk *f = emv_pk_store_find(bin, a->rid, a->index, &v2);
+        if (f == NULL || f->rid[4] != a->rid[4] || f->index != a->index) {
+            fprintf(stderr, "CAPK store: lookup of key %zu failed\n", i);
+            ret = 1;
+        }
+    }
+
+    const unsigned char norid[5] = {0xff, 0xff, 0xff, 0xff, 0xff};
+    if (ret == 0 && emv_pk_store_find(bin, norid, 0xff, NULL) != NULL) {
+        fprintf(stderr, "CAPK store: found a key that does not exist\n");
+        ret = 1;
+    }
+
+    if (verbose && ret == 0)
+        printf("CAPK store: %zu keys round-tripped through %s\n", count, binpath);
+
+    emv_pk_store_free(bin);
+    return ret;
+}
+
+int exec_capk_test(bool verbose) {
+    fprintf(stdout, "\n");
+
+    char *txtpath = NULL;
+    if (searchFile(&txtpath, RESOURCES_SUBDIR, "capk", ".txt", true) != PM3_SUCCESS) {
+        fprintf(stdout, "CAPK store test: capk.txt not found, skipped\n");
+        return 0;
+    }
+
+    struct emv_pk_store *txt = emv_pk_store_load(txtpath);
+    free(txtpath);
+    if (txt == NULL || emv_pk_store_count(txt) == 0) {
+        fprintf(stderr, "CAPK store test: failed to load capk.txt\n");
+        emv_pk_store_free(txt);
+        return 1;
+    }
+
+    // the binary store goes to a temporary file, removed again below
+    char binpath[FILE_PATH_SIZE] = {0};
+#ifndef _WIN32
+    const char *tmpdir = getenv("TMPDIR");
+    snprintf(binpath, sizeof(binpath), "%s/capk_test_XXXXXX", (tmpdir && tmpdir[0]) ? tmpdir : "/tmp");
+    int fd = mkstemp(binpath);
+    if (fd < 0) {
+        fprintf(stderr, "CAPK store test: can't create a temporary file\n");
+        emv_pk_store_free(txt);
+        return 1;
+    }
+    close(fd);
+#else
+    if (tmpnam(binpath) == NULL) {
+        fprintf(stderr, "CAPK store test: can't create a temporary file\n");
+        emv_pk_store_free(txt);
+        return 1;
+    }
+#endif
+
+    int ret = capk_test_roundtrip(txt, binpath, verbose);
+    remove(binpath);
+    emv_pk_store_free(txt);
+
+    if (ret) {
+        fprintf(stderr, "CAPK store test: failed\n");
+        return ret;
+    }
+    fprintf(stdout, "CAPK store test: passed\n");
+    return 0;
+}
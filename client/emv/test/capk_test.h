@@ -0,0 +1,17 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) 2019 Proxmark3 contributors
+//
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// CA public key store tests
+//-----------------------------------------------------------------------------
+
+#ifndef __CAPK_TEST_H
+#define __CAPK_TEST_H
+
+#include <stdbool.h>
+
+int exec_capk_test(bool verbose);
+#endif
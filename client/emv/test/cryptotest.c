@@ -30,6 +30,8 @@
 #include "sda_test.h"
 #include "dda_test.h"
 #include "cda_test.h"
+#include "capk_test.h"
+#include "tlv_test.h"
 #include "crypto/libpcrypto.h"
 #include "emv/emv_roca.h"
 
@@ -94,6 +96,12 @@ int ExecuteCryptoTests(bool verbose) {
     res = exec_cda_test(verbose);
     if (res) TestFail = true;
 
+    res = exec_capk_test(verbose);
+    if (res) TestFail = true;
+
+    res = exec_tlv_test(verbose);
+    if (res) TestFail = true;
+
     res = exec_crypto_test(verbose);
     if (res) TestFail = true;
 
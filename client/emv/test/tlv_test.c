@@ -0,0 +1,338 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) 2019 Proxmark3 contributors
+//
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// TLV database tests and benchmark
+//
+// A recorded card session (PPSE, SELECT, GPO, READ RECORD, GENERATE AC, the
+// records carry the static data of the CDA test) is loaded into a tlvdb the
+// way `emv exec` does it, and every lookup is checked against a plain walk
+// over the tree through the public element API.
+//-----------------------------------------------------------------------------
+
+#include "tlv_test.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "../tlv.h"
+#include "util_posix.h"
+
+static const unsigned char tlv_ppse[] = {
+    0x6f, 0x2f, 0x84, 0x0e, 0x32, 0x50, 0x41, 0x59, 0x2e, 0x53, 0x59, 0x53, 0x2e, 0x44, 0x44, 0x46,
+    0x30, 0x31, 0xa5, 0x1d, 0xbf, 0x0c, 0x1a, 0x61, 0x18, 0x4f, 0x07, 0xa0, 0x00, 0x00, 0x00, 0x04,
+    0x10, 0x10, 0x50, 0x0a, 0x4d, 0x41, 0x53, 0x54, 0x45, 0x52, 0x43, 0x41, 0x52, 0x44, 0x87, 0x01,
+    0x01,
+};
+
+static const unsigned char tlv_select[] = {
+    0x6f, 0x4d, 0x84, 0x07, 0xa0, 0x00, 0x00, 0x00, 0x04, 0x10, 0x10, 0xa5, 0x42, 0x50, 0x0a, 0x4d,
+    0x41, 0x53, 0x54, 0x45, 0x52, 0x43, 0x41, 0x52, 0x44, 0x87, 0x01, 0x01, 0x9f, 0x38, 0x18, 0x9f,
+    0x66, 0x04, 0x9f, 0x02, 0x06, 0x9f, 0x03, 0x06, 0x9f, 0x1a, 0x02, 0x95, 0x05, 0x5f, 0x2a, 0x02,
+    0x9a, 0x03, 0x9c, 0x01, 0x9f, 0x37, 0x04, 0x5f, 0x2d, 0x02, 0x65, 0x6e, 0xbf, 0x0c, 0x10, 0x9f,
+    0x4d, 0x02, 0x0b, 0x0a, 0x9f, 0x6e, 0x08, 0x08, 0x40, 0x00, 0x00, 0x30, 0x30, 0x00, 0x00,
+};
+
+static const unsigned char tlv_gpo[] = {
+    0x77, 0x0e, 0x82, 0x02, 0x19, 0x80, 0x94, 0x08, 0x08, 0x01, 0x01, 0x00, 0x10, 0x01, 0x03, 0x01,
+};
+
+static const unsigned char tlv_rec1[] = {
+    0x70, 0x81, 0x81, 0x5f, 0x25, 0x03, 0x14, 0x05, 0x01, 0x5f, 0x24, 0x03, 0x15, 0x06, 0x30, 0x5a,
+    0x08, 0x52, 0x85, 0x88, 0x12, 0x54, 0x34, 0x56, 0x53, 0x5f, 0x34, 0x01, 0x01, 0x8e, 0x0c, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1e, 0x03, 0x1f, 0x03, 0x9f, 0x07, 0x02, 0xff, 0x00,
+    0x9f, 0x0d, 0x05, 0xbc, 0x50, 0xbc, 0x00, 0x00, 0x9f, 0x0e, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x9f, 0x0f, 0x05, 0xbc, 0x70, 0xbc, 0x98, 0x00, 0x9f, 0x4a, 0x01, 0x82, 0x5f, 0x28, 0x02, 0x06,
+    0x43, 0x8c, 0x21, 0x9f, 0x02, 0x06, 0x9f, 0x03, 0x06, 0x9f, 0x1a, 0x02, 0x95, 0x05, 0x5f, 0x2a,
+    0x02, 0x9a, 0x03, 0x9c, 0x01, 0x9f, 0x37, 0x04, 0x9f, 0x35, 0x01, 0x9f, 0x45, 0x02, 0x9f, 0x4c,
+    0x08, 0x9f, 0x34, 0x03, 0x8d, 0x0c, 0x91, 0x0a, 0x8a, 0x02, 0x95, 0x05, 0x9f, 0x37, 0x04, 0x9f,
+    0x4c, 0x08, 0x39, 0x00,
+};
+
+static const unsigned char tlv_rec2[] = {
+    0x70, 0x81, 0xe0, 0x8f, 0x01, 0x05, 0x90, 0x81, 0xb0, 0x03, 0x0a, 0x11, 0x18, 0x1f, 0x26, 0x2d,
+    0x34, 0x3b, 0x42, 0x49, 0x50, 0x57, 0x5e, 0x65, 0x6c, 0x73, 0x7a, 0x81, 0x88, 0x8f, 0x96, 0x9d,
+    0xa4, 0xab, 0xb2, 0xb9, 0xc0, 0xc7, 0xce, 0xd5, 0xdc, 0xe3, 0xea, 0xf1, 0xf8, 0xff, 0x06, 0x0d,
+    0x14, 0x1b, 0x22, 0x29, 0x30, 0x37, 0x3e, 0x45, 0x4c, 0x53, 0x5a, 0x61, 0x68, 0x6f, 0x76, 0x7d,
+    0x84, 0x8b, 0x92, 0x99, 0xa0, 0xa7, 0xae, 0xb5, 0xbc, 0xc3, 0xca, 0xd1, 0xd8, 0xdf, 0xe6, 0xed,
+    0xf4, 0xfb, 0x02, 0x09, 0x10, 0x17, 0x1e, 0x25, 0x2c, 0x33, 0x3a, 0x41, 0x48, 0x4f, 0x56, 0x5d,
+    0x64, 0x6b, 0x72, 0x79, 0x80, 0x87, 0x8e, 0x95, 0x9c, 0xa3, 0xaa, 0xb1, 0xb8, 0xbf, 0xc6, 0xcd,
+    0xd4, 0xdb, 0xe2, 0xe9, 0xf0, 0xf7, 0xfe, 0x05, 0x0c, 0x13, 0x1a, 0x21, 0x28, 0x2f, 0x36, 0x3d,
+    0x44, 0x4b, 0x52, 0x59, 0x60, 0x67, 0x6e, 0x75, 0x7c, 0x83, 0x8a, 0x91, 0x98, 0x9f, 0xa6, 0xad,
+    0xb4, 0xbb, 0xc2, 0xc9, 0xd0, 0xd7, 0xde, 0xe5, 0xec, 0xf3, 0xfa, 0x01, 0x08, 0x0f, 0x16, 0x1d,
+    0x24, 0x2b, 0x32, 0x39, 0x40, 0x47, 0x4e, 0x55, 0x5c, 0x63, 0x6a, 0x71, 0x78, 0x7f, 0x86, 0x8d,
+    0x94, 0x9b, 0xa2, 0xa9, 0xb0, 0xb7, 0xbe, 0xc5, 0xcc, 0x9f, 0x32, 0x01, 0x03, 0x92, 0x24, 0x09,
+    0x10, 0x17, 0x1e, 0x25, 0x2c, 0x33, 0x3a, 0x41, 0x48, 0x4f, 0x56, 0x5d, 0x64, 0x6b, 0x72, 0x79,
+    0x80, 0x87, 0x8e, 0x95, 0x9c, 0xa3, 0xaa, 0xb1, 0xb8, 0xbf, 0xc6, 0xcd, 0xd4, 0xdb, 0xe2, 0xe9,
+    0xf0, 0xf7, 0xfe,
+};
+
+static const unsigned char tlv_rec3[] = {
+    0x70, 0x81, 0xc8, 0x9f, 0x46, 0x81, 0xb0, 0x0b, 0x12, 0x19, 0x20, 0x27, 0x2e, 0x35, 0x3c, 0x43,
+    0x4a, 0x51, 0x58, 0x5f, 0x66, 0x6d, 0x74, 0x7b, 0x82, 0x89, 0x90, 0x97, 0x9e, 0xa5, 0xac, 0xb3,
+    0xba, 0xc1, 0xc8, 0xcf, 0xd6, 0xdd, 0xe4, 0xeb, 0xf2, 0xf9, 0x00, 0x07, 0x0e, 0x15, 0x1c, 0x23,
+    0x2a, 0x31, 0x38, 0x3f, 0x46, 0x4d, 0x54, 0x5b, 0x62, 0x69, 0x70, 0x77, 0x7e, 0x85, 0x8c, 0x93,
+    0x9a, 0xa1, 0xa8, 0xaf, 0xb6, 0xbd, 0xc4, 0xcb, 0xd2, 0xd9, 0xe0, 0xe7, 0xee, 0xf5, 0xfc, 0x03,
+    0x0a, 0x11, 0x18, 0x1f, 0x26, 0x2d, 0x34, 0x3b, 0x42, 0x49, 0x50, 0x57, 0x5e, 0x65, 0x6c, 0x73,
+    0x7a, 0x81, 0x88, 0x8f, 0x96, 0x9d, 0xa4, 0xab, 0xb2, 0xb9, 0xc0, 0xc7, 0xce, 0xd5, 0xdc, 0xe3,
+    0xea, 0xf1, 0xf8, 0xff, 0x06, 0x0d, 0x14, 0x1b, 0x22, 0x29, 0x30, 0x37, 0x3e, 0x45, 0x4c, 0x53,
+    0x5a, 0x61, 0x68, 0x6f, 0x76, 0x7d, 0x84, 0x8b, 0x92, 0x99, 0xa0, 0xa7, 0xae, 0xb5, 0xbc, 0xc3,
+    0xca, 0xd1, 0xd8, 0xdf, 0xe6, 0xed, 0xf4, 0xfb, 0x02, 0x09, 0x10, 0x17, 0x1e, 0x25, 0x2c, 0x33,
+    0x3a, 0x41, 0x48, 0x4f, 0x56, 0x5d, 0x64, 0x6b, 0x72, 0x79, 0x80, 0x87, 0x8e, 0x95, 0x9c, 0xa3,
+    0xaa, 0xb1, 0xb8, 0xbf, 0xc6, 0xcd, 0xd4, 0x9f, 0x47, 0x01, 0x03, 0x9f, 0x49, 0x03, 0x9f, 0x37,
+    0x04, 0x5f, 0x30, 0x02, 0x02, 0x01, 0x9f, 0x42, 0x02, 0x09, 0x78,
+};
+
+static const unsigned char tlv_genac[] = {
+    0x77, 0x81, 0xd2, 0x9f, 0x27, 0x01, 0x40, 0x9f, 0x36, 0x02, 0x00, 0x10, 0x9f, 0x4b, 0x81, 0xb0,
+    0x11, 0x18, 0x1f, 0x26, 0x2d, 0x34, 0x3b, 0x42, 0x49, 0x50, 0x57, 0x5e, 0x65, 0x6c, 0x73, 0x7a,
+    0x81, 0x88, 0x8f, 0x96, 0x9d, 0xa4, 0xab, 0xb2, 0xb9, 0xc0, 0xc7, 0xce, 0xd5, 0xdc, 0xe3, 0xea,
+    0xf1, 0xf8, 0xff, 0x06, 0x0d, 0x14, 0x1b, 0x22, 0x29, 0x30, 0x37, 0x3e, 0x45, 0x4c, 0x53, 0x5a,
+    0x61, 0x68, 0x6f, 0x76, 0x7d, 0x84, 0x8b, 0x92, 0x99, 0xa0, 0xa7, 0xae, 0xb5, 0xbc, 0xc3, 0xca,
+    0xd1, 0xd8, 0xdf, 0xe6, 0xed, 0xf4, 0xfb, 0x02, 0x09, 0x10, 0x17, 0x1e, 0x25, 0x2c, 0x33, 0x3a,
+    0x41, 0x48, 0x4f, 0x56, 0x5d, 0x64, 0x6b, 0x72, 0x79, 0x80, 0x87, 0x8e, 0x95, 0x9c, 0xa3, 0xaa,
+    0xb1, 0xb8, 0xbf, 0xc6, 0xcd, 0xd4, 0xdb, 0xe2, 0xe9, 0xf0, 0xf7, 0xfe, 0x05, 0x0c, 0x13, 0x1a,
+    0x21, 0x28, 0x2f, 0x36, 0x3d, 0x44, 0x4b, 0x52, 0x59, 0x60, 0x67, 0x6e, 0x75, 0x7c, 0x83, 0x8a,
+    0x91, 0x98, 0x9f, 0xa6, 0xad, 0xb4, 0xbb, 0xc2, 0xc9, 0xd0, 0xd7, 0xde, 0xe5, 0xec, 0xf3, 0xfa,
+    0x01, 0x08, 0x0f, 0x16, 0x1d, 0x24, 0x2b, 0x32, 0x39, 0x40, 0x47, 0x4e, 0x55, 0x5c, 0x63, 0x6a,
+    0x71, 0x78, 0x7f, 0x86, 0x8d, 0x94, 0x9b, 0xa2, 0xa9, 0xb0, 0xb7, 0xbe, 0xc5, 0xcc, 0xd3, 0xda,
+    0x9f, 0x10, 0x12, 0x00, 0x10, 0x90, 0x40, 0x01, 0x22, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xff,
+};
+
+static const struct {
+    const unsigned char *buf;
+    size_t len;
+} tlv_session[] = {
+    {tlv_ppse,   sizeof(tlv_ppse)},
+    {tlv_select, sizeof(tlv_select)},
+    {tlv_gpo,    sizeof(tlv_gpo)},
+    {tlv_rec1,   sizeof(tlv_rec1)},
+    {tlv_rec2,   sizeof(tlv_rec2)},
+    {tlv_rec3,   sizeof(tlv_rec3)},
+    {tlv_genac,  sizeof(tlv_genac)},
+};
+
+#define TLV_TEST_MAX_TAGS 128
+
+// tags which are not in the session
+static const tlv_tag_t tlv_absent[] = {0x9f99, 0xdf01, 0x56, 0x9f7c};
+
+static struct tlvdb *tlv_test_session(void) {
+    const char *alr = "Root terminal TLV tree";
+    struct tlvdb *root = tlvdb_fixed(1, strlen(alr), (const unsigned char *)alr);
+
+    tlvdb_change_or_add_node(root, 0x9f02, 6, (const unsigned char *)"\x00\x00\x00\x00\x01\x00");
+    tlvdb_change_or_add_node(root, 0x9f1a, 2, (const unsigned char *)"\x06\x43");
+    tlvdb_change_or_add_node(root, 0x9f37, 4, (const unsigned char *)"\x12\x34\x57\x79");
+
+    for (size_t i = 0; i < sizeof(tlv_session) / sizeof(tlv_session[0]); i++) {
+        struct tlvdb *t = tlvdb_parse_multi(tlv_session[i].buf, tlv_session[i].len);
+        if (!t) {
+            tlvdb_free(root);
+            return NULL;
+        }
+        tlvdb_add(root, t);
+    }
+
+    return root;
+}
+
+// reference lookups, the plain tree walks
+static struct tlvdb *ref_next(struct tlvdb *tlvdb) {
+    if (tlvdb_elm_get_children(tlvdb))
+        return tlvdb_elm_get_children(tlvdb);
+
+    while (tlvdb) {
+        if (tlvdb_elm_get_next(tlvdb))
+            return tlvdb_elm_get_next(tlvdb);
+
+        tlvdb = tlvdb_elm_get_parent(tlvdb);
+    }
+
+    return NULL;
+}
+
+static const struct tlv *ref_get(struct tlvdb *tlvdb, tlv_tag_t tag, const struct tlv *prev) {
+    if (prev)
+        tlvdb = ref_next((struct tlvdb *)prev);
+
+    for (; tlvdb; tlvdb = ref_next(tlvdb)) {
+        if (tlvdb_get_tlv(tlvdb)->tag == tag)
+            return tlvdb_get_tlv(tlvdb);
+    }
+
+    return NULL;
+}
+
+static struct tlvdb *ref_find_full(struct tlvdb *tlvdb, tlv_tag_t tag) {
+    for (; tlvdb; tlvdb = tlvdb_elm_get_next(tlvdb)) {
+        if (tlvdb_get_tlv(tlvdb)->tag == tag)
+            return tlvdb;
+
+        struct tlvdb *ch = ref_find_full(tlvdb_elm_get_children(tlvdb), tag);
+        if (ch)
+            return ch;
+    }
+
+    return NULL;
+}
+
+struct tlv_tags {
+    tlv_tag_t tag[TLV_TEST_MAX_TAGS];
+    size_t count;
+};
+
+static bool tlv_test_collect(void *data, const struct tlv *tlv, int level, bool is_leaf) {
+    struct tlv_tags *tags = data;
+    for (size_t i = 0; i < tags->count; i++)
+        if (tags->tag[i] == tlv->tag)
+            return true;
+
+    if (tags->count < TLV_TEST_MAX_TAGS)
+        tags->tag[tags->count++] = tlv->tag;
+    return true;
+}
+
+static int tlv_test_lookups(struct tlvdb *root, const struct tlv_tags *tags, bool verbose) {
+    for (size_t i = 0; i < tags->count; i++) {
+        tlv_tag_t tag = tags->tag[i];
+
+        if (tlvdb_find_full(root, tag) != ref_find_full(root, tag)) {
+            fprintf(stderr, "TLV db: tlvdb_find_full(%04x) differs\n", tag);
+            return 1;
+        }
+
+        // every occurrence, in order
+        const struct tlv *a = NULL, *b = NULL;
+        do {
+            a = tlvdb_get(root, tag, a);
+            b = ref_get(root, tag, b);
+            if (a != b) {
+                fprintf(stderr, "TLV db: tlvdb_get(%04x) differs\n", tag);
+                return 1;
+            }
+        } while (a);
+
+        // from inside the tree
+        struct tlvdb *elm = ref_find_full(root, tag);
+        if (elm && tlvdb_get_inchild(elm, 0x9f37, NULL) != ref_get(tlvdb_elm_get_children(elm), 0x9f37, NULL)) {
+            fprintf(stderr, "TLV db: tlvdb_get_inchild(%04x) differs\n", tag);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int tlv_test_index(bool verbose) {
+    struct tlvdb *root = tlv_test_session();
+    if (!root) {
+        fprintf(stderr, "TLV db: failed to parse the session\n");
+        return 1;
+    }
+
+    struct tlv_tags tags = {{0}, 0};
+    tlvdb_visit(root, tlv_test_collect, &tags, 0);
+    for (size_t i = 0; i < sizeof(tlv_absent) / sizeof(tlv_absent[0]); i++)
+        tags.tag[tags.count++] = tlv_absent[i];
+
+    int ret = tlv_test_lookups(root, &tags, verbose);
+
+    // change nodes in the middle of parsed trees
+    if (!ret) {
+        tlvdb_change_or_add_node(root, 0x9f36, 2, (const unsigned char *)"\x00\x11");
+        tlvdb_change_or_add_node(root, 0x9f4d, 2, (const unsigned char *)"\x0c\x0a");
+        tlvdb_change_or_add_node(root, 0x9f7c, 1, (const unsigned char *)"\x01");
+
+        const struct tlv *atc = tlvdb_get(root, 0x9f36, NULL);
+        if (!atc || atc->len != 2 || atc->value[1] != 0x11) {
+            fprintf(stderr, "TLV db: changed node not found\n");
+            ret = 1;
+        } else {
+            ret = tlv_test_lookups(root, &tags, verbose);
+        }
+    }
+
+    // and append inside one
+    if (!ret) {
+        tlvdb_add(tlvdb_elm_get_children(tlvdb_find_full(root, 0x77)), tlvdb_fixed(0x9f26, 8, (const unsigned char *)"\x01\x02\x03\x04\x05\x06\x07\x08"));
+        tags.tag[tags.count++] = 0x9f26;
+        ret = tlv_test_lookups(root, &tags, verbose);
+    }
+
+    if (!ret && verbose)
+        printf("TLV db: %zu tags checked\n", tags.count);
+
+    tlvdb_free(root);
+    return ret;
+}
+
+// a transaction looks the card data up a few hundred times
+#define TLV_BENCH_PASSES 10
+
+static uint64_t tlv_test_bench(const struct tlv_tags *tags, int rounds, int mode) {
+    uint64_t start = usclock();
+    size_t found = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        struct tlvdb *root = tlv_test_session();
+        for (int p = 0; mode && p < TLV_BENCH_PASSES; p++) {
+            for (size_t i = 0; i < tags->count; i++) {
+                if (mode == 1)
+                    found += tlvdb_get(root, tags->tag[i], NULL) != NULL;
+                else
+                    found += ref_get(root, tags->tag[i], NULL) != NULL;
+            }
+        }
+        tlvdb_free(root);
+    }
+
+    uint64_t t = usclock() - start;
+    return (found || !mode) ? t : 0;
+}
+
+static int tlv_test_benchmark(bool verbose) {
+    const int rounds = 2000;
+
+    struct tlv_tags tags = {{0}, 0};
+    struct tlvdb *root = tlv_test_session();
+    if (!root)
+        return 1;
+    tlvdb_visit(root, tlv_test_collect, &tags, 0);
+    tlvdb_free(root);
+    for (size_t i = 0; i < sizeof(tlv_absent) / sizeof(tlv_absent[0]); i++)
+        tags.tag[tags.count++] = tlv_absent[i];
+
+    uint64_t tparse = tlv_test_bench(&tags, rounds, 0);
+    uint64_t tidx = tlv_test_bench(&tags, rounds, 1);
+    uint64_t tref = tlv_test_bench(&tags, rounds, 2);
+    tidx = tidx > tparse ? tidx - tparse : 0;
+    tref = tref > tparse ? tref - tparse : 0;
+
+    if (verbose) {
+        printf("TLV db benchmark: %d sessions, parse %u us\n", rounds, (unsigned int)tparse);
+        printf("TLV db benchmark: %zu lookups per session, indexed %u us, linear walk %u us\n",
+               tags.count * TLV_BENCH_PASSES, (unsigned int)tidx, (unsigned int)tref);
+    }
+
+    return 0;
+}
+
+int exec_tlv_test(bool verbose) {
+    int ret;
+    fprintf(stdout, "\n");
+
+    ret = tlv_test_index(verbose);
+    if (ret) {
+        fprintf(stderr, "TLV db test: failed\n");
+        return ret;
+    }
+    fprintf(stdout, "TLV db test: passed\n");
+
+    return tlv_test_benchmark(verbose);
+}
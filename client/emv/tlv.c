@@ -39,11 +39,14 @@
 //  const typeof( ((type *)0)->member ) *__mptr = (ptr);
 //        (type *)( (char *)__mptr - offsetof(type,member) );})
 
+struct tlvdb_arena;
+
 struct tlvdb {
     struct tlv tag;
     struct tlvdb *next;
     struct tlvdb *parent;
     struct tlvdb *children;
+    struct tlvdb_arena *arena;
 };
 
 struct tlvdb_root {
@@ -52,6 +55,27 @@ struct tlvdb_root {
     unsigned char buf[0];
 };
 
+// A parsed buffer lives in one allocation: the nodes in tree (pre-)order,
+// a tag -> node hash index, and the copy of the buffer the values point to.
+// Tree order means that walking the tree from node k visits nodes k..count-1
+// and then whatever has been appended after the last top level node.
+struct tlvdb_arena {
+    size_t count;
+    size_t refs;        // nodes not released by tlvdb_free yet
+    bool indexed;       // false once the tree has been changed in the middle
+    struct tlvdb *last; // last top level node
+    uint32_t *chain;    // next node with the same tag, idx + 1
+    uint32_t *table;    // tag -> first node with the tag, idx + 1
+    size_t table_mask;
+    unsigned char *buf;
+    struct tlvdb nodes[];
+};
+
+struct tlvdb_parser {
+    struct tlvdb_arena *arena; // NULL while counting the nodes
+    size_t count;
+};
+
 static tlv_tag_t tlv_parse_tag(const unsigned char **buf, size_t *len) {
     tlv_tag_t tag;
 
@@ -88,7 +112,7 @@ static size_t tlv_parse_len(const unsigned char **buf, size_t *len) {
         return l;
 
     size_t ll = l & ~ TLV_LEN_LONG;
-    if (ll > 5)
+    if (ll > 5 || ll > *len)
         return TLV_LEN_INVALID;
 
     l = 0;
@@ -115,135 +139,162 @@ bool tlv_parse_tl(const unsigned char **buf, size_t *len, struct tlv *tlv) {
     return true;
 }
 
-static struct tlvdb *tlvdb_parse_children(struct tlvdb *parent);
+static size_t tlvdb_tag_hash(tlv_tag_t tag) {
+    uint32_t h = tag * 2654435761u;
+    return h ^ (h >> 15);
+}
 
-static bool tlvdb_parse_one(struct tlvdb *tlvdb,
+static bool tlvdb_parse_one(struct tlvdb_parser *p,
                             struct tlvdb *parent,
                             const unsigned char **tmp,
-                            size_t *left) {
-    tlvdb->next = tlvdb->children = NULL;
-    tlvdb->parent = parent;
+                            size_t *left,
+                            struct tlvdb **node) {
+    struct tlv tlv;
 
-    tlvdb->tag.tag = tlv_parse_tag(tmp, left);
-    if (tlvdb->tag.tag == TLV_TAG_INVALID)
-        goto err;
+    tlv.tag = tlv_parse_tag(tmp, left);
+    if (tlv.tag == TLV_TAG_INVALID)
+        return false;
 
-    tlvdb->tag.len = tlv_parse_len(tmp, left);
-    if (tlvdb->tag.len == TLV_LEN_INVALID)
-        goto err;
+    tlv.len = tlv_parse_len(tmp, left);
+    if (tlv.len == TLV_LEN_INVALID)
+        return false;
 
-    if (tlvdb->tag.len > *left)
-        goto err;
+    if (tlv.len > *left)
+        return false;
 
-    tlvdb->tag.value = *tmp;
+    tlv.value = *tmp;
 
-    *tmp += tlvdb->tag.len;
-    *left -= tlvdb->tag.len;
+    *tmp += tlv.len;
+    *left -= tlv.len;
 
-    if (tlv_is_constructed(&tlvdb->tag) && (tlvdb->tag.len != 0)) {
-        tlvdb->children = tlvdb_parse_children(tlvdb);
-        if (!tlvdb->children)
-            goto err;
-    } else {
-        tlvdb->children = NULL;
+    struct tlvdb *tlvdb = NULL;
+    if (p->arena) {
+        tlvdb = &p->arena->nodes[p->count];
+        tlvdb->tag = tlv;
+        tlvdb->next = tlvdb->children = NULL;
+        tlvdb->parent = parent;
+        tlvdb->arena = p->arena;
+    }
+    p->count++;
+
+    if (tlv_is_constructed(&tlv) && (tlv.len != 0)) {
+        const unsigned char *ctmp = tlv.value;
+        size_t cleft = tlv.len;
+        struct tlvdb *prev = NULL;
+
+        while (cleft != 0) {
+            struct tlvdb *child = NULL;
+            if (!tlvdb_parse_one(p, tlvdb, &ctmp, &cleft, &child))
+                return false;
+
+            if (prev)
+                prev->next = child;
+            else if (tlvdb)
+                tlvdb->children = child;
+            prev = child;
+        }
     }
 
+    *node = tlvdb;
     return true;
-
-err:
-    return false;
 }
 
-static struct tlvdb *tlvdb_parse_children(struct tlvdb *parent) {
-    const unsigned char *tmp = parent->tag.value;
-    size_t left = parent->tag.len;
-    struct tlvdb *tlvdb, *first = NULL, *prev = NULL;
+static void tlvdb_arena_index(struct tlvdb_arena *arena) {
+    memset(arena->table, 0, (arena->table_mask + 1) * sizeof(uint32_t));
 
-    while (left != 0) {
-        tlvdb = malloc(sizeof(*tlvdb));
-        if (prev)
-            prev->next = tlvdb;
-        else
-            first = tlvdb;
-        prev = tlvdb;
-
-        if (!tlvdb_parse_one(tlvdb, parent, &tmp, &left))
-            goto err;
+    // backwards, so the head of every chain ends up being the first node
+    for (size_t i = arena->count; i-- > 0;) {
+        tlv_tag_t tag = arena->nodes[i].tag.tag;
+        size_t slot = tlvdb_tag_hash(tag) & arena->table_mask;
+        while (arena->table[slot] && arena->nodes[arena->table[slot] - 1].tag.tag != tag)
+            slot = (slot + 1) & arena->table_mask;
 
-        tlvdb->parent = parent;
+        arena->chain[i] = arena->table[slot];
+        arena->table[slot] = i + 1;
     }
 
-    return first;
+    arena->indexed = true;
+}
+
+// first node with the tag at or after node number start
+static struct tlvdb *tlvdb_arena_find(struct tlvdb_arena *arena, tlv_tag_t tag, size_t start) {
+    size_t slot = tlvdb_tag_hash(tag) & arena->table_mask;
+    for (uint32_t k; (k = arena->table[slot]) != 0; slot = (slot + 1) & arena->table_mask) {
+        if (arena->nodes[k - 1].tag.tag != tag)
+            continue;
 
-err:
-    tlvdb_free(first);
+        while (k && k - 1 < start)
+            k = arena->chain[k - 1];
+
+        return k ? &arena->nodes[k - 1] : NULL;
+    }
 
     return NULL;
 }
 
-struct tlvdb *tlvdb_parse(const unsigned char *buf, size_t len) {
-    struct tlvdb_root *root;
-    const unsigned char *tmp;
-    size_t left;
+static struct tlvdb *tlvdb_parse_arena(const unsigned char *buf, size_t len, bool multi) {
+    struct tlvdb_parser p = {NULL, 0};
+    struct tlvdb *tlvdb = NULL;
+    const unsigned char *tmp = buf;
+    size_t left = len;
 
     if (!len || !buf)
         return NULL;
 
-    root = malloc(sizeof(*root) + len);
-    root->len = len;
-    memcpy(root->buf, buf, len);
-
-    tmp = root->buf;
-    left = len;
-
-    if (!tlvdb_parse_one(&root->db, NULL, &tmp, &left))
-        goto err;
+    // count (and validate) first, so the tree fits in one allocation
+    do {
+        if (!tlvdb_parse_one(&p, NULL, &tmp, &left, &tlvdb))
+            return NULL;
+    } while (multi && left != 0);
 
     if (left)
-        goto err;
-
-    return &root->db;
-
-err:
-    tlvdb_free(&root->db);
-
-    return NULL;
-}
+        return NULL;
 
-struct tlvdb *tlvdb_parse_multi(const unsigned char *buf, size_t len) {
-    struct tlvdb_root *root;
-    const unsigned char *tmp;
-    size_t left;
+    size_t count = p.count;
+    size_t table_size = 16;
+    while (table_size < count * 2)
+        table_size <<= 1;
 
-    if (!len || !buf)
+    struct tlvdb_arena *arena = malloc(sizeof(*arena) +
+                                       count * sizeof(struct tlvdb) +
+                                       (count + table_size) * sizeof(uint32_t) +
+                                       len);
+    if (!arena)
         return NULL;
 
-    root = malloc(sizeof(*root) + len);
-    root->len = len;
-    memcpy(root->buf, buf, len);
-
-    tmp = root->buf;
+    arena->count = count;
+    arena->refs = count;
+    arena->chain = (uint32_t *)&arena->nodes[count];
+    arena->table = arena->chain + count;
+    arena->table_mask = table_size - 1;
+    arena->buf = (unsigned char *)(arena->table + table_size);
+    memcpy(arena->buf, buf, len);
+
+    p.arena = arena;
+    p.count = 0;
+    tmp = arena->buf;
     left = len;
 
-    if (!tlvdb_parse_one(&root->db, NULL, &tmp, &left))
-        goto err;
-
+    struct tlvdb *prev = NULL;
     while (left != 0) {
-        struct tlvdb *db = malloc(sizeof(*db));
-        if (!tlvdb_parse_one(db, NULL, &tmp, &left)) {
-            free(db);
-            goto err;
-        }
-
-        tlvdb_add(&root->db, db);
+        tlvdb_parse_one(&p, NULL, &tmp, &left, &tlvdb);
+        if (prev)
+            prev->next = tlvdb;
+        prev = tlvdb;
     }
+    arena->last = prev;
 
-    return &root->db;
+    tlvdb_arena_index(arena);
 
-err:
-    tlvdb_free(&root->db);
+    return &arena->nodes[0];
+}
 
-    return NULL;
+struct tlvdb *tlvdb_parse(const unsigned char *buf, size_t len) {
+    return tlvdb_parse_arena(buf, len, false);
+}
+
+struct tlvdb *tlvdb_parse_multi(const unsigned char *buf, size_t len) {
+    return tlvdb_parse_arena(buf, len, true);
 }
 
 struct tlvdb *tlvdb_fixed(tlv_tag_t tag, size_t len, const unsigned char *value) {
@@ -253,6 +304,7 @@ struct tlvdb *tlvdb_fixed(tlv_tag_t tag, size_t len, const unsigned char *value)
     memcpy(root->buf, value, len);
 
     root->db.parent = root->db.next = root->db.children = NULL;
+    root->db.arena = NULL;
     root->db.tag.tag = tag;
     root->db.tag.len = len;
     root->db.tag.value = root->buf;
@@ -266,6 +318,7 @@ struct tlvdb *tlvdb_external(tlv_tag_t tag, size_t len, const unsigned char *val
     root->len = 0;
 
     root->db.parent = root->db.next = root->db.children = NULL;
+    root->db.arena = NULL;
     root->db.tag.tag = tag;
     root->db.tag.len = len;
     root->db.tag.value = value;
@@ -282,7 +335,17 @@ void tlvdb_free(struct tlvdb *tlvdb) {
     for (; tlvdb; tlvdb = next) {
         next = tlvdb->next;
         tlvdb_free(tlvdb->children);
-        free(tlvdb);
+
+        struct tlvdb_arena *arena = tlvdb->arena;
+        if (!arena) {
+            free(tlvdb);
+            continue;
+        }
+
+        // parsed nodes go away together, with the last one released
+        arena->indexed = false;
+        if (--arena->refs == 0)
+            free(arena);
     }
 }
 
@@ -310,6 +373,17 @@ struct tlvdb *tlvdb_find_full(struct tlvdb *tlvdb, tlv_tag_t tag) {
         return NULL;
 
     for (; tlvdb; tlvdb = tlvdb->next) {
+        struct tlvdb_arena *arena = tlvdb->arena;
+        if (arena && arena->indexed && !tlvdb->parent) {
+            // from a top level node the search covers the rest of the arena
+            struct tlvdb *db = tlvdb_arena_find(arena, tag, tlvdb - arena->nodes);
+            if (db)
+                return db;
+
+            tlvdb = arena->last;
+            continue;
+        }
+
         if (tlvdb->tag.tag == tag)
             return tlvdb;
 
@@ -349,6 +423,10 @@ void tlvdb_add(struct tlvdb *tlvdb, struct tlvdb *other) {
         tlvdb = tlvdb->next;
     }
 
+    // appending inside a parsed tree changes its order
+    if (tlvdb->arena && tlvdb->parent)
+        tlvdb->arena->indexed = false;
+
     tlvdb->next = other;
 }
 
@@ -442,6 +520,16 @@ const struct tlv *tlvdb_get(const struct tlvdb *tlvdb, tlv_tag_t tag, const stru
 
 
     while (tlvdb) {
+        struct tlvdb_arena *arena = tlvdb->arena;
+        if (arena && arena->indexed) {
+            const struct tlvdb *db = tlvdb_arena_find(arena, tag, tlvdb - arena->nodes);
+            if (db)
+                return &db->tag;
+
+            tlvdb = arena->last->next;
+            continue;
+        }
+
         if (tlvdb->tag.tag == tag)
             return &tlvdb->tag;
 
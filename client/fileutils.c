@@ -102,8 +102,14 @@ static char *newfilenamemcopy(const char *preferredName, const char *suffix) {
 }
 
 int saveFile(const char *preferredName, const char *suffix, const void *data, size_t datalen) {
-
     if (data == NULL) return PM3_EINVARG;
+    return saveFileParts(preferredName, suffix, &data, &datalen, 1);
+}
+
+int saveFileParts(const char *preferredName, const char *suffix, const void *const data[], const size_t datalen[], size_t parts) {
+
+    for (size_t i = 0; i < parts; i++)
+        if (data[i] == NULL && datalen[i]) return PM3_EINVARG;
     char *fileName = newfilenamemcopy(preferredName, suffix);
     if (fileName == NULL) return PM3_EMALLOC;
 
@@ -116,10 +122,19 @@ int saveFile(const char *preferredName, const char *suffix, const void *data, si
         free(fileName);
         return PM3_EFILE;
     }
-    fwrite(data, 1, datalen, f);
-    fflush(f);
-    fclose(f);
-    PrintAndLogEx(SUCCESS, "saved %u bytes to binary file " _YELLOW_("%s"), datalen, fileName);
+    size_t total = 0;
+    bool ok = true;
+    for (size_t i = 0; i < parts && ok; i++) {
+        ok = (fwrite(data[i], 1, datalen[i], f) == datalen[i]);
+        total += datalen[i];
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+        PrintAndLogEx(WARNING, "could not write binary file " _YELLOW_("%s"), fileName);
+        free(fileName);
+        return PM3_EFILE;
+    }
+    PrintAndLogEx(SUCCESS, "saved %zu bytes to binary file " _YELLOW_("%s"), total, fileName);
     free(fileName);
     return PM3_SUCCESS;
 }
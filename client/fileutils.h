@@ -84,6 +84,19 @@ int fileExists(const char *filename);
  */
 int saveFile(const char *preferredName, const char *suffix, const void *data, size_t datalen);
 
+/**
+ * @brief Like saveFile, but writes several buffers one after the other, so large data split over
+ * several buffers doesn't need to be copied together first.
+ *
+ * @param preferredName
+ * @param suffix the file suffix. Including the ".".
+ * @param data array of the buffers to write
+ * @param datalen array of the lengths of the buffers
+ * @param parts number of buffers
+ * @return 0 for ok, 1 for failz
+ */
+int saveFileParts(const char *preferredName, const char *suffix, const void *const data[], const size_t datalen[], size_t parts);
+
 /**
  * @brief Utility function to save data to a textfile (EML). This method takes a preferred name, but if that
  * file already exists, it tries with another name until it finds something suitable.
@@ -9,16 +9,65 @@
 //-----------------------------------------------------------------------------
 #include "graph.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include "ui.h"
 #include "util.h"    //param_get32ex
 #include "lfdemod.h"
 #include "cmddata.h" //for g_debugmode
 
-int GraphBuffer[MAX_GRAPH_TRACE_LEN];
-size_t GraphTraceLen;
+static graph_state_t shared_graph_state;
+__thread graph_state_t *g_graph_state = &shared_graph_state;
 int s_Buff[MAX_GRAPH_TRACE_LEN];
 
+// private copy of the shared samples and demod buffer, free() when done
+graph_state_t *newGraphState(void) {
+    graph_state_t *state = calloc(1, sizeof(graph_state_t));
+    if (state == NULL)
+        return NULL;
+
+    loadGraphState(state);
+    return state;
+}
+
+// (re)load a private state from the shared one, so it can be reused for another run
+void loadGraphState(graph_state_t *state) {
+    if (state == &shared_graph_state)
+        return;
+
+    memcpy(state->graph, shared_graph_state.graph, shared_graph_state.graph_len * sizeof(int));
+    state->graph_len = shared_graph_state.graph_len;
+    memcpy(state->demod, shared_graph_state.demod, shared_graph_state.demod_len);
+    state->demod_len = shared_graph_state.demod_len;
+    state->demod_start_idx = shared_graph_state.demod_start_idx;
+    state->demod_clock = shared_graph_state.demod_clock;
+    state->demod_err_cnt = 0;
+    state->demod_num_bits = 0;
+    state->graph_saved = false;
+    state->demod_saved = false;
+}
+
+// select the state the calling thread works on, NULL selects the shared one
+void useGraphState(graph_state_t *state) {
+    g_graph_state = (state) ? state : &shared_graph_state;
+}
+
+// only the shared state drives the plot window (grid, cursors)
+bool isGraphStateShared(void) {
+    return g_graph_state == &shared_graph_state;
+}
+
+// copy the demod buffer of a private state back to the shared one, samples stay as they are
+void publishDemodBuffer(const graph_state_t *state) {
+    if (state == &shared_graph_state)
+        return;
+
+    memcpy(shared_graph_state.demod, state->demod, state->demod_len);
+    shared_graph_state.demod_len = state->demod_len;
+    shared_graph_state.demod_start_idx = state->demod_start_idx;
+    shared_graph_state.demod_clock = state->demod_clock;
+}
+
 /* write a manchester bit to the graph
 TODO,  verfy that this doesn't overflow buffer  (iceman)
 */
@@ -48,21 +97,20 @@ size_t ClearGraph(bool redraw) {
 }
 // option '1' to save GraphBuffer any other to restore
 void save_restoreGB(uint8_t saveOpt) {
-    static int SavedGB[MAX_GRAPH_TRACE_LEN];
-    static size_t SavedGBlen = 0;
-    static bool GB_Saved = false;
-    static int SavedGridOffsetAdj = 0;
+    graph_state_t *st = g_graph_state;
 
     if (saveOpt == GRAPH_SAVE) { //save
-        memcpy(SavedGB, GraphBuffer, sizeof(GraphBuffer));
-        SavedGBlen = GraphTraceLen;
-        GB_Saved = true;
-        SavedGridOffsetAdj = GridOffset;
-    } else if (GB_Saved) { //restore
-        memcpy(GraphBuffer, SavedGB, sizeof(GraphBuffer));
-        GraphTraceLen = SavedGBlen;
-        GridOffset = SavedGridOffsetAdj;
-        RepaintGraphWindow();
+        memcpy(st->saved_graph, GraphBuffer, sizeof(GraphBuffer));
+        st->saved_graph_len = GraphTraceLen;
+        st->graph_saved = true;
+        st->saved_grid_offset = GridOffset;
+    } else if (st->graph_saved) { //restore
+        memcpy(GraphBuffer, st->saved_graph, sizeof(GraphBuffer));
+        GraphTraceLen = st->saved_graph_len;
+        if (isGraphStateShared()) {
+            GridOffset = st->saved_grid_offset;
+            RepaintGraphWindow();
+        }
     }
 }
 
@@ -37,8 +37,50 @@ bool fskClocks(uint8_t *fc1, uint8_t *fc2, uint8_t *rf1, int *firstClockEdge);
 #define GRAPH_SAVE 1
 #define GRAPH_RESTORE 0
 
-extern int GraphBuffer[MAX_GRAPH_TRACE_LEN];
-extern size_t GraphTraceLen;
+#ifndef MAX_DEMOD_BUF_LEN
+#define MAX_DEMOD_BUF_LEN (1024*128)
+#endif
+
+// LF samples and demodulation results the lf / data commands work on.
+// All threads use the shared instance, which is the one the plot window shows, unless they
+// select a private copy with useGraphState(). `lf search` does that to run its demods concurrently.
+typedef struct {
+    int graph[MAX_GRAPH_TRACE_LEN];
+    size_t graph_len;
+    uint8_t demod[MAX_DEMOD_BUF_LEN];
+    size_t demod_len;
+    size_t demod_start_idx;
+    int demod_clock;
+    // errors / bits of the last raw demodulation, a rough quality measure
+    int demod_err_cnt;
+    size_t demod_num_bits;
+    // save_restoreGB / save_restoreDB slots
+    int saved_graph[MAX_GRAPH_TRACE_LEN];
+    size_t saved_graph_len;
+    bool graph_saved;
+    int saved_grid_offset;
+    uint8_t saved_demod[MAX_DEMOD_BUF_LEN];
+    size_t saved_demod_len;
+    bool demod_saved;
+    size_t saved_demod_start_idx;
+    int saved_demod_clock;
+} graph_state_t;
+
+extern __thread graph_state_t *g_graph_state;
+
+#define GraphBuffer     (g_graph_state->graph)
+#define GraphTraceLen   (g_graph_state->graph_len)
+#define DemodBuffer     (g_graph_state->demod)
+#define DemodBufferLen  (g_graph_state->demod_len)
+#define g_DemodStartIdx (g_graph_state->demod_start_idx)
+#define g_DemodClock    (g_graph_state->demod_clock)
+
+graph_state_t *newGraphState(void);
+void loadGraphState(graph_state_t *state);
+void useGraphState(graph_state_t *state);
+bool isGraphStateShared(void);
+void publishDemodBuffer(const graph_state_t *state);
+
 extern int s_Buff[MAX_GRAPH_TRACE_LEN];
 
 #endif
@@ -62,6 +62,13 @@ THE SOFTWARE.
 #include "util.h"
 #include "common.h"
 
+#if defined (__arm__) && defined (__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_NEON
+#define HWCAP_NEON (1 << 12)
+#endif
+#endif
+
 // bitslice type
 // while AVX supports 256 bit vector floating point operations, we need integer operations for boolean logic
 // same for AVX2 and 512 bit vectors
@@ -74,6 +81,8 @@ THE SOFTWARE.
 #define MAX_BITSLICES 128
 #elif defined(__SSE2__)
 #define MAX_BITSLICES 128
+#elif defined(__ARM_NEON)
+#define MAX_BITSLICES 128
 #else // MMX or SSE or NOSIMD
 #define MAX_BITSLICES 64
 #endif
@@ -118,6 +127,9 @@ typedef union {
 #elif defined (__MMX__)
 #define BITSLICE_TEST_NONCES bitslice_test_nonces_MMX
 #define CRACK_STATES_BITSLICED crack_states_bitsliced_MMX
+#elif defined (__ARM_NEON)
+#define BITSLICE_TEST_NONCES bitslice_test_nonces_NEON
+#define CRACK_STATES_BITSLICED crack_states_bitsliced_NEON
 #else
 #define BITSLICE_TEST_NONCES bitslice_test_nonces_NOSIMD
 #define CRACK_STATES_BITSLICED crack_states_bitsliced_NOSIMD
@@ -130,6 +142,7 @@ crack_states_bitsliced_t crack_states_bitsliced_AVX2;
 crack_states_bitsliced_t crack_states_bitsliced_AVX;
 crack_states_bitsliced_t crack_states_bitsliced_SSE2;
 crack_states_bitsliced_t crack_states_bitsliced_MMX;
+crack_states_bitsliced_t crack_states_bitsliced_NEON;
 crack_states_bitsliced_t crack_states_bitsliced_NOSIMD;
 crack_states_bitsliced_t crack_states_bitsliced_dispatch;
 
@@ -139,6 +152,7 @@ bitslice_test_nonces_t bitslice_test_nonces_AVX2;
 bitslice_test_nonces_t bitslice_test_nonces_AVX;
 bitslice_test_nonces_t bitslice_test_nonces_SSE2;
 bitslice_test_nonces_t bitslice_test_nonces_MMX;
+bitslice_test_nonces_t bitslice_test_nonces_NEON;
 bitslice_test_nonces_t bitslice_test_nonces_NOSIMD;
 bitslice_test_nonces_t bitslice_test_nonces_dispatch;
 
@@ -541,7 +555,7 @@ out:
 
 
 
-#ifndef __MMX__
+#if !defined(__MMX__) && !defined(__ARM_NEON)
 
 // pointers to functions:
 crack_states_bitsliced_t *crack_states_bitsliced_function_p = &crack_states_bitsliced_dispatch;
@@ -556,6 +570,69 @@ void SetSIMDInstr(SIMDExecInstr instr) {
     bitslice_test_nonces_function_p = &bitslice_test_nonces_dispatch;
 }
 
+SIMDExecInstr GetSIMDInstrSetting(void) {
+    return intSIMDInstr;
+}
+
+bool CPUSupportsNEON(void) {
+#if defined (__aarch64__)
+    return true;    // Advanced SIMD is mandatory on ARMv8-A
+#elif defined (__arm__) && defined (__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+    return false;
+#endif
+}
+
+bool SIMDInstrSupported(SIMDExecInstr instr) {
+    switch (instr) {
+        case SIMD_AUTO:
+        case SIMD_NONE:
+            return true;
+#if defined (__i386__) || defined (__x86_64__)
+#if !defined(__APPLE__) || (defined(__APPLE__) && (__clang_major__ > 8 || __clang_major__ == 8 && __clang_minor__ >= 1))
+#if (__GNUC__ >= 5) && (__GNUC__ > 5 || __GNUC_MINOR__ > 2)
+        case SIMD_AVX512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+        case SIMD_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case SIMD_AVX:
+            return __builtin_cpu_supports("avx");
+        case SIMD_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case SIMD_MMX:
+            return __builtin_cpu_supports("mmx");
+#endif
+#endif
+#if defined (COMPILER_HAS_SIMD_NEON)
+        case SIMD_NEON:
+            return CPUSupportsNEON();
+#endif
+        default:
+            return false;
+    }
+}
+
+const char *SIMDInstrName(SIMDExecInstr instr) {
+    switch (instr) {
+        case SIMD_AVX512:
+            return "AVX512F";
+        case SIMD_AVX2:
+            return "AVX2";
+        case SIMD_AVX:
+            return "AVX";
+        case SIMD_SSE2:
+            return "SSE2";
+        case SIMD_MMX:
+            return "MMX";
+        case SIMD_NEON:
+            return "NEON";
+        default:
+            return "no";
+    }
+}
+
 static SIMDExecInstr GetSIMDInstr() {
     SIMDExecInstr instr = SIMD_NONE;
 
@@ -573,7 +650,11 @@ static SIMDExecInstr GetSIMDInstr() {
     else
 #endif
 #endif
-        instr = SIMD_NONE;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) instr = SIMD_NEON;
+        else
+#endif
+            instr = SIMD_NONE;
 
     return instr;
 }
@@ -609,6 +690,11 @@ uint64_t crack_states_bitsliced_dispatch(uint32_t cuid, uint8_t *best_first_byte
             crack_states_bitsliced_function_p = &crack_states_bitsliced_MMX;
             break;
 #endif
+#endif
+#if defined (COMPILER_HAS_SIMD_NEON)
+        case SIMD_NEON:
+            crack_states_bitsliced_function_p = &crack_states_bitsliced_NEON;
+            break;
 #endif
         default:
             crack_states_bitsliced_function_p = &crack_states_bitsliced_NOSIMD;
@@ -641,6 +727,11 @@ void bitslice_test_nonces_dispatch(uint32_t nonces_to_bruteforce, uint32_t *bf_t
             bitslice_test_nonces_function_p = &bitslice_test_nonces_MMX;
             break;
 #endif
+#endif
+#if defined (COMPILER_HAS_SIMD_NEON)
+        case SIMD_NEON:
+            bitslice_test_nonces_function_p = &bitslice_test_nonces_NEON;
+            break;
 #endif
         default:
             bitslice_test_nonces_function_p = &bitslice_test_nonces_NOSIMD;
@@ -52,6 +52,9 @@ THE SOFTWARE.
 
 #include "hardnested_bruteforce.h" // statelist_t
 
+#include <stdbool.h>
+
+// COMPILER_HAS_SIMD_NEON is defined by the Makefile if the NEON variants are built (ARM only)
 typedef enum {
     SIMD_AUTO,
     SIMD_AVX512,
@@ -59,10 +62,15 @@ typedef enum {
     SIMD_AVX,
     SIMD_SSE2,
     SIMD_MMX,
+    SIMD_NEON,
     SIMD_NONE,
 } SIMDExecInstr;
 void SetSIMDInstr(SIMDExecInstr instr);
 SIMDExecInstr GetSIMDInstrAuto(void);
+SIMDExecInstr GetSIMDInstrSetting(void);
+bool CPUSupportsNEON(void);
+bool SIMDInstrSupported(SIMDExecInstr instr);
+const char *SIMDInstrName(SIMDExecInstr instr);
 
 uint64_t crack_states_bitsliced(uint32_t cuid, uint8_t *best_first_bytes, statelist_t *p, uint32_t *keys_found, uint64_t *num_keys_tested, uint32_t nonces_to_bruteforce, uint8_t *bf_test_nonce_2nd_byte, noncelist_t *nonces);
 void bitslice_test_nonces(uint32_t nonces_to_bruteforce, uint32_t *bf_test_nonce, uint8_t *bf_test_nonce_par);
@@ -17,6 +17,7 @@
 //
 
 #include "hardnested_bitarray_core.h"
+#include "hardnested_bf_core.h" // CPUSupportsNEON
 
 #include <stdint.h>
 #include <stdio.h>
@@ -97,6 +98,20 @@
 #define COUNT_BITARRAY_AND2 count_bitarray_AND2_MMX
 #define COUNT_BITARRAY_AND3 count_bitarray_AND3_MMX
 #define COUNT_BITARRAY_AND4 count_bitarray_AND4_MMX
+#elif defined (__ARM_NEON)
+#define MALLOC_BITARRAY malloc_bitarray_NEON
+#define FREE_BITARRAY free_bitarray_NEON
+#define BITCOUNT bitcount_NEON
+#define COUNT_STATES count_states_NEON
+#define BITARRAY_AND bitarray_AND_NEON
+#define BITARRAY_LOW20_AND bitarray_low20_AND_NEON
+#define COUNT_BITARRAY_AND count_bitarray_AND_NEON
+#define COUNT_BITARRAY_LOW20_AND count_bitarray_low20_AND_NEON
+#define BITARRAY_AND4 bitarray_AND4_NEON
+#define BITARRAY_OR bitarray_OR_NEON
+#define COUNT_BITARRAY_AND2 count_bitarray_AND2_NEON
+#define COUNT_BITARRAY_AND3 count_bitarray_AND3_NEON
+#define COUNT_BITARRAY_AND4 count_bitarray_AND4_NEON
 #else
 #define MALLOC_BITARRAY malloc_bitarray_NOSIMD
 #define FREE_BITARRAY free_bitarray_NOSIMD
@@ -116,31 +131,31 @@
 
 // typedefs and declaration of functions:
 typedef uint32_t *malloc_bitarray_t(uint32_t);
-malloc_bitarray_t malloc_bitarray_AVX512, malloc_bitarray_AVX2, malloc_bitarray_AVX, malloc_bitarray_SSE2, malloc_bitarray_MMX, malloc_bitarray_NOSIMD, malloc_bitarray_dispatch;
+malloc_bitarray_t malloc_bitarray_AVX512, malloc_bitarray_AVX2, malloc_bitarray_AVX, malloc_bitarray_SSE2, malloc_bitarray_MMX, malloc_bitarray_NEON, malloc_bitarray_NOSIMD, malloc_bitarray_dispatch;
 typedef void free_bitarray_t(uint32_t *);
-free_bitarray_t free_bitarray_AVX512, free_bitarray_AVX2, free_bitarray_AVX, free_bitarray_SSE2, free_bitarray_MMX, free_bitarray_NOSIMD, free_bitarray_dispatch;
+free_bitarray_t free_bitarray_AVX512, free_bitarray_AVX2, free_bitarray_AVX, free_bitarray_SSE2, free_bitarray_MMX, free_bitarray_NEON, free_bitarray_NOSIMD, free_bitarray_dispatch;
 typedef uint32_t bitcount_t(uint32_t);
-bitcount_t bitcount_AVX512, bitcount_AVX2, bitcount_AVX, bitcount_SSE2, bitcount_MMX, bitcount_NOSIMD, bitcount_dispatch;
+bitcount_t bitcount_AVX512, bitcount_AVX2, bitcount_AVX, bitcount_SSE2, bitcount_MMX, bitcount_NEON, bitcount_NOSIMD, bitcount_dispatch;
 typedef uint32_t count_states_t(uint32_t *);
-count_states_t count_states_AVX512, count_states_AVX2, count_states_AVX, count_states_SSE2, count_states_MMX, count_states_NOSIMD, count_states_dispatch;
+count_states_t count_states_AVX512, count_states_AVX2, count_states_AVX, count_states_SSE2, count_states_MMX, count_states_NEON, count_states_NOSIMD, count_states_dispatch;
 typedef void bitarray_AND_t(uint32_t[], uint32_t[]);
-bitarray_AND_t bitarray_AND_AVX512, bitarray_AND_AVX2, bitarray_AND_AVX, bitarray_AND_SSE2, bitarray_AND_MMX, bitarray_AND_NOSIMD, bitarray_AND_dispatch;
+bitarray_AND_t bitarray_AND_AVX512, bitarray_AND_AVX2, bitarray_AND_AVX, bitarray_AND_SSE2, bitarray_AND_MMX, bitarray_AND_NEON, bitarray_AND_NOSIMD, bitarray_AND_dispatch;
 typedef void bitarray_low20_AND_t(uint32_t *, uint32_t *);
-bitarray_low20_AND_t bitarray_low20_AND_AVX512, bitarray_low20_AND_AVX2, bitarray_low20_AND_AVX, bitarray_low20_AND_SSE2, bitarray_low20_AND_MMX, bitarray_low20_AND_NOSIMD, bitarray_low20_AND_dispatch;
+bitarray_low20_AND_t bitarray_low20_AND_AVX512, bitarray_low20_AND_AVX2, bitarray_low20_AND_AVX, bitarray_low20_AND_SSE2, bitarray_low20_AND_MMX, bitarray_low20_AND_NEON, bitarray_low20_AND_NOSIMD, bitarray_low20_AND_dispatch;
 typedef uint32_t count_bitarray_AND_t(uint32_t *, uint32_t *);
-count_bitarray_AND_t count_bitarray_AND_AVX512, count_bitarray_AND_AVX2, count_bitarray_AND_AVX, count_bitarray_AND_SSE2, count_bitarray_AND_MMX, count_bitarray_AND_NOSIMD, count_bitarray_AND_dispatch;
+count_bitarray_AND_t count_bitarray_AND_AVX512, count_bitarray_AND_AVX2, count_bitarray_AND_AVX, count_bitarray_AND_SSE2, count_bitarray_AND_MMX, count_bitarray_AND_NEON, count_bitarray_AND_NOSIMD, count_bitarray_AND_dispatch;
 typedef uint32_t count_bitarray_low20_AND_t(uint32_t *, uint32_t *);
-count_bitarray_low20_AND_t count_bitarray_low20_AND_AVX512, count_bitarray_low20_AND_AVX2, count_bitarray_low20_AND_AVX, count_bitarray_low20_AND_SSE2, count_bitarray_low20_AND_MMX, count_bitarray_low20_AND_NOSIMD, count_bitarray_low20_AND_dispatch;
+count_bitarray_low20_AND_t count_bitarray_low20_AND_AVX512, count_bitarray_low20_AND_AVX2, count_bitarray_low20_AND_AVX, count_bitarray_low20_AND_SSE2, count_bitarray_low20_AND_MMX, count_bitarray_low20_AND_NEON, count_bitarray_low20_AND_NOSIMD, count_bitarray_low20_AND_dispatch;
 typedef void bitarray_AND4_t(uint32_t *, uint32_t *, uint32_t *, uint32_t *);
-bitarray_AND4_t bitarray_AND4_AVX512, bitarray_AND4_AVX2, bitarray_AND4_AVX, bitarray_AND4_SSE2, bitarray_AND4_MMX, bitarray_AND4_NOSIMD, bitarray_AND4_dispatch;
+bitarray_AND4_t bitarray_AND4_AVX512, bitarray_AND4_AVX2, bitarray_AND4_AVX, bitarray_AND4_SSE2, bitarray_AND4_MMX, bitarray_AND4_NEON, bitarray_AND4_NOSIMD, bitarray_AND4_dispatch;
 typedef void bitarray_OR_t(uint32_t[], uint32_t[]);
-bitarray_OR_t bitarray_OR_AVX512, bitarray_OR_AVX2, bitarray_OR_AVX, bitarray_OR_SSE2, bitarray_OR_MMX, bitarray_OR_NOSIMD, bitarray_OR_dispatch;
+bitarray_OR_t bitarray_OR_AVX512, bitarray_OR_AVX2, bitarray_OR_AVX, bitarray_OR_SSE2, bitarray_OR_MMX, bitarray_OR_NEON, bitarray_OR_NOSIMD, bitarray_OR_dispatch;
 typedef uint32_t count_bitarray_AND2_t(uint32_t *, uint32_t *);
-count_bitarray_AND2_t count_bitarray_AND2_AVX512, count_bitarray_AND2_AVX2, count_bitarray_AND2_AVX, count_bitarray_AND2_SSE2, count_bitarray_AND2_MMX, count_bitarray_AND2_NOSIMD, count_bitarray_AND2_dispatch;
+count_bitarray_AND2_t count_bitarray_AND2_AVX512, count_bitarray_AND2_AVX2, count_bitarray_AND2_AVX, count_bitarray_AND2_SSE2, count_bitarray_AND2_MMX, count_bitarray_AND2_NEON, count_bitarray_AND2_NOSIMD, count_bitarray_AND2_dispatch;
 typedef uint32_t count_bitarray_AND3_t(uint32_t *, uint32_t *, uint32_t *);
-count_bitarray_AND3_t count_bitarray_AND3_AVX512, count_bitarray_AND3_AVX2, count_bitarray_AND3_AVX, count_bitarray_AND3_SSE2, count_bitarray_AND3_MMX, count_bitarray_AND3_NOSIMD, count_bitarray_AND3_dispatch;
+count_bitarray_AND3_t count_bitarray_AND3_AVX512, count_bitarray_AND3_AVX2, count_bitarray_AND3_AVX, count_bitarray_AND3_SSE2, count_bitarray_AND3_MMX, count_bitarray_AND3_NEON, count_bitarray_AND3_NOSIMD, count_bitarray_AND3_dispatch;
 typedef uint32_t count_bitarray_AND4_t(uint32_t *, uint32_t *, uint32_t *, uint32_t *);
-count_bitarray_AND4_t count_bitarray_AND4_AVX512, count_bitarray_AND4_AVX2, count_bitarray_AND4_AVX, count_bitarray_AND4_SSE2, count_bitarray_AND4_MMX, count_bitarray_AND4_NOSIMD, count_bitarray_AND4_dispatch;
+count_bitarray_AND4_t count_bitarray_AND4_AVX512, count_bitarray_AND4_AVX2, count_bitarray_AND4_AVX, count_bitarray_AND4_SSE2, count_bitarray_AND4_MMX, count_bitarray_AND4_NEON, count_bitarray_AND4_NOSIMD, count_bitarray_AND4_dispatch;
 
 
 inline uint32_t *MALLOC_BITARRAY(uint32_t x) {
@@ -286,7 +301,7 @@ inline uint32_t COUNT_BITARRAY_AND4(uint32_t *restrict A, uint32_t *restrict B,
 }
 
 
-#ifndef __MMX__
+#if !defined(__MMX__) && !defined(__ARM_NEON)
 
 // pointers to functions:
 malloc_bitarray_t *malloc_bitarray_function_p = &malloc_bitarray_dispatch;
@@ -319,7 +334,11 @@ uint32_t *malloc_bitarray_dispatch(uint32_t x) {
     else
 #endif
 #endif
-        malloc_bitarray_function_p = &malloc_bitarray_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) malloc_bitarray_function_p = &malloc_bitarray_NEON;
+        else
+#endif
+            malloc_bitarray_function_p = &malloc_bitarray_NOSIMD;
 
     // call the most optimized function for this CPU
     return (*malloc_bitarray_function_p)(x);
@@ -340,7 +359,11 @@ void free_bitarray_dispatch(uint32_t *x) {
     else
 #endif
 #endif
-        free_bitarray_function_p = &free_bitarray_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) free_bitarray_function_p = &free_bitarray_NEON;
+        else
+#endif
+            free_bitarray_function_p = &free_bitarray_NOSIMD;
 
     // call the most optimized function for this CPU
     (*free_bitarray_function_p)(x);
@@ -361,7 +384,11 @@ uint32_t bitcount_dispatch(uint32_t a) {
     else
 #endif
 #endif
-        bitcount_function_p = &bitcount_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) bitcount_function_p = &bitcount_NEON;
+        else
+#endif
+            bitcount_function_p = &bitcount_NOSIMD;
 
     // call the most optimized function for this CPU
     return (*bitcount_function_p)(a);
@@ -382,7 +409,11 @@ uint32_t count_states_dispatch(uint32_t *bitarray) {
     else
 #endif
 #endif
-        count_states_function_p = &count_states_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) count_states_function_p = &count_states_NEON;
+        else
+#endif
+            count_states_function_p = &count_states_NOSIMD;
 
     // call the most optimized function for this CPU
     return (*count_states_function_p)(bitarray);
@@ -403,7 +434,11 @@ void bitarray_AND_dispatch(uint32_t *A, uint32_t *B) {
     else
 #endif
 #endif
-        bitarray_AND_function_p = &bitarray_AND_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) bitarray_AND_function_p = &bitarray_AND_NEON;
+        else
+#endif
+            bitarray_AND_function_p = &bitarray_AND_NOSIMD;
 
     // call the most optimized function for this CPU
     (*bitarray_AND_function_p)(A, B);
@@ -424,7 +459,11 @@ void bitarray_low20_AND_dispatch(uint32_t *A, uint32_t *B) {
     else
 #endif
 #endif
-        bitarray_low20_AND_function_p = &bitarray_low20_AND_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) bitarray_low20_AND_function_p = &bitarray_low20_AND_NEON;
+        else
+#endif
+            bitarray_low20_AND_function_p = &bitarray_low20_AND_NOSIMD;
 
     // call the most optimized function for this CPU
     (*bitarray_low20_AND_function_p)(A, B);
@@ -445,7 +484,11 @@ uint32_t count_bitarray_AND_dispatch(uint32_t *A, uint32_t *B) {
     else
 #endif
 #endif
-        count_bitarray_AND_function_p = &count_bitarray_AND_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) count_bitarray_AND_function_p = &count_bitarray_AND_NEON;
+        else
+#endif
+            count_bitarray_AND_function_p = &count_bitarray_AND_NOSIMD;
 
     // call the most optimized function for this CPU
     return (*count_bitarray_AND_function_p)(A, B);
@@ -466,7 +509,11 @@ uint32_t count_bitarray_low20_AND_dispatch(uint32_t *A, uint32_t *B) {
     else
 #endif
 #endif
-        count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_NEON;
+        else
+#endif
+            count_bitarray_low20_AND_function_p = &count_bitarray_low20_AND_NOSIMD;
 
     // call the most optimized function for this CPU
     return (*count_bitarray_low20_AND_function_p)(A, B);
@@ -487,7 +534,11 @@ void bitarray_AND4_dispatch(uint32_t *A, uint32_t *B, uint32_t *C, uint32_t *D)
     else
 #endif
 #endif
-        bitarray_AND4_function_p = &bitarray_AND4_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) bitarray_AND4_function_p = &bitarray_AND4_NEON;
+        else
+#endif
+            bitarray_AND4_function_p = &bitarray_AND4_NOSIMD;
 
     // call the most optimized function for this CPU
     (*bitarray_AND4_function_p)(A, B, C, D);
@@ -508,7 +559,11 @@ void bitarray_OR_dispatch(uint32_t *A, uint32_t *B) {
     else
 #endif
 #endif
-        bitarray_OR_function_p = &bitarray_OR_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) bitarray_OR_function_p = &bitarray_OR_NEON;
+        else
+#endif
+            bitarray_OR_function_p = &bitarray_OR_NOSIMD;
 
     // call the most optimized function for this CPU
     (*bitarray_OR_function_p)(A, B);
@@ -529,7 +584,11 @@ uint32_t count_bitarray_AND2_dispatch(uint32_t *A, uint32_t *B) {
     else
 #endif
 #endif
-        count_bitarray_AND2_function_p = &count_bitarray_AND2_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) count_bitarray_AND2_function_p = &count_bitarray_AND2_NEON;
+        else
+#endif
+            count_bitarray_AND2_function_p = &count_bitarray_AND2_NOSIMD;
 
     // call the most optimized function for this CPU
     return (*count_bitarray_AND2_function_p)(A, B);
@@ -550,7 +609,11 @@ uint32_t count_bitarray_AND3_dispatch(uint32_t *A, uint32_t *B, uint32_t *C) {
     else
 #endif
 #endif
-        count_bitarray_AND3_function_p = &count_bitarray_AND3_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) count_bitarray_AND3_function_p = &count_bitarray_AND3_NEON;
+        else
+#endif
+            count_bitarray_AND3_function_p = &count_bitarray_AND3_NOSIMD;
 
     // call the most optimized function for this CPU
     return (*count_bitarray_AND3_function_p)(A, B, C);
@@ -571,7 +634,11 @@ uint32_t count_bitarray_AND4_dispatch(uint32_t *A, uint32_t *B, uint32_t *C, uin
     else
 #endif
 #endif
-        count_bitarray_AND4_function_p = &count_bitarray_AND4_NOSIMD;
+#if defined (COMPILER_HAS_SIMD_NEON)
+        if (CPUSupportsNEON()) count_bitarray_AND4_function_p = &count_bitarray_AND4_NEON;
+        else
+#endif
+            count_bitarray_AND4_function_p = &count_bitarray_AND4_NOSIMD;
 
     // call the most optimized function for this CPU
     return (*count_bitarray_AND4_function_p)(A, B, C, D);
@@ -72,6 +72,8 @@ THE SOFTWARE.
 #define DEFAULT_BRUTE_FORCE_RATE        (120000000.0) // if benchmark doesn't succeed
 #define TEST_BENCH_SIZE                 (6000)        // number of odd and even states for brute force benchmark
 #define TEST_BENCH_FILENAME             "hardnested_bf_bench_data.bin"
+#define CHUNKS_PER_THREAD               (16)          // target number of work chunks per brute force thread
+#define MIN_ODD_STATES_PER_CHUNK        (256)         // don't split buckets into chunks smaller than this
 //#define WRITE_BENCH_FILE
 
 // debugging options
@@ -89,6 +91,17 @@ static uint8_t bf_test_nonce_2nd_byte[256];
 static uint8_t bf_test_nonce_par[256];
 static uint32_t bucket_count = 0;
 static statelist_t *buckets[128];
+static uint32_t bucket_list_idx[128];     // position of bucket in the candidates list
+static uint32_t bucket_chunks_left[128];
+static bucket_completed_callback_t *bucket_completed_callback = NULL;
+// work chunks: each one covers a sub-range of a bucket's odd states and all of its even states.
+// Threads grab the next chunk with an atomic increment of next_chunk.
+static statelist_t *chunks = NULL;
+static uint32_t *chunk_bucket = NULL;
+static uint32_t chunk_count = 0;
+static uint32_t next_chunk = 0;
+static uint64_t *thread_busy_time = NULL;
+static uint64_t bf_start_time = 0;
 static uint32_t keys_found = 0;
 static uint64_t num_keys_tested;
 static uint64_t found_bs_key = 0;
@@ -120,8 +133,9 @@ inline uint8_t trailing_zeros(uint8_t byte) {
 bool verify_key(uint32_t cuid, noncelist_t *nonces, uint8_t *best_first_bytes, uint32_t odd, uint32_t even) {
     struct Crypto1State pcs;
     for (uint16_t test_first_byte = 1; test_first_byte < 256; test_first_byte++) {
-        noncelistentry_t *test_nonce = nonces[best_first_bytes[test_first_byte]].first;
-        while (test_nonce != NULL) {
+        noncelist_t *list = &nonces[best_first_bytes[test_first_byte]];
+        for_each_nonce(list, second_byte) {
+            noncelistentry_t *test_nonce = &list->entry[second_byte];
             pcs.odd = odd;
             pcs.even = even;
             lfsr_rollback_byte(&pcs, (cuid >> 24) ^ best_first_bytes[0], true);
@@ -135,11 +149,23 @@ bool verify_key(uint32_t cuid, noncelist_t *nonces, uint8_t *best_first_bytes, u
                     return false;
                 }
             }
-            test_nonce = test_nonce->next;
         }
     }
     return true;
 }
+// average share of elapsed time the brute force threads spent inside crack_states_bitsliced()
+static float thread_utilisation(uint32_t num_threads) {
+    uint64_t elapsed_time = msclock() - bf_start_time;
+    if (elapsed_time == 0)
+        return 100.0;
+
+    uint64_t busy_time = 0;
+    for (uint32_t i = 0; i < num_threads; i++) {
+        busy_time += __atomic_load_n(&thread_busy_time[i], __ATOMIC_RELAXED);
+    }
+    return 100.0 * (float)busy_time / ((float)elapsed_time * num_threads);
+}
+
 static void *
 #ifdef __has_attribute
 #if __has_attribute(force_align_arg_pointer)
@@ -150,6 +176,7 @@ crack_states_thread(void *x) {
     struct arg {
         bool silent;
         int thread_ID;
+        uint32_t num_threads;
         uint32_t cuid;
         uint32_t num_acquired_nonces;
         uint64_t maximum_states;
@@ -159,51 +186,103 @@ crack_states_thread(void *x) {
 
     thread_arg = (struct arg *)x;
     const int thread_id = thread_arg->thread_ID;
-    uint32_t current_bucket = thread_id;
-    while (current_bucket < bucket_count) {
-        statelist_t *bucket = buckets[current_bucket];
-        if (bucket) {
+    while (!__atomic_load_n(&keys_found, __ATOMIC_SEQ_CST)) {
+        uint32_t current_chunk = __atomic_fetch_add(&next_chunk, 1, __ATOMIC_SEQ_CST);
+        if (current_chunk >= chunk_count) {
+            break;
+        }
+        statelist_t *chunk = &chunks[current_chunk];
 #if defined (DEBUG_BRUTE_FORCE)
-            printf("Thread %u starts working on bucket %u\n", thread_id, current_bucket);
+        printf("Thread %u starts working on chunk %u\n", thread_id, current_chunk);
 #endif
-            const uint64_t key = crack_states_bitsliced(thread_arg->cuid, thread_arg->best_first_bytes, bucket, &keys_found, &num_keys_tested, nonces_to_bruteforce, bf_test_nonce_2nd_byte, thread_arg->nonces);
-            if (key != -1) {
-                __atomic_fetch_add(&keys_found, 1, __ATOMIC_SEQ_CST);
-                __atomic_fetch_add(&found_bs_key, key, __ATOMIC_SEQ_CST);
-
+        uint64_t chunk_start_time = msclock();
+        const uint64_t key = crack_states_bitsliced(thread_arg->cuid, thread_arg->best_first_bytes, chunk, &keys_found, &num_keys_tested, nonces_to_bruteforce, bf_test_nonce_2nd_byte, thread_arg->nonces);
+        __atomic_fetch_add(&thread_busy_time[thread_id], msclock() - chunk_start_time, __ATOMIC_RELAXED);
+        if (key == -1 && !__atomic_load_n(&keys_found, __ATOMIC_SEQ_CST)) {
+            uint32_t b = chunk_bucket[current_chunk];
+            if (__atomic_sub_fetch(&bucket_chunks_left[b], 1, __ATOMIC_SEQ_CST) == 0 && bucket_completed_callback != NULL) {
+                bucket_completed_callback(bucket_list_idx[b]);
+            }
+        }
+        if (key != -1) {
+            __atomic_fetch_add(&keys_found, 1, __ATOMIC_SEQ_CST);
+            __atomic_fetch_add(&found_bs_key, key, __ATOMIC_SEQ_CST);
+
+            char progress_text[80];
+            char keystr[19];
+            sprintf(keystr, "%012" PRIx64 "  ", key);
+            sprintf(progress_text, "Brute force phase completed. Key found: " _YELLOW_("%s"), keystr);
+            hardnested_print_progress(thread_arg->num_acquired_nonces, progress_text, 0.0, 0);
+            break;
+        } else if (keys_found) {
+            break;
+        } else {
+            if (!thread_arg->silent) {
                 char progress_text[80];
-                char keystr[19];
-                sprintf(keystr, "%012" PRIx64 "  ", key);
-                sprintf(progress_text, "Brute force phase completed. Key found: " _YELLOW_("%s"), keystr);
-                hardnested_print_progress(thread_arg->num_acquired_nonces, progress_text, 0.0, 0);
-                break;
-            } else if (keys_found) {
-                break;
-            } else {
-                if (!thread_arg->silent) {
-                    char progress_text[80];
-                    sprintf(progress_text, "Brute force phase: %6.02f%%\t", 100.0 * (float)num_keys_tested / (float)(thread_arg->maximum_states));
-                    float remaining_bruteforce = thread_arg->nonces[thread_arg->best_first_bytes[0]].expected_num_brute_force - (float)num_keys_tested / 2;
-                    hardnested_print_progress(thread_arg->num_acquired_nonces, progress_text, remaining_bruteforce, 5000);
-                }
+                sprintf(progress_text, "Brute force phase: %6.02f%%  (threads busy: %3.0f%%)", 100.0 * (float)num_keys_tested / (float)(thread_arg->maximum_states), thread_utilisation(thread_arg->num_threads));
+                float remaining_bruteforce = thread_arg->nonces[thread_arg->best_first_bytes[0]].expected_num_brute_force - (float)num_keys_tested / 2;
+                hardnested_print_progress(thread_arg->num_acquired_nonces, progress_text, remaining_bruteforce, 5000);
             }
         }
-        current_bucket += NUM_BRUTE_FORCE_THREADS;
     }
     return NULL;
 }
 
 
+// Split the buckets into chunks of roughly equal work (odd states * even states), so that all threads
+// stay busy until the end, even if a few buckets are much larger than the others.
+static bool split_buckets_into_chunks(uint32_t num_threads) {
+    uint64_t total_states = 0;
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        total_states += (uint64_t)buckets[i]->len[ODD_STATE] * buckets[i]->len[EVEN_STATE];
+    }
+    uint64_t states_per_chunk = total_states / ((uint64_t)num_threads * CHUNKS_PER_THREAD) + 1;
+
+    uint32_t odd_states_per_chunk[128];
+    chunk_count = 0;
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        uint64_t odd_per_chunk = states_per_chunk / buckets[i]->len[EVEN_STATE];
+        odd_states_per_chunk[i] = MIN(MAX(odd_per_chunk, MIN_ODD_STATES_PER_CHUNK), buckets[i]->len[ODD_STATE]);
+        chunk_count += (buckets[i]->len[ODD_STATE] + odd_states_per_chunk[i] - 1) / odd_states_per_chunk[i];
+    }
+
+    chunks = calloc(chunk_count, sizeof(statelist_t));
+    chunk_bucket = calloc(chunk_count, sizeof(uint32_t));
+    if ((chunks == NULL || chunk_bucket == NULL) && chunk_count > 0) {
+        free(chunks);
+        free(chunk_bucket);
+        chunks = NULL;
+        chunk_bucket = NULL;
+        return false;
+    }
+
+    uint32_t c = 0;
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        bucket_chunks_left[i] = 0;
+        for (uint32_t odd_idx = 0; odd_idx < buckets[i]->len[ODD_STATE]; odd_idx += odd_states_per_chunk[i]) {
+            chunks[c].states[ODD_STATE] = buckets[i]->states[ODD_STATE] + odd_idx;
+            chunks[c].len[ODD_STATE] = MIN(odd_states_per_chunk[i], buckets[i]->len[ODD_STATE] - odd_idx);
+            chunks[c].states[EVEN_STATE] = buckets[i]->states[EVEN_STATE];
+            chunks[c].len[EVEN_STATE] = buckets[i]->len[EVEN_STATE];
+            chunks[c].next = NULL;
+            chunk_bucket[c] = i;
+            bucket_chunks_left[i]++;
+            c++;
+        }
+    }
+    next_chunk = 0;
+    return true;
+}
+
+
 void prepare_bf_test_nonces(noncelist_t *nonces, uint8_t best_first_byte) {
     // we do bitsliced brute forcing with best_first_bytes[0] only.
     // Extract the corresponding 2nd bytes
-    noncelistentry_t *test_nonce = nonces[best_first_byte].first;
     uint32_t i = 0;
-    while (test_nonce != NULL) {
-        bf_test_nonce[i] = test_nonce->nonce_enc;
-        bf_test_nonce_par[i] = test_nonce->par_enc;
-        bf_test_nonce_2nd_byte[i] = (test_nonce->nonce_enc >> 16) & 0xff;
-        test_nonce = test_nonce->next;
+    for_each_nonce(&nonces[best_first_byte], second_byte) {
+        bf_test_nonce[i] = nonces[best_first_byte].entry[second_byte].nonce_enc;
+        bf_test_nonce_par[i] = nonces[best_first_byte].entry[second_byte].par_enc;
+        bf_test_nonce_2nd_byte[i] = second_byte;
         i++;
     }
     nonces_to_bruteforce = i;
@@ -294,7 +373,7 @@ static void write_benchfile(statelist_t *candidates) {
 #endif
 
 
-bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint32_t num_acquired_nonces, uint64_t maximum_states, noncelist_t *nonces, uint8_t *best_first_bytes, uint64_t *foundkey) {
+bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint32_t num_acquired_nonces, uint64_t maximum_states, noncelist_t *nonces, uint8_t *best_first_bytes, uint64_t *foundkey, bucket_completed_callback_t *bucket_completed) {
 #if defined (WRITE_BENCH_FILE)
     write_benchfile(candidates);
 #endif
@@ -303,38 +382,61 @@ bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint
     keys_found = 0;
     num_keys_tested = 0;
     found_bs_key = 0;
+    bucket_completed_callback = bucket_completed;
 
     bitslice_test_nonces(nonces_to_bruteforce, bf_test_nonce, bf_test_nonce_par);
 
     // count number of states to go
     bucket_count = 0;
-    for (statelist_t *p = candidates; p != NULL; p = p->next) {
-        if (p->states[ODD_STATE] != NULL && p->states[EVEN_STATE] != NULL) {
+    uint32_t list_idx = 0;
+    for (statelist_t *p = candidates; p != NULL; p = p->next, list_idx++) {
+        if (p->states[ODD_STATE] != NULL && p->states[EVEN_STATE] != NULL && p->len[ODD_STATE] != 0 && p->len[EVEN_STATE] != 0) {
             buckets[bucket_count] = p;
+            bucket_list_idx[bucket_count] = list_idx;
             bucket_count++;
         }
     }
 
-    uint64_t start_time = msclock();
-
 #if defined(__linux__) ||  defined(__APPLE__)
     if (NUM_BRUTE_FORCE_THREADS < 0)
         return false;
 #endif
 
-    pthread_t threads[NUM_BRUTE_FORCE_THREADS];
+    const uint32_t num_threads = NUM_BRUTE_FORCE_THREADS;
+
+    if (!split_buckets_into_chunks(num_threads)) {
+        PrintAndLogEx(ERR, "Out of memory error in brute_force_bs(). Aborting...");
+        return false;
+    }
+
+    thread_busy_time = calloc(num_threads, sizeof(uint64_t));
+    if (thread_busy_time == NULL) {
+        PrintAndLogEx(ERR, "Out of memory error in brute_force_bs(). Aborting...");
+        free(chunks);
+        free(chunk_bucket);
+        chunks = NULL;
+        chunk_bucket = NULL;
+        return false;
+    }
+
+    uint64_t start_time = msclock();
+    bf_start_time = start_time;
+
+    pthread_t threads[num_threads];
     struct args {
         bool silent;
         int thread_ID;
+        uint32_t num_threads;
         uint32_t cuid;
         uint32_t num_acquired_nonces;
         uint64_t maximum_states;
         noncelist_t *nonces;
         uint8_t *best_first_bytes;
-    } thread_args[NUM_BRUTE_FORCE_THREADS];
+    } thread_args[num_threads];
 
-    for (uint32_t i = 0; i < NUM_BRUTE_FORCE_THREADS; i++) {
+    for (uint32_t i = 0; i < num_threads; i++) {
         thread_args[i].thread_ID = i;
+        thread_args[i].num_threads = num_threads;
         thread_args[i].silent = silent;
         thread_args[i].cuid = cuid;
         thread_args[i].num_acquired_nonces = num_acquired_nonces;
@@ -343,12 +445,20 @@ bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint
         thread_args[i].best_first_bytes = best_first_bytes;
         pthread_create(&threads[i], NULL, crack_states_thread, (void *)&thread_args[i]);
     }
-    for (uint32_t i = 0; i < NUM_BRUTE_FORCE_THREADS; i++) {
+    for (uint32_t i = 0; i < num_threads; i++) {
         pthread_join(threads[i], 0);
     }
 
     uint64_t elapsed_time = msclock() - start_time;
 
+    free(chunks);
+    free(chunk_bucket);
+    chunks = NULL;
+    chunk_bucket = NULL;
+    chunk_count = 0;
+    free(thread_busy_time);
+    thread_busy_time = NULL;
+
     if (bf_rate != NULL)
         *bf_rate = (float)num_keys_tested / ((float)elapsed_time / 1000.0);
 
@@ -461,7 +571,7 @@ float brute_force_benchmark() {
 
     float bf_rate;
     uint64_t found_key = 0;
-    brute_force_bs(&bf_rate, test_candidates, 0, 0, maximum_states, NULL, 0, &found_key);
+    brute_force_bs(&bf_rate, test_candidates, 0, 0, maximum_states, NULL, 0, &found_key, NULL);
 
     free(test_candidates[0].states[ODD_STATE]);
     free(test_candidates[0].states[EVEN_STATE]);
@@ -27,8 +27,12 @@ typedef struct {
     void *next;
 } statelist_t;
 
+// called (from the brute force threads) whenever all states of a bucket have been tested without success.
+// bucket_idx is the position of the bucket in the candidates list.
+typedef void bucket_completed_callback_t(uint32_t bucket_idx);
+
 void prepare_bf_test_nonces(noncelist_t *nonces, uint8_t best_first_byte);
-bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint32_t num_acquired_nonces, uint64_t maximum_states, noncelist_t *nonces, uint8_t *best_first_bytes, uint64_t *found_key);
+bool brute_force_bs(float *bf_rate, statelist_t *candidates, uint32_t cuid, uint32_t num_acquired_nonces, uint64_t maximum_states, noncelist_t *nonces, uint8_t *best_first_bytes, uint64_t *found_key, bucket_completed_callback_t *bucket_completed);
 float brute_force_benchmark(void);
 uint8_t trailing_zeros(uint8_t byte);
 bool verify_key(uint32_t cuid, noncelist_t *nonces, uint8_t *best_first_bytes, uint32_t odd, uint32_t even);
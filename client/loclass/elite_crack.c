@@ -40,6 +40,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <pthread.h>
 #include "cipherutils.h"
 #include "cipher.h"
 #include "ikeys.h"
@@ -47,6 +48,12 @@
 #include "fileutils.h"
 #include "mbedtls/des.h"
 #include "util_posix.h"
+#include "util.h"             // num_CPUs
+#include "optimized_cipher.h"
+
+// candidates handed to a bruteforce thread at a time
+#define LOCLASS_BF_CHUNK        0x1000
+#define LOCLASS_BF_MAX_THREADS  64
 
 /**
  * @brief Permutes a key from standard NIST format to Iclass specific format
@@ -172,10 +179,9 @@ static void rk(uint8_t *key, uint8_t n, uint8_t *outp_key) {
     return;
 }
 
-static mbedtls_des_context ctx_enc;
-static mbedtls_des_context ctx_dec;
-
+// local contexts, hash2 is called from several threads
 static void desdecrypt_iclass(uint8_t *iclass_key, uint8_t *input, uint8_t *output) {
+    mbedtls_des_context ctx_dec;
     uint8_t key_std_format[8] = {0};
     permutekey_rev(iclass_key, key_std_format);
     mbedtls_des_setkey_dec(&ctx_dec, key_std_format);
@@ -183,6 +189,7 @@ static void desdecrypt_iclass(uint8_t *iclass_key, uint8_t *input, uint8_t *outp
 }
 
 static void desencrypt_iclass(uint8_t *iclass_key, uint8_t *input, uint8_t *output) {
+    mbedtls_des_context ctx_enc;
     uint8_t key_std_format[8] = {0};
     permutekey_rev(iclass_key, key_std_format);
     mbedtls_des_setkey_enc(&ctx_enc, key_std_format);
@@ -291,17 +298,112 @@ static int _readFromDump(uint8_t dump[], dumpdata *item, uint8_t i) {
  * @param keytable where to write found values.
  * @return
  */
+typedef struct {
+    dumpdata *item;
+    uint8_t key_index[8];
+    uint8_t bytes_to_recover[3];
+    uint8_t numbytes_to_recover;
+    uint8_t keytable[128];      // low bytes of the keytable, the bytes to recover get overwritten
+    uint32_t endmask;
+    uint32_t next;              // start of the next unclaimed chunk
+    uint32_t found;
+    uint32_t result;            // the brute value which produced the MAC
+    uint64_t tested;            // candidates checked by all threads
+    bool progress;
+} loclass_bf_t;
+
+/**
+ * @brief Checks one candidate key_sel against the item, re-entrant counterpart of
+ *  permutekey_rev + diversifyKey + doMAC using the optimized cipher.
+ */
+static bool loclass_check_key(mbedtls_des_context *ctx, uint8_t key_sel[8], dumpdata *item) {
+    uint8_t key_sel_p[8], crypted_csn[8], div_key[8], mac[4];
+    //Permute from iclass format to standard format
+    permutekey_rev(key_sel, key_sel_p);
+    //Diversify
+    mbedtls_des_setkey_enc(ctx, key_sel_p);
+    mbedtls_des_crypt_ecb(ctx, item->csn, crypted_csn);
+    hash0(x_bytes_to_num(crypted_csn, 8), div_key);
+    //Calc mac
+    opt_doReaderMAC(item->cc_nr, div_key, mac);
+    return memcmp(mac, item->mac, 4) == 0;
+}
+
+static void *bruteforce_thread(void *arg) {
+    loclass_bf_t *bf = (loclass_bf_t *)arg;
+    mbedtls_des_context ctx;
+    mbedtls_des_init(&ctx);
+
+    uint8_t keytable[128];
+    memcpy(keytable, bf->keytable, sizeof(keytable));
+    uint8_t key_sel[8];
+    uint64_t tested = 0;
+
+    while (__atomic_load_n(&bf->found, __ATOMIC_RELAXED) == 0) {
+
+        uint32_t brute = __atomic_fetch_add(&bf->next, LOCLASS_BF_CHUNK, __ATOMIC_RELAXED);
+        if (brute >= bf->endmask)
+            break;
+
+        if (bf->progress && brute != 0 && (brute & 0xFFFF) == 0) {
+            printf("%3d,", (brute >> 16) & 0xFF);
+            if (((brute >> 16) % 0x10) == 0)
+                printf("\n");
+            fflush(stdout);
+        }
+
+        uint32_t end = MIN(brute + LOCLASS_BF_CHUNK, bf->endmask);
+        for (; brute < end; brute++) {
+
+            //Update the keytable with the brute-values
+            for (uint8_t i = 0; i < bf->numbytes_to_recover; i++)
+                keytable[bf->bytes_to_recover[i]] = brute >> (i * 8) & 0xFF;
+
+            // Piece together the key
+            for (uint8_t i = 0; i < 8; i++)
+                key_sel[i] = keytable[bf->key_index[i]];
+
+            tested++;
+            if (loclass_check_key(&ctx, key_sel, bf->item)) {
+                __atomic_store_n(&bf->result, brute, __ATOMIC_RELAXED);
+                __atomic_store_n(&bf->found, 1, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+    }
+
+    __atomic_fetch_add(&bf->tested, tested, __ATOMIC_RELAXED);
+    mbedtls_des_free(&ctx);
+    return NULL;
+}
+
+// searches the bf->endmask candidates on all CPUs, returns true if one produced the MAC
+static bool bruteforce_search(loclass_bf_t *bf) {
+    bf->next = 0;
+    bf->found = 0;
+    bf->tested = 0;
+
+    uint32_t thread_count = MIN(num_CPUs(), LOCLASS_BF_MAX_THREADS);
+    uint32_t chunks = (bf->endmask + LOCLASS_BF_CHUNK - 1) / LOCLASS_BF_CHUNK;
+    thread_count = MAX(1, MIN(thread_count, chunks));
+
+    pthread_t threads[LOCLASS_BF_MAX_THREADS];
+    for (uint32_t i = 0; i < thread_count; i++)
+        pthread_create(&threads[i], NULL, bruteforce_thread, bf);
+    for (uint32_t i = 0; i < thread_count; i++)
+        pthread_join(threads[i], NULL);
+
+    return bf->found != 0;
+}
+
 int bruteforceItem(dumpdata item, uint16_t keytable[]) {
     int errors = 0;
-    int found = false;
-    uint8_t key_sel_p[8] = {0};
-    uint8_t div_key[8] = {0};
-    uint8_t key_sel[8] = {0};
-    uint8_t calculated_MAC[4] = {0};
+    loclass_bf_t bf;
+    memset(&bf, 0, sizeof(bf));
+    bf.item = &item;
 
     //Get the key index (hash1)
-    uint8_t key_index[8] = {0};
-    hash1(item.csn, key_index);
+    hash1(item.csn, bf.key_index);
 
     /*
      * Determine which bytes to retrieve. A hash is typically
@@ -315,19 +417,16 @@ int bruteforceItem(dumpdata item, uint16_t keytable[]) {
      * The markers are placed in the high area of the 16 bit key-table.
      * Only the lower eight bits correspond to the (hopefully cracked) key-value.
      **/
-    uint8_t bytes_to_recover[3] = {0};
+    uint8_t *bytes_to_recover = bf.bytes_to_recover;
     uint8_t numbytes_to_recover = 0 ;
     int i;
     for (i = 0; i < 8; i++) {
-        if (keytable[key_index[i]] & (CRACKED | BEING_CRACKED)) continue;
+        if (keytable[bf.key_index[i]] & (CRACKED | BEING_CRACKED)) continue;
 
-        bytes_to_recover[numbytes_to_recover++] = key_index[i];
-        keytable[key_index[i]] |= BEING_CRACKED;
-
-        if (numbytes_to_recover > 3) {
+        if (numbytes_to_recover == 3) {
             PrintAndLogEx(FAILED, "The CSN requires > 3 byte bruteforce, not supported");
             printvar("[-] CSN", item.csn, 8);
-            printvar("[-] HASH1", key_index, 8);
+            printvar("[-] HASH1", bf.key_index, 8);
             PrintAndLogEx(NORMAL, "");
             //Before we exit, reset the 'BEING_CRACKED' to zero
             keytable[bytes_to_recover[0]]  &= ~BEING_CRACKED;
@@ -335,13 +434,15 @@ int bruteforceItem(dumpdata item, uint16_t keytable[]) {
             keytable[bytes_to_recover[2]]  &= ~BEING_CRACKED;
             return 1;
         }
+
+        bytes_to_recover[numbytes_to_recover++] = bf.key_index[i];
+        keytable[bf.key_index[i]] |= BEING_CRACKED;
     }
+    bf.numbytes_to_recover = numbytes_to_recover;
+
+    for (i = 0; i < 128; i++)
+        bf.keytable[i] = keytable[i] & 0xFF;
 
-    /*
-     *A uint32 has room for 4 bytes, we'll only need 24 of those bits to bruteforce up to three bytes,
-     */
-    //uint32_t brute = startvalue;
-    uint32_t brute = 0;
     /*
        Determine where to stop the bruteforce. A 1-byte attack stops after 256 tries,
        (when brute reaches 0x100). And so on...
@@ -349,55 +450,13 @@ int bruteforceItem(dumpdata item, uint16_t keytable[]) {
        bytes_to_recover = 2 --> endmask = 0x000010000
        bytes_to_recover = 3 --> endmask = 0x001000000
     */
-
-    uint32_t endmask =  1 << 8 * numbytes_to_recover;
+    bf.endmask =  1 << 8 * numbytes_to_recover;
+    bf.progress = true;
     PrintAndLogEx(NORMAL, "----------------------------");
     for (i = 0 ; i < numbytes_to_recover && numbytes_to_recover > 1; i++)
         PrintAndLogEx(INFO, "Bruteforcing byte %d", bytes_to_recover[i]);
 
-    while (!found && !(brute & endmask)) {
-
-        //Update the keytable with the brute-values
-        for (i = 0; i < numbytes_to_recover; i++) {
-            keytable[bytes_to_recover[i]] &= 0xFF00;
-            keytable[bytes_to_recover[i]] |= (brute >> (i * 8) & 0xFF);
-        }
-
-        // Piece together the key
-        key_sel[0] = keytable[key_index[0]] & 0xFF;
-        key_sel[1] = keytable[key_index[1]] & 0xFF;
-        key_sel[2] = keytable[key_index[2]] & 0xFF;
-        key_sel[3] = keytable[key_index[3]] & 0xFF;
-        key_sel[4] = keytable[key_index[4]] & 0xFF;
-        key_sel[5] = keytable[key_index[5]] & 0xFF;
-        key_sel[6] = keytable[key_index[6]] & 0xFF;
-        key_sel[7] = keytable[key_index[7]] & 0xFF;
-
-        //Permute from iclass format to standard format
-        permutekey_rev(key_sel, key_sel_p);
-        //Diversify
-        diversifyKey(item.csn, key_sel_p, div_key);
-        //Calc mac
-        doMAC(item.cc_nr, div_key, calculated_MAC);
-
-        // success
-        if (memcmp(calculated_MAC, item.mac, 4) == 0) {
-            printf("\r\n");
-            for (i = 0 ; i < numbytes_to_recover; i++) {
-                PrintAndLogEx(INFO, "%d: 0x%02x", bytes_to_recover[i], 0xFF & keytable[bytes_to_recover[i]]);
-            }
-            found = true;
-            break;
-        }
-
-        brute++;
-        if ((brute & 0xFFFF) == 0) {
-            printf("%3d,", (brute >> 16) & 0xFF);
-            if (((brute >> 16) % 0x10) == 0)
-                printf("\n");
-            fflush(stdout);
-        }
-    }
+    bool found = bruteforce_search(&bf);
 
     if (!found) {
         PrintAndLogEx(NORMAL, "\n");
@@ -411,15 +470,97 @@ int bruteforceItem(dumpdata item, uint16_t keytable[]) {
             keytable[bytes_to_recover[i]]  |= CRACK_FAILED;
         }
     } else {
-        //PrintAndLogEx(SUCCESS, "DES calcs: %u", brute);
+        printf("\r\n");
         for (i = 0; i < numbytes_to_recover; i++) {
-            keytable[bytes_to_recover[i]]  &= 0xFF;
-            keytable[bytes_to_recover[i]]  |= CRACKED;
+            keytable[bytes_to_recover[i]] = (bf.result >> (i * 8) & 0xFF) | CRACKED;
+            PrintAndLogEx(INFO, "%d: 0x%02x", bytes_to_recover[i], 0xFF & keytable[bytes_to_recover[i]]);
         }
     }
     return errors;
 }
 
+/**
+ * @brief Measures the bruteforce engine on a synthetic three byte attack whose answer is the last
+ *  candidate of a 2^20 range, and checks the optimized kernel against permutekey_rev/diversifyKey/doMAC.
+ * @return 0 for ok, 1 for failz
+ */
+int benchmarkElite(void) {
+    PrintAndLogEx(INFO, "Benchmarking loclass bruteforce...");
+
+    uint8_t k_cus[8] = {0x5B, 0x7C, 0x62, 0xC4, 0x91, 0xC1, 0x1B, 0x39};
+    uint8_t csn[8] = {0x00, 0x0B, 0x0F, 0xFF, 0xF7, 0xFF, 0x12, 0xE0};
+    uint8_t cc_nr[12] = {0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x12, 0x34, 0x56, 0x78};
+
+    loclass_bf_t bf;
+    memset(&bf, 0, sizeof(bf));
+    dumpdata item;
+    memcpy(item.csn, csn, sizeof(item.csn));
+    memcpy(item.cc_nr, cc_nr, sizeof(item.cc_nr));
+    bf.item = &item;
+
+    hash2(k_cus, bf.keytable);
+    hash1(csn, bf.key_index);
+    for (uint8_t i = 0; i < 8; i++) {
+        if (memchr(bf.bytes_to_recover, bf.key_index[i], bf.numbytes_to_recover) == NULL)
+            bf.bytes_to_recover[bf.numbytes_to_recover++] = bf.key_index[i];
+    }
+    if (bf.numbytes_to_recover != 3) {
+        PrintAndLogEx(ERR, "Error: benchmark CSN must select three distinct bytes");
+        return 1;
+    }
+    bf.keytable[bf.bytes_to_recover[0]] = 0xFF;
+    bf.keytable[bf.bytes_to_recover[1]] = 0xFF;
+    bf.keytable[bf.bytes_to_recover[2]] = 0x0F;
+    bf.endmask = 0x100000;
+    uint32_t expected = 0x0FFFFF;
+
+    uint8_t key_sel[8], key_sel_p[8], div_key[8];
+    for (uint8_t i = 0; i < 8; i++)
+        key_sel[i] = bf.keytable[bf.key_index[i]];
+    permutekey_rev(key_sel, key_sel_p);
+    diversifyKey(csn, key_sel_p, div_key);
+    doMAC(item.cc_nr, div_key, item.mac);
+
+    mbedtls_des_context ctx;
+    mbedtls_des_init(&ctx);
+    bool ok = loclass_check_key(&ctx, key_sel, &item);
+    mbedtls_des_free(&ctx);
+    if (ok == false) {
+        PrintAndLogEx(ERR, "Error: optimized MAC differs from doMAC");
+        return 1;
+    }
+
+    // reference, one candidate at a time as bruteforceItem used to do
+    uint32_t ref_count = 0x2000;
+    uint64_t t1 = msclock();
+    for (uint32_t brute = 0; brute < ref_count; brute++) {
+        uint8_t mac[4];
+        key_sel[0] = brute & 0xFF;
+        key_sel[1] = brute >> 8;
+        permutekey_rev(key_sel, key_sel_p);
+        diversifyKey(csn, key_sel_p, div_key);
+        doMAC(item.cc_nr, div_key, mac);
+    }
+    uint64_t t_ref = MAX(msclock() - t1, 1);
+
+    t1 = msclock();
+    bool found = bruteforce_search(&bf);
+    uint64_t t_opt = MAX(msclock() - t1, 1);
+
+    double ref_rate = (double)ref_count * 1000 / t_ref;
+    double opt_rate = (double)bf.tested * 1000 / t_opt;
+    PrintAndLogEx(SUCCESS, "reference    : %8.0f candidates/s", ref_rate);
+    PrintAndLogEx(SUCCESS, "%2u thread(s) : %8.0f candidates/s  (%" PRIu64 " candidates in %" PRIu64 " ms, %.1fx)",
+                  MIN(num_CPUs(), LOCLASS_BF_MAX_THREADS), opt_rate, bf.tested, t_opt, opt_rate / ref_rate);
+    PrintAndLogEx(SUCCESS, "full 3 byte search, worst case: %.0f s", (double)0x1000000 / opt_rate);
+
+    if (found == false || bf.result != expected) {
+        PrintAndLogEx(ERR, "Error: bruteforce did not find the expected bytes");
+        return 1;
+    }
+    return 0;
+}
+
 /**
  * From dismantling iclass-paper:
  *  Assume that an adversary somehow learns the first 16 bytes of hash2(K_cus ), i.e., y [0] and z [0] .
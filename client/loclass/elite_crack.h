@@ -126,6 +126,12 @@ int calculateMasterKey(uint8_t first16bytes[], uint64_t master_key[]);
  */
 int testElite(void);
 
+/**
+ * @brief Benchmark of the bruteforce engine, reports candidates/s
+ * @return
+ */
+int benchmarkElite(void);
+
 /**
       Here are some pretty optimal values that can be used to recover necessary data in only
       eight auth attempts.
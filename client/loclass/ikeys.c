@@ -69,6 +69,7 @@ From "Dismantling iclass":
 #include "fileutils.h"
 #include "cipherutils.h"
 #include "mbedtls/des.h"
+#include "ikeys.h"
 
 uint8_t pi[35] = {0x0F, 0x17, 0x1B, 0x1D, 0x1E, 0x27, 0x2B, 0x2D, 0x2E, 0x33, 0x35, 0x39, 0x36, 0x3A, 0x3C, 0x47, 0x4B, 0x4D, 0x4E, 0x53, 0x55, 0x56, 0x59, 0x5A, 0x5C, 0x63, 0x65, 0x66, 0x69, 0x6A, 0x6C, 0x71, 0x72, 0x74, 0x78};
 
@@ -352,13 +353,16 @@ void hash0(uint64_t c, uint8_t k[8]) {
  * @param div_key
  */
 void diversifyKey(uint8_t csn[8], uint8_t key[8], uint8_t div_key[8]) {
-    // Prepare the DES key
-    mbedtls_des_setkey_enc(&ctx_enc, key);
+    // Prepare the DES key, on the stack so several threads can diversify at once
+    mbedtls_des_context ctx;
+    mbedtls_des_init(&ctx);
+    mbedtls_des_setkey_enc(&ctx, key);
 
     uint8_t crypted_csn[8] = {0};
 
     // Calculate DES(CSN, KEY)
-    mbedtls_des_crypt_ecb(&ctx_enc, csn, crypted_csn);
+    mbedtls_des_crypt_ecb(&ctx, csn, crypted_csn);
+    mbedtls_des_free(&ctx);
 
     //Calculate HASH0(DES))
     uint64_t crypt_csn = x_bytes_to_num(crypted_csn, 8);
@@ -19,10 +19,13 @@
 #include "mifare4.h"
 #include "ui.h"         // PrintAndLog...
 #include "crapto1/crapto1.h"
+#include "bucketsort.h"
 #include "crc16.h"
+#include "parity.h"
 #include "protocols.h"
 #include "mfkey.h"
 #include "util_posix.h"  // msclock
+#include "util.h"        // num_CPUs
 
 
 int mfDarkside(uint8_t blockno, uint8_t key_type, uint64_t *key) {
@@ -131,9 +134,7 @@ int mfDarkside(uint8_t blockno, uint8_t key_type, uint64_t *key) {
     free(keylist);
     return PM3_SUCCESS;
 }
-int mfCheckKeys(uint8_t blockNo, uint8_t keyType, bool clear_trace, uint8_t keycnt, uint8_t *keyBlock, uint64_t *key) {
-    *key = -1;
-    clearCommandBuffer();
+static void mfCheckKeysSend(uint8_t blockNo, uint8_t keyType, bool clear_trace, uint8_t keycnt, uint8_t *keyBlock) {
     uint8_t data[PM3_CMD_DATA_SIZE] = {0};
     data[0] = keyType;
     data[1] = blockNo;
@@ -141,7 +142,10 @@ int mfCheckKeys(uint8_t blockNo, uint8_t keyType, bool clear_trace, uint8_t keyc
     data[3] = keycnt;
     memcpy(data + 4, keyBlock, 6 * keycnt);
     SendCommandNG(CMD_HF_MIFARE_CHKKEYS, data, (4 + 6 * keycnt));
+}
 
+static int mfCheckKeysWait(uint64_t *key) {
+    *key = -1;
     PacketResponseNG resp;
     if (!WaitForResponseTimeout(CMD_HF_MIFARE_CHKKEYS, &resp, 2500)) return PM3_ETIMEOUT;
     if (resp.status != PM3_SUCCESS) return resp.status;
@@ -156,6 +160,12 @@ int mfCheckKeys(uint8_t blockNo, uint8_t keyType, bool clear_trace, uint8_t keyc
     return PM3_SUCCESS;
 }
 
+int mfCheckKeys(uint8_t blockNo, uint8_t keyType, bool clear_trace, uint8_t keycnt, uint8_t *keyBlock, uint64_t *key) {
+    clearCommandBuffer();
+    mfCheckKeysSend(blockNo, keyType, clear_trace, keycnt, keyBlock);
+    return mfCheckKeysWait(key);
+}
+
 // Sends chunks of keys to device.
 // 0 == ok all keys found
 // 1 ==
@@ -286,6 +296,27 @@ static int Compare16Bits(const void *a, const void *b) {
     return -1;
 }
 
+// the 16 Bits compared by Compare16Bits(), as bucket index
+static uint16_t Key16Bits(uint64_t state) {
+    return ((state >> 16) & 0x00ff) | ((state >> 40) & 0xff00);
+}
+
+// group the states by the 16 Bits which are already part of the key
+static void nested_bucket_sort(StateList_t *statelist, struct Crypto1State *states, uint32_t len) {
+    statelist->len = len;
+    statelist->head.keyhead = calloc(len + 1, sizeof(uint64_t));
+    statelist->bucket_start = calloc(0x10001, sizeof(uint32_t));
+    if (statelist->head.keyhead == NULL || statelist->bucket_start == NULL) {
+        free(statelist->head.keyhead);
+        free(statelist->bucket_start);
+        statelist->head.keyhead = NULL;
+        statelist->bucket_start = NULL;
+        statelist->len = 0;
+        return;
+    }
+    bucket_sort_64((uint64_t *)states, statelist->head.keyhead, len, Key16Bits, statelist->bucket_start);
+}
+
 // wrapper function for multi-threaded lfsr_recovery32
 static void
 #ifdef __has_attribute
@@ -296,23 +327,165 @@ __attribute__((force_align_arg_pointer))
 *nested_worker_thread(void *arg) {
     struct Crypto1State *p1;
     StateList_t *statelist = arg;
-    statelist->head.slhead = lfsr_recovery32(statelist->ks1, statelist->nt ^ statelist->uid);
+    struct Crypto1State *states = lfsr_recovery32(statelist->ks1, statelist->nt ^ statelist->uid);
 
-    for (p1 = statelist->head.slhead; * (uint64_t *)p1 != 0; p1++) {};
+    for (p1 = states; * (uint64_t *)p1 != 0; p1++) {};
 
-    statelist->len = p1 - statelist->head.slhead;
-    statelist->tail.sltail = --p1;
-    qsort(statelist->head.slhead, statelist->len, sizeof(uint64_t), Compare16Bits);
+    nested_bucket_sort(statelist, states, p1 - states);
+    free(states);
 
     return statelist->head.slhead;
 }
 
+#define NESTED_JOIN_MAX_THREADS 64
+
+typedef struct {
+    StateList_t *statelists;
+    uint32_t first_bucket;
+    uint32_t end_bucket;
+    uint32_t num_keys;
+} nested_join_job_t;
+
+// States can only lead to the same key if their 16 key Bits are the same. Roll back the
+// states of the buckets which are non-empty in both lists and keep the ones of the first
+// list which also appear in the second. The result is written over the first list.
+static void *nested_join_thread(void *arg) {
+    nested_join_job_t *job = arg;
+    StateList_t *sl = job->statelists;
+    uint64_t *keys = sl[0].head.keyhead + sl[0].bucket_start[job->first_bucket];
+    uint32_t num_keys = 0;
+
+    for (uint32_t b = job->first_bucket; b < job->end_bucket; b++) {
+        uint64_t *p0 = sl[0].head.keyhead + sl[0].bucket_start[b];
+        uint64_t *end0 = sl[0].head.keyhead + sl[0].bucket_start[b + 1];
+        uint64_t *p1 = sl[1].head.keyhead + sl[1].bucket_start[b];
+        uint64_t *end1 = sl[1].head.keyhead + sl[1].bucket_start[b + 1];
+        if (p0 == end0 || p1 == end1)
+            continue;
+
+        for (uint64_t *p = p1; p < end1; p++)
+            lfsr_rollback_word((struct Crypto1State *)p, sl[1].nt ^ sl[1].uid, 0);
+
+        for (; p0 < end0; p0++) {
+            lfsr_rollback_word((struct Crypto1State *)p0, sl[0].nt ^ sl[0].uid, 0);
+            for (uint64_t *p = p1; p < end1; p++) {
+                if (*p == *p0) {
+                    keys[num_keys++] = *p0;
+                    break;
+                }
+            }
+        }
+    }
+    job->num_keys = num_keys;
+    return NULL;
+}
+
+// intersect two bucket sorted state lists, the bucket ranges are split across all CPUs.
+// Returns the number of key candidates left in statelists[0].
+static uint32_t nested_join(StateList_t statelists[2]) {
+    if (statelists[0].bucket_start == NULL || statelists[1].bucket_start == NULL) {
+        statelists[0].len = 0;
+        return 0;
+    }
+
+    uint32_t num_threads = num_CPUs();
+    if (num_threads > NESTED_JOIN_MAX_THREADS)
+        num_threads = NESTED_JOIN_MAX_THREADS;
+
+    pthread_t thread_id[NESTED_JOIN_MAX_THREADS];
+    nested_join_job_t jobs[NESTED_JOIN_MAX_THREADS];
+    for (uint32_t i = 0; i < num_threads; i++) {
+        jobs[i].statelists = statelists;
+        jobs[i].first_bucket = 0x10000 * i / num_threads;
+        jobs[i].end_bucket = 0x10000 * (i + 1) / num_threads;
+        jobs[i].num_keys = 0;
+        pthread_create(thread_id + i, NULL, nested_join_thread, &jobs[i]);
+    }
+    for (uint32_t i = 0; i < num_threads; i++)
+        pthread_join(thread_id[i], NULL);
+
+    // every thread left its keys at the start of its own range, move them together
+    uint64_t *keys = statelists[0].head.keyhead;
+    uint32_t keycnt = 0;
+    for (uint32_t i = 0; i < num_threads; i++) {
+        memmove(keys + keycnt, keys + statelists[0].bucket_start[jobs[i].first_bucket], jobs[i].num_keys * sizeof(uint64_t));
+        keycnt += jobs[i].num_keys;
+    }
+    keys[keycnt] = UINT64_C(-1);
+    statelists[0].len = keycnt;
+    statelists[0].tail.keytail = keys + keycnt - 1;
+    return keycnt;
+}
+
+// The parity bit of the last byte of an encrypted nonce is encrypted with the keystream bit
+// following ks1, which the intersection doesn't use. Drop the candidates which disagree with it.
+static uint32_t nested_filter_parity(StateList_t statelists[2]) {
+    uint64_t *keys = statelists[0].head.keyhead;
+    uint32_t keycnt = 0;
+
+    if (keys == NULL)
+        return 0;
+
+    for (uint32_t k = 0; k < statelists[0].len; k++) {
+        bool valid = true;
+        for (int i = 0; i < 2 && valid; i++) {
+            if (statelists[i].par_err == NESTED_PAR_ERR_UNKNOWN)
+                continue;
+            struct Crypto1State state = *(struct Crypto1State *)&keys[k];
+            crypto1_word(&state, statelists[i].nt ^ statelists[i].uid, 0);
+            uint32_t nt_enc = statelists[i].nt ^ statelists[i].ks1;
+            valid = oddparity8(statelists[i].nt & 0xff) == ((statelists[i].par_err & 0x01) ^ oddparity8(nt_enc & 0xff) ^ filter(state.odd));
+        }
+        if (valid)
+            keys[keycnt++] = keys[k];
+    }
+    keys[keycnt] = UINT64_C(-1);
+    statelists[0].len = keycnt;
+    return keycnt;
+}
+
+// Check the candidate keys with the device. The next chunk of keys is sent before the answer
+// for the current one arrives, so that the device doesn't wait for a USB round-trip per chunk.
+static int nested_check_keys(StateList_t *statelist, uint64_t *resultkey) {
+    uint8_t keyBlock[KEYBLOCK_SIZE];
+    uint32_t sent = 0;
+    uint8_t in_flight = 0;
+    int res = PM3_ESOFT;
+
+    clearCommandBuffer();
+    do {
+        while (sent < statelist->len && in_flight < 2 && res != PM3_SUCCESS) {
+            uint32_t size = statelist->len - sent > KEYS_IN_BLOCK ? KEYS_IN_BLOCK : statelist->len - sent;
+            for (uint32_t j = 0; j < size; j++) {
+                uint64_t key64 = 0;
+                crypto1_get_lfsr(statelist->head.slhead + sent + j, &key64);
+                num_to_bytes(key64, 6, keyBlock + j * 6);
+            }
+            mfCheckKeysSend(statelist->blockNo, statelist->keyType, false, size, keyBlock);
+            sent += size;
+            in_flight++;
+        }
+
+        uint64_t key64 = 0;
+        int chunk_res = mfCheckKeysWait(&key64);
+        in_flight--;
+        if (chunk_res == PM3_SUCCESS) {
+            // keep waiting for the chunk still queued, its answer must not be mistaken for a later one
+            *resultkey = key64;
+            res = PM3_SUCCESS;
+        } else if (chunk_res == PM3_ETIMEOUT) {
+            return res == PM3_SUCCESS ? res : PM3_ETIMEOUT;
+        }
+    } while (in_flight > 0 || (sent < statelist->len && res != PM3_SUCCESS));
+
+    return res;
+}
+
 int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *resultKey, bool calibrate) {
     uint16_t i;
     uint32_t uid;
     PacketResponseNG resp;
     StateList_t statelists[2];
-    struct Crypto1State *p1, *p2, *p3, *p4;
 
     clearCommandBuffer();
     SendCommandOLD(CMD_HF_MIFARE_NESTED, blockNo + keyType * 0x100, trgBlockNo + trgKeyType * 0x100, calibrate, key, 6);
@@ -329,6 +502,7 @@ int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo,
         statelists[i].uid = uid;
         memcpy(&statelists[i].nt, (void *)(resp.data.asBytes + 4 + i * 8 + 0), 4);
         memcpy(&statelists[i].ks1, (void *)(resp.data.asBytes + 4 + i * 8 + 4), 4);
+        statelists[i].par_err = (resp.length >= 4 + 2 * 8 + 2) ? resp.data.asBytes[4 + 2 * 8 + i] : NESTED_PAR_ERR_UNKNOWN;
     }
 
     // calc keys
@@ -342,6 +516,56 @@ int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo,
     for (i = 0; i < 2; i++)
         pthread_join(thread_id[i], (void *)&statelists[i].head.slhead);
 
+    // the first 16 Bits of the cryptostate already contain part of our key.
+    // Create the intersection of the two lists based on these 16 Bits, roll back
+    // the cryptostates and keep the ones present in both lists: these are possible keys.
+    nested_join(statelists);
+    nested_filter_parity(statelists);
+
+    uint32_t keycnt = statelists[0].len;
+    if (keycnt == 0) goto out;
+
+    memset(resultKey, 0, 6);
+    uint64_t key64 = -1;
+
+    // The list may still contain several key candidates. Test them with the device
+    if (nested_check_keys(&statelists[0], &key64) == PM3_SUCCESS) {
+        free(statelists[0].head.slhead);
+        free(statelists[1].head.slhead);
+        free(statelists[0].bucket_start);
+        free(statelists[1].bucket_start);
+        num_to_bytes(key64, 6, resultKey);
+
+        PrintAndLogEx(SUCCESS, "target block:%3u key type: %c  -- found valid key [%012" PRIx64 "]",
+                      (uint16_t)resp.oldarg[2] & 0xff,
+                      (resp.oldarg[2] >> 8) ? 'B' : 'A',
+                      key64
+                     );
+        return -5;
+    }
+
+out:
+    PrintAndLogEx(SUCCESS, "target block:%3u key type: %c",
+                  (uint16_t)resp.oldarg[2] & 0xff,
+                  (resp.oldarg[2] >> 8) ? 'B' : 'A'
+                 );
+
+    free(statelists[0].head.slhead);
+    free(statelists[1].head.slhead);
+    free(statelists[0].bucket_start);
+    free(statelists[1].bucket_start);
+    return -4;
+}
+
+// qsort based intersection as done before nested_join(), kept as reference for the benchmark
+static uint32_t nested_join_qsort(StateList_t statelists[2]) {
+    struct Crypto1State *p1, *p2, *p3, *p4;
+
+    for (int i = 0; i < 2; i++) {
+        qsort(statelists[i].head.slhead, statelists[i].len, sizeof(uint64_t), Compare16Bits);
+        statelists[i].tail.sltail = statelists[i].head.slhead + statelists[i].len - 1;
+    }
+
     // the first 16 Bits of the cryptostate already contain part of our key.
     // Create the intersection of the two lists based on these 16 Bits and
     // roll back the cryptostate
@@ -386,49 +610,132 @@ int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo,
     // Create the intersection
     statelists[0].len = intersection(statelists[0].head.keyhead, statelists[1].head.keyhead);
 
-    //statelists[0].tail.keytail = --p7;
-    uint32_t keycnt = statelists[0].len;
-    if (keycnt == 0) goto out;
+    return statelists[0].len;
+}
 
-    memset(resultKey, 0, 6);
-    uint64_t key64 = -1;
+// synthetic nested authentications, not captured from a card: uid, nt, ks1 and parity errors of the
+// two encrypted nonces were computed with crypto1 from the listed key
+static const struct {
+    uint32_t uid;
+    uint32_t nt[2];
+    uint32_t ks1[2];
+    uint8_t par_err[2];
+    uint64_t key;
+} nested_test_vectors[] = {
+    {0x4851b1ec, {0x402cbe46, 0x534fc031}, {0x70f9fa79, 0x1ae75283}, {0x2, 0x1}, 0xa0a1a2a3a4a5},
+    {0x01020304, {0x2fe0e564, 0x7ce6bfed}, {0xffd7ec7c, 0xffefa481}, {0xa, 0xc}, 0xffffffffffff},
+    {0xdeadbeef, {0x9383a6d7, 0x2fbf14c2}, {0xb027fab0, 0xe0a7e2df}, {0x0, 0x6}, 0x4d3a99c351dd},
+    {0x8f5c3a11, {0xa4e7a525, 0xa20bd420}, {0x40af3d7a, 0x40d2ab9c}, {0x7, 0xf}, 0x1a982c7e459a},
+};
+
+static bool nested_keys_contain(StateList_t *statelist, uint64_t key) {
+    for (uint32_t i = 0; i < statelist->len; i++) {
+        uint64_t key64 = 0;
+        crypto1_get_lfsr(statelist->head.slhead + i, &key64);
+        if (key64 == key)
+            return true;
+    }
+    return false;
+}
 
-    // The list may still contain several key candidates. Test each of them with mfCheckKeys
-    uint32_t max_keys = keycnt > KEYS_IN_BLOCK ? KEYS_IN_BLOCK : keycnt;
-    uint8_t keyBlock[PM3_CMD_DATA_SIZE] = {0x00};
+// compare the host side of the nested attack, qsort based vs. bucket join, on the synthetic nonces above
+int mfnested_benchmark(void) {
+    const int rounds = 5;
+    bool ok = true;
+
+    PrintAndLogEx(INFO, "Nested attack state list intersection on synthetic nonces, %d rounds each, bucket join using %d threads", rounds, num_CPUs());
+    PrintAndLogEx(NORMAL, " uid      | states          | keys | parity | qsort     | bucket join");
+    PrintAndLogEx(NORMAL, "--------------------------------------------------------------------------");
+
+    for (size_t v = 0; v < ARRAYLEN(nested_test_vectors); v++) {
+        StateList_t recovered[2];
+        for (int i = 0; i < 2; i++) {
+            struct Crypto1State *p1;
+            recovered[i].head.slhead = lfsr_recovery32(nested_test_vectors[v].ks1[i], nested_test_vectors[v].nt[i] ^ nested_test_vectors[v].uid);
+            if (recovered[i].head.slhead == NULL) {
+                if (i == 1)
+                    free(recovered[0].head.slhead);
+                PrintAndLogEx(FAILED, "out of memory");
+                return PM3_EMALLOC;
+            }
+            for (p1 = recovered[i].head.slhead; * (uint64_t *)p1 != 0; p1++) {};
+            recovered[i].len = p1 - recovered[i].head.slhead;
+        }
 
-    for (i = 0; i < keycnt; i += max_keys) {
+        uint64_t time_qsort = 0, time_bucket = 0;
+        uint32_t keys_qsort = 0, keys_bucket = 0, keys_filtered = 0;
+        bool found_qsort = false, found_bucket = false;
+        bool oom = false;
+        for (int r = 0; r < rounds && !oom; r++) {
+            StateList_t statelists[2];
+            for (int i = 0; i < 2; i++) {
+                statelists[i].uid = nested_test_vectors[v].uid;
+                statelists[i].nt = nested_test_vectors[v].nt[i];
+                statelists[i].len = recovered[i].len;
+                statelists[i].bucket_start = NULL;
+                statelists[i].head.keyhead = calloc(recovered[i].len + 1, sizeof(uint64_t));
+                if (statelists[i].head.keyhead != NULL)
+                    memcpy(statelists[i].head.keyhead, recovered[i].head.keyhead, recovered[i].len * sizeof(uint64_t));
+            }
+            if (statelists[0].head.keyhead == NULL || statelists[1].head.keyhead == NULL) {
+                free(statelists[0].head.keyhead);
+                free(statelists[1].head.keyhead);
+                oom = true;
+                break;
+            }
+            uint64_t t1 = msclock();
+            keys_qsort = nested_join_qsort(statelists);
+            time_qsort += msclock() - t1;
+            found_qsort = nested_keys_contain(&statelists[0], nested_test_vectors[v].key);
+            for (int i = 0; i < 2; i++)
+                free(statelists[i].head.keyhead);
+
+            t1 = msclock();
+            for (int i = 0; i < 2; i++) {
+                statelists[i].uid = nested_test_vectors[v].uid;
+                statelists[i].nt = nested_test_vectors[v].nt[i];
+                statelists[i].ks1 = nested_test_vectors[v].ks1[i];
+                statelists[i].par_err = nested_test_vectors[v].par_err[i];
+                nested_bucket_sort(&statelists[i], recovered[i].head.slhead, recovered[i].len);
+                oom |= statelists[i].bucket_start == NULL;
+            }
+            keys_bucket = nested_join(statelists);
+            time_bucket += msclock() - t1;
+            keys_filtered = nested_filter_parity(statelists);
+            found_bucket = nested_keys_contain(&statelists[0], nested_test_vectors[v].key);
+            for (int i = 0; i < 2; i++) {
+                free(statelists[i].head.keyhead);
+                free(statelists[i].bucket_start);
+            }
+        }
 
-        int size = keycnt - i > max_keys ? max_keys : keycnt - i;
+        free(recovered[0].head.slhead);
+        free(recovered[1].head.slhead);
 
-        for (int j = 0; j < size; j++) {
-            crypto1_get_lfsr(statelists[0].head.slhead + i, &key64);
-            num_to_bytes(key64, 6, keyBlock + i * 6);
+        if (oom) {
+            PrintAndLogEx(FAILED, "out of memory");
+            return PM3_EMALLOC;
         }
 
-        if (mfCheckKeys(statelists[0].blockNo, statelists[0].keyType, false, size, keyBlock, &key64) == PM3_SUCCESS) {
-            free(statelists[0].head.slhead);
-            free(statelists[1].head.slhead);
-            num_to_bytes(key64, 6, resultKey);
-
-            PrintAndLogEx(SUCCESS, "target block:%3u key type: %c  -- found valid key [%012" PRIx64 "]",
-                          (uint16_t)resp.oldarg[2] & 0xff,
-                          (resp.oldarg[2] >> 8) ? 'B' : 'A',
-                          key64
-                         );
-            return -5;
+        PrintAndLogEx(NORMAL, " %08x | %7u %7u | %4u | %6u | %6.1f ms | %6.1f ms",
+                      nested_test_vectors[v].uid,
+                      recovered[0].len, recovered[1].len,
+                      keys_bucket, keys_filtered,
+                      (float)time_qsort / rounds,
+                      (float)time_bucket / rounds);
+
+        if (!found_qsort || !found_bucket || keys_qsort != keys_bucket) {
+            PrintAndLogEx(FAILED, "key %012" PRIx64 " %s, %u keys with qsort, %u with bucket join",
+                          nested_test_vectors[v].key,
+                          found_bucket ? "found" : "not found",
+                          keys_qsort, keys_bucket);
+            ok = false;
         }
     }
 
-out:
-    PrintAndLogEx(SUCCESS, "target block:%3u key type: %c",
-                  (uint16_t)resp.oldarg[2] & 0xff,
-                  (resp.oldarg[2] >> 8) ? 'B' : 'A'
-                 );
-
-    free(statelists[0].head.slhead);
-    free(statelists[1].head.slhead);
-    return -4;
+    if (ok)
+        PrintAndLogEx(SUCCESS, "all keys found, both methods agree");
+    return ok ? PM3_SUCCESS : PM3_ESOFT;
 }
 
 // MIFARE
@@ -36,11 +36,13 @@ typedef struct {
         uint64_t *keytail;
     } tail;
     uint32_t len;
+    uint32_t *bucket_start; // 0x10001 offsets of the groups of states sharing the same 16 key bits
     uint32_t uid;
     uint32_t blockNo;
     uint32_t keyType;
     uint32_t nt;
     uint32_t ks1;
+    uint8_t par_err;        // parity errors of the encrypted nonce, one bit per byte, MSB first
 } StateList_t;
 
 typedef struct {
@@ -57,10 +59,12 @@ typedef struct {
 extern char logHexFileName[FILE_PATH_SIZE];
 #define KEYS_IN_BLOCK   ((PM3_CMD_DATA_SIZE - 4) / 6)
 #define KEYBLOCK_SIZE   (KEYS_IN_BLOCK * 6)
+#define NESTED_PAR_ERR_UNKNOWN  0xff    // firmware doesn't report the parity errors
 #define CANDIDATE_SIZE  (0xFFFF * 6)
 
 int mfDarkside(uint8_t blockno, uint8_t key_type, uint64_t *key);
 int mfnested(uint8_t blockNo, uint8_t keyType, uint8_t *key, uint8_t trgBlockNo, uint8_t trgKeyType, uint8_t *resultKey, bool calibrate);
+int mfnested_benchmark(void);
 int mfCheckKeys(uint8_t blockNo, uint8_t keyType, bool clear_trace, uint8_t keycnt, uint8_t *keyBlock, uint64_t *key);
 int mfCheckKeys_fast(uint8_t sectorsCnt, uint8_t firstChunk, uint8_t lastChunk,
                      uint8_t strategy, uint32_t size, uint8_t *keyBlock, sector_t *e_sector, bool use_flashmemory);
@@ -36,12 +36,15 @@ int g_absVMax = 0;
 uint32_t startMax; // Maximum offset in the graph (right side of graph)
 uint32_t PageWidth; // How many samples are currently visible on this 'page' / graph
 int unlockStart = 0;
+// bumped by every RepaintGraphWindow(), tells the plot its buffers may have changed
+static uint32_t graphGeneration = 0;
 
 void ProxGuiQT::ShowGraphWindow(void) {
     emit ShowGraphWindowSignal();
 }
 
 void ProxGuiQT::RepaintGraphWindow(void) {
+    __atomic_add_fetch(&graphGeneration, 1, __ATOMIC_RELEASE);
     emit RepaintGraphWindowSignal();
 }
 
@@ -239,6 +242,129 @@ void ProxWidget::showEvent(QShowEvent *event) {
     plot->show();
 }
 
+//----------- Level of detail
+
+#define LOD_FANOUT 8
+
+void MinMaxPyramid::update(const int *buffer, size_t len, uint32_t gen) {
+    if (buffer == source && len == sourceLen && gen == generation)
+        return;
+
+    source = buffer;
+    sourceLen = len;
+    generation = gen;
+
+    size_t nlevels = 0;
+    for (size_t n = len; n > LOD_FANOUT; n = (n + LOD_FANOUT - 1) / LOD_FANOUT)
+        nlevels++;
+    levels.resize(nlevels);
+
+    size_t n = len;
+    for (size_t l = 0; l < nlevels; l++) {
+        Level &cur = levels[l];
+        size_t m = (n + LOD_FANOUT - 1) / LOD_FANOUT;
+        cur.mins.resize(m);
+        cur.maxs.resize(m);
+        cur.sums.resize(m);
+        for (size_t j = 0; j < m; j++)
+            build(l, j);
+        n = m;
+    }
+}
+
+// Commands write GraphBuffer in place without a repaint, so the samples [start, end) about to be
+// drawn are checked against the first level. Stale blocks and everything above them get rebuilt
+void MinMaxPyramid::refresh(size_t start, size_t end) {
+    if (levels.empty())
+        return;
+    if (end > sourceLen) end = sourceLen;
+
+    Level &first = levels[0];
+    size_t lo = first.mins.size(), hi = 0;
+    for (size_t j = start / LOD_FANOUT; j * LOD_FANOUT < end; j++) {
+        int vMin = first.mins[j], vMax = first.maxs[j];
+        int64_t vSum = first.sums[j];
+        build(0, j);
+        if (first.mins[j] != vMin || first.maxs[j] != vMax || first.sums[j] != vSum) {
+            if (j < lo) lo = j;
+            hi = j + 1;
+        }
+    }
+    for (size_t l = 1; l < levels.size() && lo < hi; l++) {
+        lo /= LOD_FANOUT;
+        hi = (hi + LOD_FANOUT - 1) / LOD_FANOUT;
+        for (size_t j = lo; j < hi; j++)
+            build(l, j);
+    }
+}
+
+// levels[l][j] from the LOD_FANOUT entries below it
+void MinMaxPyramid::build(size_t l, size_t j) {
+    size_t n = (l == 0) ? sourceLen : levels[l - 1].mins.size();
+    int vMin = INT_MAX, vMax = INT_MIN;
+    int64_t vSum = 0;
+    size_t end = (j + 1) * LOD_FANOUT;
+    if (end > n) end = n;
+    for (size_t k = j * LOD_FANOUT; k < end; k++)
+        take(l, k, &vMin, &vMax, &vSum);
+    levels[l].mins[j] = vMin;
+    levels[l].maxs[j] = vMax;
+    levels[l].sums[j] = vSum;
+}
+
+// level 0 is the source buffer itself, level l > 0 is levels[l - 1]
+void MinMaxPyramid::take(size_t lvl, size_t idx, int *vMin, int *vMax, int64_t *vSum) const {
+    if (lvl == 0) {
+        int v = source[idx];
+        if (v < *vMin) *vMin = v;
+        if (v > *vMax) *vMax = v;
+        *vSum += v;
+        return;
+    }
+    const Level &l = levels[lvl - 1];
+    if (l.mins[idx] < *vMin) *vMin = l.mins[idx];
+    if (l.maxs[idx] > *vMax) *vMax = l.maxs[idx];
+    *vSum += l.sums[idx];
+}
+
+// min / max / sum of samples [start, end). Empty ranges give INT_MAX / INT_MIN / 0
+void MinMaxPyramid::query(size_t start, size_t end, int *vMin, int *vMax, int64_t *vSum) const {
+    *vMin = INT_MAX;
+    *vMax = INT_MIN;
+    *vSum = 0;
+    if (end > sourceLen) end = sourceLen;
+
+    size_t lvl = 0;
+    while (start < end) {
+        if (lvl == levels.size() || end - start < 2 * LOD_FANOUT) {
+            for (; start < end; start++)
+                take(lvl, start, vMin, vMax, vSum);
+            break;
+        }
+        // peel off the unaligned ends, the rest is whole blocks of the next level
+        for (; start % LOD_FANOUT; start++)
+            take(lvl, start, vMin, vMax, vSum);
+        for (; end % LOD_FANOUT; end--)
+            take(lvl, end - 1, vMin, vMax, vSum);
+        start /= LOD_FANOUT;
+        end /= LOD_FANOUT;
+        lvl++;
+    }
+}
+
+// Extends the path by a vertical span at x, entering from the end closest to the current position
+static void columnTo(QPainterPath &path, int x, int y0, int y1) {
+    qreal cur = path.currentPosition().y();
+    if (fabs(cur - y0) > fabs(cur - y1)) {
+        int t = y0;
+        y0 = y1;
+        y1 = t;
+    }
+    path.lineTo(x, y0);
+    if (y1 != y0)
+        path.lineTo(x, y1);
+}
+
 //----------- Plotting
 
 int Plot::xCoordOf(int i, QRect r) {
@@ -256,6 +382,15 @@ int Plot::valueOf_yCoord(int y, QRect r, int maxVal) {
     return (y - z) * maxVal / z;
 }
 
+// One past the last sample drawn left of r.right()
+uint32_t Plot::visibleEnd(size_t len, QRect r) {
+    size_t end = GraphStart + (size_t)ceil((r.right() - r.left()) / GraphPixelsPerPoint);
+    if (end > len) end = len;
+    while (end > GraphStart && xCoordOf(end - 1, r) >= r.right()) end--;
+    while (end < len && xCoordOf(end, r) < r.right()) end++;
+    return end;
+}
+
 static const QColor GREEN = QColor(100, 255, 100);
 static const QColor RED   = QColor(255, 100, 100);
 static const QColor BLUE  = QColor(100, 100, 255);
@@ -274,7 +409,7 @@ QColor Plot::getColor(int graphNum) {
     }
 }
 
-void Plot::setMaxAndStart(int *buffer, size_t len, QRect plotRect) {
+void Plot::setMaxAndStart(int *buffer, size_t len, MinMaxPyramid *lod, QRect plotRect) {
     if (len == 0) return;
     startMax = 0;
     if (plotRect.right() >= plotRect.left() + 40) {
@@ -286,14 +421,11 @@ void Plot::setMaxAndStart(int *buffer, size_t len, QRect plotRect) {
         GraphStart = startMax;
     }
     if (GraphStart > len) return;
-    int vMin = INT_MAX, vMax = INT_MIN, v = 0;
-    uint32_t sample_index = GraphStart ;
-    for (; sample_index < len && xCoordOf(sample_index, plotRect) < plotRect.right() ; sample_index++) {
-
-        v = buffer[sample_index];
-        if (v < vMin) vMin = v;
-        if (v > vMax) vMax = v;
-    }
+    int vMin, vMax;
+    int64_t vSum;
+    uint32_t end = visibleEnd(len, plotRect);
+    lod->refresh(GraphStart, end);
+    lod->query(GraphStart, end, &vMin, &vMax, &vSum);
 
     g_absVMax = 0;
     if (fabs((double) vMin) > g_absVMax) g_absVMax = (int)fabs((double) vMin);
@@ -329,6 +461,44 @@ void Plot::PlotDemod(uint8_t *buffer, size_t len, QRect plotRect, QRect annotati
     penPath.moveTo(x, y);
     delta_x = 0;
     int clk = first_delta_x;
+    if (lodEnabled && GraphPixelsPerPoint < 1) {
+        // zoomed out: a bit is a flat run, so only its ends matter. Runs sharing a pixel column merge into one span
+        int colX = x, colY0 = y, colY1 = y;
+        for (int i = BitStart; i < (int)len && xCoordOf(delta_x + DemodStart, plotRect) < plotRect.right(); i++) {
+            if (clk > 0) {
+                int xs = xCoordOf(DemodStart + delta_x, plotRect);
+                int xe = xCoordOf(DemodStart + delta_x + clk - 1, plotRect);
+                if (xe >= plotRect.right()) xe = plotRect.right() - 1;
+                y = yCoordOf(buffer[i] * 200 - 100, plotRect, absVMax);
+
+                if (xs != colX) {
+                    columnTo(penPath, colX, colY0, colY1);
+                    colX = xs;
+                    colY0 = colY1 = y;
+                } else {
+                    if (y < colY0) colY0 = y;
+                    if (y > colY1) colY1 = y;
+                }
+                if (xe != colX) {
+                    columnTo(penPath, colX, colY0, colY1);
+                    colX = xe;
+                    colY0 = colY1 = y;
+                }
+
+                // labels of narrower bits would only overlap
+                x = xCoordOf(DemodStart + delta_x + clk / 2, plotRect);
+                if (clk * GraphPixelsPerPoint >= 16 && x < plotRect.right()) {
+                    sprintf(str, "%u", buffer[i]);
+                    painter->drawText(x - 8, y + ((buffer[i] > 0) ? 18 : -6), str);
+                }
+            }
+            delta_x += clk;
+            clk = grid_delta_x;
+        }
+        columnTo(penPath, colX, colY0, colY1);
+        painter->drawPath(penPath);
+        return;
+    }
     for (int i = BitStart; i < (int)len && xCoordOf(delta_x + DemodStart, plotRect) < plotRect.right(); i++) {
         for (int ii = 0; ii < (clk) && i < (int)len && xCoordOf(DemodStart + delta_x + ii, plotRect) < plotRect.right() ; ii++) {
             x = xCoordOf(DemodStart + delta_x + ii, plotRect);
@@ -356,34 +526,53 @@ void Plot::PlotDemod(uint8_t *buffer, size_t len, QRect plotRect, QRect annotati
     painter->drawPath(penPath);
 }
 
-void Plot::PlotGraph(int *buffer, size_t len, QRect plotRect, QRect annotationRect, QPainter *painter, int graphNum) {
+void Plot::PlotGraph(int *buffer, size_t len, const MinMaxPyramid *lod, QRect plotRect, QRect annotationRect, QPainter *painter, int graphNum) {
     if (len == 0) return;
-    // clock_t begin = clock();
     QPainterPath penPath;
     int vMin = INT_MAX, vMax = INT_MIN, vMean = 0, v = 0;
     uint32_t i = 0;
     int x = xCoordOf(GraphStart, plotRect);
     int y = yCoordOf(buffer[GraphStart], plotRect, g_absVMax);
     penPath.moveTo(x, y);
-    for (i = GraphStart; i < len && xCoordOf(i, plotRect) < plotRect.right(); i++) {
+    if (lodEnabled && GraphPixelsPerPoint < 1) {
+        // zoomed out: one min/max span per pixel column instead of a segment per sample
+        i = visibleEnd(len, plotRect);
+        for (int col = 0; ; col++) {
+            // samples whose xCoordOf() lands in this column
+            uint32_t i0 = GraphStart + (uint32_t)ceil(col / GraphPixelsPerPoint);
+            uint32_t i1 = GraphStart + (uint32_t)ceil((col + 1) / GraphPixelsPerPoint);
+            if (i0 >= i) break;
+            if (i1 > i) i1 = i;
+
+            int cMin, cMax;
+            int64_t cSum;
+            lod->query(i0, i1, &cMin, &cMax, &cSum);
+            columnTo(penPath, plotRect.left() + col, yCoordOf(cMax, plotRect, g_absVMax), yCoordOf(cMin, plotRect, g_absVMax));
+        }
+        int64_t vSum;
+        lod->query(GraphStart, i, &vMin, &vMax, &vSum);
+        vMean = (int)(vSum / (i - GraphStart));
+    } else {
+        for (i = GraphStart; i < len && xCoordOf(i, plotRect) < plotRect.right(); i++) {
 
-        x = xCoordOf(i, plotRect);
-        v = buffer[i];
+            x = xCoordOf(i, plotRect);
+            v = buffer[i];
 
-        y = yCoordOf(v, plotRect, g_absVMax);
+            y = yCoordOf(v, plotRect, g_absVMax);
 
-        penPath.lineTo(x, y);
+            penPath.lineTo(x, y);
 
-        if (GraphPixelsPerPoint > 10) {
-            QRect f(QPoint(x - 3, y - 3), QPoint(x + 3, y + 3));
-            painter->fillRect(f, QColor(100, 255, 100));
+            if (GraphPixelsPerPoint > 10) {
+                QRect f(QPoint(x - 3, y - 3), QPoint(x + 3, y + 3));
+                painter->fillRect(f, QColor(100, 255, 100));
+            }
+            // catch stats
+            if (v < vMin) vMin = v;
+            if (v > vMax) vMax = v;
+            vMean += v;
         }
-        // catch stats
-        if (v < vMin) vMin = v;
-        if (v > vMax) vMax = v;
-        vMean += v;
+        vMean /= (i - GraphStart);
     }
-    vMean /= (i - GraphStart);
 
     painter->setPen(getColor(graphNum));
 
@@ -422,10 +611,6 @@ void Plot::PlotGraph(int *buffer, size_t len, QRect plotRect, QRect annotationRe
     sprintf(str, "max=%d  min=%d  mean=%d  n=%d/%zu  CursorAVal=[%d]  CursorBVal=[%d]",
             vMax, vMin, vMean, i, len, buffer[CursorAPos], buffer[CursorBPos]);
     painter->drawText(20, annotationRect.bottom() - 23 - 20 * graphNum, str);
-
-    //clock_t end = clock();
-    //double elapsed_secs = double(end - begin) / CLOCKS_PER_SEC;
-    //printf("Plot time %f\n", elapsed_secs);
 }
 
 void Plot::plotGridLines(QPainter *painter, QRect r) {
@@ -466,6 +651,9 @@ void Plot::plotGridLines(QPainter *painter, QRect r) {
 #define WIDTH_AXES 80
 
 void Plot::paintEvent(QPaintEvent *event) {
+    QElapsedTimer frameTimer;
+    frameTimer.start();
+
     QPainter painter(this);
     QBrush brush(QColor(100, 255, 100));
     QPen pen(QColor(100, 255, 100));
@@ -490,8 +678,11 @@ void Plot::paintEvent(QPaintEvent *event) {
     //Black foreground
     painter.fillRect(plotRect, QColor(0, 0, 0));
 
+    uint32_t generation = __atomic_load_n(&graphGeneration, __ATOMIC_ACQUIRE);
+    graphLod.update(GraphBuffer, GraphTraceLen, generation);
+
     //init graph variables
-    setMaxAndStart(GraphBuffer, GraphTraceLen, plotRect);
+    setMaxAndStart(GraphBuffer, GraphTraceLen, &graphLod, plotRect);
 
     // center line
     int zeroHeight = plotRect.top() + (plotRect.bottom() - plotRect.top()) / 2;
@@ -501,14 +692,15 @@ void Plot::paintEvent(QPaintEvent *event) {
     plotGridLines(&painter, plotRect);
 
     //Start painting graph
-    PlotGraph(GraphBuffer, GraphTraceLen, plotRect, infoRect, &painter, 0);
+    PlotGraph(GraphBuffer, GraphTraceLen, &graphLod, plotRect, infoRect, &painter, 0);
     if (showDemod && DemodBufferLen > 8) {
         PlotDemod(DemodBuffer, DemodBufferLen, plotRect, infoRect, &painter, 2, g_DemodStartIdx);
     }
     if (g_useOverlays) {
+        overlayLod.update(s_Buff, GraphTraceLen, generation);
         //init graph variables
-        setMaxAndStart(s_Buff, GraphTraceLen, plotRect);
-        PlotGraph(s_Buff, GraphTraceLen, plotRect, infoRect, &painter, 1);
+        setMaxAndStart(s_Buff, GraphTraceLen, &overlayLod, plotRect);
+        PlotGraph(s_Buff, GraphTraceLen, &overlayLod, plotRect, infoRect, &painter, 1);
     }
     // End graph drawing
 
@@ -530,9 +722,13 @@ void Plot::paintEvent(QPaintEvent *event) {
         painter.drawLine(xCoordOf(CursorDPos, plotRect), plotRect.top(), xCoordOf(CursorDPos, plotRect), plotRect.bottom());
     }
 
+    // frame time, everything but the annotation line itself
+    frameMs = frameTimer.nsecsElapsed() / 1e6;
+    frameMsAvg = (frameMsAvg > 0) ? frameMsAvg * 0.9 + frameMs * 0.1 : frameMs;
+
     //Draw annotations
-    char str[200];
-    sprintf(str, "@%d  dt=%d [%2.2f] zoom=%2.2f  CursorAPos=%d  CursorBPos=%d  GridX=%d  GridY=%d (%s) GridXoffset=%d",
+    char str[256];
+    sprintf(str, "@%d  dt=%d [%2.2f] zoom=%2.2f  CursorAPos=%d  CursorBPos=%d  GridX=%d  GridY=%d (%s) GridXoffset=%d  frame=%.1fms avg=%.1fms%s",
             GraphStart,
             CursorBPos - CursorAPos,
             ((int32_t)(CursorBPos - CursorAPos)) / CursorScaleFactor,
@@ -542,13 +738,17 @@ void Plot::paintEvent(QPaintEvent *event) {
             PlotGridXdefault,
             PlotGridYdefault,
             GridLocked ? "Locked" : "Unlocked",
-            GridOffset
+            GridOffset,
+            frameMs,
+            frameMsAvg,
+            lodEnabled ? "" : " (LOD off)"
            );
     painter.setPen(QColor(255, 255, 255));
     painter.drawText(20, infoRect.bottom() - 3, str);
 }
 
-Plot::Plot(QWidget *parent) : QWidget(parent), GraphStart(0), GraphPixelsPerPoint(1) {
+Plot::Plot(QWidget *parent) : QWidget(parent), GraphStart(0), GraphPixelsPerPoint(1),
+    lodEnabled(true), frameMs(0), frameMsAvg(0) {
     //Need to set this, otherwise we don't receive keypress events
     setFocusPolicy(Qt::StrongFocus);
     resize(400, 200);
@@ -636,6 +836,11 @@ void Plot::keyPressEvent(QKeyEvent *event) {
             }
             break;
 
+        case Qt::Key_F:
+            lodEnabled = !lodEnabled;
+            frameMsAvg = 0;
+            break;
+
         case Qt::Key_G:
             if (PlotGridX || PlotGridY) {
                 PlotGridX = 0;
@@ -658,6 +863,7 @@ void Plot::keyPressEvent(QKeyEvent *event) {
             puts("-----------------------------------------------------------------------");
             puts("\tUP                       Zoom out");
             puts("\tDOWN                     Zoom in");
+            puts("\tF                        Toggle fast (min/max per pixel) drawing when zoomed out");
             puts("\tG                        Toggle grid display");
             puts("\tH                        Show help");
             puts("\tL                        Toggle lock grid relative to samples");
@@ -13,18 +13,46 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <vector>
 
 #include <QApplication>
 #include <QPushButton>
 #include <QObject>
 #include <QWidget>
 #include <QPainter>
+#include <QElapsedTimer>
 #include <QtGui>
 
 #include "ui/ui_overlays.h"
 
 class ProxWidget;
 
+/**
+ * @brief Min/max/sum decimation of a sample buffer.
+ * Answers the span of any sample range in O(log n), so a zoomed out plot
+ * can draw one vertical line per pixel column instead of one per sample.
+ */
+class MinMaxPyramid {
+  private:
+    struct Level {
+        std::vector<int> mins;
+        std::vector<int> maxs;
+        std::vector<int64_t> sums;
+    };
+    const int *source;
+    size_t sourceLen;
+    uint32_t generation;
+    std::vector<Level> levels; // levels[k] holds one entry per LOD_FANOUT^(k+1) samples
+    void take(size_t lvl, size_t idx, int *vMin, int *vMax, int64_t *vSum) const;
+    void build(size_t l, size_t j);
+
+  public:
+    MinMaxPyramid(void) : source(NULL), sourceLen(0), generation(0) {}
+    void update(const int *buffer, size_t len, uint32_t gen);
+    void refresh(size_t start, size_t end);
+    void query(size_t start, size_t end, int *vMin, int *vMax, int64_t *vSum) const;
+};
+
 /**
  * @brief The actual plot, black area were we paint the graph
  */
@@ -35,13 +63,19 @@ class Plot: public QWidget {
     double GraphPixelsPerPoint; // How many visual pixels are between each sample point (x axis)
     uint32_t CursorAPos;
     uint32_t CursorBPos;
-    void PlotGraph(int *buffer, size_t len, QRect r, QRect r2, QPainter *painter, int graphNum);
+    MinMaxPyramid graphLod;   // decimated GraphBuffer
+    MinMaxPyramid overlayLod; // decimated s_Buff
+    bool lodEnabled;          // draw min/max spans per pixel column when zoomed out
+    double frameMs;           // time spent in the last paintEvent
+    double frameMsAvg;        // running average of frameMs
+    void PlotGraph(int *buffer, size_t len, const MinMaxPyramid *lod, QRect r, QRect r2, QPainter *painter, int graphNum);
     void PlotDemod(uint8_t *buffer, size_t len, QRect r, QRect r2, QPainter *painter, int graphNum, uint32_t plotOffset);
     void plotGridLines(QPainter *painter, QRect r);
     int xCoordOf(int i, QRect r);
     int yCoordOf(int v, QRect r, int maxVal);
     int valueOf_yCoord(int y, QRect r, int maxVal);
-    void setMaxAndStart(int *buffer, size_t len, QRect plotRect);
+    uint32_t visibleEnd(size_t len, QRect r);
+    void setMaxAndStart(int *buffer, size_t len, MinMaxPyramid *lod, QRect plotRect);
     QColor getColor(int graphNum);
 
   public:
@@ -342,6 +342,7 @@ static void show_help(bool showFullHelp, char *exec_name) {
         PrintAndLogEx(NORMAL, "      -p/--port                           serial port to connect to");
         PrintAndLogEx(NORMAL, "      -w/--wait                           20sec waiting the serial port to appear in the OS");
         PrintAndLogEx(NORMAL, "      -f/--flush                          output will be flushed after every print");
+        PrintAndLogEx(NORMAL, "      --binlog                            also write the session log as binary records (log_<date>.bin)");
         PrintAndLogEx(NORMAL, "      -d/--debug <0|1|2>                  set debugmode");
         PrintAndLogEx(NORMAL, "\nOptions in client mode:");
         PrintAndLogEx(NORMAL, "      -t/--text                           dump all interactive command's help at once");
@@ -585,6 +586,12 @@ int main(int argc, char *argv[]) {
             continue;
         }
 
+        // binary session log
+        if (strcmp(argv[i], "--binlog") == 0) {
+            SetBinaryLog(true);
+            continue;
+        }
+
         // set baudrate
         if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--baud") == 0) {
             if (i + 1 == argc) {
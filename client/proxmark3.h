@@ -20,6 +20,7 @@
 #define PROXPROMPT_OFFLINE "[offline] pm3 --> "
 #define PROXHISTORY "history.txt"
 #define PROXLOG "log_%Y%m%d.txt"
+#define PROXLOG_BIN "log_%Y%m%d.bin"
 #define MAX_NESTED_CMDSCRIPT 10
 #define MAX_NESTED_LUASCRIPT 10
 
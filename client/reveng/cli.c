@@ -70,6 +70,9 @@ static void usage(void);
 
 static const char *myname = "reveng"; /* name of our program */
 
+/* client/util.c */
+int num_CPUs(void);
+
 int reveng_main(int argc, char *argv[]) {
     /* Command-line interface for CRC RevEng.
      * Process options and switches in the argument list and
@@ -84,7 +87,8 @@ int reveng_main(int argc, char *argv[]) {
     unsigned long width = 0UL;
     int c, mode = 0, args, psets, pass;
     poly_t apoly, crc, qpoly = PZERO, *apolys, *pptr = NULL, *qptr = NULL;
-    model_t pset = model, *candmods, *mptr;
+    model_t *candmods, *mptr, *pmods;
+    int *pmatch, nmods;
     char *string;
 
     myname = argv[0];
@@ -400,40 +404,44 @@ ipqx:
 
             /* scan against preset models */
             if (~uflags & C_NOPCK) {
+                pmods = calloc(mcount() + 1, sizeof(model_t));
+                pmatch = calloc(mcount() + 1, sizeof(int));
+                if (!pmods || !pmatch) {
+                    free(pmods);
+                    free(pmatch);
+                    uerror("cannot allocate memory for preset list");
+                    return 0;
+                }
                 pass = 0;
                 do {
+                    /* collect the candidate presets, then check them
+                     * against the arguments in one batch
+                     */
+                    nmods = 0;
                     psets = mcount();
                     while (psets) {
-                        mbynum(&pset, --psets);
+                        mptr = pmods + nmods;
+                        mbynum(mptr, --psets);
                         /* skip if different width, or refin or refout don't match */
-                        if (plen(pset.spoly) != width || (model.flags ^ pset.flags) & (P_REFIN | P_REFOUT))
+                        if (plen(mptr->spoly) != width || (model.flags ^ mptr->flags) & (P_REFIN | P_REFOUT))
                             continue;
                         /* skip if the preset doesn't match specified parameters */
-                        if (rflags & R_HAVEP && pcmp(&model.spoly, &pset.spoly))
+                        if (rflags & R_HAVEP && pcmp(&model.spoly, &mptr->spoly))
                             continue;
-                        if (rflags & R_HAVEI && psncmp(&model.init, &pset.init))
+                        if (rflags & R_HAVEI && psncmp(&model.init, &mptr->init))
                             continue;
-                        if (rflags & R_HAVEX && psncmp(&model.xorout, &pset.xorout))
+                        if (rflags & R_HAVEX && psncmp(&model.xorout, &mptr->xorout))
                             continue;
-                        apoly = pclone(pset.xorout);
-                        if (pset.flags & P_REFOUT)
-                            prev(&apoly);
-                        for (qptr = apolys; qptr < pptr; ++qptr) {
-                            crc = pcrc(*qptr, pset.spoly, pset.init, apoly, 0);
-                            if (ptst(crc)) {
-                                pfree(&crc);
-                                break;
-                            } else
-                                pfree(&crc);
-                        }
-                        pfree(&apoly);
-                        if (qptr == pptr) {
+                        ++nmods;
+                    }
+                    mscan(pmods, nmods, args, apolys, pmatch);
+                    for (mptr = pmods; mptr < pmods + nmods; ++mptr) {
+                        if (pmatch[mptr - pmods]) {
                             /* the selected model solved all arguments */
-                            ufound(&pset);
+                            ufound(mptr);
                             uflags |= C_RESULT;
                         }
                     }
-                    mfree(&pset);
 
                     /* toggle refIn/refOut and reflect arguments */
                     if (~rflags & R_HAVERI) {
@@ -442,6 +450,10 @@ ipqx:
                             prevch(qptr, ibperhx);
                     }
                 } while (~rflags & R_HAVERI && ++pass < 2);
+                for (psets = mcount(); psets >= 0; --psets)
+                    mfree(pmods + psets);
+                free(pmods);
+                free(pmatch);
             }
             if (uflags & C_RESULT) {
                 for (qptr = apolys; qptr < pptr; ++qptr)
@@ -532,6 +544,12 @@ uprog(const poly_t gpoly, int flags, unsigned long seq) {
     free(string);
 }
 
+int
+ucpus(void) {
+    /* Callback function to size the search thread pool */
+    return num_CPUs();
+}
+
 static poly_t
 rdpoly(const char *name, int flags, int bperhx) {
     /* read poly from file in chunks and report errors */
@@ -40,10 +40,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include "reveng.h"
 
 /* Private declarations */
 
+/* maximum number of threads used by mscan() */
+#define M_MAXTHR 16
+
+typedef struct {
+    const model_t *models;
+    int count;
+    int args;
+    const poly_t *argpolys;
+    int *match;
+    int next;
+} mscan_t;
+
+static int mchk(const model_t *model, int args, const poly_t *argpolys);
+static void *mscanthr(void *arg);
+
 static const poly_t pzero = PZERO;
 
 /* Definitions */
@@ -248,3 +264,78 @@ void mnovel(model_t *model) {
     pfree(&model->check);
     pfree(&model->magic);
 }
+
+void mscan(const model_t *models, int count, int args, const poly_t *argpolys, int *match) {
+    /* Checks each of count models against all the arguments and sets
+     * match[i] nonzero if models[i] solves every one of them, i.e.
+     * each argument is a valid codeword under that model.
+     * The models are shared out among up to ucpus() threads; the
+     * models and arguments are only read.
+     */
+    pthread_t threads[M_MAXTHR];
+    mscan_t job;
+    int nthreads, started = 0, i;
+
+    if (!models || !match || count <= 0) return;
+
+    job.models = models;
+    job.count = count;
+    job.args = args;
+    job.argpolys = argpolys;
+    job.match = match;
+    job.next = 0;
+
+    nthreads = ucpus();
+    if (nthreads > M_MAXTHR)
+        nthreads = M_MAXTHR;
+    if (nthreads > count)
+        nthreads = count;
+
+    for (i = 1; i < nthreads; ++i) {
+        if (pthread_create(&threads[started], NULL, mscanthr, &job))
+            break;
+        ++started;
+    }
+    /* the calling thread takes part, and finishes alone if no threads started */
+    mscanthr(&job);
+    for (i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+/* Private functions */
+
+static int mchk(const model_t *model, int args, const poly_t *argpolys) {
+    /* Returns nonzero if every argument is a codeword of model. */
+    poly_t xorout, crc;
+    unsigned long bits = 0UL;
+    int i;
+
+    for (i = 0; i < args; ++i)
+        bits += plen(argpolys[i]);
+    /* long or many arguments: divide them a byte at a time */
+    if (bits >= 1024UL)
+        pcrctab(model->spoly);
+
+    xorout = pclone(model->xorout);
+    if (model->flags & P_REFOUT)
+        prev(&xorout);
+    for (i = 0; i < args; ++i) {
+        crc = pcrc(argpolys[i], model->spoly, model->init, xorout, 0);
+        if (ptst(crc)) {
+            pfree(&crc);
+            break;
+        }
+        pfree(&crc);
+    }
+    pfree(&xorout);
+    return (i == args);
+}
+
+static void *mscanthr(void *arg) {
+    mscan_t *job = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count)
+        job->match[i] = mchk(&job->models[i], job->args, job->argpolys);
+    return (NULL);
+}
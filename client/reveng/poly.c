@@ -88,9 +88,30 @@
 static bmp_t getwrd(const poly_t poly, unsigned long iter);
 static bmp_t rev(bmp_t accu, int bits);
 static void prhex(char **spp, bmp_t bits, int flags, int bperhx);
+static const bmp_t *ptabget(bmp_t dvsr, int make);
+static bmp_t pcrcw(const poly_t message, bmp_t rem, bmp_t dvsr, unsigned long max);
 
 static const poly_t pzero = PZERO;
 
+/* Byte-at-a-time division tables for single-word divisors.
+ * Each thread keeps a few tables keyed by the divisor word, so that
+ * repeated calls with the same model (or a model search running on
+ * several threads) don't rebuild them.  Building a table costs about
+ * as much as dividing PTAB_MIN bits serially, so shorter messages
+ * only use a table that is already cached.
+ */
+#define PTAB_WAYS 4
+#define PTAB_MIN  1024UL
+
+typedef struct {
+    int valid;
+    bmp_t dvsr;
+    bmp_t table[256];
+} ptab_t;
+
+static __thread ptab_t ptabs[PTAB_WAYS];
+static __thread unsigned int ptabnext;
+
 /* word number (0..m-1) of var'th bit (0..n-1) */
 #if BMP_POF2 >= 5
 #  define IDX(var) ((var) >> BMP_POF2)
@@ -934,19 +955,7 @@ pcrc(const poly_t message, const poly_t divisor, const poly_t init, const poly_t
             && init.length <= (unsigned long) BMP_BIT) {
         rem = init.length ? *init.bitmap : BMP_C(0);
         dvsr = divisor.length ? *divisor.bitmap : BMP_C(0);
-        for (iter = 0UL, ofs = 0UL; iter < max; ++iter, --ofs) {
-            if (!ofs) {
-                ofs = BMP_BIT;
-                rem ^= *bptr++;
-            }
-            if (rem & probe)
-                rem = (rem << 1) ^ dvsr;
-            else
-                rem <<= 1;
-        }
-        if (bptr < eptr)
-            /* max < message.length */
-            rem ^= *bptr >> OFS(BMP_BIT - 1UL + max);
+        rem = pcrcw(message, rem, dvsr, max);
         if (init.length > max && init.length - max > divisor.length) {
             palloc(&result, init.length - max);
             *result.bitmap = rem;
@@ -995,6 +1004,38 @@ pcrc(const poly_t message, const poly_t divisor, const poly_t init, const poly_t
     return (result);
 }
 
+void
+pcrctab(const poly_t divisor) {
+    /* Prepares the calling thread's division table for divisor, so
+     * that subsequent calls to pcrc() or pmodz() with divisor run a
+     * byte at a time regardless of message length.
+     * Has no effect on divisors wider than one word.
+     */
+    if (divisor.length && divisor.length <= (unsigned long) BMP_BIT)
+        ptabget(*divisor.bitmap, 1);
+}
+
+int
+pmodz(const poly_t dividend, const poly_t divisor) {
+    /* Returns nonzero if dividend leaves no remainder on division by
+     * divisor, i.e. if pcrc(dividend, divisor, pzero, pzero, 0) is
+     * zero.  Does not allocate memory if divisor fits in one word.
+     * dividend and divisor must be CLEAN.
+     */
+    poly_t rem;
+    int result;
+
+    if (!divisor.length)
+        return (1);
+    if (divisor.length <= (unsigned long) BMP_BIT)
+        return (!pcrcw(dividend, BMP_C(0), *divisor.bitmap,
+                       dividend.length > divisor.length ? dividend.length - divisor.length : 0UL));
+    rem = pcrc(dividend, divisor, pzero, pzero, 0);
+    result = !ptst(rem);
+    pfree(&rem);
+    return (result);
+}
+
 int
 piter(poly_t *poly) {
     /* Replace poly with the 'next' polynomial of equal length.
@@ -1130,6 +1171,78 @@ pident(const poly_t a, const poly_t b) {
 
 /* Private functions */
 
+static const bmp_t *
+ptabget(bmp_t dvsr, int make) {
+    /* Returns the calling thread's division table for the divisor
+     * word dvsr, building it if make is nonzero.  Returns NULL if
+     * there is no table and make is zero.
+     */
+    ptab_t *tptr;
+    bmp_t rem, probe = ~(~BMP_C(0) >> 1);
+    unsigned int idx, bit;
+
+    for (idx = 0U; idx < PTAB_WAYS; ++idx)
+        if (ptabs[idx].valid && ptabs[idx].dvsr == dvsr)
+            return (ptabs[idx].table);
+    if (!make)
+        return (NULL);
+
+    tptr = &ptabs[ptabnext];
+    ptabnext = (ptabnext + 1U) % PTAB_WAYS;
+    for (idx = 0U; idx < 256U; ++idx) {
+        rem = (bmp_t) idx << (BMP_BIT - 8);
+        for (bit = 0U; bit < 8U; ++bit) {
+            if (rem & probe)
+                rem = (rem << 1) ^ dvsr;
+            else
+                rem <<= 1;
+        }
+        tptr->table[idx] = rem;
+    }
+    tptr->dvsr = dvsr;
+    tptr->valid = 1;
+    return (tptr->table);
+}
+
+static bmp_t
+pcrcw(const poly_t message, bmp_t rem, bmp_t dvsr, unsigned long max) {
+    /* Core of pcrc() for divisors of up to one word.  Divides the
+     * first max bits of message into rem, then adds the remaining
+     * bits of message to the result.
+     * Whole bytes are divided through a table when one is available;
+     * message words are spliced in on byte boundaries as BMP_BIT is
+     * a multiple of 8.
+     */
+    unsigned long iter = 0UL, ofs = 0UL;
+    bmp_t probe = ~(~BMP_C(0) >> 1);
+    const bmp_t *bptr = message.bitmap, *eptr = message.bitmap + SIZE(message.length);
+    const bmp_t *table = ptabget(dvsr, max >= PTAB_MIN);
+
+    if (table) {
+        for (; max - iter >= 8UL; iter += 8UL, ofs -= 8UL) {
+            if (!ofs) {
+                ofs = BMP_BIT;
+                rem ^= *bptr++;
+            }
+            rem = (rem << 8) ^ table[rem >> (BMP_BIT - 8)];
+        }
+    }
+    for (; iter < max; ++iter, --ofs) {
+        if (!ofs) {
+            ofs = BMP_BIT;
+            rem ^= *bptr++;
+        }
+        if (rem & probe)
+            rem = (rem << 1) ^ dvsr;
+        else
+            rem <<= 1;
+    }
+    if (bptr < eptr)
+        /* max < message.length */
+        rem ^= *bptr >> OFS(BMP_BIT - 1UL + max);
+    return (rem);
+}
+
 static bmp_t
 getwrd(const poly_t poly, unsigned long iter) {
     /* Fetch unaligned word from poly where LSB of result is
@@ -49,22 +49,51 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 #define FILE void
 #include "reveng.h"
 
+/* polys per work unit of the threaded search; must divide R_SPMASK + 1 */
+#define R_CHUNK  4096UL
+/* maximum number of search threads */
+#define R_MAXTHR 16
+/* work units each thread may run ahead of the oldest unreported one */
+#define R_AHEAD  4
+
+typedef struct {
+    bmp_t chunk;                        /* work unit number + 1 when done, 0 when free */
+    bmp_t hits[R_CHUNK / BMP_BIT];      /* candidates found in the unit, one bit per poly */
+} rslot_t;
+
+typedef struct {
+    const poly_t *pworks;   /* differences to divide, terminated by an empty poly */
+    unsigned long width;
+    bmp_t first, step;      /* bitmap word of the n'th poly is first + n * step */
+    bmp_t count, nchunks;
+    bmp_t next, done;       /* next unit to hand out, units reported so far */
+    int nslots;
+    rslot_t *slots;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} rsearch_t;
+
 static poly_t *modpol(const poly_t init, int rflags, int args, const poly_t *argpolys);
 static void engini(int *resc, model_t **result, const poly_t divisor, int flags, int args, const poly_t *argpolys);
 static void calout(int *resc, model_t **result, const poly_t divisor, const poly_t init, int flags, int args, const poly_t *argpolys);
 static void calini(int *resc, model_t **result, const poly_t divisor, int flags, const poly_t xorout, int args, const poly_t *argpolys);
 static void chkres(int *resc, model_t **result, const poly_t divisor, const poly_t init, int flags, const poly_t xorout, int args, const poly_t *argpolys);
+static void addcand(int *resc, model_t **result, const poly_t divisor, const model_t *guess, int rflags, int args, const poly_t *argpolys);
+static int thrsearch(int *resc, model_t **result, poly_t *gpoly, const model_t *guess, const poly_t qpoly, int rflags, int args, const poly_t *argpolys, const poly_t *pworks);
+static void *thrwork(void *arg);
 
 static const poly_t pzero = PZERO;
 
 model_t *
 reveng(const model_t *guess, const poly_t qpoly, int rflags, int args, const poly_t *argpolys) {
     /* Complete the parameters of a model by calculation or brute search. */
-    poly_t *pworks, *wptr, rem, gpoly;
+    poly_t *pworks, *wptr, gpoly;
     model_t *result = NULL, *rptr;
     int resc = 0;
     unsigned long spin = 0, seq = 0;
@@ -87,39 +116,29 @@ reveng(const model_t *guess, const poly_t qpoly, int rflags, int args, const pol
         if (plen(gpoly))
             pshift(&gpoly, gpoly, 0UL, 0UL, plen(gpoly) - 1UL, 1UL);
 
-        while (piter(&gpoly) && (~rflags & R_HAVEQ || pcmp(&gpoly, &qpoly) < 0)) {
-            /* For each possible poly of this size, try
-             * dividing all the differences in the list.
-             */
-            if (!(spin++ & R_SPMASK)) {
-                uprog(gpoly, guess->flags, seq++);
-            }
-            for (wptr = pworks; plen(*wptr); ++wptr) {
+        /* Single-word polys are searched on several threads if
+         * possible, otherwise one at a time here.
+         */
+        if (!thrsearch(&resc, &result, &gpoly, guess, qpoly, rflags, args, argpolys, pworks)) {
+            while (piter(&gpoly) && (~rflags & R_HAVEQ || pcmp(&gpoly, &qpoly) < 0)) {
+                /* For each possible poly of this size, try
+                 * dividing all the differences in the list.
+                 */
+                if (!(spin++ & R_SPMASK)) {
+                    uprog(gpoly, guess->flags, seq++);
+                }
                 /* straight divide message by poly, don't multiply by x^n */
-                rem = pcrc(*wptr, gpoly, pzero, pzero, 0);
-                if (ptst(rem)) {
-                    pfree(&rem);
+                for (wptr = pworks; plen(*wptr) && pmodz(*wptr, gpoly); ++wptr)
+                    ;
+                /* If gpoly divides all the differences, it is a
+                 * candidate.  Search for an Init value for this
+                 * poly or if Init is known, log the result.
+                 */
+                if (!plen(*wptr))
+                    addcand(&resc, &result, gpoly, guess, rflags, args, argpolys);
+                if (!piter(&gpoly))
                     break;
-                } else
-                    pfree(&rem);
-            }
-            /* If gpoly divides all the differences, it is a
-             * candidate.  Search for an Init value for this
-             * poly or if Init is known, log the result.
-             */
-            if (!plen(*wptr)) {
-                /* gpoly is a candidate poly */
-                if (rflags & R_HAVEI && rflags & R_HAVEX)
-                    chkres(&resc, &result, gpoly, guess->init, guess->flags, guess->xorout, args, argpolys);
-                else if (rflags & R_HAVEI)
-                    calout(&resc, &result, gpoly, guess->init, guess->flags, args, argpolys);
-                else if (rflags & R_HAVEX)
-                    calini(&resc, &result, gpoly, guess->flags, guess->xorout, args, argpolys);
-                else
-                    engini(&resc, &result, gpoly, guess->flags, args, argpolys);
             }
-            if (!piter(&gpoly))
-                break;
         }
         /* Finished with gpoly and the differences list, free them.
          */
@@ -501,3 +520,160 @@ chkres(int *resc, model_t **result, const poly_t divisor, const poly_t init, int
     /* callback to notify new model */
     ufound(rptr);
 }
+
+static void
+addcand(int *resc, model_t **result, const poly_t divisor, const model_t *guess, int rflags, int args, const poly_t *argpolys) {
+    /* divisor is a candidate poly from the brute force search.
+     * Search for an Init value for this poly or if Init is known,
+     * log the result.
+     */
+    if (rflags & R_HAVEI && rflags & R_HAVEX)
+        chkres(resc, result, divisor, guess->init, guess->flags, guess->xorout, args, argpolys);
+    else if (rflags & R_HAVEI)
+        calout(resc, result, divisor, guess->init, guess->flags, args, argpolys);
+    else if (rflags & R_HAVEX)
+        calini(resc, result, divisor, guess->flags, guess->xorout, args, argpolys);
+    else
+        engini(resc, result, divisor, guess->flags, args, argpolys);
+}
+
+static int
+thrsearch(int *resc, model_t **result, poly_t *gpoly, const model_t *guess, const poly_t qpoly, int rflags, int args, const poly_t *argpolys, const poly_t *pworks) {
+    /* Brute force search over the same polys as the loop in reveng(),
+     * with the divisions shared out in work units among ucpus()
+     * threads.  Units are reported in order on the calling thread, so
+     * progress reports and results appear exactly as from the
+     * serial loop.
+     * Returns zero without searching if gpoly is wider than one word
+     * or threads are unavailable or not worthwhile; the caller then
+     * searches serially.
+     */
+    pthread_t threads[R_MAXTHR];
+    rsearch_t job;
+    rslot_t *slot;
+    unsigned long width = plen(*gpoly), seq = 0UL;
+    bmp_t base, mask, qval, idx, chunk, n;
+    int nthreads, started = 0, i;
+
+    if (!width || width > (unsigned long) BMP_BIT)
+        return (0);
+    if ((nthreads = ucpus()) < 2)
+        return (0);
+    if (nthreads > R_MAXTHR)
+        nthreads = R_MAXTHR;
+
+    /* gpoly is even; the search covers the odd polys above it,
+     * up to and excluding qpoly if given.
+     */
+    base = *gpoly->bitmap >> (BMP_BIT - width);
+    mask = ~BMP_C(0) >> (BMP_BIT - width);
+    job.count = ((mask - base) >> 1) + BMP_C(1);
+    if (rflags & R_HAVEQ) {
+        if (plen(qpoly) < width)
+            job.count = BMP_C(0);
+        else if (plen(qpoly) == width) {
+            qval = *qpoly.bitmap >> (BMP_BIT - width);
+            n = qval > base ? (qval - base) >> 1 : BMP_C(0);
+            if (n < job.count)
+                job.count = n;
+        }
+    }
+    job.nchunks = (job.count + R_CHUNK - 1UL) / R_CHUNK;
+    if (job.nchunks < 2UL)
+        return (0);
+
+    job.pworks = pworks;
+    job.width = width;
+    job.step = BMP_C(2) << (BMP_BIT - width);
+    job.first = *gpoly->bitmap + (job.step >> 1);
+    job.next = job.done = BMP_C(0);
+    job.nslots = nthreads * R_AHEAD;
+    if (!(job.slots = calloc(job.nslots, sizeof(rslot_t))))
+        return (0);
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+
+    for (i = 0; i < nthreads; ++i) {
+        if (pthread_create(&threads[started], NULL, thrwork, &job))
+            break;
+        ++started;
+    }
+
+    if (started) {
+        for (chunk = 0UL; chunk < job.nchunks; ++chunk) {
+            slot = job.slots + chunk % job.nslots;
+            pthread_mutex_lock(&job.lock);
+            while (slot->chunk != chunk + 1UL)
+                pthread_cond_wait(&job.cond, &job.lock);
+            pthread_mutex_unlock(&job.lock);
+
+            base = chunk * R_CHUNK;
+            n = job.count - base < R_CHUNK ? job.count - base : R_CHUNK;
+            if (!(base & R_SPMASK)) {
+                *gpoly->bitmap = job.first + base * job.step;
+                uprog(*gpoly, guess->flags, seq++);
+            }
+            for (idx = 0UL; idx < n; ++idx) {
+                if (slot->hits[idx / BMP_BIT] & BMP_C(1) << (idx % BMP_BIT)) {
+                    *gpoly->bitmap = job.first + (base + idx) * job.step;
+                    addcand(resc, result, *gpoly, guess, rflags, args, argpolys);
+                }
+            }
+
+            pthread_mutex_lock(&job.lock);
+            slot->chunk = BMP_C(0);
+            job.done = chunk + 1UL;
+            pthread_cond_broadcast(&job.cond);
+            pthread_mutex_unlock(&job.lock);
+        }
+        for (i = 0; i < started; ++i)
+            pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.lock);
+    free(job.slots);
+    return (started != 0);
+}
+
+static void *
+thrwork(void *arg) {
+    /* Search thread: divides the differences by each poly in the
+     * next free work unit and marks the polys that divide them all.
+     */
+    rsearch_t *job = arg;
+    rslot_t *slot;
+    bmp_t chunk, idx, n, word;
+    poly_t gpoly;
+    const poly_t *wptr;
+
+    gpoly.length = job->width;
+    gpoly.bitmap = &word;
+
+    pthread_mutex_lock(&job->lock);
+    while (job->next < job->nchunks) {
+        if (job->next >= job->done + (bmp_t) job->nslots) {
+            pthread_cond_wait(&job->cond, &job->lock);
+            continue;
+        }
+        chunk = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        slot = job->slots + chunk % job->nslots;
+        memset(slot->hits, 0, sizeof(slot->hits));
+        n = job->count - chunk * R_CHUNK < R_CHUNK ? job->count - chunk * R_CHUNK : R_CHUNK;
+        word = job->first + chunk * R_CHUNK * job->step;
+        for (idx = 0UL; idx < n; ++idx, word += job->step) {
+            for (wptr = job->pworks; plen(*wptr) && pmodz(*wptr, gpoly); ++wptr)
+                ;
+            if (!plen(*wptr))
+                slot->hits[idx / BMP_BIT] |= BMP_C(1) << (idx % BMP_BIT);
+        }
+
+        pthread_mutex_lock(&job->lock);
+        slot->chunk = chunk + 1UL;
+        pthread_cond_broadcast(&job->cond);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return (NULL);
+}
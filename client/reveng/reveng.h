@@ -168,6 +168,8 @@ void prcp(poly_t *poly);
 void pinv(poly_t *poly);
 poly_t pmod(const poly_t dividend, const poly_t divisor);
 poly_t pcrc(const poly_t message, const poly_t divisor, const poly_t init, const poly_t xorout, int flags);
+void pcrctab(const poly_t divisor);
+int pmodz(const poly_t dividend, const poly_t divisor);
 int piter(poly_t *poly);
 void palloc(poly_t *poly, unsigned long length);
 void pfree(poly_t *poly);
@@ -198,6 +200,7 @@ void mcanon(model_t *model);
 void mcheck(model_t *model);
 void mrev(model_t *model);
 void mnovel(model_t *model);
+void mscan(const model_t *models, int count, int args, const poly_t *argpolys, int *match);
 
 /* preset.c */
 #define M_OVERWR     1
@@ -232,5 +235,6 @@ int reveng_main(int argc, char *argv[]);
 void ufound(const model_t *model);
 void uerror(const char *msg);
 void uprog(const poly_t gpoly, int flags, unsigned long seq);
+int ucpus(void);
 
 #endif /* REVENG_H */
@@ -0,0 +1,107 @@
+//-----------------------------------------------------------------------------
+// Copyright (C) 2019 Proxmark3 contributors
+//
+// This code is licensed to you under the terms of the GNU GPL, version 2 or,
+// at your option, any later version. See the LICENSE.txt file for the text of
+// the license.
+//-----------------------------------------------------------------------------
+// Reply routing tests
+//
+// Built with `make comms_test`, not part of the client. comms.c is compiled
+// in here so the tests can feed made up replies through the static storeReply
+// without a Proxmark3 connected.
+//-----------------------------------------------------------------------------
+
+#include "../comms.c"
+
+#include <stdlib.h>
+
+// proxmark3.c isn't linked in, without a user directory ui.c has nowhere to log to
+const char *get_my_user_directory(void) {
+    return NULL;
+}
+
+static void storeTestReply(uint64_t n) {
+    PacketResponseNG packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.cmd = CMD_ACK;
+    packet.oldarg[0] = n;
+    storeReply(&packet);
+}
+
+static bool waitTestReply(reply_ticket_t ticket, uint64_t expected) {
+    PacketResponseNG resp;
+    return WaitForReply(ticket, &resp, 100) && resp.oldarg[0] == expected;
+}
+
+// a ticket whose reply was discarded has to fail right away, not after its timeout
+static bool waitTestReplyDiscarded(reply_ticket_t ticket) {
+    PacketResponseNG resp;
+    uint64_t start = msclock();
+    return WaitForReply(ticket, &resp, 2000) == false && msclock() - start < 1000;
+}
+
+#define REPLY_TEST(name, cond) \
+    do { \
+        bool ok_ = (cond); \
+        PrintAndLogEx(ok_ ? SUCCESS : FAILED, "%-50s %s", name, ok_ ? _GREEN_("ok") : _RED_("fail")); \
+        failed |= !ok_; \
+    } while (0)
+
+/**
+ * @brief TestReplyRouting feeds made up replies through the receive queue and checks they reach
+ *  the right waiters, also after replies have been discarded. Needs the queue for itself, so no device connected.
+ * @return PM3_SUCCESS if all checks passed
+ */
+static int TestReplyRouting(void) {
+    bool failed = false;
+    PacketResponseNG resp;
+
+    clearCommandBuffer();
+    SubscribeReply(CMD_ACK);
+
+    reply_ticket_t t1 = ExpectReply(CMD_ACK);
+    reply_ticket_t t2 = ExpectReply(CMD_ACK);
+    storeTestReply(1);
+    storeTestReply(2);
+    REPLY_TEST("ticketed replies not taken by plain waiters", WaitForResponseTimeout(CMD_ACK, &resp, 10) == false);
+    REPLY_TEST("replies taken out of order", waitTestReply(t2, 2) && waitTestReply(t1, 1));
+
+    storeTestReply(99);
+    reply_ticket_t t3 = ExpectReply(CMD_ACK);
+    storeTestReply(3);
+    REPLY_TEST("reply without ticket doesn't shift numbering", waitTestReply(t3, 3));
+    REPLY_TEST("reply without ticket goes to plain waiters", WaitForResponseTimeout(CMD_ACK, &resp, 10) && resp.oldarg[0] == 99);
+
+    reply_ticket_t t4 = ExpectReply(CMD_ACK);
+    reply_ticket_t t5 = ExpectReply(CMD_ACK);
+    storeTestReply(4);
+    clearCommandBuffer();
+    storeTestReply(5);
+    reply_ticket_t t6 = ExpectReply(CMD_ACK);
+    storeTestReply(6);
+    REPLY_TEST("cleared reply fails its ticket", waitTestReplyDiscarded(t4));
+    REPLY_TEST("tickets after a clear stay in sync", waitTestReply(t5, 5) && waitTestReply(t6, 6));
+
+    // the ring holds CMD_BUFFER_SIZE - 1 replies, one more drops the oldest
+    reply_ticket_t tickets[CMD_BUFFER_SIZE];
+    for (int i = 0; i < CMD_BUFFER_SIZE; i++)
+        tickets[i] = ExpectReply(CMD_ACK);
+    for (int i = 0; i < CMD_BUFFER_SIZE; i++)
+        storeTestReply(100 + i);
+    bool in_sync = true;
+    for (int i = CMD_BUFFER_SIZE - 1; i > 0; i--)
+        in_sync &= waitTestReply(tickets[i], 100 + i);
+    REPLY_TEST("overflowed reply fails its ticket", waitTestReplyDiscarded(tickets[0]));
+    REPLY_TEST("tickets after an overflow stay in sync", in_sync);
+
+    UnsubscribeReply(CMD_ACK);
+    clearCommandBuffer();
+
+    return failed ? PM3_ESOFT : PM3_SUCCESS;
+}
+
+int main(void) {
+    g_printAndLog = PRINTANDLOG_PRINT;
+    return TestReplyRouting() == PM3_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -24,6 +24,7 @@
 #include <readline/readline.h>
 #include <complex.h>
 #include "util.h"
+#include "util_posix.h"  // usclock
 #include "proxmark3.h"  // PROXLOG
 #include "fileutils.h"
 #include "pm3_cmd.h"
@@ -42,8 +43,53 @@ bool GridLocked = false;
 bool showDemod = true;
 
 pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
-
-static void fPrintAndLog(FILE *stream, const char *fmt, ...);
+static __thread print_capture_t *print_capture = NULL;
+
+static void fPrintAndLog(FILE *stream, logLevel_t level, const char *fmt, ...);
+
+// Session log.
+// Producers copy their line into a bounded lock free ring (multi producer, single consumer)
+// and go on, a writer thread drains it in batches, strips the colours of a whole batch at
+// once and hands it to the file with one write. When the ring is full lines are dropped
+// and counted rather than making the caller wait for the disk.
+#define LOG_RING_SLOTS  1024            // power of two
+#define LOG_SLOT_TEXT   (MAX_PRINT_BUFFER + 32)
+#define LOG_BATCH_SIZE  (64 * 1024)
+#define LOG_POLL_MS     2               // writer polls this often while lines come in
+#define LOG_IDLE_US     100000          // and goes to sleep after this long without any
+#define LOG_BIN_MAGIC   "PM3LOG"
+#define LOG_BIN_VERSION 1
+
+typedef struct {
+    uint32_t seq;
+    uint8_t level;
+    uint8_t stream;     // 1 = stderr
+    uint16_t len;
+    uint64_t time_us;
+    char text[LOG_SLOT_TEXT];
+} log_slot_t;
+
+static struct {
+    log_slot_t *slots;
+    uint32_t tail;      // next slot a producer claims
+    uint32_t head;      // next slot the writer reads
+    uint32_t dropped;
+    bool running;
+    bool stop;
+    bool sleeping;
+    pthread_t thread;
+    pthread_mutex_t wake_lock;
+    pthread_cond_t wake;
+    FILE *logfile;
+    FILE *binfile;
+    bool binary;
+    bool logging;
+    uint64_t start_us;
+} session_log = {
+    .wake_lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .logging = true,
+};
 
 // needed by flasher, so let's put it here instead of fileutils.c
 int searchHomeFilePath(char **foundpath, const char *filename, bool create_home) {
@@ -128,6 +174,9 @@ void PrintAndLogEx(logLevel_t level, const char *fmt, ...) {
     if (g_debugMode == 0 && level == DEBUG)
         return;
 
+    if (print_capture && (level == WARNING || level == FAILED || level == ERR))
+        print_capture->warnings++;
+
     char prefix[20] = {0};
     char buffer[MAX_PRINT_BUFFER] = {0};
     char buffer2[MAX_PRINT_BUFFER + 20] = {0};
@@ -173,7 +222,7 @@ void PrintAndLogEx(logLevel_t level, const char *fmt, ...) {
 
     // no prefixes for normal & inplace
     if (level == NORMAL) {
-        fPrintAndLog(stream, "%s", buffer);
+        fPrintAndLog(stream, level, "%s", buffer);
         return;
     }
 
@@ -183,7 +232,7 @@ void PrintAndLogEx(logLevel_t level, const char *fmt, ...) {
 
         // line starts with newline
         if (buffer[0] == '\n')
-            fPrintAndLog(stream, "");
+            fPrintAndLog(stream, level, "");
 
         token = strtok_r(buffer, delim, &tmp_ptr);
 
@@ -198,54 +247,281 @@ void PrintAndLogEx(logLevel_t level, const char *fmt, ...) {
 
             token = strtok_r(NULL, delim, &tmp_ptr);
         }
-        fPrintAndLog(stream, "%s", buffer2);
+        fPrintAndLog(stream, level, "%s", buffer2);
     } else {
         snprintf(buffer2, sizeof(buffer2), "%s%s", prefix, buffer);
         if (level == INPLACE) {
+            // progress lines make no sense once replayed
+            if (print_capture)
+                return;
             char buffer3[MAX_PRINT_BUFFER + 20] = {0};
             memcpy_filter_ansi(buffer3, buffer2, sizeof(buffer2), !session.supports_colors);
             fprintf(stream, "\r%s", buffer3);
             fflush(stream);
         } else {
-            fPrintAndLog(stream, "%s", buffer2);
+            fPrintAndLog(stream, level, "%s", buffer2);
+        }
+    }
+}
+
+// claim a slot, fill it, publish it. Returns false when the writer isn't running or the ring is full
+static bool logEnqueue(logLevel_t level, FILE *stream, const char *text) {
+    if (__atomic_load_n(&session_log.running, __ATOMIC_ACQUIRE) == false)
+        return false;
+
+    uint32_t pos = __atomic_load_n(&session_log.tail, __ATOMIC_RELAXED);
+    log_slot_t *slot;
+    for (;;) {
+        slot = &session_log.slots[pos & (LOG_RING_SLOTS - 1)];
+        int32_t diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&session_log.tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            // full
+            __atomic_fetch_add(&session_log.dropped, 1, __ATOMIC_RELAXED);
+            return true;
+        } else {
+            pos = __atomic_load_n(&session_log.tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    size_t len = MIN(strlen(text), LOG_SLOT_TEXT - 1);
+    memcpy(slot->text, text, len);
+    slot->len = len;
+    slot->level = level;
+    slot->stream = (stream == stderr);
+    slot->time_us = usclock() - session_log.start_us;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&session_log.sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&session_log.wake_lock);
+        pthread_cond_signal(&session_log.wake);
+        pthread_mutex_unlock(&session_log.wake_lock);
+    }
+    return true;
+}
+
+// binary record: uint64 time (us since the header), uint8 level, uint8 stream, uint16 length, text.
+// Host byte order, text without colours and newline.
+static void logWriteBinary(const log_slot_t *slot, char *tmp) {
+    size_t len = memcpy_filter_ansi(tmp, slot->text, slot->len, true);
+    uint16_t len16 = len;
+    fwrite(&slot->time_us, sizeof(uint64_t), 1, session_log.binfile);
+    fwrite(&slot->level, sizeof(uint8_t), 1, session_log.binfile);
+    fwrite(&slot->stream, sizeof(uint8_t), 1, session_log.binfile);
+    fwrite(&len16, sizeof(uint16_t), 1, session_log.binfile);
+    fwrite(tmp, 1, len, session_log.binfile);
+}
+
+static void *logWriterThread(void *arg) {
+    (void)arg;
+    char *batch = calloc(LOG_BATCH_SIZE + LOG_SLOT_TEXT + 80, sizeof(char));
+    char *plain = calloc(LOG_BATCH_SIZE + LOG_SLOT_TEXT + 80, sizeof(char));
+    if (batch == NULL || plain == NULL) {
+        free(batch);
+        free(plain);
+        __atomic_store_n(&session_log.running, false, __ATOMIC_RELEASE);
+        return NULL;
+    }
+
+    uint64_t last_us = 0;
+    for (;;) {
+        size_t n = 0;
+        uint32_t count = 0;
+        while (n < LOG_BATCH_SIZE) {
+            log_slot_t *slot = &session_log.slots[session_log.head & (LOG_RING_SLOTS - 1)];
+            if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != session_log.head + 1)
+                break;
+
+            memcpy(batch + n, slot->text, slot->len);
+            n += slot->len;
+            batch[n++] = '\n';
+            if (session_log.binfile)
+                logWriteBinary(slot, plain);
+
+            __atomic_store_n(&slot->seq, session_log.head + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+            session_log.head++;
+            count++;
+        }
+
+        uint32_t dropped = __atomic_exchange_n(&session_log.dropped, 0, __ATOMIC_RELAXED);
+        if (dropped)
+            n += sprintf(batch + n, "[!] %u lines dropped from the session log\n", dropped);
+
+        if (n) {
+            size_t len = memcpy_filter_ansi(plain, batch, n, true);
+            fwrite(plain, 1, len, session_log.logfile);
+            fflush(session_log.logfile);
+            if (session_log.binfile)
+                fflush(session_log.binfile);
+        }
+        if (count) {
+            last_us = usclock();
+            continue;
+        }
+
+        // while lines keep coming, poll: producers find us awake and don't need to signal,
+        // and the next batch gets a chance to fill up
+        if (usclock() - last_us < LOG_IDLE_US && __atomic_load_n(&session_log.stop, __ATOMIC_SEQ_CST) == false) {
+            msleep(LOG_POLL_MS);
+            continue;
+        }
+
+        // nothing left, sleep until a producer shows up. The ring is checked again after
+        // announcing we sleep, a producer that missed the flag has published by then.
+        pthread_mutex_lock(&session_log.wake_lock);
+        __atomic_store_n(&session_log.sleeping, true, __ATOMIC_SEQ_CST);
+        log_slot_t *slot = &session_log.slots[session_log.head & (LOG_RING_SLOTS - 1)];
+        bool empty = __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != session_log.head + 1;
+        if (empty && __atomic_load_n(&session_log.stop, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_unlock(&session_log.wake_lock);
+            break;
+        }
+        if (empty)
+            pthread_cond_wait(&session_log.wake, &session_log.wake_lock);
+        __atomic_store_n(&session_log.sleeping, false, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&session_log.wake_lock);
+    }
+
+    free(batch);
+    free(plain);
+    return NULL;
+}
+
+// drain what is queued and stop the writer, later lines are written directly
+static void logStop(void) {
+    if (__atomic_load_n(&session_log.running, __ATOMIC_ACQUIRE) == false)
+        return;
+
+    pthread_mutex_lock(&session_log.wake_lock);
+    __atomic_store_n(&session_log.stop, true, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&session_log.wake);
+    pthread_mutex_unlock(&session_log.wake_lock);
+    pthread_join(session_log.thread, NULL);
+
+    __atomic_store_n(&session_log.running, false, __ATOMIC_RELEASE);
+    // a producer might still be filling a slot it claimed, leave the ring allocated
+}
+
+static void logStart(void) {
+    session_log.slots = calloc(LOG_RING_SLOTS, sizeof(log_slot_t));
+    if (session_log.slots == NULL)
+        return;
+
+    for (uint32_t i = 0; i < LOG_RING_SLOTS; i++)
+        session_log.slots[i].seq = i;
+
+    session_log.start_us = usclock();
+    if (pthread_create(&session_log.thread, NULL, logWriterThread, NULL) != 0)
+        return;
+
+    __atomic_store_n(&session_log.running, true, __ATOMIC_RELEASE);
+    atexit(logStop);
+}
+
+// log_YYYYMMDD.txt and, with the binary option, log_YYYYMMDD.bin in the user directory
+static void logOpen(void) {
+    char *my_logfile_path = NULL;
+    char filename[40];
+    struct tm *timenow;
+    time_t now = time(NULL);
+    timenow = gmtime(&now);
+    strftime(filename, sizeof(filename), PROXLOG, timenow);
+    if (searchHomeFilePath(&my_logfile_path, filename, true) != PM3_SUCCESS) {
+        fprintf(stderr, "[-] Logging disabled!\n\n");
+        session_log.logging = false;
+        return;
+    }
+
+    session_log.logfile = fopen(my_logfile_path, "a");
+    if (session_log.logfile == NULL) {
+        fprintf(stderr, "[-] Can't open logfile %s, logging disabled!\n", my_logfile_path);
+        session_log.logging = false;
+        free(my_logfile_path);
+        return;
+    }
+    printf("[=] Session log %s\n", my_logfile_path);
+    free(my_logfile_path);
+
+    if (session_log.binary) {
+        strftime(filename, sizeof(filename), PROXLOG_BIN, timenow);
+        if (searchHomeFilePath(&my_logfile_path, filename, true) == PM3_SUCCESS) {
+            session_log.binfile = fopen(my_logfile_path, "ab");
+            if (session_log.binfile) {
+                // header: magic, version, start of the session in seconds since epoch
+                uint8_t version = LOG_BIN_VERSION;
+                uint64_t start = now;
+                fwrite(LOG_BIN_MAGIC, 1, strlen(LOG_BIN_MAGIC), session_log.binfile);
+                fwrite(&version, sizeof(uint8_t), 1, session_log.binfile);
+                fwrite(&start, sizeof(uint64_t), 1, session_log.binfile);
+                printf("[=] Binary session log %s\n", my_logfile_path);
+            } else {
+                fprintf(stderr, "[-] Can't open binary logfile %s\n", my_logfile_path);
+            }
+            free(my_logfile_path);
         }
     }
+
+    logStart();
 }
 
-static void fPrintAndLog(FILE *stream, const char *fmt, ...) {
+static void fPrintAndLog(FILE *stream, logLevel_t level, const char *fmt, ...) {
     char *saved_line;
     int saved_point;
     va_list argptr;
-    static FILE *logfile = NULL;
-    static int logging = 1;
     char buffer[MAX_PRINT_BUFFER] = {0};
     char buffer2[MAX_PRINT_BUFFER] = {0};
-    // lock this section to avoid interlacing prints from different threads
-    pthread_mutex_lock(&print_lock);
 
-    if ((g_printAndLog & PRINTANDLOG_LOG) && logging && !logfile) {
-        char *my_logfile_path = NULL;
-        char filename[40];
-        struct tm *timenow;
-        time_t now = time(NULL);
-        timenow = gmtime(&now);
-        strftime(filename, sizeof(filename), PROXLOG, timenow);
-        if (searchHomeFilePath(&my_logfile_path, filename, true) != PM3_SUCCESS) {
-            fprintf(stderr, "[-] Logging disabled!\n\n");
-            my_logfile_path = NULL;
-            logging = 0;
-        } else {
-            logfile = fopen(my_logfile_path, "a");
-            if (logfile == NULL) {
-                fprintf(stderr, "[-] Can't open logfile %s, logging disabled!\n", my_logfile_path);
-                logging = 0;
-            } else {
-                printf("[=] Session log %s\n", my_logfile_path);
-            }
-            free(my_logfile_path);
+    if (print_capture) {
+        // one record per call: stream flag, level, text, NUL
+        va_start(argptr, fmt);
+        vsnprintf(buffer, sizeof(buffer), fmt, argptr);
+        va_end(argptr);
+        size_t n = strlen(buffer) + 3;
+        if (print_capture->len + n > print_capture->size) {
+            size_t size = MAX(print_capture->size * 2, print_capture->len + n + MAX_PRINT_BUFFER);
+            char *tmp = realloc(print_capture->buf, size);
+            if (tmp == NULL)
+                return;
+            print_capture->buf = tmp;
+            print_capture->size = size;
+        }
+        print_capture->buf[print_capture->len] = (stream == stderr) ? 'e' : 'o';
+        print_capture->buf[print_capture->len + 1] = (char)level;
+        memcpy(print_capture->buf + print_capture->len + 2, buffer, n - 2);
+        print_capture->len += n;
+        return;
+    }
+
+    va_start(argptr, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, argptr);
+    va_end(argptr);
+
+    bool log = (g_printAndLog & PRINTANDLOG_LOG) && session_log.logging;
+    if (log && session_log.logfile == NULL) {
+        pthread_mutex_lock(&print_lock);
+        if (session_log.logging && session_log.logfile == NULL)
+            logOpen();
+        pthread_mutex_unlock(&print_lock);
+    }
+
+    if (log && session_log.logfile) {
+        // no writer thread, write it ourselves
+        if (logEnqueue(level, stream, buffer) == false) {
+            pthread_mutex_lock(&print_lock);
+            memcpy_filter_ansi(buffer2, buffer, sizeof(buffer), true);
+            fprintf(session_log.logfile, "%s\n", buffer2);
+            fflush(session_log.logfile);
+            pthread_mutex_unlock(&print_lock);
         }
     }
 
+    if ((g_printAndLog & PRINTANDLOG_PRINT) == 0)
+        return;
+
+    // lock this section to avoid interlacing prints from different threads
+    pthread_mutex_lock(&print_lock);
 
 // If there is an incoming message from the hardware (eg: lf hid read) in
 // the background (while the prompt is displayed and accepting user input),
@@ -263,17 +539,10 @@ static void fPrintAndLog(FILE *stream, const char *fmt, ...) {
     }
 #endif
 
-    va_start(argptr, fmt);
-    vsnprintf(buffer, sizeof(buffer), fmt, argptr);
-    va_end(argptr);
-
-    bool filter_ansi = !session.supports_colors;
-    memcpy_filter_ansi(buffer2, buffer, sizeof(buffer), filter_ansi);
-    if (g_printAndLog & PRINTANDLOG_PRINT) {
-        fprintf(stream, "%s", buffer2);
-        fprintf(stream, "          "); // cleaning prompt
-        fprintf(stream, "\n");
-    }
+    memcpy_filter_ansi(buffer2, buffer, sizeof(buffer), !session.supports_colors);
+    fprintf(stream, "%s", buffer2);
+    fprintf(stream, "          "); // cleaning prompt
+    fprintf(stream, "\n");
 
 #ifdef RL_STATE_READCMD
     // We are using GNU readline. libedit (OSX) doesn't support this flag.
@@ -286,16 +555,6 @@ static void fPrintAndLog(FILE *stream, const char *fmt, ...) {
     }
 #endif
 
-    if ((g_printAndLog & PRINTANDLOG_LOG) && logging && logfile) {
-        if (filter_ansi) { // already done
-            fprintf(logfile, "%s\n", buffer2);
-        } else {
-            memcpy_filter_ansi(buffer, buffer2, sizeof(buffer2), true);
-            fprintf(logfile, "%s\n", buffer);
-        }
-        fflush(logfile);
-    }
-
     if (flushAfterWrite)
         fflush(stdout);
 
@@ -303,17 +562,39 @@ static void fPrintAndLog(FILE *stream, const char *fmt, ...) {
     pthread_mutex_unlock(&print_lock);
 }
 
+// collect the output of the calling thread in capture, NULL prints again
+void PrintAndLogCapture(print_capture_t *capture) {
+    print_capture = capture;
+}
+
+// print what was collected and release the capture buffer
+void PrintAndLogCaptured(print_capture_t *capture) {
+    for (size_t i = 0; i < capture->len;) {
+        char *rec = capture->buf + i;
+        fPrintAndLog((rec[0] == 'e') ? stderr : stdout, (logLevel_t)rec[1], "%s", rec + 2);
+        i += strlen(rec + 2) + 3;
+    }
+    free(capture->buf);
+    memset(capture, 0, sizeof(print_capture_t));
+}
+
 void SetFlushAfterWrite(bool value) {
     flushAfterWrite = value;
 }
 
-void memcpy_filter_ansi(void *dest, const void *src, size_t n, bool filter) {
+// also write the session log as binary records, must be set before the first print
+void SetBinaryLog(bool value) {
+    session_log.binary = value;
+}
+
+// returns the number of bytes written to dest
+size_t memcpy_filter_ansi(void *dest, const void *src, size_t n, bool filter) {
     if (filter) {
         // Filter out ANSI sequences on these OS
         uint8_t *rdest = (uint8_t *)dest;
         uint8_t *rsrc = (uint8_t *)src;
-        uint16_t si = 0;
-        for (uint16_t i = 0; i < n; i++) {
+        size_t si = 0;
+        for (size_t i = 0; i < n; i++) {
             if ((i < n - 1)
                     && (rsrc[i] == '\x1b')
                     && (rsrc[i + 1] >= 0x40)
@@ -340,8 +621,10 @@ void memcpy_filter_ansi(void *dest, const void *src, size_t n, bool filter) {
             }
             rdest[si++] = rsrc[i];
         }
+        return si;
     } else {
         memcpy(dest, src, n);
+        return n;
     }
 }
 
@@ -40,7 +40,18 @@ void RepaintGraphWindow(void);
 void PrintAndLogOptions(const char *str[][2], size_t size, size_t space);
 void PrintAndLogEx(logLevel_t level, const char *fmt, ...);
 void SetFlushAfterWrite(bool value);
-void memcpy_filter_ansi(void *dest, const void *src, size_t n, bool filter);
+void SetBinaryLog(bool value);
+
+// output of PrintAndLogEx collected for a thread instead of printed
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t size;
+    uint32_t warnings;  // WARNING, FAILED and ERR messages seen
+} print_capture_t;
+void PrintAndLogCapture(print_capture_t *capture);
+void PrintAndLogCaptured(print_capture_t *capture);
+size_t memcpy_filter_ansi(void *dest, const void *src, size_t n, bool filter);
 
 extern double CursorScaleFactor;
 extern int PlotGridX, PlotGridY, PlotGridXdefault, PlotGridYdefault, GridOffset;
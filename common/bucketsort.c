@@ -43,3 +43,33 @@ extern void bucket_sort_intersect(uint32_t *const estart, uint32_t *const estop,
         bucket_info->numbuckets = nonempty_bucket;
     }
 }
+
+// Stable counting sort of a list of 64 bit values into 0x10000 buckets. The bucket of
+// each value is given by key16(). On return, bucket k is dst[bucket_start[k]] up to
+// dst[bucket_start[k + 1] - 1], bucket_start must hold 0x10001 entries.
+void bucket_sort_64(const uint64_t *src, uint64_t *dst, uint32_t len, uint16_t (*key16)(uint64_t), uint32_t *bucket_start) {
+    for (uint32_t i = 0; i <= 0x10000; i++) {
+        bucket_start[i] = 0;
+    }
+
+    // count the bucket sizes
+    for (uint32_t i = 0; i < len; i++) {
+        bucket_start[key16(src[i]) + 1]++;
+    }
+
+    // turn sizes into start offsets
+    for (uint32_t i = 1; i <= 0x10000; i++) {
+        bucket_start[i] += bucket_start[i - 1];
+    }
+
+    // scatter, using bucket_start[k] as fill pointer of bucket k. Afterwards it points to
+    // the start of bucket k + 1, so shift the offsets back by one
+    for (uint32_t i = 0; i < len; i++) {
+        uint16_t k = key16(src[i]);
+        dst[bucket_start[k]++] = src[i];
+    }
+    for (uint32_t i = 0x10000; i > 0; i--) {
+        bucket_start[i] = bucket_start[i - 1];
+    }
+    bucket_start[0] = 0;
+}
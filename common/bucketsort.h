@@ -21,4 +21,6 @@ void bucket_sort_intersect(uint32_t *const estart, uint32_t *const estop,
                            uint32_t *const ostart, uint32_t *const ostop,
                            bucket_info_t *bucket_info, bucket_array_t bucket);
 
+void bucket_sort_64(const uint64_t *src, uint64_t *dst, uint32_t len, uint16_t (*key16)(uint64_t), uint32_t *bucket_start);
+
 #endif
@@ -61,9 +61,14 @@ uint16_t crc16_iclass(uint8_t const *d, size_t n);
 uint16_t crc16_legic(uint8_t const *d, size_t n, uint8_t uidcrc);
 
 // table implementation
+// the crc16_* functions above use their own tables, init_table() / generate_table()
+// only pick the table of crc16_fast(), per thread in the client.
 void init_table(CrcType_t crctype);
 void reset_table(void);
 void generate_table(uint16_t polynomial, bool refin);
 uint16_t crc16_fast(uint8_t const *d, size_t n, uint16_t initval, bool refin, bool refout);
 
+// crc of a given type with at most 'slices' table lookups per step: 1, 4 or 8 (8 on the client only)
+uint16_t crc16_sliced(CrcType_t ct, uint8_t const *d, size_t n, uint8_t slices);
+
 #endif
@@ -52,13 +52,16 @@
 #include "ui.h"
 # include "cmddata.h"
 # define prnt(args...) PrintAndLogEx(DEBUG, ## args );
+// the client may demodulate several buffers concurrently, each thread keeps its own signal properties
+# define SIGNAL_TLS __thread
 #else
 # include "dbprint.h"
 uint8_t g_debugMode = 0;
 # define prnt Dbprintf
+# define SIGNAL_TLS
 #endif
 
-signal_t signalprop = { 255, -255, 0, 0, true };
+static SIGNAL_TLS signal_t signalprop = { 255, -255, 0, 0, true };
 signal_t *getSignalProperties(void) {
     return &signalprop;
 }
@@ -135,3 +135,17 @@ uint64_t msclock(void) {
 #endif
 }
 
+// a microseconds timer for latency measurement
+uint64_t usclock(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart / frequency.QuadPart) * 1000000 + (uint64_t)(count.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (1000000 * (uint64_t)t.tv_sec + t.tv_nsec / 1000);
+#endif
+}
+
@@ -22,5 +22,6 @@ void msleep(uint32_t n); // sleep n milliseconds
 #endif // _WIN32
 
 uint64_t msclock(void);      // a milliseconds clock
+uint64_t usclock(void);      // a microseconds clock
 
 #endif